@@ -355,12 +355,14 @@ LOCAL_SRC_FILES := \
 	bluez/monitor/keys.c \
 	bluez/monitor/ellisys.c \
 	bluez/monitor/analyze.c \
+	bluez/monitor/profile.c \
 	bluez/monitor/intel.c \
 	bluez/monitor/broadcom.c \
 	bluez/src/shared/util.c \
 	bluez/src/shared/queue.c \
 	bluez/src/shared/crypto.c \
 	bluez/src/shared/btsnoop.c \
+	bluez/src/shared/lz4.c \
 	bluez/src/shared/mainloop.c \
 	bluez/lib/hci.c \
 	bluez/lib/bluetooth.c \
@@ -414,6 +416,7 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
 	bluez/android/hal-audio.c \
+	bluez/android/hal-audio-pcm.c \
 	bluez/android/hal-audio-sbc.c \
 	bluez/android/hal-audio-aptx.c \
 
@@ -441,6 +444,37 @@ endif
 
 include $(BUILD_SHARED_LIBRARY)
 
+#
+# audio-bench
+#
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+	bluez/android/audio-bench.c \
+	bluez/android/hal-audio-pcm.c \
+	bluez/android/hal-audio-sbc.c \
+	bluez/android/hal-audio-aptx.c \
+
+LOCAL_C_INCLUDES = \
+	$(LOCAL_PATH)/bluez \
+	$(call include-path-for, system-core) \
+	$(call include-path-for, libhardware) \
+	$(call include-path-for, sbc) \
+
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	libsbc \
+
+LOCAL_CFLAGS := $(BLUEZ_COMMON_CFLAGS) -Wno-declaration-after-statement
+LOCAL_LDFLAGS := -ldl
+
+LOCAL_MODULE_PATH := $(TARGET_OUT_OPTIONAL_EXECUTABLES)
+LOCAL_MODULE_TAGS := debug
+LOCAL_MODULE := audio-bench
+
+include $(BUILD_EXECUTABLE)
+
 #
 # SCO audio
 #
@@ -509,6 +543,7 @@ LOCAL_SRC_FILES := \
 	bluez/android/bluetoothd-snoop.c \
 	bluez/src/shared/mainloop.c \
 	bluez/src/shared/btsnoop.c \
+	bluez/src/shared/lz4.c \
 	bluez/android/log.c \
 
 LOCAL_C_INCLUDES := \
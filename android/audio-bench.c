@@ -0,0 +1,634 @@
+/*
+ * Copyright (C) 2026 BlueZ contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Measures the CPU cost of the A2DP HAL audio processing on the target,
+ * without AudioFlinger or a Bluetooth link: PCM conversion kernels and
+ * media packet encoding for each configuration the codec presets allow.
+ * Cost is reported per call and as how many times faster than real time
+ * the audio is processed.
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "audio-msg.h"
+#include "hal-audio.h"
+#include "profiles/audio/a2dp-codecs.h"
+
+#define DEFAULT_DURATION_MS	200
+#define DEFAULT_MTU		895
+
+#define CODEC_PCM_LEN		(20 * 512)
+#define MAX_PRESETS_LEN		1024
+
+/* AudioFlinger period sizes, the last one is the HAL's fixed buffer */
+static const size_t pcm_frames[] = { 256, 512, 1024, 2560 };
+
+static const unsigned int pcm_rates[] = { 44100, 48000 };
+
+#define NUM_PCM_FRAMES (sizeof(pcm_frames) / sizeof(pcm_frames[0]))
+#define NUM_PCM_RATES (sizeof(pcm_rates) / sizeof(pcm_rates[0]))
+
+static unsigned int duration_ms = DEFAULT_DURATION_MS;
+static uint16_t mtu = DEFAULT_MTU;
+static bool qos_sweep;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Deterministic full scale noise, including the extreme values */
+static void fill_pcm(int16_t *pcm, size_t samples)
+{
+	uint32_t state = 0x12345678;
+	size_t i;
+
+	for (i = 0; i < samples; i++) {
+		state = state * 1103515245 + 12345;
+		pcm[i] = state >> 16;
+	}
+
+	if (samples >= 4) {
+		pcm[0] = INT16_MIN;
+		pcm[1] = INT16_MIN;
+		pcm[2] = INT16_MAX;
+		pcm[3] = INT16_MAX;
+	}
+}
+
+static bool check_downmix(const struct audio_pcm_ops *ops,
+					const int16_t *input, size_t frames)
+{
+	const struct audio_pcm_ops *ref = NULL;
+	int16_t *expect, *output;
+	unsigned int i;
+	bool result;
+
+	/* the scalar kernel is always last */
+	for (i = 0; audio_pcm_get_ops(i); i++)
+		ref = audio_pcm_get_ops(i);
+
+	/* odd frame count so every kernel runs its scalar tail too */
+	frames -= 1;
+
+	expect = calloc(frames, sizeof(int16_t));
+	output = calloc(frames, sizeof(int16_t));
+	if (!expect || !output) {
+		free(expect);
+		free(output);
+		return false;
+	}
+
+	ref->downmix_to_mono(input, expect, frames);
+	ops->downmix_to_mono(input, output, frames);
+
+	result = !memcmp(expect, output, frames * sizeof(int16_t));
+
+	free(expect);
+	free(output);
+
+	return result;
+}
+
+static void bench_downmix(const struct audio_pcm_ops *ops,
+					const int16_t *input, int16_t *output)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < NUM_PCM_FRAMES; i++) {
+		size_t frames = pcm_frames[i];
+		uint64_t start, end, elapsed;
+		unsigned long calls = 0;
+		double per_call;
+
+		start = now_ns();
+		end = start + duration_ms * 1000000ull;
+
+		do {
+			ops->downmix_to_mono(input, output, frames);
+			calls++;
+		} while (now_ns() < end);
+
+		elapsed = now_ns() - start;
+		per_call = (double) elapsed / calls;
+
+		printf("  %-8s %5zu frames: %9.1f ns/call %8.1f Mframes/s",
+					ops->name, frames, per_call,
+					frames * 1000.0 / per_call);
+
+		for (j = 0; j < NUM_PCM_RATES; j++) {
+			double period = frames * 1e9 / pcm_rates[j];
+
+			printf("  %7.0fx real time @%u", period / per_call,
+								pcm_rates[j]);
+		}
+
+		printf("\n");
+	}
+}
+
+static bool run_pcm(void)
+{
+	const struct audio_pcm_ops *ops;
+	size_t max_frames = pcm_frames[NUM_PCM_FRAMES - 1];
+	int16_t *input, *output;
+	unsigned int i;
+	bool result = true;
+
+	input = calloc(max_frames * 2, sizeof(int16_t));
+	output = calloc(max_frames, sizeof(int16_t));
+	if (!input || !output) {
+		free(input);
+		free(output);
+		return false;
+	}
+
+	fill_pcm(input, max_frames * 2);
+
+	printf("Stereo to mono downmix (selected: %s)\n",
+						audio_pcm_select_ops()->name);
+
+	for (i = 0; (ops = audio_pcm_get_ops(i)); i++) {
+		if (!ops->supported()) {
+			printf("  %-8s not supported\n", ops->name);
+			continue;
+		}
+
+		if (!check_downmix(ops, input, max_frames)) {
+			printf("  %-8s output differs from scalar\n",
+								ops->name);
+			result = false;
+			continue;
+		}
+
+		bench_downmix(ops, input, output);
+	}
+
+	free(input);
+	free(output);
+
+	return result;
+}
+
+static uint8_t nth_bit(uint8_t mask, unsigned int n)
+{
+	uint8_t bit;
+
+	for (bit = 1; bit; bit <<= 1) {
+		if (!(mask & bit))
+			continue;
+
+		if (!n--)
+			return bit;
+	}
+
+	return 0;
+}
+
+static unsigned int sbc_count(const uint8_t *caps)
+{
+	const a2dp_sbc_t *sbc = (const void *) caps;
+
+	return popcount(sbc->frequency) *
+				popcount(sbc->channel_mode) *
+				popcount(sbc->subbands) *
+				popcount(sbc->block_length) *
+				popcount(sbc->allocation_method);
+}
+
+static int sbc_freq2int(uint8_t freq)
+{
+	switch (freq) {
+	case SBC_SAMPLING_FREQ_16000:
+		return 16000;
+	case SBC_SAMPLING_FREQ_32000:
+		return 32000;
+	case SBC_SAMPLING_FREQ_44100:
+		return 44100;
+	case SBC_SAMPLING_FREQ_48000:
+		return 48000;
+	default:
+		return 0;
+	}
+}
+
+static const char *sbc_mode2str(uint8_t mode)
+{
+	switch (mode) {
+	case SBC_CHANNEL_MODE_MONO:
+		return "Mono";
+	case SBC_CHANNEL_MODE_DUAL_CHANNEL:
+		return "DualChannel";
+	case SBC_CHANNEL_MODE_STEREO:
+		return "Stereo";
+	case SBC_CHANNEL_MODE_JOINT_STEREO:
+		return "JointStereo";
+	default:
+		return "(unknown)";
+	}
+}
+
+static int sbc_blocks2int(uint8_t blocks)
+{
+	switch (blocks) {
+	case SBC_BLOCK_LENGTH_4:
+		return 4;
+	case SBC_BLOCK_LENGTH_8:
+		return 8;
+	case SBC_BLOCK_LENGTH_12:
+		return 12;
+	case SBC_BLOCK_LENGTH_16:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+/* Picks one value out of each capability field, index is mixed radix */
+static void sbc_select(const uint8_t *caps, unsigned int index,
+				uint8_t *config, char *label, size_t len)
+{
+	const a2dp_sbc_t *sbc = (const void *) caps;
+	a2dp_sbc_t *cfg = (void *) config;
+	unsigned int n;
+
+	*cfg = *sbc;
+
+	n = popcount(sbc->frequency);
+	cfg->frequency = nth_bit(sbc->frequency, index % n);
+	index /= n;
+
+	n = popcount(sbc->channel_mode);
+	cfg->channel_mode = nth_bit(sbc->channel_mode, index % n);
+	index /= n;
+
+	n = popcount(sbc->subbands);
+	cfg->subbands = nth_bit(sbc->subbands, index % n);
+	index /= n;
+
+	n = popcount(sbc->block_length);
+	cfg->block_length = nth_bit(sbc->block_length, index % n);
+	index /= n;
+
+	n = popcount(sbc->allocation_method);
+	cfg->allocation_method = nth_bit(sbc->allocation_method, index % n);
+
+	snprintf(label, len, "%u %s %u/%u %s bitpool %u",
+			sbc_freq2int(cfg->frequency),
+			sbc_mode2str(cfg->channel_mode),
+			cfg->subbands == SBC_SUBBANDS_4 ? 4 : 8,
+			sbc_blocks2int(cfg->block_length),
+			cfg->allocation_method == SBC_ALLOCATION_SNR ?
+							"SNR" : "Loudness",
+			cfg->max_bitpool);
+}
+
+static unsigned int aptx_count(const uint8_t *caps)
+{
+	const a2dp_aptx_t *aptx = (const void *) caps;
+
+	return popcount(aptx->frequency) *
+				popcount(aptx->channel_mode);
+}
+
+static void aptx_select(const uint8_t *caps, unsigned int index,
+				uint8_t *config, char *label, size_t len)
+{
+	const a2dp_aptx_t *aptx = (const void *) caps;
+	a2dp_aptx_t *cfg = (void *) config;
+	unsigned int n;
+
+	*cfg = *aptx;
+
+	n = popcount(aptx->frequency);
+	cfg->frequency = nth_bit(aptx->frequency, index % n);
+	index /= n;
+
+	n = popcount(aptx->channel_mode);
+	cfg->channel_mode = nth_bit(aptx->channel_mode, index % n);
+
+	snprintf(label, len, "%u %s",
+			cfg->frequency == APTX_SAMPLING_FREQ_48000 ?
+								48000 : 44100,
+			cfg->channel_mode == APTX_CHANNEL_MODE_MONO ?
+							"Mono" : "Stereo");
+}
+
+/*
+ * Presets are capabilities, the remote picks one value of each field. Every
+ * such configuration is measured.
+ */
+static const struct {
+	const char *name;
+	const char *legend;
+	audio_codec_get_t get_codec;
+	size_t config_len;
+	unsigned int (*count) (const uint8_t *caps);
+	void (*select) (const uint8_t *caps, unsigned int index,
+				uint8_t *config, char *label, size_t len);
+} bench_codecs[] = {
+	{ "SBC", "rate mode subbands/blocks allocation", codec_sbc,
+			sizeof(a2dp_sbc_t), sbc_count, sbc_select },
+	{ "aptX", "rate mode", codec_aptx,
+			sizeof(a2dp_aptx_t), aptx_count, aptx_select },
+};
+
+#define NUM_BENCH_CODECS (sizeof(bench_codecs) / sizeof(bench_codecs[0]))
+
+static bool bench_encode(const struct audio_codec *codec, void *codec_data,
+				const uint8_t *pcm, struct media_packet *mp,
+				size_t payload_len, const char *label)
+{
+	struct audio_input_config cfg;
+	uint64_t start, end, elapsed;
+	uint64_t consumed = 0, encoded = 0;
+	unsigned long packets = 0;
+	double per_packet, audio_ns;
+
+	if (!codec->get_config(codec_data, &cfg)) {
+		printf("  %-44s invalid configuration\n", label);
+		return false;
+	}
+
+	start = now_ns();
+	end = start + duration_ms * 1000000ull;
+
+	do {
+		size_t written = 0;
+		ssize_t read;
+
+		read = codec->encode_mediapacket(codec_data, pcm,
+						CODEC_PCM_LEN, mp, payload_len,
+						&written);
+		if (read <= 0) {
+			printf("  %-44s encoding failed\n", label);
+			return false;
+		}
+
+		consumed += read;
+		encoded += written;
+		packets++;
+	} while (now_ns() < end);
+
+	elapsed = now_ns() - start;
+	per_packet = (double) elapsed / packets;
+
+	/* 16bit samples */
+	audio_ns = consumed / (2 * popcount(cfg.channels)) * 1e9 /
+								cfg.rate;
+
+	printf("  %-44s %7.2f us/packet %8.0f packets/s %5.2f%% cpu "
+					"%6.1fx real time %4.0f kbit/s\n",
+					label, per_packet / 1000,
+					1e9 / per_packet,
+					elapsed * 100 / audio_ns,
+					audio_ns / elapsed,
+					encoded * 8 * 1e6 / audio_ns);
+
+	return true;
+}
+
+static bool bench_config(const struct audio_codec *codec,
+				const uint8_t *config, size_t config_len,
+				const uint8_t *pcm, const char *label)
+{
+	struct audio_preset *preset;
+	struct media_packet *mp;
+	void *codec_data;
+	size_t payload_len = mtu;
+	char step_label[64];
+	unsigned int step = 0;
+	bool result;
+
+	if (codec->use_rtp)
+		payload_len -= sizeof(struct rtp_header);
+
+	preset = calloc(1, sizeof(*preset) + config_len);
+	mp = calloc(1, mtu);
+	if (!preset || !mp) {
+		free(preset);
+		free(mp);
+		return false;
+	}
+
+	preset->len = config_len;
+	memcpy(preset->data, config, config_len);
+
+	if (!codec->init(preset, payload_len, &codec_data)) {
+		printf("  %-44s cannot initialize codec\n", label);
+		free(preset);
+		free(mp);
+		return false;
+	}
+
+	codec->update_qos(codec_data, QOS_POLICY_DEFAULT);
+
+	result = bench_encode(codec, codec_data, pcm, mp, payload_len, label);
+
+	/* each step is what the HAL falls back to on a congested link */
+	while (result && qos_sweep &&
+			codec->update_qos(codec_data, QOS_POLICY_DECREASE)) {
+		snprintf(step_label, sizeof(step_label), "  qos step %u",
+								++step);
+		result = bench_encode(codec, codec_data, pcm, mp, payload_len,
+								step_label);
+	}
+
+	codec->cleanup(codec_data);
+	free(preset);
+	free(mp);
+
+	return result;
+}
+
+static bool bench_codec(unsigned int index, const uint8_t *pcm)
+{
+	const struct audio_codec *codec = bench_codecs[index].get_codec();
+	uint8_t *presets, *ptr, *config;
+	size_t len = MAX_PRESETS_LEN;
+	char label[64];
+	int count, i;
+	bool result = true;
+
+	if (codec->load && !codec->load()) {
+		printf("%s not available\n", bench_codecs[index].name);
+		return true;
+	}
+
+	presets = calloc(1, len);
+	config = calloc(1, bench_codecs[index].config_len);
+	if (!presets || !config) {
+		result = false;
+		goto done;
+	}
+
+	count = codec->get_presets((struct audio_preset *) presets, &len);
+
+	for (i = 0, ptr = presets; i < count; i++) {
+		struct audio_preset *preset = (void *) ptr;
+		unsigned int configs, j;
+
+		ptr += sizeof(*preset) + preset->len;
+
+		if (preset->len != bench_codecs[index].config_len)
+			continue;
+
+		configs = bench_codecs[index].count(preset->data);
+
+		printf("%s preset %d, %u configurations (%s), MTU %u\n",
+				bench_codecs[index].name, i, configs,
+				bench_codecs[index].legend, mtu);
+
+		for (j = 0; j < configs; j++) {
+			bench_codecs[index].select(preset->data, j, config,
+							label, sizeof(label));
+
+			if (!bench_config(codec, config, preset->len, pcm,
+									label))
+				result = false;
+		}
+	}
+
+done:
+	free(presets);
+	free(config);
+
+	if (codec->unload)
+		codec->unload();
+
+	return result;
+}
+
+static bool run_codec(void)
+{
+	int16_t *pcm;
+	unsigned int i;
+	bool result = true;
+
+	pcm = calloc(CODEC_PCM_LEN, 1);
+	if (!pcm)
+		return false;
+
+	fill_pcm(pcm, CODEC_PCM_LEN / sizeof(int16_t));
+
+	for (i = 0; i < NUM_BENCH_CODECS; i++)
+		if (!bench_codec(i, (const uint8_t *) pcm))
+			result = false;
+
+	free(pcm);
+
+	return result;
+}
+
+static const struct {
+	const char *name;
+	bool (*run) (void);
+} tests[] = {
+	{ "pcm", run_pcm },
+	{ "codec", run_codec },
+};
+
+#define NUM_TESTS (sizeof(tests) / sizeof(tests[0]))
+
+static void usage(void)
+{
+	unsigned int i;
+
+	printf("audio-bench - A2DP HAL audio processing benchmark\n");
+	printf("Usage:\n"
+		"\taudio-bench [options] [test...]\n");
+	printf("options:\n"
+		"\t-d <ms>            duration of each measurement (%u)\n"
+		"\t-m <mtu>           media packet size for codecs (%u)\n"
+		"\t-q                 also measure each QoS fallback step\n"
+		"\t-h                 show this help\n",
+					DEFAULT_DURATION_MS, DEFAULT_MTU);
+	printf("tests:\n");
+
+	for (i = 0; i < NUM_TESTS; i++)
+		printf("\t%s\n", tests[i].name);
+}
+
+static const struct option main_options[] = {
+	{ "duration",	required_argument,	NULL, 'd' },
+	{ "mtu",	required_argument,	NULL, 'm' },
+	{ "qos",	no_argument,		NULL, 'q' },
+	{ "help",	no_argument,		NULL, 'h' },
+	{ }
+};
+
+int main(int argc, char *argv[])
+{
+	unsigned int i;
+	bool result = true;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "d:m:qh", main_options,
+							NULL)) != EOF) {
+		switch (opt) {
+		case 'd':
+			duration_ms = atoi(optarg);
+			if (!duration_ms) {
+				usage();
+				exit(1);
+			}
+			break;
+		case 'm':
+			mtu = atoi(optarg);
+			if (mtu <= sizeof(struct rtp_header) + 1) {
+				usage();
+				exit(1);
+			}
+			break;
+		case 'q':
+			qos_sweep = true;
+			break;
+		case 'h':
+			usage();
+			exit(0);
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < NUM_TESTS; i++) {
+		int j;
+		bool selected = optind == argc;
+
+		for (j = optind; j < argc; j++)
+			if (!strcmp(argv[j], tests[i].name))
+				selected = true;
+
+		if (selected && !tests[i].run())
+			result = false;
+	}
+
+	return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
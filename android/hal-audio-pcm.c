@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2013 Intel Corporation
+ * Copyright (C) 2026 BlueZ contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <endian.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#include <immintrin.h>
+#define HAVE_PCM_X86
+#endif
+
+#if defined(__ARM_NEON) && __BYTE_ORDER == __LITTLE_ENDIAN
+#include <arm_neon.h>
+#define HAVE_PCM_NEON
+#endif
+
+#include "audio-msg.h"
+#include "hal-audio.h"
+#include "hal-utils.h"
+
+/*
+ * All kernels produce exactly the same output as the scalar one, i.e. each
+ * mono sample is (left + right) / 2 rounded towards zero.
+ */
+
+static bool pcm_scalar_supported(void)
+{
+	return true;
+}
+
+static void pcm_scalar_downmix(const int16_t *input, int16_t *output,
+								size_t frames)
+{
+	size_t i;
+
+	for (i = 0; i < frames; i++) {
+		int16_t l = get_le16(&input[i * 2]);
+		int16_t r = get_le16(&input[i * 2 + 1]);
+
+		put_le16((l + r) / 2, &output[i]);
+	}
+}
+
+static const struct audio_pcm_ops pcm_scalar = {
+	.name = "scalar",
+	.supported = pcm_scalar_supported,
+	.downmix_to_mono = pcm_scalar_downmix,
+};
+
+#ifdef HAVE_PCM_X86
+static bool pcm_sse2_supported(void)
+{
+	__builtin_cpu_init();
+
+	return __builtin_cpu_supports("sse2");
+}
+
+/* Sum of each L/R pair halved towards zero, 4 pairs per 128 bits */
+__attribute__((target("sse2")))
+static inline __m128i sse2_halve_pairs(__m128i v)
+{
+	__m128i sum = _mm_madd_epi16(v, _mm_set1_epi16(1));
+
+	sum = _mm_add_epi32(sum, _mm_srli_epi32(sum, 31));
+
+	return _mm_srai_epi32(sum, 1);
+}
+
+__attribute__((target("sse2")))
+static void pcm_sse2_downmix(const int16_t *input, int16_t *output,
+								size_t frames)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= frames; i += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i *) &input[i * 2]);
+		__m128i b = _mm_loadu_si128((const __m128i *)
+							&input[i * 2 + 8]);
+
+		a = sse2_halve_pairs(a);
+		b = sse2_halve_pairs(b);
+
+		_mm_storeu_si128((__m128i *) &output[i], _mm_packs_epi32(a, b));
+	}
+
+	pcm_scalar_downmix(input + i * 2, output + i, frames - i);
+}
+
+static const struct audio_pcm_ops pcm_sse2 = {
+	.name = "sse2",
+	.supported = pcm_sse2_supported,
+	.downmix_to_mono = pcm_sse2_downmix,
+};
+
+static bool pcm_avx2_supported(void)
+{
+	__builtin_cpu_init();
+
+	return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_halve_pairs(__m256i v)
+{
+	__m256i sum = _mm256_madd_epi16(v, _mm256_set1_epi16(1));
+
+	sum = _mm256_add_epi32(sum, _mm256_srli_epi32(sum, 31));
+
+	return _mm256_srai_epi32(sum, 1);
+}
+
+__attribute__((target("avx2")))
+static void pcm_avx2_downmix(const int16_t *input, int16_t *output,
+								size_t frames)
+{
+	size_t i;
+
+	for (i = 0; i + 16 <= frames; i += 16) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)
+							&input[i * 2]);
+		__m256i b = _mm256_loadu_si256((const __m256i *)
+							&input[i * 2 + 16]);
+		__m256i mono;
+
+		a = avx2_halve_pairs(a);
+		b = avx2_halve_pairs(b);
+
+		/* packing works per 128 bit lane, put the quarters in order */
+		mono = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b),
+								0xd8);
+
+		_mm256_storeu_si256((__m256i *) &output[i], mono);
+	}
+
+	pcm_sse2_downmix(input + i * 2, output + i, frames - i);
+}
+
+static const struct audio_pcm_ops pcm_avx2 = {
+	.name = "avx2",
+	.supported = pcm_avx2_supported,
+	.downmix_to_mono = pcm_avx2_downmix,
+};
+#endif
+
+#ifdef HAVE_PCM_NEON
+/* NEON is only used when the whole HAL is built for it */
+static bool pcm_neon_supported(void)
+{
+	return true;
+}
+
+static inline int16x4_t neon_halve_pairs(int16x8_t v)
+{
+	int32x4_t sum = vpaddlq_s16(v);
+
+	sum = vaddq_s32(sum, vreinterpretq_s32_u32(
+				vshrq_n_u32(vreinterpretq_u32_s32(sum), 31)));
+
+	return vmovn_s32(vshrq_n_s32(sum, 1));
+}
+
+static void pcm_neon_downmix(const int16_t *input, int16_t *output,
+								size_t frames)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= frames; i += 8) {
+		int16x8_t a = vld1q_s16(&input[i * 2]);
+		int16x8_t b = vld1q_s16(&input[i * 2 + 8]);
+
+		vst1q_s16(&output[i], vcombine_s16(neon_halve_pairs(a),
+							neon_halve_pairs(b)));
+	}
+
+	pcm_scalar_downmix(input + i * 2, output + i, frames - i);
+}
+
+static const struct audio_pcm_ops pcm_neon = {
+	.name = "neon",
+	.supported = pcm_neon_supported,
+	.downmix_to_mono = pcm_neon_downmix,
+};
+#endif
+
+/* Fastest first */
+static const struct audio_pcm_ops *pcm_ops[] = {
+#ifdef HAVE_PCM_X86
+	&pcm_avx2,
+	&pcm_sse2,
+#endif
+#ifdef HAVE_PCM_NEON
+	&pcm_neon,
+#endif
+	&pcm_scalar,
+};
+
+#define NUM_PCM_OPS (sizeof(pcm_ops) / sizeof(pcm_ops[0]))
+
+const struct audio_pcm_ops *audio_pcm_get_ops(unsigned int index)
+{
+	if (index >= NUM_PCM_OPS)
+		return NULL;
+
+	return pcm_ops[index];
+}
+
+const struct audio_pcm_ops *audio_pcm_select_ops(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < NUM_PCM_OPS; i++)
+		if (pcm_ops[i]->supported())
+			return pcm_ops[i];
+
+	return &pcm_scalar;
+}
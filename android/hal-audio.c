@@ -19,14 +19,17 @@
 #include <errno.h>
 #include <pthread.h>
 #include <poll.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <linux/sockios.h>
 
 #include <hardware/audio.h>
 #include <hardware/hardware.h>
@@ -45,6 +48,34 @@
 
 #define MAX_DELAY	100000 /* 100ms */
 
+/*
+ * PCM passed to out_write() is queued in a ring which is drained by the
+ * encoder thread. The first PCM_RING_MIRROR bytes are mirrored past the
+ * end of the ring so the encoder can always read that much in one piece.
+ */
+#define PCM_RING_SIZE	(2 * FIXED_BUFFER_SIZE)
+#define PCM_RING_MIRROR	FIXED_BUFFER_SIZE
+
+#define ENCODER_PRIORITY	2 /* SCHED_FIFO */
+
+/*
+ * Packets which are already due when encoded are held back and sent with
+ * a single sendmmsg() once the encoder has caught up, runs out of PCM or
+ * fills the batch.
+ */
+#define MAX_BATCH_PACKETS	8
+
+/*
+ * Bitrate follows the endpoint socket queue. The socket stops polling as
+ * writable once half of its send buffer is used, so the high mark is set
+ * below that. Quality goes down quickly and comes back slowly.
+ */
+#define QOS_QUEUE_HIGH		40	/* % of send buffer in use */
+#define QOS_QUEUE_LOW		10
+#define QOS_DOWN_PACKETS	3	/* congested packets in a row */
+#define QOS_HOLD_TIME		500000	/* 500ms after each change */
+#define QOS_UP_TIME		5000000	/* 5s of clear link to step up */
+
 static const uint8_t a2dp_src_uuid[] = {
 		0x00, 0x00, 0x11, 0x0a, 0x00, 0x00, 0x10, 0x00,
 		0x80, 0x00, 0x00, 0x80, 0x5f, 0x9b, 0x34, 0xfb };
@@ -110,20 +141,42 @@ static struct {
 
 #define MAX_AUDIO_ENDPOINTS NUM_CODECS
 
+struct bitrate_ctl {
+	unsigned int level;		/* steps below codec default */
+	unsigned int congested;		/* congested packets in a row */
+	struct timespec changed;
+	struct timespec clear_since;
+	int sndbuf;
+	int fill;			/* % of send buffer, -1 if unknown */
+	int max_fill;
+	uint64_t latency;		/* from socket wait to write done */
+	uint64_t max_latency;
+	uint32_t decreases;
+	uint32_t increases;
+	const char *reason;
+};
+
 struct audio_endpoint {
 	uint8_t id;
 	const struct audio_codec *codec;
 	void *codec_data;
 	int fd;
 
-	struct media_packet *mp;
+	struct media_packet *mp;	/* MAX_BATCH_PACKETS packets */
 	size_t mp_data_len;
 
+	struct iovec iov[MAX_BATCH_PACKETS];
+	struct mmsghdr msgs[MAX_BATCH_PACKETS];
+	unsigned int queued;
+
 	uint16_t seq;
 	uint32_t samples;
 	struct timespec start;
 
 	bool resync;
+	uint64_t stalled;
+
+	struct bitrate_ctl qos;
 };
 
 static struct audio_endpoint audio_endpoints[MAX_AUDIO_ENDPOINTS];
@@ -135,6 +188,22 @@ enum a2dp_state_t {
 	AUDIO_A2DP_STATE_STARTED
 };
 
+/* Single producer (out_write) and single consumer (encoder thread) */
+struct pcm_ring {
+	uint8_t *buf;
+	size_t head;
+	size_t tail;
+};
+
+struct encoder_stats {
+	uint32_t packets;
+	uint32_t sends;
+	uint32_t late;
+	uint32_t dropped;
+	uint32_t underruns;
+	size_t fill_low;
+};
+
 struct a2dp_stream_out {
 	struct audio_stream_out stream;
 
@@ -143,6 +212,19 @@ struct a2dp_stream_out {
 	struct audio_input_config cfg;
 
 	uint8_t *downmix_buf;
+	const struct audio_pcm_ops *pcm;
+
+	struct pcm_ring ring;
+
+	pthread_t encoder_th;
+	pthread_mutex_t encoder_mutex;
+	pthread_cond_t encoder_cond;
+	bool encoder_running;
+	bool encoder_drain;
+	bool encoder_quit;
+	bool encoder_done;
+
+	struct encoder_stats stats;
 };
 
 struct a2dp_audio_dev {
@@ -527,18 +609,31 @@ static bool open_endpoint(struct audio_endpoint **epp,
 	codec->init(preset, payload_len, &ep->codec_data);
 	codec->get_config(ep->codec_data, cfg);
 
-	ep->mp = calloc(mtu, 1);
+	ep->mp = calloc(MAX_BATCH_PACKETS, mtu);
 	if (!ep->mp)
 		goto failed;
 
-	if (ep->codec->use_rtp) {
-		struct media_packet_rtp *mp_rtp =
-					(struct media_packet_rtp *) ep->mp;
-		mp_rtp->hdr.v = 2;
-		mp_rtp->hdr.pt = 0x60;
-		mp_rtp->hdr.ssrc = htonl(1);
+	for (i = 0; i < MAX_BATCH_PACKETS; i++) {
+		struct msghdr *msg = &ep->msgs[i].msg_hdr;
+
+		ep->iov[i].iov_base = (uint8_t *) ep->mp + i * mtu;
+		ep->iov[i].iov_len = 0;
+
+		memset(msg, 0, sizeof(*msg));
+		msg->msg_iov = &ep->iov[i];
+		msg->msg_iovlen = 1;
+
+		if (ep->codec->use_rtp) {
+			struct media_packet_rtp *mp_rtp = ep->iov[i].iov_base;
+
+			mp_rtp->hdr.v = 2;
+			mp_rtp->hdr.pt = 0x60;
+			mp_rtp->hdr.ssrc = htonl(1);
+		}
 	}
 
+	ep->queued = 0;
+
 	ep->mp_data_len = payload_len;
 
 	free(preset);
@@ -566,6 +661,34 @@ static void close_endpoint(struct audio_endpoint *ep)
 	ep->codec_data = NULL;
 }
 
+static bool endpoint_qos(struct audio_endpoint *ep, uint8_t op,
+							const char *reason)
+{
+	struct bitrate_ctl *qos = &ep->qos;
+
+	clock_gettime(CLOCK_MONOTONIC, &qos->changed);
+	qos->clear_since = qos->changed;
+
+	if (op == QOS_POLICY_DEFAULT)
+		qos->level = 0;
+
+	if (!ep->codec->update_qos(ep->codec_data, op))
+		return false;
+
+	if (op == QOS_POLICY_DECREASE) {
+		qos->level++;
+		qos->decreases++;
+	} else if (op == QOS_POLICY_INCREASE) {
+		if (qos->level)
+			qos->level--;
+		qos->increases++;
+	}
+
+	qos->reason = reason;
+
+	return true;
+}
+
 static bool resume_endpoint(struct audio_endpoint *ep)
 {
 	if (ipc_resume_stream_cmd(ep->id) != AUDIO_STATUS_SUCCESS)
@@ -573,8 +696,14 @@ static bool resume_endpoint(struct audio_endpoint *ep)
 
 	ep->samples = 0;
 	ep->resync = false;
+	ep->stalled = 0;
+	ep->queued = 0;
 
-	ep->codec->update_qos(ep->codec_data, QOS_POLICY_DEFAULT);
+	ep->qos.congested = 0;
+	ep->qos.fill = -1;
+	ep->qos.sndbuf = 0;
+
+	endpoint_qos(ep, QOS_POLICY_DEFAULT, "stream resumed");
 
 	return true;
 }
@@ -584,20 +713,16 @@ static void downmix_to_mono(struct a2dp_stream_out *out, const uint8_t *buffer,
 {
 	const int16_t *input = (const void *) buffer;
 	int16_t *output = (void *) out->downmix_buf;
-	size_t i, frames;
+	size_t frames;
 
 	/* PCM 16bit stereo */
 	frames = bytes / (2 * sizeof(int16_t));
 
-	for (i = 0; i < frames; i++) {
-		int16_t l = get_le16(&input[i * 2]);
-		int16_t r = get_le16(&input[i * 2 + 1]);
-
-		put_le16((l + r) / 2, &output[i]);
-	}
+	out->pcm->downmix_to_mono(input, output, frames);
 }
 
-static bool wait_for_endpoint(struct audio_endpoint *ep, bool *writable)
+static bool wait_for_endpoint(struct audio_endpoint *ep, int timeout,
+								bool *writable)
 {
 	int ret;
 
@@ -608,7 +733,7 @@ static bool wait_for_endpoint(struct audio_endpoint *ep, bool *writable)
 		pollfd.events = POLLOUT;
 		pollfd.revents = 0;
 
-		ret = poll(&pollfd, 1, 500);
+		ret = poll(&pollfd, 1, timeout);
 
 		if (ret >= 0) {
 			*writable = !!(pollfd.revents & POLLOUT);
@@ -625,13 +750,36 @@ static bool wait_for_endpoint(struct audio_endpoint *ep, bool *writable)
 	return true;
 }
 
-static bool write_to_endpoint(struct audio_endpoint *ep, size_t bytes)
+/* Bluetooth sockets report free space in the send buffer for SIOCOUTQ */
+static int endpoint_queue_fill(struct audio_endpoint *ep)
+{
+	struct bitrate_ctl *qos = &ep->qos;
+	socklen_t len = sizeof(qos->sndbuf);
+	int space;
+
+	if (!qos->sndbuf && getsockopt(ep->fd, SOL_SOCKET, SO_SNDBUF,
+						&qos->sndbuf, &len) < 0)
+		qos->sndbuf = -1;
+
+	if (qos->sndbuf <= 0 || ioctl(ep->fd, SIOCOUTQ, &space) < 0)
+		return -1;
+
+	if (space < 0)
+		space = 0;
+	else if (space > qos->sndbuf)
+		space = qos->sndbuf;
+
+	return (qos->sndbuf - space) * 100 / qos->sndbuf;
+}
+
+/* Returns the number of packets sent or -1 on socket error */
+static int write_to_endpoint(struct audio_endpoint *ep, unsigned int first)
 {
-	struct media_packet *mp = (struct media_packet *) ep->mp;
 	int ret;
 
 	while (true) {
-		ret = write(ep->fd, mp, bytes);
+		ret = sendmmsg(ep->fd, &ep->msgs[first], ep->queued - first,
+								MSG_DONTWAIT);
 
 		if (ret >= 0)
 			break;
@@ -641,133 +789,492 @@ static bool write_to_endpoint(struct audio_endpoint *ep, size_t bytes)
 		 * fail, we can try to write next packet
 		 */
 		if (errno == EAGAIN) {
-			ret = errno;
-			warn("write failed (%d)", ret);
+			warn("write failed (%d)", EAGAIN);
+			ret = 0;
 			break;
 		}
 
 		if (errno != EINTR) {
 			ret = errno;
 			error("write failed (%d)", ret);
+			return -1;
+		}
+	}
+
+	ep->qos.fill = endpoint_queue_fill(ep);
+
+	return ret;
+}
+
+static void bitrate_control(struct audio_endpoint *ep, bool sent,
+					uint64_t latency, size_t duration)
+{
+	struct bitrate_ctl *qos = &ep->qos;
+	struct timespec now;
+	bool congested, clear;
+
+	qos->latency = latency;
+	if (latency > qos->max_latency)
+		qos->max_latency = latency;
+
+	if (qos->fill > qos->max_fill)
+		qos->max_fill = qos->fill;
+
+	/* waiting for the socket for half of a packet means it is late */
+	congested = !sent || qos->fill >= QOS_QUEUE_HIGH ||
+					(duration && latency > duration / 2);
+	clear = sent && qos->fill >= 0 && qos->fill <= QOS_QUEUE_LOW &&
+					(!duration || latency <= duration / 4);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	qos->congested = congested ? qos->congested + 1 : 0;
+	if (!clear)
+		qos->clear_since = now;
+
+	if (timespec_diff_us(&now, &qos->changed) < QOS_HOLD_TIME)
+		return;
+
+	if (qos->congested >= QOS_DOWN_PACKETS) {
+		endpoint_qos(ep, QOS_POLICY_DECREASE, "socket queue growing");
+		qos->congested = 0;
+		return;
+	}
+
+	if (qos->level && timespec_diff_us(&now, &qos->clear_since) >=
+								QOS_UP_TIME)
+		endpoint_qos(ep, QOS_POLICY_INCREASE, "socket queue clear");
+}
+
+static void stall_endpoint(struct audio_endpoint *ep, uint64_t time_us)
+{
+	bool reported = ep->stalled >= MAX_DELAY;
+
+	ep->stalled += time_us;
+
+	/* treat long stall like a lag and ask once for lower bitrate */
+	if (reported || ep->stalled < MAX_DELAY)
+		return;
+
+	warn("link stalled for %jums", ep->stalled / 1000);
+
+	endpoint_qos(ep, QOS_POLICY_DECREASE, "link stalled");
+}
+
+/* Sends queued media packets, dropping what the link cannot take in time */
+static bool flush_packets(struct a2dp_stream_out *out)
+{
+	struct audio_endpoint *ep = out->ep;
+	unsigned int first = 0;
+	size_t duration;
+	int timeout;
+
+	duration = ep->codec->get_mediapacket_duration(ep->codec_data);
+
+	/* wait for socket to be ready for write until the next packet
+	 * is due, so a congested link does not hold up the PCM ring,
+	 * and just skip writing data if timeout occurs
+	 */
+	timeout = duration ? duration / 1000 + 1 : MAX_DELAY / 1000;
+
+	while (first < ep->queued) {
+		struct timespec start, now;
+		uint64_t latency;
+		bool writable;
+		int sent = 0;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		if (!wait_for_endpoint(ep, timeout, &writable))
 			return false;
+
+		if (writable) {
+			sent = write_to_endpoint(ep, first);
+			if (sent < 0)
+				return false;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		latency = timespec_diff_us(&now, &start);
+
+		if (sent) {
+			out->stats.packets += sent;
+			out->stats.sends++;
+			ep->stalled = 0;
+			first += sent;
+		} else {
+			out->stats.dropped += ep->queued - first;
+			first = ep->queued;
+			stall_endpoint(ep, latency);
 		}
+
+		bitrate_control(ep, sent > 0, latency, duration);
 	}
 
+	ep->queued = 0;
+
 	return true;
 }
 
-static bool write_data(struct a2dp_stream_out *out, const void *buffer,
+static ssize_t send_packet(struct a2dp_stream_out *out, const uint8_t *buffer,
 								size_t bytes)
 {
 	struct audio_endpoint *ep = out->ep;
-	struct media_packet *mp = (struct media_packet *) ep->mp;
-	struct media_packet_rtp *mp_rtp = (struct media_packet_rtp *) ep->mp;
+	struct media_packet *mp;
+	struct media_packet_rtp *mp_rtp;
 	size_t free_space = ep->mp_data_len;
-	size_t consumed = 0;
+	size_t written = 0;
+	size_t duration;
+	ssize_t read;
+	uint32_t samples;
+	int ret;
+	struct timespec current;
+	uint64_t audio_sent, audio_passed;
+	bool due;
+
+	/* calculate where are we and where we should be */
+	clock_gettime(CLOCK_MONOTONIC, &current);
+	if (!ep->samples)
+		memcpy(&ep->start, &current, sizeof(ep->start));
+	audio_sent = ep->samples * 1000000ll / out->cfg.rate;
+	audio_passed = timespec_diff_us(&current, &ep->start);
+	due = audio_sent <= audio_passed;
+
+	/* held back packets are late already, don't keep them over a wait */
+	if (!due && ep->queued && !flush_packets(out))
+		return -1;
 
-	while (consumed < bytes) {
-		size_t written = 0;
-		ssize_t read;
-		uint32_t samples;
-		int ret;
-		struct timespec current;
-		uint64_t audio_sent, audio_passed;
-		bool do_write = false;
+	mp = ep->iov[ep->queued].iov_base;
+	mp_rtp = ep->iov[ep->queued].iov_base;
 
-		/*
-		 * prepare media packet in advance so we don't waste time after
-		 * wakeup
-		 */
-		if (ep->codec->use_rtp) {
-			mp_rtp->hdr.sequence_number = htons(ep->seq++);
-			mp_rtp->hdr.timestamp = htonl(ep->samples);
-		}
-		read = ep->codec->encode_mediapacket(ep->codec_data,
-						buffer + consumed,
-						bytes - consumed, mp,
-						free_space, &written);
+	/*
+	 * prepare media packet in advance so we don't waste time after
+	 * wakeup
+	 */
+	if (ep->codec->use_rtp) {
+		mp_rtp->hdr.sequence_number = htons(ep->seq);
+		mp_rtp->hdr.timestamp = htonl(ep->samples);
+	}
+	read = ep->codec->encode_mediapacket(ep->codec_data, buffer, bytes, mp,
+							free_space, &written);
 
-		/*
-		 * not much we can do here, let's just ignore remaining
-		 * data and continue
-		 */
-		if (read <= 0)
-			return true;
+	/* not enough data for a complete frame, wait for more */
+	if (read <= 0)
+		return 0;
 
-		/* calculate where are we and where we should be */
-		clock_gettime(CLOCK_MONOTONIC, &current);
-		if (!ep->samples)
-			memcpy(&ep->start, &current, sizeof(ep->start));
-		audio_sent = ep->samples * 1000000ll / out->cfg.rate;
-		audio_passed = timespec_diff_us(&current, &ep->start);
+	if (ep->codec->use_rtp)
+		ep->seq++;
 
-		/*
-		 * if we're ahead of stream then wait for next write point,
-		 * if we're lagging more than 100ms then stop writing and just
-		 * skip data until we're back in sync
-		 */
-		if (audio_sent > audio_passed) {
-			struct timespec anchor;
+	duration = ep->codec->get_mediapacket_duration(ep->codec_data);
 
-			ep->resync = false;
+	/*
+	 * if we're ahead of stream then wait for next write point,
+	 * if we're lagging more than 100ms then stop writing and just
+	 * skip data until we're back in sync
+	 */
+	if (!due) {
+		struct timespec anchor;
 
-			timespec_add(&ep->start, audio_sent, &anchor);
+		ep->resync = false;
 
-			while (true) {
-				ret = clock_nanosleep(CLOCK_MONOTONIC,
-							TIMER_ABSTIME, &anchor,
-							NULL);
+		timespec_add(&ep->start, audio_sent, &anchor);
 
-				if (!ret)
-					break;
+		while (true) {
+			ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+								&anchor, NULL);
+
+			if (!ret)
+				break;
 
-				if (ret != EINTR) {
-					error("clock_nanosleep failed (%d)",
-									ret);
-					return false;
-				}
+			if (ret != EINTR) {
+				error("clock_nanosleep failed (%d)", ret);
+				return -1;
 			}
-		} else if (!ep->resync) {
-			uint64_t diff = audio_passed - audio_sent;
+		}
+	} else {
+		uint64_t diff = audio_passed - audio_sent;
 
-			if (diff > MAX_DELAY) {
-				warn("lag is %jums, resyncing", diff / 1000);
+		/* late by more than a packet means the stream stuttered */
+		if (diff > duration)
+			out->stats.late++;
 
-				ep->codec->update_qos(ep->codec_data,
-							QOS_POLICY_DECREASE);
-				ep->resync = true;
-			}
+		if (!ep->resync && diff > MAX_DELAY) {
+			warn("lag is %jums, resyncing", diff / 1000);
+
+			endpoint_qos(ep, QOS_POLICY_DECREASE, "lagging behind");
+			ep->resync = true;
+
+			out->stats.dropped += ep->queued;
+			ep->queued = 0;
 		}
+	}
 
-		/* we send data only in case codec encoded some data, i.e. some
-		 * codecs do internal buffering and output data only if full
-		 * frame can be encoded
-		 * in resync mode we'll just drop mediapackets
-		 */
-		if (written > 0 && !ep->resync) {
-			/* wait some time for socket to be ready for write,
-			 * but we'll just skip writing data if timeout occurs
-			 */
-			if (!wait_for_endpoint(ep, &do_write))
-				return false;
+	/* we send data only in case codec encoded some data, i.e. some
+	 * codecs do internal buffering and output data only if full
+	 * frame can be encoded
+	 * in resync mode we'll just drop mediapackets
+	 */
+	if (written > 0 && !ep->resync) {
+		if (ep->codec->use_rtp)
+			written += sizeof(struct rtp_header);
+
+		ep->iov[ep->queued++].iov_len = written;
 
-			if (do_write) {
-				if (ep->codec->use_rtp)
-					written += sizeof(struct rtp_header);
+		if ((!due || ep->queued == MAX_BATCH_PACKETS) &&
+							!flush_packets(out))
+			return -1;
+	} else if (written > 0) {
+		out->stats.dropped++;
+	}
 
-				if (!write_to_endpoint(ep, written))
-					return false;
+	/*
+	 * AudioFlinger provides 16bit PCM, so sample size is 2 bytes
+	 * multiplied by number of channels. Number of channels is
+	 * simply number of bits set in channels mask.
+	 */
+	samples = read / (2 * popcount(out->cfg.channels));
+	ep->samples += samples;
+
+	return read;
+}
+
+static size_t ring_fill(struct pcm_ring *ring)
+{
+	size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	return (head + PCM_RING_SIZE - tail) % PCM_RING_SIZE;
+}
+
+static size_t ring_space(struct pcm_ring *ring)
+{
+	return PCM_RING_SIZE - 1 - ring_fill(ring);
+}
+
+/* Producer side, len must not exceed ring_space() */
+static void ring_write(struct pcm_ring *ring, const uint8_t *data, size_t len)
+{
+	size_t head = ring->head;
+	size_t first = PCM_RING_SIZE - head;
+	size_t wrapped;
+
+	if (first > len)
+		first = len;
+
+	wrapped = len - first;
+
+	memcpy(ring->buf + head, data, first);
+	memcpy(ring->buf, data + first, wrapped);
+
+	if (head < PCM_RING_MIRROR) {
+		size_t n = PCM_RING_MIRROR - head;
+
+		if (n > first)
+			n = first;
+
+		memcpy(ring->buf + PCM_RING_SIZE + head, data, n);
+	}
+
+	if (wrapped > PCM_RING_MIRROR)
+		wrapped = PCM_RING_MIRROR;
+
+	memcpy(ring->buf + PCM_RING_SIZE, data + first, wrapped);
+
+	__atomic_store_n(&ring->head, (head + len) % PCM_RING_SIZE,
+							__ATOMIC_RELEASE);
+}
+
+/* Consumer side, valid for up to PCM_RING_MIRROR queued bytes */
+static const uint8_t *ring_peek(struct pcm_ring *ring)
+{
+	return ring->buf + ring->tail;
+}
+
+static void ring_consume(struct pcm_ring *ring, size_t len)
+{
+	__atomic_store_n(&ring->tail, (ring->tail + len) % PCM_RING_SIZE,
+							__ATOMIC_RELEASE);
+}
+
+static void set_encoder_priority(void)
+{
+	struct sched_param param;
+	int err;
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = ENCODER_PRIORITY;
+
+	err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (err)
+		DBG("SCHED_FIFO not available (%d), using default policy", err);
+}
+
+/*
+ * Wait until more than have bytes are queued. Returns the number of queued
+ * bytes or 0 if the encoder should stop.
+ */
+static size_t wait_for_pcm(struct a2dp_stream_out *out, size_t have)
+{
+	size_t fill;
+
+	pthread_mutex_lock(&out->encoder_mutex);
+
+	fill = ring_fill(&out->ring);
+
+	if (!fill && out->stats.packets && !out->encoder_drain)
+		out->stats.underruns++;
+
+	while (fill <= have && !out->encoder_quit && !out->encoder_drain) {
+		pthread_cond_wait(&out->encoder_cond, &out->encoder_mutex);
+		fill = ring_fill(&out->ring);
+	}
+
+	if (fill <= have || out->encoder_quit)
+		fill = 0;
+	else if (!out->encoder_drain && fill < out->stats.fill_low)
+		out->stats.fill_low = fill;
+
+	pthread_mutex_unlock(&out->encoder_mutex);
+
+	return fill;
+}
+
+static void *encoder_thread(void *data)
+{
+	struct a2dp_stream_out *out = data;
+	size_t have = 0;
+
+	set_encoder_priority();
+
+	while (true) {
+		size_t fill;
+		ssize_t read;
+
+		/* nothing more to encode for now, send what is held back */
+		if (out->ep->queued && ring_fill(&out->ring) <= have &&
+							!flush_packets(out))
+			break;
+
+		fill = wait_for_pcm(out, have);
+		if (!fill)
+			break;
+
+		if (fill > PCM_RING_MIRROR)
+			fill = PCM_RING_MIRROR;
+
+		read = send_packet(out, ring_peek(&out->ring), fill);
+		if (read < 0)
+			break;
+
+		if (!read) {
+			if (fill < PCM_RING_MIRROR) {
+				have = fill;
+				continue;
 			}
+
+			/* codec cannot use this data at all, skip it */
+			read = fill;
 		}
 
-		/*
-		 * AudioFlinger provides 16bit PCM, so sample size is 2 bytes
-		 * multiplied by number of channels. Number of channels is
-		 * simply number of bits set in channels mask.
-		 */
-		samples = read / (2 * popcount(out->cfg.channels));
-		ep->samples += samples;
-		consumed += read;
+		have = 0;
+
+		ring_consume(&out->ring, read);
+
+		pthread_mutex_lock(&out->encoder_mutex);
+		pthread_cond_broadcast(&out->encoder_cond);
+		pthread_mutex_unlock(&out->encoder_mutex);
+	}
+
+	pthread_mutex_lock(&out->encoder_mutex);
+	out->encoder_done = true;
+	pthread_cond_broadcast(&out->encoder_cond);
+	pthread_mutex_unlock(&out->encoder_mutex);
+
+	return NULL;
+}
+
+static void encoder_stop(struct a2dp_stream_out *out, bool drain)
+{
+	if (!out->encoder_running)
+		return;
+
+	pthread_mutex_lock(&out->encoder_mutex);
+	if (drain)
+		out->encoder_drain = true;
+	else
+		out->encoder_quit = true;
+	pthread_cond_broadcast(&out->encoder_cond);
+	pthread_mutex_unlock(&out->encoder_mutex);
+
+	pthread_join(out->encoder_th, NULL);
+
+	out->encoder_running = false;
+}
+
+static bool encoder_start(struct a2dp_stream_out *out)
+{
+	int err;
+
+	/* encoder may have stopped on socket error, start over */
+	if (out->encoder_running && out->encoder_done)
+		encoder_stop(out, false);
+
+	if (out->encoder_running)
+		return true;
+
+	out->ring.head = 0;
+	out->ring.tail = 0;
+	out->encoder_drain = false;
+	out->encoder_quit = false;
+	out->encoder_done = false;
+
+	err = pthread_create(&out->encoder_th, NULL, encoder_thread, out);
+	if (err) {
+		error("audio: cannot start encoder thread (%d)", err);
+		return false;
+	}
+
+	out->encoder_running = true;
+
+	return true;
+}
+
+/* Blocks while the ring is full, so AudioFlinger is paced by the encoder */
+static bool queue_data(struct a2dp_stream_out *out, const uint8_t *buffer,
+								size_t bytes)
+{
+	while (bytes > 0) {
+		size_t space;
+		bool done;
+
+		pthread_mutex_lock(&out->encoder_mutex);
+
+		space = ring_space(&out->ring);
+
+		while (!space && !out->encoder_done) {
+			pthread_cond_wait(&out->encoder_cond,
+							&out->encoder_mutex);
+			space = ring_space(&out->ring);
+		}
+
+		done = out->encoder_done;
+
+		pthread_mutex_unlock(&out->encoder_mutex);
+
+		if (done)
+			return false;
+
+		if (space > bytes)
+			space = bytes;
+
+		ring_write(&out->ring, buffer, space);
+
+		buffer += space;
+		bytes -= space;
+
+		pthread_mutex_lock(&out->encoder_mutex);
+		pthread_cond_broadcast(&out->encoder_cond);
+		pthread_mutex_unlock(&out->encoder_mutex);
 	}
 
 	return true;
@@ -824,7 +1331,10 @@ static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
 		in_len = bytes / 2;
 	}
 
-	if (!write_data(out, in_buf, in_len))
+	if (!encoder_start(out))
+		return -1;
+
+	if (!queue_data(out, in_buf, in_len))
 		return -1;
 
 	return bytes;
@@ -901,6 +1411,9 @@ static int out_standby(struct audio_stream *stream)
 	DBG("");
 
 	if (out->audio_state == AUDIO_A2DP_STATE_STARTED) {
+		/* let the encoder send what is already queued */
+		encoder_stop(out, true);
+
 		if (ipc_suspend_stream_cmd(out->ep->id) != AUDIO_STATUS_SUCCESS)
 			return -1;
 		out->audio_state = AUDIO_A2DP_STATE_STANDBY;
@@ -911,8 +1424,37 @@ static int out_standby(struct audio_stream *stream)
 
 static int out_dump(const struct audio_stream *stream, int fd)
 {
+	struct a2dp_stream_out *out = (struct a2dp_stream_out *) stream;
+	struct encoder_stats *stats = &out->stats;
+
 	DBG("");
-	return -ENOSYS;
+
+	/* counters are updated by the encoder thread without locking */
+	dprintf(fd, "A2DP output stream:\n");
+	dprintf(fd, "  encoder: %s\n",
+				out->encoder_running ? "running" : "stopped");
+	dprintf(fd, "  ring: %zu of %u bytes queued, lowest %zu\n",
+				ring_fill(&out->ring), PCM_RING_SIZE - 1,
+				stats->fill_low);
+	dprintf(fd, "  packets: %u sent in %u writes, %u late, %u dropped\n",
+				stats->packets, stats->sends, stats->late,
+				stats->dropped);
+	dprintf(fd, "  underruns: %u\n", stats->underruns);
+
+	if (out->ep) {
+		struct bitrate_ctl *qos = &out->ep->qos;
+
+		dprintf(fd, "  bitrate: %u steps below default, "
+				"%u decreases, %u increases, last: %s\n",
+				qos->level, qos->decreases, qos->increases,
+				qos->reason ? qos->reason : "none");
+		dprintf(fd, "  socket queue: %d%% (max %d%%), "
+				"send latency %juus (max %juus)\n",
+				qos->fill, qos->max_fill,
+				qos->latency, qos->max_latency);
+	}
+
+	return 0;
 }
 
 static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
@@ -956,6 +1498,8 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
 	free(str);
 
 	if (enter_suspend && out->audio_state == AUDIO_A2DP_STATE_STARTED) {
+		encoder_stop(out, false);
+
 		if (ipc_suspend_stream_cmd(out->ep->id) != AUDIO_STATUS_SUCCESS)
 			return -1;
 		out->audio_state = AUDIO_A2DP_STATE_SUSPENDED;
@@ -979,12 +1523,18 @@ static uint32_t out_get_latency(const struct audio_stream_out *stream)
 	struct a2dp_stream_out *out = (struct a2dp_stream_out *) stream;
 	struct audio_endpoint *ep = out->ep;
 	size_t pkt_duration;
+	uint32_t ring_duration;
 
 	DBG("");
 
 	pkt_duration = ep->codec->get_mediapacket_duration(ep->codec_data);
 
-	return FIXED_A2DP_PLAYBACK_LATENCY_MS + pkt_duration / 1000;
+	/* a full ring of PCM is queued ahead of the encoder */
+	ring_duration = PCM_RING_SIZE * 1000 /
+			(out->cfg.rate * 2 * popcount(out->cfg.channels));
+
+	return FIXED_A2DP_PLAYBACK_LATENCY_MS + pkt_duration / 1000 +
+								ring_duration;
 }
 
 static int out_set_volume(struct audio_stream_out *stream, float left,
@@ -1157,8 +1707,21 @@ static int audio_open_output_stream_real(struct audio_hw_device *dev,
 		out->downmix_buf = malloc(FIXED_BUFFER_SIZE / 2);
 		if (!out->downmix_buf)
 			goto fail;
+
+		out->pcm = audio_pcm_select_ops();
+
+		DBG("downmix using %s", out->pcm->name);
 	}
 
+	out->ring.buf = malloc(PCM_RING_SIZE + PCM_RING_MIRROR);
+	if (!out->ring.buf)
+		goto fail;
+
+	out->stats.fill_low = PCM_RING_SIZE;
+
+	pthread_mutex_init(&out->encoder_mutex, NULL);
+	pthread_cond_init(&out->encoder_cond, NULL);
+
 	*stream_out = &out->stream;
 	a2dp_dev->out = out;
 
@@ -1168,6 +1731,7 @@ static int audio_open_output_stream_real(struct audio_hw_device *dev,
 
 fail:
 	error("audio: cannot open output stream");
+	free(out->downmix_buf);
 	free(out);
 	*stream_out = NULL;
 	return -EIO;
@@ -1206,8 +1770,14 @@ static void audio_close_output_stream(struct audio_hw_device *dev,
 
 	DBG("");
 
+	encoder_stop(out, false);
+
 	close_endpoint(a2dp_dev->out->ep);
 
+	pthread_cond_destroy(&out->encoder_cond);
+	pthread_mutex_destroy(&out->encoder_mutex);
+
+	free(out->ring.buf);
 	free(out->downmix_buf);
 
 	free(stream);
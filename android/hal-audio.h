@@ -95,8 +95,22 @@ struct audio_codec {
 
 #define QOS_POLICY_DEFAULT	0x00
 #define QOS_POLICY_DECREASE	0x01
+#define QOS_POLICY_INCREASE	0x02
 
 typedef const struct audio_codec * (*audio_codec_get_t) (void);
 
 const struct audio_codec *codec_sbc(void);
 const struct audio_codec *codec_aptx(void);
+
+struct audio_pcm_ops {
+	const char *name;
+
+	bool (*supported) (void);
+
+	/* Averages interleaved 16bit stereo frames into 16bit mono */
+	void (*downmix_to_mono) (const int16_t *input, int16_t *output,
+								size_t frames);
+};
+
+const struct audio_pcm_ops *audio_pcm_get_ops(unsigned int index);
+const struct audio_pcm_ops *audio_pcm_select_ops(void);
@@ -49,6 +49,8 @@ struct _GObexPacket {
 	GSList *headers;
 
 	GObexDataProducer get_body;
+	GObexBodyProvider get_body_ref;
+	GDestroyNotify release_body;
 	gpointer get_body_data;
 };
 
@@ -116,7 +118,7 @@ gboolean g_obex_packet_add_body(GObexPacket *pkt, GObexDataProducer func,
 {
 	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
 
-	if (pkt->get_body != NULL)
+	if (pkt->get_body != NULL || pkt->get_body_ref != NULL)
 		return FALSE;
 
 	pkt->get_body = func;
@@ -125,6 +127,25 @@ gboolean g_obex_packet_add_body(GObexPacket *pkt, GObexDataProducer func,
 	return TRUE;
 }
 
+/*
+ * The provider returns data it keeps valid until release is called with the
+ * ref it set, which happens once the data has been sent or dropped.
+ */
+gboolean g_obex_packet_add_body_ref(GObexPacket *pkt, GObexBodyProvider func,
+				GDestroyNotify release, gpointer user_data)
+{
+	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
+
+	if (pkt->get_body != NULL || pkt->get_body_ref != NULL)
+		return FALSE;
+
+	pkt->get_body_ref = func;
+	pkt->release_body = release;
+	pkt->get_body_data = user_data;
+
+	return TRUE;
+}
+
 gboolean g_obex_packet_add_unicode(GObexPacket *pkt, guint8 id,
 							const char *str)
 {
@@ -384,9 +405,21 @@ failed:
 	return NULL;
 }
 
-static gssize get_body(GObexPacket *pkt, guint8 *buf, gsize len)
+static void encode_body_header(guint8 *buf, gsize body_len)
 {
 	guint16 u16;
+
+	if (body_len > 0)
+		buf[0] = G_OBEX_HDR_BODY;
+	else
+		buf[0] = G_OBEX_HDR_BODY_END;
+
+	u16 = g_htons(body_len + 3);
+	memcpy(&buf[1], &u16, sizeof(u16));
+}
+
+static gssize get_body(GObexPacket *pkt, guint8 *buf, gsize len)
+{
 	gssize ret;
 
 	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
@@ -398,26 +431,24 @@ static gssize get_body(GObexPacket *pkt, guint8 *buf, gsize len)
 	if (ret < 0)
 		return ret;
 
-	if (ret > 0)
-		buf[0] = G_OBEX_HDR_BODY;
-	else
-		buf[0] = G_OBEX_HDR_BODY_END;
-
-	u16 = g_htons(ret + 3);
-	memcpy(&buf[1], &u16, sizeof(u16));
+	encode_body_header(buf, ret);
 
 	return ret;
 }
 
-gssize g_obex_packet_encode(GObexPacket *pkt, guint8 *buf, gsize len)
+static void encode_final(GObexPacket *pkt, guint8 *buf)
+{
+	if (pkt->opcode == G_OBEX_RSP_CONTINUE)
+		buf[0] = G_OBEX_RSP_SUCCESS;
+	buf[0] |= FINAL_BIT;
+}
+
+static gssize encode_headers(GObexPacket *pkt, guint8 *buf, gsize len)
 {
 	gssize ret;
 	gsize count;
-	guint16 u16;
 	GSList *l;
 
-	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
-
 	if (3 + pkt->data_len + pkt->hlen > len)
 		return -ENOBUFS;
 
@@ -447,15 +478,36 @@ gssize g_obex_packet_encode(GObexPacket *pkt, guint8 *buf, gsize len)
 		count += ret;
 	}
 
+	return count;
+}
+
+gssize g_obex_packet_encode(GObexPacket *pkt, guint8 *buf, gsize len)
+{
+	gssize ret;
+	gsize count;
+	guint16 u16;
+
+	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
+
+	/*
+	 * Referenced bodies may point into a file mapping, copying them could
+	 * fault if the file shrinks. Only g_obex_packet_encode_iov sends them.
+	 */
+	if (pkt->get_body_ref)
+		return -EINVAL;
+
+	ret = encode_headers(pkt, buf, len);
+	if (ret < 0)
+		return ret;
+
+	count = ret;
+
 	if (pkt->get_body) {
 		ret = get_body(pkt, buf + count, len - count);
 		if (ret < 0)
 			return ret;
-		if (ret == 0) {
-			if (pkt->opcode == G_OBEX_RSP_CONTINUE)
-				buf[0] = G_OBEX_RSP_SUCCESS;
-			buf[0] |= FINAL_BIT;
-		}
+		if (ret == 0)
+			encode_final(pkt, buf);
 
 		count += ret + 3;
 	}
@@ -465,3 +517,68 @@ gssize g_obex_packet_encode(GObexPacket *pkt, guint8 *buf, gsize len)
 
 	return count;
 }
+
+/*
+ * Same as g_obex_packet_encode but the data of a body added with
+ * g_obex_packet_add_body_ref is not copied, it is returned in body instead
+ * and follows the len bytes encoded in buf on the wire. The caller must call
+ * release with release_data, if set, once it is done with the body.
+ */
+gssize g_obex_packet_encode_iov(GObexPacket *pkt, guint8 *buf, gsize len,
+				struct iovec *body, GDestroyNotify *release,
+				gpointer *release_data)
+{
+	const void *data;
+	gpointer ref = NULL;
+	gssize ret;
+	gsize count;
+	guint16 u16;
+
+	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
+
+	body->iov_base = NULL;
+	body->iov_len = 0;
+	*release = NULL;
+	*release_data = NULL;
+
+	if (pkt->get_body_ref == NULL)
+		return g_obex_packet_encode(pkt, buf, len);
+
+	ret = encode_headers(pkt, buf, len);
+	if (ret < 0)
+		return ret;
+
+	count = ret;
+
+	if (len - count < 3)
+		return -ENOBUFS;
+
+	ret = pkt->get_body_ref(&data, len - count - 3, &ref,
+							pkt->get_body_data);
+	if (ref && pkt->release_body) {
+		if (ret < 0) {
+			pkt->release_body(ref);
+			return ret;
+		}
+
+		*release = pkt->release_body;
+		*release_data = ref;
+	}
+
+	if (ret < 0)
+		return ret;
+
+	encode_body_header(buf + count, ret);
+	if (ret == 0)
+		encode_final(pkt, buf);
+
+	count += 3;
+
+	body->iov_base = (void *) data;
+	body->iov_len = ret;
+
+	u16 = g_htons(count + ret);
+	memcpy(&buf[1], &u16, sizeof(u16));
+
+	return count;
+}
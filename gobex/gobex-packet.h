@@ -24,6 +24,7 @@
 #define __GOBEX_PACKET_H
 
 #include <stdarg.h>
+#include <sys/uio.h>
 #include <glib.h>
 
 #include "gobex/gobex-defs.h"
@@ -88,6 +89,8 @@ gboolean g_obex_packet_prepend_header(GObexPacket *pkt, GObexHeader *header);
 gboolean g_obex_packet_add_header(GObexPacket *pkt, GObexHeader *header);
 gboolean g_obex_packet_add_body(GObexPacket *pkt, GObexDataProducer func,
 							gpointer user_data);
+gboolean g_obex_packet_add_body_ref(GObexPacket *pkt, GObexBodyProvider func,
+				GDestroyNotify release, gpointer user_data);
 gboolean g_obex_packet_add_unicode(GObexPacket *pkt, guint8 id,
 							const char *str);
 gboolean g_obex_packet_add_bytes(GObexPacket *pkt, guint8 id,
@@ -108,5 +111,8 @@ GObexPacket *g_obex_packet_decode(const void *data, gsize len,
 						GObexDataPolicy data_policy,
 						GError **err);
 gssize g_obex_packet_encode(GObexPacket *pkt, guint8 *buf, gsize len);
+gssize g_obex_packet_encode_iov(GObexPacket *pkt, guint8 *buf, gsize len,
+				struct iovec *body, GDestroyNotify *release,
+				gpointer *release_data);
 
 #endif /* __GOBEX_PACKET_H */
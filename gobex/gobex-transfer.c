@@ -50,7 +50,11 @@ struct transfer {
 	guint abort_id;
 
 	GObexDataProducer data_producer;
+	GObexBodyProvider body_provider;
+	GDestroyNotify body_release;
 	GObexDataConsumer data_consumer;
+	GObexFlushFunc flush_func;
+	GObexPacket *flush_rsp;
 	GObexFunc complete_func;
 
 	gpointer user_data;
@@ -77,6 +81,9 @@ static void transfer_free(struct transfer *transfer)
 		g_obex_remove_request_function(transfer->obex,
 							transfer->abort_id);
 
+	if (transfer->flush_rsp != NULL)
+		g_obex_packet_free(transfer->flush_rsp);
+
 	g_obex_unref(transfer->obex);
 	g_free(transfer);
 }
@@ -359,19 +366,48 @@ static guint8 put_get_bytes(struct transfer *transfer, GObexPacket *req)
 	return rsp;
 }
 
+/*
+ * Gives the consumer a chance to commit the data before the final response
+ * is sent. Returns FALSE if the response has to wait for
+ * g_obex_put_rsp_flushed.
+ */
+static gboolean put_flush(struct transfer *transfer, guint8 *rspcode)
+{
+	int err;
+
+	if (*rspcode != G_OBEX_RSP_SUCCESS || transfer->flush_func == NULL)
+		return TRUE;
+
+	err = transfer->flush_func(transfer->user_data);
+	if (err == -EAGAIN)
+		return FALSE;
+
+	if (err < 0)
+		*rspcode = g_obex_errno_to_rsp(err);
+
+	return TRUE;
+}
+
 static void transfer_put_req_first(struct transfer *transfer, GObexPacket *req,
 					guint8 first_hdr_id, va_list args)
 {
 	GError *err = NULL;
 	GObexPacket *rsp;
 	guint8 rspcode;
+	gboolean flushed;
 
 	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
 
 	rspcode = put_get_bytes(transfer, req);
+	flushed = put_flush(transfer, &rspcode);
 
 	rsp = g_obex_packet_new_valist(rspcode, TRUE, first_hdr_id, args);
 
+	if (!flushed) {
+		transfer->flush_rsp = rsp;
+		return;
+	}
+
 	if (!g_obex_send(transfer->obex, rsp, &err)) {
 		transfer_complete(transfer, err);
 		g_error_free(err);
@@ -393,6 +429,12 @@ static void transfer_put_req(GObex *obex, GObexPacket *req, gpointer user_data)
 
 	rspcode = put_get_bytes(transfer, req);
 
+	if (!put_flush(transfer, &rspcode)) {
+		transfer->flush_rsp = g_obex_packet_new(rspcode, TRUE,
+							G_OBEX_HDR_INVALID);
+		return;
+	}
+
 	/* Don't send continue while SRM is active */
 	if (g_obex_srm_active(transfer->obex) &&
 				rspcode == G_OBEX_RSP_CONTINUE)
@@ -411,6 +453,27 @@ done:
 		transfer_complete(transfer, NULL);
 }
 
+static guint put_rsp_register(struct transfer *transfer)
+{
+	GObex *obex = transfer->obex;
+	guint id;
+
+	if (!g_slist_find(transfers, transfer))
+		return 0;
+
+	id = g_obex_add_request_function(obex, G_OBEX_OP_PUT, transfer_put_req,
+								transfer);
+	transfer->put_id = id;
+
+	id = g_obex_add_request_function(obex, G_OBEX_OP_ABORT,
+						transfer_abort_req, transfer);
+	transfer->abort_id = id;
+
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
+
+	return transfer->id;
+}
+
 guint g_obex_put_rsp(GObex *obex, GObexPacket *req,
 			GObexDataConsumer data_func, GObexFunc complete_func,
 			gpointer user_data, GError **err,
@@ -418,7 +481,6 @@ guint g_obex_put_rsp(GObex *obex, GObexPacket *req,
 {
 	struct transfer *transfer;
 	va_list args;
-	guint id;
 
 	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "obex %p", obex);
 
@@ -428,20 +490,67 @@ guint g_obex_put_rsp(GObex *obex, GObexPacket *req,
 	va_start(args, first_hdr_id);
 	transfer_put_req_first(transfer, req, first_hdr_id, args);
 	va_end(args);
-	if (!g_slist_find(transfers, transfer))
-		return 0;
 
-	id = g_obex_add_request_function(obex, G_OBEX_OP_PUT, transfer_put_req,
-								transfer);
-	transfer->put_id = id;
+	return put_rsp_register(transfer);
+}
 
-	id = g_obex_add_request_function(obex, G_OBEX_OP_ABORT,
-						transfer_abort_req, transfer);
-	transfer->abort_id = id;
+/*
+ * Same as g_obex_put_rsp but flush_func is called before the final response
+ * is sent. If it returns -EAGAIN the response is held back until
+ * g_obex_put_rsp_flushed is called, other errors are turned into an error
+ * response.
+ */
+guint g_obex_put_rsp_flush(GObex *obex, GObexPacket *req,
+			GObexDataConsumer data_func, GObexFlushFunc flush_func,
+			GObexFunc complete_func, gpointer user_data,
+			GError **err, guint first_hdr_id, ...)
+{
+	struct transfer *transfer;
+	va_list args;
 
-	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "obex %p", obex);
 
-	return transfer->id;
+	transfer = transfer_new(obex, G_OBEX_OP_PUT, complete_func, user_data);
+	transfer->data_consumer = data_func;
+	transfer->flush_func = flush_func;
+
+	va_start(args, first_hdr_id);
+	transfer_put_req_first(transfer, req, first_hdr_id, args);
+	va_end(args);
+
+	return put_rsp_register(transfer);
+}
+
+gboolean g_obex_put_rsp_flushed(guint id, int err)
+{
+	struct transfer *transfer;
+	GObexPacket *rsp;
+	GError *gerr = NULL;
+
+	transfer = find_transfer(id);
+	if (transfer == NULL || transfer->flush_rsp == NULL)
+		return FALSE;
+
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u err %d", id, err);
+
+	rsp = transfer->flush_rsp;
+	transfer->flush_rsp = NULL;
+
+	if (err < 0) {
+		g_obex_packet_free(rsp);
+		rsp = g_obex_packet_new(g_obex_errno_to_rsp(err), TRUE,
+							G_OBEX_HDR_INVALID);
+	}
+
+	if (!g_obex_send(transfer->obex, rsp, &gerr)) {
+		transfer_complete(transfer, gerr);
+		g_error_free(gerr);
+		return TRUE;
+	}
+
+	transfer_complete(transfer, NULL);
+
+	return TRUE;
 }
 
 guint g_obex_get_req_pkt(GObex *obex, GObexPacket *req,
@@ -499,17 +608,15 @@ guint g_obex_get_req(GObex *obex, GObexDataConsumer data_func,
 	return transfer->id;
 }
 
-static gssize get_get_data(void *buf, gsize len, gpointer user_data)
+static void transfer_add_get_body(struct transfer *transfer,
+							GObexPacket *rsp);
+
+static gssize get_get_result(struct transfer *transfer, gssize ret)
 {
-	struct transfer *transfer = user_data;
 	GObexPacket *req, *rsp;
 	GError *err = NULL;
-	gssize ret;
 	guint8 op;
 
-	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
-
-	ret = transfer->data_producer(buf, len, transfer->user_data);
 	if (ret > 0) {
 		if (!g_obex_srm_active(transfer->obex))
 			return ret;
@@ -517,7 +624,7 @@ static gssize get_get_data(void *buf, gsize len, gpointer user_data)
 		/* Generate next response */
 		rsp = g_obex_packet_new(G_OBEX_RSP_CONTINUE, TRUE,
 							G_OBEX_HDR_INVALID);
-		g_obex_packet_add_body(rsp, get_get_data, transfer);
+		transfer_add_get_body(transfer, rsp);
 
 		if (!g_obex_send(transfer->obex, rsp, &err)) {
 			transfer_complete(transfer, err);
@@ -549,6 +656,37 @@ static gssize get_get_data(void *buf, gsize len, gpointer user_data)
 	return ret;
 }
 
+static gssize get_get_data(void *buf, gsize len, gpointer user_data)
+{
+	struct transfer *transfer = user_data;
+
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
+
+	return get_get_result(transfer, transfer->data_producer(buf, len,
+							transfer->user_data));
+}
+
+static gssize get_get_body(const void **buf, gsize len, gpointer *ref,
+							gpointer user_data)
+{
+	struct transfer *transfer = user_data;
+
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
+
+	return get_get_result(transfer, transfer->body_provider(buf, len, ref,
+							transfer->user_data));
+}
+
+static void transfer_add_get_body(struct transfer *transfer,
+							GObexPacket *rsp)
+{
+	if (transfer->body_provider)
+		g_obex_packet_add_body_ref(rsp, get_get_body,
+					transfer->body_release, transfer);
+	else
+		g_obex_packet_add_body(rsp, get_get_data, transfer);
+}
+
 static gboolean transfer_get_req_first(struct transfer *transfer,
 							GObexPacket *rsp)
 {
@@ -556,7 +694,7 @@ static gboolean transfer_get_req_first(struct transfer *transfer,
 
 	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
 
-	g_obex_packet_add_body(rsp, get_get_data, transfer);
+	transfer_add_get_body(transfer, rsp);
 
 	if (!g_obex_send(transfer->obex, rsp, &err)) {
 		transfer_complete(transfer, err);
@@ -576,7 +714,7 @@ static void transfer_get_req(GObex *obex, GObexPacket *req, gpointer user_data)
 	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
 
 	rsp = g_obex_packet_new(G_OBEX_RSP_CONTINUE, TRUE, G_OBEX_HDR_INVALID);
-	g_obex_packet_add_body(rsp, get_get_data, transfer);
+	transfer_add_get_body(transfer, rsp);
 
 	if (!g_obex_send(obex, rsp, &err)) {
 		transfer_complete(transfer, err);
@@ -584,18 +722,11 @@ static void transfer_get_req(GObex *obex, GObexPacket *req, gpointer user_data)
 	}
 }
 
-guint g_obex_get_rsp_pkt(GObex *obex, GObexPacket *rsp,
-			GObexDataProducer data_func, GObexFunc complete_func,
-			gpointer user_data, GError **err)
+static guint get_rsp_start(struct transfer *transfer, GObexPacket *rsp)
 {
-	struct transfer *transfer;
+	GObex *obex = transfer->obex;
 	guint id;
 
-	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "obex %p", obex);
-
-	transfer = transfer_new(obex, G_OBEX_OP_GET, complete_func, user_data);
-	transfer->data_producer = data_func;
-
 	if (!transfer_get_req_first(transfer, rsp))
 		return 0;
 
@@ -615,6 +746,36 @@ guint g_obex_get_rsp_pkt(GObex *obex, GObexPacket *rsp,
 	return transfer->id;
 }
 
+guint g_obex_get_rsp_pkt(GObex *obex, GObexPacket *rsp,
+			GObexDataProducer data_func, GObexFunc complete_func,
+			gpointer user_data, GError **err)
+{
+	struct transfer *transfer;
+
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "obex %p", obex);
+
+	transfer = transfer_new(obex, G_OBEX_OP_GET, complete_func, user_data);
+	transfer->data_producer = data_func;
+
+	return get_rsp_start(transfer, rsp);
+}
+
+guint g_obex_get_rsp_pkt_ref(GObex *obex, GObexPacket *rsp,
+			GObexBodyProvider body_func,
+			GDestroyNotify release_func, GObexFunc complete_func,
+			gpointer user_data, GError **err)
+{
+	struct transfer *transfer;
+
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "obex %p", obex);
+
+	transfer = transfer_new(obex, G_OBEX_OP_GET, complete_func, user_data);
+	transfer->body_provider = body_func;
+	transfer->body_release = release_func;
+
+	return get_rsp_start(transfer, rsp);
+}
+
 guint g_obex_get_rsp(GObex *obex, GObexDataProducer data_func,
 			GObexFunc complete_func, gpointer user_data,
 			GError **err, guint first_hdr_id, ...)
@@ -27,6 +27,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/uio.h>
 
 #include "gobex.h"
 #include "gobex-debug.h"
@@ -77,6 +78,9 @@ struct _GObex {
 	guint8 *tx_buf;
 	size_t tx_data;
 	size_t tx_sent;
+	struct iovec tx_body;	/* Body data following tx_buf, not copied */
+	GDestroyNotify tx_body_release;
+	gpointer tx_body_ref;
 
 	gboolean suspended;
 	gboolean use_srm;
@@ -267,12 +271,72 @@ static gboolean req_timeout(gpointer user_data)
 	return FALSE;
 }
 
+static void release_tx_body(GObex *obex)
+{
+	GDestroyNotify release = obex->tx_body_release;
+
+	obex->tx_body.iov_len = 0;
+	obex->tx_body_release = NULL;
+
+	if (release)
+		release(obex->tx_body_ref);
+
+	obex->tx_body_ref = NULL;
+}
+
+/* Writes the remaining tx_buf data and the body behind it in one go */
+static gssize write_iov(GObex *obex, GError **err)
+{
+	struct iovec iov[2];
+	gssize ret;
+
+	iov[0].iov_base = &obex->tx_buf[obex->tx_sent];
+	iov[0].iov_len = obex->tx_data;
+	iov[1] = obex->tx_body;
+
+	do {
+		ret = writev(g_io_channel_unix_get_fd(obex->io), iov, 2);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0) {
+		if (errno == EAGAIN)
+			return 0;
+
+		g_set_error(err, G_OBEX_ERROR, G_OBEX_ERROR_FAILED,
+						"writev: %s", strerror(errno));
+		return -1;
+	}
+
+	g_obex_dump(G_OBEX_DEBUG_DATA, "<", iov[0].iov_base,
+					MIN((gsize) ret, obex->tx_data));
+
+	if ((gsize) ret < obex->tx_data) {
+		obex->tx_sent += ret;
+		obex->tx_data -= ret;
+		return ret;
+	}
+
+	obex->tx_body.iov_base = (guint8 *) obex->tx_body.iov_base +
+							ret - obex->tx_data;
+	obex->tx_body.iov_len -= ret - obex->tx_data;
+	obex->tx_sent += obex->tx_data;
+	obex->tx_data = 0;
+
+	if (obex->tx_body.iov_len == 0)
+		release_tx_body(obex);
+
+	return ret;
+}
+
 static gboolean write_stream(GObex *obex, GError **err)
 {
 	GIOStatus status;
 	gsize bytes_written;
 	char *buf;
 
+	if (obex->tx_body.iov_len > 0)
+		return write_iov(obex, err) >= 0;
+
 	buf = (char *) &obex->tx_buf[obex->tx_sent];
 	status = g_io_channel_write_chars(obex->io, buf, obex->tx_data,
 							&bytes_written, err);
@@ -293,6 +357,14 @@ static gboolean write_packet(GObex *obex, GError **err)
 	gsize bytes_written;
 	char *buf;
 
+	if (obex->tx_body.iov_len > 0) {
+		gsize total = obex->tx_data + obex->tx_body.iov_len;
+		gssize ret = write_iov(obex, err);
+
+		/* Packets can only be sent whole */
+		return ret == 0 || (gsize) ret == total;
+	}
+
 	buf = (char *) &obex->tx_buf[obex->tx_sent];
 	status = g_io_channel_write_chars(obex->io, buf, obex->tx_data,
 							&bytes_written, err);
@@ -439,7 +511,7 @@ static gboolean write_data(GIOChannel *io, GIOCondition cond,
 	if (cond & (G_IO_HUP | G_IO_ERR))
 		goto stop_tx;
 
-	if (obex->tx_data == 0) {
+	if (obex->tx_data == 0 && obex->tx_body.iov_len == 0) {
 		struct pending_pkt *p = g_queue_pop_head(obex->tx_queue);
 		ssize_t len;
 
@@ -458,7 +530,13 @@ static gboolean write_data(GIOChannel *io, GIOCondition cond,
 		}
 
 encode:
-		len = g_obex_packet_encode(p->pkt, obex->tx_buf, obex->tx_mtu);
+		len = g_obex_packet_encode_iov(p->pkt, obex->tx_buf,
+						obex->tx_mtu, &obex->tx_body,
+						&obex->tx_body_release,
+						&obex->tx_body_ref);
+		if (obex->tx_body.iov_len == 0)
+			release_tx_body(obex);
+
 		if (len == -EAGAIN) {
 			g_queue_push_head(obex->tx_queue, p);
 			g_obex_suspend(obex);
@@ -497,12 +575,14 @@ encode:
 		goto stop_tx;
 
 done:
-	if (obex->tx_data > 0 || g_queue_get_length(obex->tx_queue) > 0)
+	if (obex->tx_data > 0 || obex->tx_body.iov_len > 0 ||
+				g_queue_get_length(obex->tx_queue) > 0)
 		return TRUE;
 
 stop_tx:
 	obex->rx_last_op = G_OBEX_OP_NONE;
 	obex->tx_data = 0;
+	release_tx_body(obex);
 	obex->write_source = 0;
 	return FALSE;
 }
@@ -995,7 +1075,8 @@ void g_obex_resume(GObex *obex)
 		g_obex_srm_resume(obex);
 
 done:
-	if (g_queue_get_length(obex->tx_queue) > 0 || obex->tx_data > 0)
+	if (g_queue_get_length(obex->tx_queue) > 0 || obex->tx_data > 0 ||
+						obex->tx_body.iov_len > 0)
 		enable_tx(obex);
 }
 
@@ -1538,6 +1619,8 @@ void g_obex_unref(GObex *obex)
 	if (obex->write_source > 0)
 		g_source_remove(obex->write_source);
 
+	release_tx_body(obex);
+
 	g_free(obex->rx_buf);
 	g_free(obex->tx_buf);
 	g_free(obex->srm);
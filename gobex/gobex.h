@@ -121,6 +121,13 @@ guint g_obex_put_rsp(GObex *obex, GObexPacket *req,
 			gpointer user_data, GError **err,
 			guint first_hdr_id, ...);
 
+guint g_obex_put_rsp_flush(GObex *obex, GObexPacket *req,
+			GObexDataConsumer data_func, GObexFlushFunc flush_func,
+			GObexFunc complete_func, gpointer user_data,
+			GError **err, guint first_hdr_id, ...);
+
+gboolean g_obex_put_rsp_flushed(guint id, int err);
+
 guint g_obex_get_rsp(GObex *obex, GObexDataProducer data_func,
 			GObexFunc complete_func, gpointer user_data,
 			GError **err, guint first_hdr_id, ...);
@@ -129,6 +136,11 @@ guint g_obex_get_rsp_pkt(GObex *obex, GObexPacket *rsp,
 			GObexDataProducer data_func, GObexFunc complete_func,
 			gpointer user_data, GError **err);
 
+guint g_obex_get_rsp_pkt_ref(GObex *obex, GObexPacket *rsp,
+			GObexBodyProvider body_func,
+			GDestroyNotify release_func, GObexFunc complete_func,
+			gpointer user_data, GError **err);
+
 gboolean g_obex_cancel_transfer(guint id, GObexFunc complete_func,
 							gpointer user_data);
 
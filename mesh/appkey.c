@@ -149,6 +149,34 @@ bool appkey_msg_in_replay_cache(struct mesh_net *net, uint16_t idx,
 	return false;
 }
 
+/*
+ * Keys are also kept in a per-network index by their 6-bit AID so that
+ * an incoming access message is only tried against the keys that it
+ * can have been encrypted with. A key shows up under the AID of both
+ * its current and its updated value.
+ */
+static void aid_index_remove(struct mesh_net *net, struct mesh_app_key *key)
+{
+	l_queue_remove(mesh_net_get_app_keys_aid(net, key->key_aid), key);
+
+	if (key->new_key_aid != NET_NID_INVALID)
+		l_queue_remove(mesh_net_get_app_keys_aid(net,
+						key->new_key_aid), key);
+}
+
+static void aid_index_add(struct mesh_net *net, struct mesh_app_key *key)
+{
+	if (key->key_aid)
+		l_queue_push_tail(mesh_net_get_app_keys_aid(net,
+							key->key_aid), key);
+
+	if (key->new_key_aid != NET_NID_INVALID &&
+			(key->new_key_aid & KEY_AID_MASK) !=
+					(key->key_aid & KEY_AID_MASK))
+		l_queue_push_tail(mesh_net_get_app_keys_aid(net,
+						key->new_key_aid), key);
+}
+
 static struct mesh_app_key *app_key_new(void)
 {
 	struct mesh_app_key *key = l_new(struct mesh_app_key, 1);
@@ -167,12 +195,20 @@ static bool set_key(struct mesh_app_key *key, uint16_t app_idx,
 		return false;
 
 	key_aid = KEY_ID_AKF | (key_aid << KEY_AID_SHIFT);
-	if (!is_new)
+	if (!is_new) {
+		if (key->key_aid)
+			mesh_crypto_key_unref(key->key);
+
 		key->key_aid = key_aid;
-	else
+	} else {
+		if (key->new_key_aid != NET_NID_INVALID)
+			mesh_crypto_key_unref(key->new_key);
+
 		key->new_key_aid = key_aid;
+	}
 
 	memcpy(is_new ? key->new_key : key->key, key_value, 16);
+	mesh_crypto_key_ref(key_value);
 
 	return true;
 }
@@ -184,6 +220,12 @@ void appkey_key_free(void *data)
 	if (!key)
 		return;
 
+	if (key->key_aid)
+		mesh_crypto_key_unref(key->key);
+
+	if (key->new_key_aid != NET_NID_INVALID)
+		mesh_crypto_key_unref(key->new_key);
+
 	l_queue_destroy(key->replay_cache, l_free);
 	l_free(key);
 }
@@ -218,6 +260,7 @@ bool appkey_key_init(struct mesh_net *net, uint16_t net_idx, uint16_t app_idx,
 		return false;
 
 	l_queue_push_tail(app_keys, key);
+	aid_index_add(net, key);
 
 	return true;
 }
@@ -339,8 +382,14 @@ int appkey_key_update(struct mesh_net *net, uint16_t net_idx, uint16_t app_idx,
 	if (memcmp(new_key, key->new_key, 16) == 0)
 		return MESH_STATUS_SUCCESS;
 
-	if (!set_key(key, app_idx, new_key, true))
+	aid_index_remove(net, key);
+
+	if (!set_key(key, app_idx, new_key, true)) {
+		aid_index_add(net, key);
 		return MESH_STATUS_INSUFF_RESOURCES;
+	}
+
+	aid_index_add(net, key);
 
 	node = mesh_net_node_get(net);
 
@@ -394,6 +443,7 @@ int appkey_key_add(struct mesh_net *net, uint16_t net_idx, uint16_t app_idx,
 	key->net_idx = net_idx;
 	key->app_idx = app_idx;
 	l_queue_push_tail(app_keys, key);
+	aid_index_add(net, key);
 
 	l_queue_clear(key->replay_cache, l_free);
 
@@ -422,6 +472,7 @@ int appkey_key_delete(struct mesh_net *net, uint16_t net_idx,
 	node_app_key_delete(net, mesh_net_get_address(net), net_idx, app_idx);
 
 	l_queue_remove(app_keys, key);
+	aid_index_remove(net, key);
 	appkey_key_free(key);
 
 	node = mesh_net_node_get(net);
@@ -33,6 +33,99 @@
 /* Multiply used Zero array */
 static const uint8_t zero[16] = { 0, };
 
+/*
+ * Keys that live for as long as the daemon uses them (NetKey derived
+ * encryption and privacy keys, AppKeys, DevKeys) are registered here so
+ * that the kernel cipher contexts are set up once instead of for every
+ * packet. The contexts are created on first use, since each of them
+ * holds on to AF_ALG sockets. Keys that are not registered, such as the
+ * intermediate keys of the k1 to k4 functions, fall back to one-shot
+ * contexts.
+ */
+struct crypto_key {
+	uint8_t key[16];
+	unsigned int ref_cnt;
+	struct l_cipher *ecb;
+	struct l_checksum *cmac;
+	struct l_aead_cipher *ccm[2];
+};
+
+static struct l_queue *crypto_keys;
+
+static bool match_crypto_key(const void *a, const void *b)
+{
+	const struct crypto_key *ctx = a;
+
+	return memcmp(ctx->key, b, sizeof(ctx->key)) == 0;
+}
+
+static struct crypto_key *crypto_key_find(const uint8_t key[16])
+{
+	return l_queue_find(crypto_keys, match_crypto_key, key);
+}
+
+static void crypto_key_free(void *data)
+{
+	struct crypto_key *ctx = data;
+
+	l_cipher_free(ctx->ecb);
+	l_checksum_free(ctx->cmac);
+	l_aead_cipher_free(ctx->ccm[0]);
+	l_aead_cipher_free(ctx->ccm[1]);
+	l_free(ctx);
+}
+
+void mesh_crypto_key_ref(const uint8_t key[16])
+{
+	struct crypto_key *ctx = crypto_key_find(key);
+
+	if (ctx) {
+		ctx->ref_cnt++;
+		return;
+	}
+
+	if (!crypto_keys)
+		crypto_keys = l_queue_new();
+
+	ctx = l_new(struct crypto_key, 1);
+	memcpy(ctx->key, key, sizeof(ctx->key));
+	ctx->ref_cnt = 1;
+	l_queue_push_tail(crypto_keys, ctx);
+}
+
+void mesh_crypto_key_unref(const uint8_t key[16])
+{
+	struct crypto_key *ctx = crypto_key_find(key);
+
+	if (!ctx || --ctx->ref_cnt)
+		return;
+
+	l_queue_remove(crypto_keys, ctx);
+	crypto_key_free(ctx);
+
+	if (l_queue_isempty(crypto_keys)) {
+		l_queue_destroy(crypto_keys, NULL);
+		crypto_keys = NULL;
+	}
+}
+
+static struct l_aead_cipher *crypto_key_ccm(struct crypto_key *ctx,
+							size_t mic_size)
+{
+	int i;
+
+	if (mic_size != 4 && mic_size != 8)
+		return NULL;
+
+	i = (mic_size == 8);
+
+	if (!ctx->ccm[i])
+		ctx->ccm[i] = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM,
+						ctx->key, 16, mic_size);
+
+	return ctx->ccm[i];
+}
+
 static bool aes_ecb_one(const uint8_t key[16], const uint8_t in[16],
 								uint8_t out[16])
 {
@@ -49,6 +142,23 @@ static bool aes_ecb_one(const uint8_t key[16], const uint8_t in[16],
 	return result;
 }
 
+static bool aes_ecb(const uint8_t key[16], const uint8_t in[16],
+								uint8_t out[16])
+{
+	struct crypto_key *ctx = crypto_key_find(key);
+
+	if (!ctx)
+		return aes_ecb_one(key, in, out);
+
+	if (!ctx->ecb) {
+		ctx->ecb = l_cipher_new(L_CIPHER_AES, key, 16);
+		if (!ctx->ecb)
+			return false;
+	}
+
+	return l_cipher_encrypt(ctx->ecb, in, out, 16);
+}
+
 static bool aes_cmac(void *checksum, const uint8_t *msg,
 					size_t msg_len, uint8_t res[16])
 {
@@ -83,10 +193,28 @@ static bool aes_cmac_one(const uint8_t key[16], const void *msg,
 	return result;
 }
 
+static bool aes_cmac_key(const uint8_t key[16], const void *msg,
+					size_t msg_len, uint8_t res[16])
+{
+	struct crypto_key *ctx = crypto_key_find(key);
+
+	if (!ctx)
+		return aes_cmac_one(key, msg, msg_len, res);
+
+	if (!ctx->cmac) {
+		ctx->cmac = l_checksum_new_cmac_aes(key, 16);
+		if (!ctx->cmac)
+			return false;
+	} else
+		l_checksum_reset(ctx->cmac);
+
+	return aes_cmac(ctx->cmac, msg, msg_len, res);
+}
+
 bool mesh_crypto_aes_cmac(const uint8_t key[16], const uint8_t *msg,
 					size_t msg_len, uint8_t res[16])
 {
-	return aes_cmac_one(key, msg, msg_len, res);
+	return aes_cmac_key(key, msg, msg_len, res);
 }
 
 bool mesh_crypto_aes_ccm_encrypt(const uint8_t nonce[13], const uint8_t key[16],
@@ -95,10 +223,20 @@ bool mesh_crypto_aes_ccm_encrypt(const uint8_t nonce[13], const uint8_t key[16],
 					void *out_msg,
 					void *out_mic, size_t mic_size)
 {
-	void *cipher;
+	struct crypto_key *ctx = crypto_key_find(key);
+	struct l_aead_cipher *cipher = NULL;
 	bool result;
 
-	cipher = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM, key, 16, mic_size);
+	if (ctx)
+		cipher = crypto_key_ccm(ctx, mic_size);
+
+	if (!cipher) {
+		ctx = NULL;
+		cipher = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM, key, 16,
+								mic_size);
+		if (!cipher)
+			return false;
+	}
 
 	result = l_aead_cipher_encrypt(cipher, msg, msg_len, aad, aad_len,
 					nonce, 13, out_msg, msg_len + mic_size);
@@ -110,7 +248,8 @@ bool mesh_crypto_aes_ccm_encrypt(const uint8_t nonce[13], const uint8_t key[16],
 			*(uint64_t *)out_mic = l_get_be64(out_msg + msg_len);
 	}
 
-	l_aead_cipher_free(cipher);
+	if (!ctx)
+		l_aead_cipher_free(cipher);
 
 	return result;
 }
@@ -121,11 +260,21 @@ bool mesh_crypto_aes_ccm_decrypt(const uint8_t nonce[13], const uint8_t key[16],
 				void *out_msg,
 				void *out_mic, size_t mic_size)
 {
-	void *cipher;
+	struct crypto_key *ctx = crypto_key_find(key);
+	struct l_aead_cipher *cipher = NULL;
 	bool result;
 	size_t out_msg_len = enc_msg_len - mic_size;
 
-	cipher = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM, key, 16, mic_size);
+	if (ctx)
+		cipher = crypto_key_ccm(ctx, mic_size);
+
+	if (!cipher) {
+		ctx = NULL;
+		cipher = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM, key, 16,
+								mic_size);
+		if (!cipher)
+			return false;
+	}
 
 	result = l_aead_cipher_decrypt(cipher, enc_msg, enc_msg_len,
 							aad, aad_len, nonce, 13,
@@ -140,7 +289,8 @@ bool mesh_crypto_aes_ccm_decrypt(const uint8_t nonce[13], const uint8_t key[16],
 				l_get_be64(enc_msg + enc_msg_len - mic_size);
 	}
 
-	l_aead_cipher_free(cipher);
+	if (!ctx)
+		l_aead_cipher_free(cipher);
 
 	return result;
 }
@@ -319,7 +469,7 @@ bool mesh_crypto_beacon_cmac(const uint8_t encryption_key[16],
 	memcpy(msg + 1, network_id, 8);
 	l_put_be32(iv_index, msg + 9);
 
-	if (!aes_cmac_one(encryption_key, msg, 13, tmp))
+	if (!aes_cmac_key(encryption_key, msg, 13, tmp))
 		return false;
 
 	*cmac = l_get_be64(tmp);
@@ -576,7 +726,7 @@ bool mesh_crypto_network_obfuscate(const uint8_t privacy_key[16],
 	uint8_t ecb[16], tmp[16];
 	int i;
 
-	if (!aes_ecb_one(privacy_key, privacy_counter, ecb))
+	if (!aes_ecb(privacy_key, privacy_counter, ecb))
 		return false;
 
 	tmp[0] = ((!!ctl) << 7) | (ttl & TTL_MASK);
@@ -603,7 +753,7 @@ bool mesh_crypto_network_clarify(const uint8_t privacy_key[16],
 	uint8_t ecb[16], tmp[6];
 	int i;
 
-	if (!aes_ecb_one(privacy_key, privacy_counter, ecb))
+	if (!aes_ecb(privacy_key, privacy_counter, ecb))
 		return false;
 
 	for (i = 0; i < 6; i++)
@@ -60,6 +60,7 @@ struct frnd_negotiation {
 	uint8_t			fn_cnt;
 	uint8_t			wrfrw;
 	uint8_t			receive_delay;
+	uint8_t			cache;
 	int8_t			rssi;
 	bool			clearing;
 };
@@ -211,6 +212,7 @@ void friend_request(struct mesh_net *net, uint16_t src,
 	neg->poll_timeout = timeout;
 	neg->old_relay = prev;
 	neg->num_ele = num_ele;
+	neg->cache = frnd_cache_size;
 
 	/* RSSI (Negative Factor, larger values == less time)
 	 * Scaling factor 0-3 == multiplier of 1.0 - 2.5
@@ -489,7 +491,8 @@ void friend_poll(struct mesh_net *net, uint16_t src, bool seq,
 						neg->receive_delay,
 						neg->wrfrw,
 						neg->poll_timeout,
-						neg->fn_cnt, neg->lp_cnt);
+						neg->fn_cnt, neg->lp_cnt,
+						neg->cache);
 
 		frnd->timeout = l_timeout_create_ms(
 					frnd->poll_timeout * 100,
@@ -527,27 +530,25 @@ void friend_poll(struct mesh_net *net, uint16_t src, bool seq,
 	/* Reset Poll Timeout */
 	l_timeout_modify_ms(frnd->timeout, frnd->poll_timeout * 100);
 
-	if (!l_queue_length(frnd->pkt_cache))
+	if (!frnd->cache_len)
 		goto update;
 
 	if (frnd->seq != frnd->last && frnd->seq != seq) {
-		pkt = l_queue_peek_head(frnd->pkt_cache);
-		if (pkt->cnt_out < pkt->cnt_in) {
+		pkt = mesh_friend_cache_peek(frnd);
+		if (pkt->cnt_out < pkt->cnt_in)
 			pkt->cnt_out++;
-		} else {
-			pkt = l_queue_pop_head(frnd->pkt_cache);
-			l_free(pkt);
-		}
+		else
+			mesh_friend_cache_pop(frnd);
 	}
 
-	pkt = l_queue_peek_head(frnd->pkt_cache);
+	pkt = mesh_friend_cache_peek(frnd);
 
 	if (!pkt)
 		goto update;
 
 	frnd->seq = seq;
 	frnd->last = !seq;
-	md = !!(l_queue_length(frnd->pkt_cache) > 1);
+	md = !!(frnd->cache_len > 1);
 
 	if (pkt->ctl) {
 		/* Make sure we don't change the bit-sense of MD,
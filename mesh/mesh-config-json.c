@@ -28,10 +28,13 @@
 #include <ftw.h>
 #include <libgen.h>
 #include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <sys/stat.h>
 #include <sys/time.h>
 
 #include <ell/ell.h>
@@ -41,21 +44,74 @@
 #include "mesh/util.h"
 #include "mesh/mesh-config.h"
 
-/* To prevent local node JSON cache thrashing, minimum update times */
+/*
+ * Sequence numbers are reserved on disk in blocks covering roughly
+ * MIN_SEQ_CACHE_TIME seconds of traffic at the observed send rate. A new
+ * block is reserved once half of the current one is used, leaving the
+ * other half as time for the reservation to reach the disk.
+ */
 #define MIN_SEQ_CACHE_TRIGGER	32
 #define MIN_SEQ_CACHE_VALUE	(2 * 32)
+#define MAX_SEQ_CACHE_VALUE	(64 * 1024)
 #define MIN_SEQ_CACHE_TIME	(5 * 60)
 
+/*
+ * Individual updates are appended to a journal next to node.json and folded
+ * back into the snapshot once the journal outgrows it (but no sooner than
+ * JOURNAL_MIN_COMPACT bytes), so a single change never rewrites the file.
+ */
+#define JOURNAL_MIN_COMPACT	(16 * 1024)
+
 #define CHECK_KEY_IDX_RANGE(x) ((x) <= 4095)
 
 struct mesh_config {
 	json_object *jnode;
 	char *node_dir_path;
+	char *jnl_path;
+	int jnl_fd;
+	size_t jnl_size;
+	size_t snapshot_size;
+	struct l_idle *jnl_sync;
+	struct sync_req *sync_req;
+	bool sync_again;
+	bool writer_ref;
 	uint8_t uuid[16];
 	uint32_t write_seq;
 	struct timeval write_time;
+	uint32_t seq_reserved;		/* Last sequenceNumber journaled */
+	uint32_t seq_durable;		/* Last sequenceNumber known on disk */
+	uint32_t seq_block;
+	uint32_t seq_gen;		/* Bumped on each new reservation */
+	uint32_t durable_gen;
 };
 
+/*
+ * Journal syncs are handed to a writer thread so that fdatasync() never
+ * stalls the main loop. The thread works on a duplicate of the journal
+ * descriptor and reports completion through a pipe.
+ */
+struct sync_req {
+	struct mesh_config *cfg;	/* NULL once the config is released */
+	int fd;
+	uint32_t seq;
+	uint32_t gen;
+	bool failed;
+};
+
+static struct {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct l_queue *pending;
+	struct l_queue *done;
+	struct l_io *io;
+	int notify[2];
+	int notify_err;		/* Set by the thread, reported by the loop */
+	unsigned int refs;
+	bool running;
+	bool quit;
+} writer;
+
 struct write_info {
 	struct mesh_config *cfg;
 	void *user_data;
@@ -65,6 +121,7 @@ struct write_info {
 static const char *cfgnode_name = "/node.json";
 static const char *bak_ext = ".bak";
 static const char *tmp_ext = ".tmp";
+static const char *jnl_ext = ".jnl";
 
 static bool save_config(json_object *jnode, const char *fname)
 {
@@ -82,6 +139,8 @@ static bool save_config(json_object *jnode, const char *fname)
 
 	if (fwrite(str, sizeof(char), strlen(str), outfile) < strlen(str))
 		l_warn("Incomplete write of mesh configuration");
+	else if (fflush(outfile) || fsync(fileno(outfile)) < 0)
+		l_warn("Failed to sync mesh configuration");
 	else
 		result = true;
 
@@ -90,6 +149,626 @@ static bool save_config(json_object *jnode, const char *fname)
 	return result;
 }
 
+static void sync_dir(const char *fname)
+{
+	char *dir = l_strdup(fname);
+	char *sep = strrchr(dir, '/');
+	int fd;
+
+	if (sep)
+		*sep = '\0';
+
+	fd = open(sep ? dir : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+
+	l_free(dir);
+}
+
+static bool journal_open(struct mesh_config *cfg)
+{
+	if (cfg->jnl_fd >= 0)
+		return true;
+
+	cfg->jnl_fd = open(cfg->jnl_path, O_WRONLY | O_CREAT | O_APPEND |
+							O_CLOEXEC, 0644);
+	if (cfg->jnl_fd < 0) {
+		l_error("Failed to open configuration journal %s: %s",
+						cfg->jnl_path, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+/* Cut a journal down to size and make the new size durable */
+static bool journal_trim(const char *fname, size_t size)
+{
+	int fd;
+	bool result;
+
+	fd = open(fname, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return errno == ENOENT;
+
+	result = ftruncate(fd, size) == 0 && fsync(fd) == 0;
+	close(fd);
+
+	return result;
+}
+
+static void journal_synced(struct mesh_config *cfg, uint32_t seq,
+								uint32_t gen)
+{
+	if (gen < cfg->durable_gen)
+		return;
+
+	cfg->seq_durable = seq;
+	cfg->durable_gen = gen;
+}
+
+static void *writer_thread(void *user_data)
+{
+	struct sync_req *req;
+
+	pthread_mutex_lock(&writer.mutex);
+
+	while (true) {
+		while (!writer.quit && l_queue_isempty(writer.pending))
+			pthread_cond_wait(&writer.cond, &writer.mutex);
+
+		if (writer.quit)
+			break;
+
+		req = l_queue_pop_head(writer.pending);
+		pthread_mutex_unlock(&writer.mutex);
+
+		req->failed = fdatasync(req->fd) < 0;
+		close(req->fd);
+
+		pthread_mutex_lock(&writer.mutex);
+		l_queue_push_tail(writer.done, req);
+
+		/* A full pipe already has a wakeup pending */
+		if (write(writer.notify[1], "", 1) < 0 && errno != EAGAIN)
+			writer.notify_err = errno;
+	}
+
+	pthread_mutex_unlock(&writer.mutex);
+
+	return NULL;
+}
+
+static void journal_sync(struct l_idle *idle, void *user_data);
+
+static bool writer_notify(struct l_io *io, void *user_data)
+{
+	struct l_queue *done;
+	struct sync_req *req;
+	char buf[64];
+	int err;
+
+	if (read(writer.notify[0], buf, sizeof(buf)) < 0)
+		return true;
+
+	pthread_mutex_lock(&writer.mutex);
+	done = writer.done;
+	writer.done = l_queue_new();
+	err = writer.notify_err;
+	writer.notify_err = 0;
+	pthread_mutex_unlock(&writer.mutex);
+
+	if (err)
+		l_warn("Failed to signal journal sync: %s", strerror(err));
+
+	while ((req = l_queue_pop_head(done))) {
+		struct mesh_config *cfg = req->cfg;
+
+		if (cfg) {
+			cfg->sync_req = NULL;
+
+			if (req->failed)
+				l_warn("Failed to sync configuration journal");
+			else
+				journal_synced(cfg, req->seq, req->gen);
+
+			if (cfg->sync_again && !cfg->jnl_sync) {
+				cfg->sync_again = false;
+				cfg->jnl_sync = l_idle_create(journal_sync,
+								cfg, NULL);
+			}
+		}
+
+		l_free(req);
+	}
+
+	l_queue_destroy(done, NULL);
+
+	return true;
+}
+
+static void free_sync_req(void *data)
+{
+	struct sync_req *req = data;
+
+	if (req->cfg)
+		req->cfg->sync_req = NULL;
+
+	l_free(req);
+}
+
+static void writer_stop(void)
+{
+	if (!writer.running)
+		return;
+
+	pthread_mutex_lock(&writer.mutex);
+	writer.quit = true;
+	pthread_cond_signal(&writer.cond);
+	pthread_mutex_unlock(&writer.mutex);
+
+	pthread_join(writer.thread, NULL);
+
+	/* Requests the thread never got to still own their descriptor */
+	while (!l_queue_isempty(writer.pending)) {
+		struct sync_req *req = l_queue_pop_head(writer.pending);
+
+		close(req->fd);
+		free_sync_req(req);
+	}
+
+	l_queue_destroy(writer.pending, NULL);
+	l_queue_destroy(writer.done, free_sync_req);
+	l_io_destroy(writer.io);
+	close(writer.notify[0]);
+	close(writer.notify[1]);
+	pthread_cond_destroy(&writer.cond);
+	pthread_mutex_destroy(&writer.mutex);
+
+	memset(&writer, 0, sizeof(writer));
+}
+
+static bool writer_start(void)
+{
+	if (writer.running)
+		return true;
+
+	if (pipe2(writer.notify, O_CLOEXEC | O_NONBLOCK) < 0)
+		return false;
+
+	writer.io = l_io_new(writer.notify[0]);
+	if (!writer.io)
+		goto fail;
+
+	l_io_set_read_handler(writer.io, writer_notify, NULL, NULL);
+	writer.pending = l_queue_new();
+	writer.done = l_queue_new();
+	pthread_mutex_init(&writer.mutex, NULL);
+	pthread_cond_init(&writer.cond, NULL);
+
+	if (pthread_create(&writer.thread, NULL, writer_thread, NULL)) {
+		pthread_cond_destroy(&writer.cond);
+		pthread_mutex_destroy(&writer.mutex);
+		l_queue_destroy(writer.pending, NULL);
+		l_queue_destroy(writer.done, NULL);
+		l_io_destroy(writer.io);
+		goto fail;
+	}
+
+	writer.running = true;
+
+	return true;
+
+fail:
+	close(writer.notify[0]);
+	close(writer.notify[1]);
+	memset(&writer, 0, sizeof(writer));
+
+	return false;
+}
+
+static bool writer_submit(struct mesh_config *cfg)
+{
+	struct sync_req *req;
+	int fd;
+
+	if (!writer_start())
+		return false;
+
+	fd = dup(cfg->jnl_fd);
+	if (fd < 0)
+		return false;
+
+	req = l_new(struct sync_req, 1);
+	req->cfg = cfg;
+	req->fd = fd;
+	req->seq = cfg->seq_reserved;
+	req->gen = cfg->seq_gen;
+	cfg->sync_req = req;
+
+	if (!cfg->writer_ref) {
+		cfg->writer_ref = true;
+		writer.refs++;
+	}
+
+	pthread_mutex_lock(&writer.mutex);
+	l_queue_push_tail(writer.pending, req);
+	pthread_cond_signal(&writer.cond);
+	pthread_mutex_unlock(&writer.mutex);
+
+	return true;
+}
+
+/* Make everything journaled so far durable before returning */
+static void journal_flush(struct mesh_config *cfg)
+{
+	if (cfg->jnl_fd >= 0 && fdatasync(cfg->jnl_fd) < 0) {
+		l_warn("Failed to sync configuration journal");
+		return;
+	}
+
+	journal_synced(cfg, cfg->seq_reserved, cfg->seq_gen);
+}
+
+static void journal_close(struct mesh_config *cfg)
+{
+	if (cfg->jnl_sync) {
+		l_idle_remove(cfg->jnl_sync);
+		cfg->jnl_sync = NULL;
+	}
+
+	if (cfg->sync_req) {
+		cfg->sync_req->cfg = NULL;
+		cfg->sync_req = NULL;
+	}
+
+	if (cfg->writer_ref) {
+		cfg->writer_ref = false;
+
+		if (!--writer.refs)
+			writer_stop();
+	}
+
+	if (cfg->jnl_fd < 0)
+		return;
+
+	fdatasync(cfg->jnl_fd);
+	close(cfg->jnl_fd);
+	cfg->jnl_fd = -1;
+}
+
+static void journal_reset(struct mesh_config *cfg)
+{
+	if (!cfg->jnl_size)
+		return;
+
+	if (!journal_open(cfg) || ftruncate(cfg->jnl_fd, 0) < 0 ||
+						fsync(cfg->jnl_fd) < 0) {
+		l_error("Failed to reset configuration journal");
+		return;
+	}
+
+	cfg->jnl_size = 0;
+}
+
+/*
+ * Replace node.json with a snapshot of the current configuration. The new
+ * snapshot is synced before it is renamed into place and the journal is only
+ * emptied once the rename is durable, so a crash at any point leaves either
+ * the old snapshot plus the journal or the new snapshot behind. The journal
+ * is only ever replayed on top of node.json. A node that has to fall back to
+ * node.json.bak loses whatever was journaled since.
+ */
+static bool write_snapshot(struct mesh_config *cfg)
+{
+	char *fname_tmp, *fname_bak, *fname_cfg;
+	struct stat st;
+	bool result;
+
+	fname_cfg = cfg->node_dir_path;
+	fname_tmp = l_strdup_printf("%s%s", fname_cfg, tmp_ext);
+	fname_bak = l_strdup_printf("%s%s", fname_cfg, bak_ext);
+	remove(fname_tmp);
+
+	result = save_config(cfg->jnode, fname_tmp);
+
+	if (result) {
+		remove(fname_bak);
+		if (link(fname_cfg, fname_bak) < 0 && errno != ENOENT)
+			l_debug("No backup of %s: %s", fname_cfg,
+							strerror(errno));
+
+		result = rename(fname_tmp, fname_cfg) == 0;
+	}
+
+	if (result) {
+		sync_dir(fname_cfg);
+		journal_reset(cfg);
+		journal_synced(cfg, cfg->seq_reserved, cfg->seq_gen);
+
+		if (!stat(fname_cfg, &st))
+			cfg->snapshot_size = st.st_size;
+	}
+
+	remove(fname_tmp);
+
+	l_free(fname_tmp);
+	l_free(fname_bak);
+
+	return result;
+}
+
+static void journal_sync(struct l_idle *idle, void *user_data)
+{
+	struct mesh_config *cfg = user_data;
+
+	l_idle_remove(idle);
+	cfg->jnl_sync = NULL;
+
+	if (cfg->jnl_fd < 0)
+		return;
+
+	/* One sync in flight per journal, later records ride the next one */
+	if (cfg->sync_req) {
+		cfg->sync_again = true;
+		return;
+	}
+
+	if (!writer_submit(cfg))
+		journal_flush(cfg);
+}
+
+static bool journal_append(struct mesh_config *cfg, json_object *jrec)
+{
+	const char *str;
+	char *line;
+	size_t len;
+	ssize_t written;
+
+	if (!journal_open(cfg))
+		return write_snapshot(cfg);
+
+	str = json_object_to_json_string_ext(jrec, JSON_C_TO_STRING_PLAIN);
+	line = l_strdup_printf("%s\n", str);
+	len = strlen(line);
+
+	written = write(cfg->jnl_fd, line, len);
+	l_free(line);
+
+	if (written < 0 || (size_t) written != len) {
+		l_warn("Incomplete write of configuration journal");
+
+		/* Drop the partial record, the snapshot supersedes it */
+		if (ftruncate(cfg->jnl_fd, cfg->jnl_size) < 0)
+			l_warn("Failed to trim configuration journal");
+
+		return write_snapshot(cfg);
+	}
+
+	cfg->jnl_size += len;
+
+	if (cfg->jnl_size > JOURNAL_MIN_COMPACT &&
+					cfg->jnl_size > cfg->snapshot_size)
+		return write_snapshot(cfg);
+
+	/* Records written in the same main loop iteration share one sync */
+	if (!cfg->jnl_sync)
+		cfg->jnl_sync = l_idle_create(journal_sync, cfg, NULL);
+
+	return true;
+}
+
+/*
+ * Journal the current value of one or more top level properties. Absent
+ * properties are recorded as null and deleted when the journal is replayed.
+ */
+static bool journal_node(struct mesh_config *cfg, const char *keyword, ...)
+{
+	json_object *jrec, *jset, *jvalue;
+	va_list args;
+	bool result;
+
+	jset = json_object_new_object();
+	if (!jset)
+		return false;
+
+	va_start(args, keyword);
+
+	for (; keyword; keyword = va_arg(args, const char *)) {
+		if (json_object_object_get_ex(cfg->jnode, keyword, &jvalue))
+			jvalue = json_object_get(jvalue);
+		else
+			jvalue = NULL;
+
+		json_object_object_add(jset, keyword, jvalue);
+	}
+
+	va_end(args);
+
+	jrec = json_object_new_object();
+	if (!jrec) {
+		json_object_put(jset);
+		return false;
+	}
+
+	json_object_object_add(jrec, "node", jset);
+	result = journal_append(cfg, jrec);
+	json_object_put(jrec);
+
+	return result;
+}
+
+/* Journal the complete state of a single model */
+static bool journal_model(struct mesh_config *cfg, int ele_idx,
+							json_object *jmodel)
+{
+	json_object *jrec, *jvalue;
+	bool result;
+
+	if (!json_object_object_get_ex(jmodel, "modelId", &jvalue))
+		return false;
+
+	jrec = json_object_new_object();
+	if (!jrec)
+		return false;
+
+	json_object_object_add(jrec, "element", json_object_new_int(ele_idx));
+	json_object_object_add(jrec, "model", json_object_get(jvalue));
+	json_object_object_add(jrec, "value", json_object_get(jmodel));
+
+	result = journal_append(cfg, jrec);
+	json_object_put(jrec);
+
+	return result;
+}
+
+static bool journal_apply_model(json_object *jnode, json_object *jrec)
+{
+	json_object *jelements, *jelement, *jmodels, *jvalue, *jmodel;
+	const char *model_id;
+	int i, num_mods;
+
+	if (!json_object_object_get_ex(jrec, "element", &jvalue))
+		return false;
+
+	if (!json_object_object_get_ex(jnode, "elements", &jelements))
+		return false;
+
+	jelement = json_object_array_get_idx(jelements,
+						json_object_get_int(jvalue));
+	if (!jelement)
+		return false;
+
+	if (!json_object_object_get_ex(jelement, "models", &jmodels))
+		return false;
+
+	if (!json_object_object_get_ex(jrec, "model", &jvalue))
+		return false;
+
+	model_id = json_object_get_string(jvalue);
+	if (!model_id)
+		return false;
+
+	if (!json_object_object_get_ex(jrec, "value", &jmodel) ||
+			json_object_get_type(jmodel) != json_type_object)
+		return false;
+
+	num_mods = json_object_array_length(jmodels);
+
+	for (i = 0; i < num_mods; ++i) {
+		json_object *jentry;
+		const char *str;
+
+		jentry = json_object_array_get_idx(jmodels, i);
+		if (!json_object_object_get_ex(jentry, "modelId", &jvalue))
+			continue;
+
+		str = json_object_get_string(jvalue);
+		if (!str || strcmp(str, model_id))
+			continue;
+
+		json_object_array_put_idx(jmodels, i, json_object_get(jmodel));
+		return true;
+	}
+
+	return false;
+}
+
+static void journal_apply_node(json_object *jnode, json_object *jset)
+{
+	json_object_object_foreach(jset, keyword, jvalue) {
+		if (jvalue)
+			json_object_object_add(jnode, keyword,
+						json_object_get(jvalue));
+		else
+			json_object_object_del(jnode, keyword);
+	}
+}
+
+static bool journal_apply(json_object *jnode, json_object *jrec)
+{
+	json_object *jset;
+
+	if (!json_object_object_get_ex(jrec, "node", &jset))
+		return journal_apply_model(jnode, jrec);
+
+	if (json_object_get_type(jset) != json_type_object)
+		return false;
+
+	journal_apply_node(jnode, jset);
+
+	return true;
+}
+
+/*
+ * Apply journal records on top of a freshly parsed snapshot. Replay stops at
+ * the first incomplete or unusable record, which can only be the result of an
+ * interrupted write. Returns the journal size and stores the size of the
+ * part that has been applied in valid.
+ */
+static size_t journal_replay(json_object *jnode, const char *fname,
+								size_t *valid)
+{
+	int fd;
+	char *str, *line, *end;
+	struct stat st;
+	unsigned int count = 0;
+
+	*valid = 0;
+
+	fd = open(fname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	if (fstat(fd, &st) == -1 || !st.st_size) {
+		close(fd);
+		return 0;
+	}
+
+	str = l_malloc(st.st_size + 1);
+
+	if (read(fd, str, st.st_size) != st.st_size) {
+		l_error("Failed to read configuration journal %s", fname);
+		goto done;
+	}
+
+	str[st.st_size] = '\0';
+
+	for (line = str; (end = strchr(line, '\n')); line = end + 1) {
+		json_object *jrec;
+		bool applied;
+
+		*end = '\0';
+
+		jrec = json_tokener_parse(line);
+		if (!jrec)
+			break;
+
+		applied = journal_apply(jnode, jrec);
+		json_object_put(jrec);
+
+		if (!applied)
+			break;
+
+		*valid = end + 1 - str;
+		count++;
+	}
+
+	l_debug("Replayed %u journal records from %s", count, fname);
+
+	if (*valid != (size_t) st.st_size)
+		l_warn("Discarding %zu bytes of configuration journal %s",
+					(size_t) st.st_size - *valid, fname);
+
+done:
+	close(fd);
+	l_free(str);
+
+	return st.st_size;
+}
+
 static bool get_int(json_object *jobj, const char *keyword, int *value)
 {
 	json_object *jvalue;
@@ -613,7 +1292,7 @@ bool mesh_config_net_key_add(struct mesh_config *cfg, uint16_t idx,
 
 	json_object_array_add(jarray, jentry);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return journal_node(cfg, "netKeys", NULL);
 
 fail:
 	if (jentry)
@@ -655,7 +1334,7 @@ bool mesh_config_net_key_update(struct mesh_config *cfg, uint16_t idx,
 	json_object_object_add(jentry, "keyRefresh",
 				json_object_new_int(KEY_REFRESH_PHASE_ONE));
 
-	return save_config(jnode, cfg->node_dir_path);
+	return journal_node(cfg, "netKeys", NULL);
 }
 
 bool mesh_config_net_key_del(struct mesh_config *cfg, uint16_t idx)
@@ -679,7 +1358,7 @@ bool mesh_config_net_key_del(struct mesh_config *cfg, uint16_t idx)
 		json_object_object_del(jnode, "netKeys");
 		/* TODO: Do we raise an error here? */
 		l_warn("Removing the last network key! Zero keys left.");
-		return save_config(jnode, cfg->node_dir_path);
+		return journal_node(cfg, "netKeys", NULL);
 	}
 
 	/*
@@ -694,7 +1373,7 @@ bool mesh_config_net_key_del(struct mesh_config *cfg, uint16_t idx)
 	json_object_object_del(jnode, "netKeys");
 	json_object_object_add(jnode, "netKeys", jarray_new);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return journal_node(cfg, "netKeys", NULL);
 }
 
 bool mesh_config_write_device_key(struct mesh_config *cfg, uint8_t *key)
@@ -702,7 +1381,7 @@ bool mesh_config_write_device_key(struct mesh_config *cfg, uint8_t *key)
 	if (!cfg || !add_key_value(cfg->jnode, "deviceKey", key))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return journal_node(cfg, "deviceKey", NULL);
 }
 
 bool mesh_config_write_token(struct mesh_config *cfg, uint8_t *token)
@@ -710,7 +1389,7 @@ bool mesh_config_write_token(struct mesh_config *cfg, uint8_t *token)
 	if (!cfg || !add_u64_value(cfg->jnode, "token", token))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return journal_node(cfg, "token", NULL);
 }
 
 bool mesh_config_app_key_add(struct mesh_config *cfg, uint16_t net_idx,
@@ -762,7 +1441,7 @@ bool mesh_config_app_key_add(struct mesh_config *cfg, uint16_t net_idx,
 
 	json_object_array_add(jarray, jentry);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return journal_node(cfg, "appKeys", NULL);
 
 fail:
 
@@ -804,7 +1483,7 @@ bool mesh_config_app_key_update(struct mesh_config *cfg, uint16_t app_idx,
 	if (!add_key_value(jentry, "key", key))
 		return false;
 
-	return save_config(jnode, cfg->node_dir_path);
+	return journal_node(cfg, "appKeys", NULL);
 }
 
 bool mesh_config_app_key_del(struct mesh_config *cfg, uint16_t net_idx,
@@ -826,7 +1505,7 @@ bool mesh_config_app_key_del(struct mesh_config *cfg, uint16_t net_idx,
 
 	if (json_object_array_length(jarray) == 1) {
 		json_object_object_del(jnode, "appKeys");
-		return true;
+		return journal_node(cfg, "appKeys", NULL);
 	}
 
 	/*
@@ -841,7 +1520,7 @@ bool mesh_config_app_key_del(struct mesh_config *cfg, uint16_t net_idx,
 	json_object_object_del(jnode, "appKeys");
 	json_object_object_add(jnode, "appKeys", jarray_new);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return journal_node(cfg, "appKeys", NULL);
 }
 
 bool mesh_config_model_binding_add(struct mesh_config *cfg, uint16_t ele_addr,
@@ -886,7 +1565,7 @@ bool mesh_config_model_binding_add(struct mesh_config *cfg, uint16_t ele_addr,
 
 	json_object_array_add(jarray, jstring);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return journal_model(cfg, ele_idx, jmodel);
 }
 
 bool mesh_config_model_binding_del(struct mesh_config *cfg, uint16_t ele_addr,
@@ -920,7 +1599,7 @@ bool mesh_config_model_binding_del(struct mesh_config *cfg, uint16_t ele_addr,
 
 	if (json_object_array_length(jarray) == 1) {
 		json_object_object_del(jmodel, "bind");
-		return true;
+		return journal_model(cfg, ele_idx, jmodel);
 	}
 
 	/*
@@ -935,7 +1614,7 @@ bool mesh_config_model_binding_del(struct mesh_config *cfg, uint16_t ele_addr,
 	json_object_object_del(jmodel, "bind");
 	json_object_object_add(jmodel, "bind", jarray_new);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return journal_model(cfg, ele_idx, jmodel);
 }
 
 static void free_model(void *data)
@@ -1526,7 +2205,7 @@ bool mesh_config_write_mode(struct mesh_config *cfg, const char *keyword,
 	if (!cfg || !write_mode(cfg->jnode, keyword, value))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return journal_node(cfg, keyword, NULL);
 }
 
 static bool write_relay_mode(json_object *jobj, uint8_t mode,
@@ -1562,7 +2241,7 @@ bool mesh_config_write_unicast(struct mesh_config *cfg, uint16_t unicast)
 	if (!cfg || !write_uint16_hex(cfg->jnode, "unicastAddress", unicast))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return journal_node(cfg, "unicastAddress", NULL);
 }
 
 bool mesh_config_write_relay_mode(struct mesh_config *cfg, uint8_t mode,
@@ -1572,7 +2251,7 @@ bool mesh_config_write_relay_mode(struct mesh_config *cfg, uint8_t mode,
 	if (!cfg || !write_relay_mode(cfg->jnode, mode, count, interval))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return journal_node(cfg, "relay", NULL);
 }
 
 bool mesh_config_write_net_transmit(struct mesh_config *cfg, uint8_t cnt,
@@ -1598,7 +2277,7 @@ bool mesh_config_write_net_transmit(struct mesh_config *cfg, uint8_t cnt,
 	json_object_object_del(jnode, "retransmit");
 	json_object_object_add(jnode, "retransmit", jretransmit);
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return journal_node(cfg, "retransmit", NULL);
 
 fail:
 	json_object_put(jretransmit);
@@ -1623,7 +2302,7 @@ bool mesh_config_write_iv_index(struct mesh_config *cfg, uint32_t idx,
 	if (!write_int(jnode, "IVupdate", tmp))
 		return false;
 
-	return save_config(jnode, cfg->node_dir_path);
+	return journal_node(cfg, "IVindex", "IVupdate", NULL);
 }
 
 static void add_model(void *a, void *b)
@@ -1644,6 +2323,50 @@ static void add_model(void *a, void *b)
 	json_object_array_add(jmodels, jmodel);
 }
 
+static bool seq_reserve(struct mesh_config *cfg, uint32_t seq)
+{
+	struct timeval now;
+	struct timeval elapsed;
+	uint64_t elapsed_ms;
+	uint64_t block = cfg->seq_block;
+
+	gettimeofday(&now, NULL);
+
+	/* Estimate the send rate unless the sequence was reset */
+	if (seq >= cfg->write_seq) {
+		timersub(&now, &cfg->write_time, &elapsed);
+		elapsed_ms = elapsed.tv_sec * 1000 + elapsed.tv_usec / 1000;
+
+		if (!elapsed_ms)
+			elapsed_ms = 1;
+
+		block = (uint64_t) (seq - cfg->write_seq) *
+					1000 * MIN_SEQ_CACHE_TIME / elapsed_ms;
+
+		/* Shrink gradually when traffic slows down */
+		if (block < cfg->seq_block / 2)
+			block = cfg->seq_block / 2;
+	}
+
+	if (block < MIN_SEQ_CACHE_VALUE)
+		block = MIN_SEQ_CACHE_VALUE;
+	else if (block > MAX_SEQ_CACHE_VALUE)
+		block = MAX_SEQ_CACHE_VALUE;
+
+	l_debug("Seq Cache: %d -> %d", seq, seq + (uint32_t) block);
+
+	cfg->seq_block = block;
+	cfg->seq_reserved = seq + block;
+	cfg->seq_gen++;
+	cfg->write_seq = seq;
+	cfg->write_time = now;
+
+	if (!write_int(cfg->jnode, "sequenceNumber", cfg->seq_reserved))
+		return false;
+
+	return journal_node(cfg, "sequenceNumber", NULL);
+}
+
 /* Add unprovisioned node (local) */
 static struct mesh_config *create_config(const char *cfg_path,
 					const uint8_t uuid[16],
@@ -1741,7 +2464,12 @@ static struct mesh_config *create_config(const char *cfg_path,
 	cfg->jnode = jnode;
 	memcpy(cfg->uuid, uuid, 16);
 	cfg->node_dir_path = l_strdup(cfg_path);
+	cfg->jnl_path = l_strdup_printf("%s%s", cfg_path, jnl_ext);
+	cfg->jnl_fd = -1;
 	cfg->write_seq = node->seq_number;
+	cfg->seq_reserved = node->seq_number;
+	cfg->seq_durable = node->seq_number;
+	cfg->seq_block = MIN_SEQ_CACHE_VALUE;
 	gettimeofday(&cfg->write_time, NULL);
 
 	return cfg;
@@ -1775,7 +2503,9 @@ struct mesh_config *mesh_config_create(const char *cfgdir_name,
 	if (!cfg)
 		return NULL;
 
-	if (!mesh_config_save(cfg, true, NULL, NULL)) {
+	/* The snapshot below makes the first reservation durable */
+	if (!seq_reserve(cfg, db_node->seq_number) ||
+			!mesh_config_save(cfg, true, NULL, NULL)) {
 		mesh_config_release(cfg);
 		return NULL;
 	}
@@ -1839,7 +2569,7 @@ bool mesh_config_net_key_set_phase(struct mesh_config *cfg, uint16_t idx,
 		finish_key_refresh(jnode, idx);
 	}
 
-	return save_config(jnode, cfg->node_dir_path);
+	return journal_node(cfg, "netKeys", "appKeys", NULL);
 }
 
 bool mesh_config_model_pub_add(struct mesh_config *cfg, uint16_t ele_addr,
@@ -1903,40 +2633,39 @@ bool mesh_config_model_pub_add(struct mesh_config *cfg, uint16_t ele_addr,
 	json_object_object_add(jpub, "retransmit", jretransmit);
 	json_object_object_add(jmodel, "publish", jpub);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return journal_model(cfg, ele_idx, jmodel);
 
 fail:
 	json_object_put(jpub);
 	return false;
 }
 
-static bool delete_model_property(json_object *jnode, uint16_t ele_addr,
+static bool delete_model_property(struct mesh_config *cfg, uint16_t ele_addr,
 			uint32_t mod_id, bool vendor, const char *keyword)
 {
 	json_object *jmodel;
 	int ele_idx;
 
-	ele_idx = get_element_index(jnode, ele_addr);
+	if (!cfg)
+		return false;
+
+	ele_idx = get_element_index(cfg->jnode, ele_addr);
 	if (ele_idx < 0)
 		return false;
 
-	jmodel = get_element_model(jnode, ele_idx, mod_id, vendor);
+	jmodel = get_element_model(cfg->jnode, ele_idx, mod_id, vendor);
 	if (!jmodel)
 		return false;
 
 	json_object_object_del(jmodel, keyword);
 
-	return true;
+	return journal_model(cfg, ele_idx, jmodel);
 }
 
 bool mesh_config_model_pub_del(struct mesh_config *cfg, uint16_t addr,
 						uint32_t mod_id, bool vendor)
 {
-	if (!cfg || !delete_model_property(cfg->jnode, addr, mod_id, vendor,
-								"publish"))
-		return false;
-
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return delete_model_property(cfg, addr, mod_id, vendor, "publish");
 }
 
 bool mesh_config_model_sub_add(struct mesh_config *cfg, uint16_t ele_addr,
@@ -1987,7 +2716,7 @@ bool mesh_config_model_sub_add(struct mesh_config *cfg, uint16_t ele_addr,
 
 	json_object_array_add(jarray, jstring);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return journal_model(cfg, ele_idx, jmodel);
 }
 
 bool mesh_config_model_sub_del(struct mesh_config *cfg, uint16_t ele_addr,
@@ -2027,7 +2756,7 @@ bool mesh_config_model_sub_del(struct mesh_config *cfg, uint16_t ele_addr,
 
 	if (json_object_array_length(jarray) == 1) {
 		json_object_object_del(jmodel, "subscribe");
-		return true;
+		return journal_model(cfg, ele_idx, jmodel);
 	}
 
 	/*
@@ -2042,24 +2771,24 @@ bool mesh_config_model_sub_del(struct mesh_config *cfg, uint16_t ele_addr,
 	json_object_object_del(jmodel, "subscribe");
 	json_object_object_add(jmodel, "subscribe", jarray_new);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return journal_model(cfg, ele_idx, jmodel);
 }
 
 bool mesh_config_model_sub_del_all(struct mesh_config *cfg, uint16_t addr,
 						uint32_t mod_id, bool vendor)
 {
-	if (!cfg || !delete_model_property(cfg->jnode, addr, mod_id, vendor,
-								"subscribe"))
-		return false;
-
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return delete_model_property(cfg, addr, mod_id, vendor, "subscribe");
 }
 
+/*
+ * The sequence number passed in is the next one to be used. Sending only
+ * waits for the disk if it has caught up with the last reservation known
+ * to be durable, which a block sized to the send rate should prevent.
+ */
 bool mesh_config_write_seq_number(struct mesh_config *cfg, uint32_t seq,
 								bool cache)
 {
-	int value;
-	uint32_t cached = 0;
+	uint32_t lead;
 
 	if (!cfg)
 		return false;
@@ -2068,45 +2797,24 @@ bool mesh_config_write_seq_number(struct mesh_config *cfg, uint32_t seq,
 		if (!write_int(cfg->jnode, "sequenceNumber", seq))
 			return false;
 
+		cfg->seq_reserved = seq;
+		cfg->seq_gen++;
+
 		return mesh_config_save(cfg, true, NULL, NULL);
 	}
 
-	/* If resetting seq to Zero, make sure cached value reset as well */
-	if (seq && get_int(cfg->jnode, "sequenceNumber", &value))
-		cached = (uint32_t)value;
-
-	/*
-	 * When sequence number approaches value stored on disk, calculate
-	 * average time between sequence number updates, then overcommit the
-	 * sequence number by MIN_SEQ_CACHE_TIME seconds worth of traffic or
-	 * MIN_SEQ_CACHE_VALUE (whichever is greater) to avoid frequent writes
-	 * to disk and to protect against crashes.
-	 *
-	 * The real value will be saved when daemon shuts down properly.
-	 */
-	if (seq + MIN_SEQ_CACHE_TRIGGER >= cached) {
-		struct timeval now;
-		struct timeval elapsed;
-		uint64_t elapsed_ms;
-
-		gettimeofday(&now, NULL);
-		timersub(&now, &cfg->write_time, &elapsed);
-		elapsed_ms = elapsed.tv_sec * 1000 + elapsed.tv_usec / 1000;
-
-		cached = seq + (seq - cfg->write_seq) *
-					1000 * MIN_SEQ_CACHE_TIME / elapsed_ms;
-
-		if (cached < seq + MIN_SEQ_CACHE_VALUE)
-			cached = seq + MIN_SEQ_CACHE_VALUE;
-
-		l_debug("Seq Cache: %d -> %d", seq, cached);
-
-		cfg->write_seq = seq;
+	lead = cfg->seq_block / 2;
+	if (lead < MIN_SEQ_CACHE_TRIGGER)
+		lead = MIN_SEQ_CACHE_TRIGGER;
 
-		if (!write_int(cfg->jnode, "sequenceNumber", cached))
-		    return false;
+	if (seq < cfg->write_seq || seq + lead >= cfg->seq_reserved) {
+		if (!seq_reserve(cfg, seq))
+			return false;
+	}
 
-		return mesh_config_save(cfg, false, NULL, NULL);
+	if (seq > cfg->seq_durable) {
+		l_warn("Sequence number %6.6x ahead of storage", seq);
+		journal_flush(cfg);
 	}
 
 	return true;
@@ -2117,16 +2825,18 @@ bool mesh_config_write_ttl(struct mesh_config *cfg, uint8_t ttl)
 	if (!cfg || !write_int(cfg->jnode, "defaultTTL", ttl))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return journal_node(cfg, "defaultTTL", NULL);
 }
 
-static bool load_node(const char *fname, const uint8_t uuid[16],
-				mesh_config_node_func_t cb, void *user_data)
+static bool load_node(const char *fname, const char *cfg_path,
+			const uint8_t uuid[16], mesh_config_node_func_t cb,
+			void *user_data)
 {
 	int fd;
-	char *str;
-	struct stat st;
+	char *str, *jnl_path;
+	struct stat st, jnl_st;
 	ssize_t sz;
+	size_t jnl_size, jnl_valid;
 	bool result = false;
 	json_object *jnode;
 	struct mesh_config_node node;
@@ -2163,6 +2873,23 @@ static bool load_node(const char *fname, const uint8_t uuid[16],
 	if (!jnode)
 		goto done;
 
+	jnl_path = l_strdup_printf("%s%s", cfg_path, jnl_ext);
+
+	if (!strcmp(fname, cfg_path))
+		jnl_size = journal_replay(jnode, jnl_path, &jnl_valid);
+	else {
+		/*
+		 * The journal may already hold records written on top of
+		 * the newer snapshot, which are not valid for the backup.
+		 */
+		jnl_size = stat(jnl_path, &jnl_st) ? 0 : jnl_st.st_size;
+		jnl_valid = 0;
+
+		if (jnl_size)
+			l_warn("Discarding configuration journal %s",
+								jnl_path);
+	}
+
 	memset(&node, 0, sizeof(node));
 	result = read_node(jnode, &node);
 
@@ -2171,17 +2898,40 @@ static bool load_node(const char *fname, const uint8_t uuid[16],
 
 		cfg->jnode = jnode;
 		memcpy(cfg->uuid, uuid, 16);
-		cfg->node_dir_path = l_strdup(fname);
+		cfg->node_dir_path = l_strdup(cfg_path);
+		cfg->jnl_path = jnl_path;
+		cfg->jnl_fd = -1;
+		cfg->jnl_size = jnl_valid;
+		cfg->snapshot_size = st.st_size;
 		cfg->write_seq = node.seq_number;
+		cfg->seq_reserved = node.seq_number;
+		cfg->seq_durable = node.seq_number;
+		cfg->seq_block = MIN_SEQ_CACHE_VALUE;
 		gettimeofday(&cfg->write_time, NULL);
 
-		result = cb(&node, uuid, cfg, user_data);
+		/* Cut off the remains of an interrupted journal write */
+		if (jnl_valid != jnl_size && !journal_trim(jnl_path, jnl_valid))
+			l_warn("Failed to trim configuration journal");
+
+		/*
+		 * Everything up to the stored value may already have been
+		 * used, so reserve the first block before sending starts.
+		 */
+		if (!seq_reserve(cfg, node.seq_number)) {
+			l_error("Failed to reserve sequence numbers for %s",
+								cfg_path);
+			result = false;
+		} else
+			result = cb(&node, uuid, cfg, user_data);
 
 		if (!result) {
+			journal_close(cfg);
 			l_free(cfg->node_dir_path);
+			l_free(cfg->jnl_path);
 			l_free(cfg);
 		}
-	}
+	} else
+		l_free(jnl_path);
 
 	/* Done with the node: free resources */
 	l_free(node.net_transmit);
@@ -2204,7 +2954,9 @@ void mesh_config_release(struct mesh_config *cfg)
 	if (!cfg)
 		return;
 
+	journal_close(cfg);
 	l_free(cfg->node_dir_path);
+	l_free(cfg->jnl_path);
 	json_object_put(cfg->jnode);
 	l_free(cfg);
 }
@@ -2212,26 +2964,9 @@ void mesh_config_release(struct mesh_config *cfg)
 static void idle_save_config(void *user_data)
 {
 	struct write_info *info = user_data;
-	char *fname_tmp, *fname_bak, *fname_cfg;
-	bool result = false;
-
-	fname_cfg = info->cfg->node_dir_path;
-	fname_tmp = l_strdup_printf("%s%s", fname_cfg, tmp_ext);
-	fname_bak = l_strdup_printf("%s%s", fname_cfg, bak_ext);
-	remove(fname_tmp);
-
-	result = save_config(info->cfg->jnode, fname_tmp);
-
-	if (result) {
-		remove(fname_bak);
-		rename(fname_cfg, fname_bak);
-		rename(fname_tmp, fname_cfg);
-	}
-
-	remove(fname_tmp);
+	bool result;
 
-	l_free(fname_tmp);
-	l_free(fname_bak);
+	result = write_snapshot(info->cfg);
 
 	gettimeofday(&info->cfg->write_time, NULL);
 
@@ -2299,12 +3034,12 @@ bool mesh_config_load_nodes(const char *cfgdir_name, mesh_config_node_func_t cb,
 		dirname = l_strdup_printf("%s/%s", cfgdir_name, entry->d_name);
 		fname = l_strdup_printf("%s%s", dirname, cfgnode_name);
 
-		if (!load_node(fname, uuid, cb, user_data)) {
+		if (!load_node(fname, fname, uuid, cb, user_data)) {
 
 			/* Fall-back to Backup version */
 			bak = l_strdup_printf("%s%s", fname, bak_ext);
 
-			if (load_node(bak, uuid, cb, user_data)) {
+			if (load_node(bak, fname, uuid, cb, user_data)) {
 				remove(fname);
 				rename(bak, fname);
 			}
@@ -22,6 +22,8 @@ struct mesh_io_private;
 typedef bool (*mesh_io_init_t)(struct mesh_io *io, void *opts);
 typedef bool (*mesh_io_destroy_t)(struct mesh_io *io);
 typedef bool (*mesh_io_caps_t)(struct mesh_io *io, struct mesh_io_caps *caps);
+typedef bool (*mesh_io_tx_stats_t)(struct mesh_io *io,
+					struct mesh_io_tx_stats *stats);
 typedef bool (*mesh_io_send_t)(struct mesh_io *io,
 					struct mesh_io_send_info *info,
 					const uint8_t *data, uint16_t len);
@@ -43,6 +45,7 @@ struct mesh_io_api {
 	mesh_io_deregister_t	dereg;
 	mesh_io_filter_set_t	set;
 	mesh_io_tx_cancel_t	cancel;
+	mesh_io_tx_stats_t	tx_stats;
 };
 
 struct mesh_io {
@@ -36,6 +36,24 @@
 #include "mesh/mesh-io-api.h"
 #include "mesh/mesh-io-generic.h"
 
+/* Upper bound of concurrent advertising sets used for transmission */
+#define MAX_ADV_SETS	4
+
+enum adv_set_state {
+	ADV_SET_IDLE,
+	ADV_SET_BUSY,
+	ADV_SET_STOPPING
+};
+
+struct adv_set {
+	struct mesh_io_private *pvt;
+	struct tx_pkt *tx;
+	uint32_t loaded;	/* PDU the set is programmed with */
+	uint8_t handle;
+	enum adv_set_state state;
+	bool pinned;
+};
+
 struct mesh_io_private {
 	uint16_t index;
 	struct bt_hci *hci;
@@ -43,9 +61,17 @@ struct mesh_io_private {
 	struct l_queue *rx_regs;
 	struct l_queue *tx_pkts;
 	uint8_t filters[4];
+	bool ready;
 	bool sending;
 	struct tx_pkt *tx;
 	uint16_t interval;
+	uint8_t num_sets;
+	struct adv_set sets[MAX_ADV_SETS];
+	uint32_t tx_id;
+	uint32_t max_queued;
+	uint32_t tx_sent;
+	uint32_t latency_max;
+	uint64_t latency_total;
 };
 
 struct pvt_rx_reg {
@@ -63,7 +89,10 @@ struct process_data {
 
 struct tx_pkt {
 	struct mesh_io_send_info	info;
+	uint32_t			id;
+	uint32_t			instant;
 	bool				delete;
+	bool				sent;
 	uint8_t				len;
 	uint8_t				pkt[30];
 };
@@ -119,24 +148,11 @@ static void process_rx(struct mesh_io_private *pvt, int8_t rssi,
 	l_queue_foreach(pvt->rx_regs, process_rx_callbacks, &rx);
 }
 
-static void event_adv_report(struct mesh_io *io, const void *buf, uint8_t size)
+static void process_adv_data(struct mesh_io *io, int8_t rssi,
+					const uint8_t *adv, uint8_t adv_len)
 {
-	const struct bt_hci_evt_le_adv_report *evt = buf;
-	const uint8_t *adv;
-	uint32_t instant;
-	uint8_t adv_len;
+	uint32_t instant = get_instant();
 	uint16_t len = 0;
-	int8_t rssi;
-
-	if (evt->event_type != 0x03)
-		return;
-
-	instant = get_instant();
-	adv = evt->data;
-	adv_len = evt->data_len;
-
-	/* rssi is just beyond last byte of data */
-	rssi = (int8_t) adv[adv_len];
 
 	while (len < adv_len - 1) {
 		uint8_t field_len = adv[0];
@@ -158,6 +174,48 @@ static void event_adv_report(struct mesh_io *io, const void *buf, uint8_t size)
 	}
 }
 
+static void event_adv_report(struct mesh_io *io, const void *buf, uint8_t size)
+{
+	const struct bt_hci_evt_le_adv_report *evt = buf;
+
+	if (evt->event_type != 0x03)
+		return;
+
+	/* rssi is just beyond last byte of data */
+	process_adv_data(io, (int8_t) evt->data[evt->data_len], evt->data,
+								evt->data_len);
+}
+
+static void event_ext_adv_report(struct mesh_io *io, const void *buf,
+								uint8_t size)
+{
+	const struct bt_hci_evt_le_ext_adv_report *evt = buf;
+	const struct bt_hci_le_ext_adv_report *report;
+	uint8_t i;
+
+	buf += sizeof(*evt);
+	size -= sizeof(*evt);
+
+	for (i = 0; i < evt->num_reports; i++) {
+		report = buf;
+
+		if (size < sizeof(*report) ||
+				size < sizeof(*report) + report->data_len)
+			return;
+
+		/* Only legacy ADV_NONCONN_IND PDUs carry mesh traffic */
+		if (L_LE16_TO_CPU(report->event_type) == 0x0010)
+			process_adv_data(io, report->rssi, report->data,
+							report->data_len);
+
+		buf += sizeof(*report) + report->data_len;
+		size -= sizeof(*report) + report->data_len;
+	}
+}
+
+static void event_adv_set_term(struct mesh_io_private *pvt, const void *buf,
+								uint8_t size);
+
 static void event_callback(const void *buf, uint8_t size, void *user_data)
 {
 	uint8_t event = l_get_u8(buf);
@@ -168,27 +226,31 @@ static void event_callback(const void *buf, uint8_t size, void *user_data)
 		event_adv_report(io, buf + 1, size - 1);
 		break;
 
+	case BT_HCI_EVT_LE_EXT_ADV_REPORT:
+		event_ext_adv_report(io, buf + 1, size - 1);
+		break;
+
+	case BT_HCI_EVT_LE_ADV_SET_TERM:
+		event_adv_set_term(io->pvt, buf + 1, size - 1);
+		break;
+
 	default:
 		l_info("Other Meta Evt - %d", event);
 	}
 }
 
-static void local_commands_callback(const void *data, uint8_t size,
-							void *user_data)
-{
-	const struct bt_hci_rsp_read_local_commands *rsp = data;
+static void tx_worker(void *user_data);
+static void start_scan(struct mesh_io_private *pvt);
 
-	if (rsp->status)
-		l_error("Failed to read local commands");
-}
-
-static void local_features_callback(const void *data, uint8_t size,
-							void *user_data)
+static void io_ready(struct mesh_io_private *pvt)
 {
-	const struct bt_hci_rsp_read_local_features *rsp = data;
+	pvt->ready = true;
 
-	if (rsp->status)
-		l_error("Failed to read local features");
+	if (!l_queue_isempty(pvt->rx_regs))
+		start_scan(pvt);
+
+	if (!l_queue_isempty(pvt->tx_pkts))
+		l_idle_oneshot(tx_worker, pvt, NULL);
 }
 
 static void hci_generic_callback(const void *data, uint8_t size,
@@ -200,11 +262,59 @@ static void hci_generic_callback(const void *data, uint8_t size,
 		l_error("Failed to initialize HCI");
 }
 
-static void configure_hci(struct mesh_io_private *io)
+static void read_num_sets_callback(const void *data, uint8_t size,
+							void *user_data)
 {
+	const struct bt_hci_rsp_le_read_num_supported_adv_sets *rsp = data;
+	struct mesh_io_private *pvt = user_data;
+	uint8_t i;
+
+	if (rsp->status || !rsp->num_of_sets) {
+		l_error("Failed to read number of advertising sets");
+		pvt->num_sets = 1;
+	} else if (rsp->num_of_sets > MAX_ADV_SETS)
+		pvt->num_sets = MAX_ADV_SETS;
+	else
+		pvt->num_sets = rsp->num_of_sets;
+
+	for (i = 0; i < pvt->num_sets; i++) {
+		pvt->sets[i].pvt = pvt;
+		pvt->sets[i].handle = i;
+		pvt->sets[i].state = ADV_SET_IDLE;
+	}
+
+	l_debug("Using %u extended advertising sets", pvt->num_sets);
+
+	io_ready(pvt);
+}
+
+static void local_commands_callback(const void *data, uint8_t size,
+							void *user_data)
+{
+	const struct bt_hci_rsp_read_local_commands *rsp = data;
+	struct mesh_io_private *pvt = user_data;
 	struct bt_hci_cmd_le_set_scan_parameters cmd;
-	struct bt_hci_cmd_set_event_mask cmd_sem;
-	struct bt_hci_cmd_le_set_event_mask cmd_slem;
+
+	if (rsp->status)
+		l_error("Failed to read local commands");
+
+	/*
+	 * Extended advertising lets the controller transmit several PDUs
+	 * concurrently and repeat them on its own. Legacy and extended
+	 * commands cannot be mixed, so the choice is made before the
+	 * first advertising or scanning command is sent.
+	 *
+	 *   Octet 36: Set Extended Advertising Parameters, Data, Enable
+	 *             and Read Number of Supported Advertising Sets
+	 *   Octet 37: Set Extended Scan Parameters and Enable
+	 */
+	if (!rsp->status && (rsp->commands[36] & 0xae) == 0xae &&
+				(rsp->commands[37] & 0x60) == 0x60) {
+		bt_hci_send(pvt->hci, BT_HCI_CMD_LE_READ_NUM_SUPPORTED_ADV_SETS,
+					NULL, 0, read_num_sets_callback,
+					pvt, NULL);
+		return;
+	}
 
 	/* Set scan parameters */
 	cmd.type = 0x00; /* Passive Scanning. No scanning PDUs shall be sent */
@@ -216,6 +326,26 @@ static void configure_hci(struct mesh_io_private *io)
 	 */
 	cmd.filter_policy = 0x00;
 
+	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_SCAN_PARAMETERS, &cmd,
+				sizeof(cmd), hci_generic_callback, NULL, NULL);
+
+	io_ready(pvt);
+}
+
+static void local_features_callback(const void *data, uint8_t size,
+							void *user_data)
+{
+	const struct bt_hci_rsp_read_local_features *rsp = data;
+
+	if (rsp->status)
+		l_error("Failed to read local features");
+}
+
+static void configure_hci(struct mesh_io_private *io)
+{
+	struct bt_hci_cmd_set_event_mask cmd_sem;
+	struct bt_hci_cmd_le_set_event_mask cmd_slem;
+
 	/* Set event mask
 	 *
 	 * Mask: 0x2000800002008890
@@ -238,7 +368,7 @@ static void configure_hci(struct mesh_io_private *io)
 
 	/* Set LE event mask
 	 *
-	 * Mask: 0x000000000000087f
+	 * Mask: 0x000000000002187f
 	 *   LE Connection Complete
 	 *   LE Advertising Report
 	 *   LE Connection Update Complete
@@ -247,10 +377,12 @@ static void configure_hci(struct mesh_io_private *io)
 	 *   LE Remote Connection Parameter Request
 	 *   LE Data Length Change
 	 *   LE PHY Update Complete
+	 *   LE Extended Advertising Report
+	 *   LE Advertising Set Terminated
 	 */
 	cmd_slem.mask[0] = 0x7f;
-	cmd_slem.mask[1] = 0x08;
-	cmd_slem.mask[2] = 0x00;
+	cmd_slem.mask[1] = 0x18;
+	cmd_slem.mask[2] = 0x02;
 	cmd_slem.mask[3] = 0x00;
 	cmd_slem.mask[4] = 0x00;
 	cmd_slem.mask[5] = 0x00;
@@ -262,9 +394,9 @@ static void configure_hci(struct mesh_io_private *io)
 	bt_hci_send(io->hci, BT_HCI_CMD_RESET, NULL, 0, hci_generic_callback,
 								NULL, NULL);
 
-	/* Read local supported commands */
+	/* Read local supported commands, continues with scan parameters */
 	bt_hci_send(io->hci, BT_HCI_CMD_READ_LOCAL_COMMANDS, NULL, 0,
-					local_commands_callback, NULL, NULL);
+					local_commands_callback, io, NULL);
 
 	/* Read local supported features */
 	bt_hci_send(io->hci, BT_HCI_CMD_READ_LOCAL_FEATURES, NULL, 0,
@@ -277,10 +409,6 @@ static void configure_hci(struct mesh_io_private *io)
 	/* Set LE event mask */
 	bt_hci_send(io->hci, BT_HCI_CMD_LE_SET_EVENT_MASK, &cmd_slem,
 			sizeof(cmd_slem), hci_generic_callback, NULL, NULL);
-
-	/* Scan Params */
-	bt_hci_send(io->hci, BT_HCI_CMD_LE_SET_SCAN_PARAMETERS, &cmd,
-				sizeof(cmd), hci_generic_callback, NULL, NULL);
 }
 
 static bool hci_init(struct mesh_io *io)
@@ -335,14 +463,23 @@ static bool dev_init(struct mesh_io *io, void *opts)
 static bool dev_destroy(struct mesh_io *io)
 {
 	struct mesh_io_private *pvt = io->pvt;
+	uint8_t i;
 
 	if (!pvt)
 		return true;
 
+	l_debug("TX: %u sent, max queued %u, latency max %u ms",
+				pvt->tx_sent, pvt->max_queued,
+				pvt->latency_max);
+
 	bt_hci_unref(pvt->hci);
 	l_timeout_remove(pvt->tx_timeout);
 	l_queue_destroy(pvt->rx_regs, l_free);
 	l_queue_destroy(pvt->tx_pkts, l_free);
+
+	for (i = 0; i < pvt->num_sets; i++)
+		l_free(pvt->sets[i].tx);
+
 	l_free(pvt);
 	io->pvt = NULL;
 
@@ -362,6 +499,33 @@ static bool dev_caps(struct mesh_io *io, struct mesh_io_caps *caps)
 	return true;
 }
 
+static bool dev_tx_stats(struct mesh_io *io, struct mesh_io_tx_stats *stats)
+{
+	struct mesh_io_private *pvt = io->pvt;
+	uint8_t i;
+
+	if (!pvt || !stats)
+		return false;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->queued = l_queue_length(pvt->tx_pkts);
+	stats->max_queued = pvt->max_queued;
+	stats->sent = pvt->tx_sent;
+	stats->latency_max = pvt->latency_max;
+
+	if (pvt->tx_sent)
+		stats->latency_avg = pvt->latency_total / pvt->tx_sent;
+
+	stats->adv_sets = pvt->num_sets;
+
+	for (i = 0; i < pvt->num_sets; i++) {
+		if (pvt->sets[i].state != ADV_SET_IDLE)
+			stats->adv_sets_busy++;
+	}
+
+	return true;
+}
+
 static void send_cancel_done(const void *buf, uint8_t size,
 							void *user_data)
 {
@@ -468,11 +632,30 @@ static void set_send_adv_params(const void *buf, uint8_t size,
 				set_send_adv_data, pvt, NULL);
 }
 
+static void tx_account(struct mesh_io_private *pvt, struct tx_pkt *tx)
+{
+	uint32_t latency;
+
+	if (tx->sent)
+		return;
+
+	tx->sent = true;
+	latency = get_instant() - tx->instant;
+
+	pvt->tx_sent++;
+	pvt->latency_total += latency;
+
+	if (latency > pvt->latency_max)
+		pvt->latency_max = latency;
+}
+
 static void send_pkt(struct mesh_io_private *pvt, struct tx_pkt *tx,
 							uint16_t interval)
 {
 	struct bt_hci_cmd_le_set_adv_enable cmd;
 
+	tx_account(pvt, tx);
+
 	pvt->tx = tx;
 	pvt->interval = interval;
 
@@ -487,6 +670,263 @@ static void send_pkt(struct mesh_io_private *pvt, struct tx_pkt *tx,
 				set_send_adv_params, pvt, NULL);
 }
 
+static void tx_timeout(struct l_timeout *timeout, void *user_data);
+static void ext_dispatch(struct mesh_io_private *pvt);
+
+static void ext_set_done(struct adv_set *set, bool requeue)
+{
+	struct tx_pkt *tx = set->tx;
+
+	set->tx = NULL;
+	set->state = ADV_SET_IDLE;
+	set->pinned = false;
+
+	if (!tx)
+		return;
+
+	/* Unlimited PDUs take turns with the rest of the queue */
+	if (requeue && tx->info.type == MESH_IO_TIMING_TYPE_GENERAL &&
+			tx->info.u.gen.cnt == MESH_IO_TX_COUNT_UNLIMITED)
+		l_queue_push_tail(set->pvt->tx_pkts, tx);
+	else
+		l_free(tx);
+}
+
+static void ext_set_enable_done(const void *buf, uint8_t size,
+							void *user_data)
+{
+	struct adv_set *set = user_data;
+	uint8_t status = l_get_u8(buf);
+
+	if (!status || set->state != ADV_SET_BUSY)
+		return;
+
+	l_error("Failed to start advertising set %u (0x%2.2x)", set->handle,
+								status);
+	set->loaded = 0;
+	ext_set_done(set, false);
+	ext_dispatch(set->pvt);
+}
+
+static void ext_set_disable_done(const void *buf, uint8_t size,
+							void *user_data)
+{
+	struct adv_set *set = user_data;
+
+	if (set->state != ADV_SET_STOPPING)
+		return;
+
+	set->state = ADV_SET_IDLE;
+	ext_dispatch(set->pvt);
+}
+
+static uint8_t ext_pinned_sets(struct mesh_io_private *pvt)
+{
+	uint8_t i, count = 0;
+
+	for (i = 0; i < pvt->num_sets; i++) {
+		if (pvt->sets[i].pinned)
+			count++;
+	}
+
+	return count;
+}
+
+/*
+ * Program one advertising set with a single PDU. The commands are queued
+ * back to back without waiting for each completion, and the controller
+ * repeats the PDU itself until the requested number of advertising events
+ * has been sent, which it reports with LE Advertising Set Terminated.
+ *
+ * Unlimited PDUs (beacons) stay enabled until cancelled, as long as that
+ * leaves at least one set for everything else. Otherwise they get time
+ * slices, and a set that already carries the PDU is only re-enabled.
+ */
+static void ext_set_start(struct adv_set *set, struct tx_pkt *tx)
+{
+	struct mesh_io_private *pvt = set->pvt;
+	struct bt_hci_cmd_le_set_adv_set_rand_addr cmd_addr;
+	struct bt_hci_cmd_le_set_ext_adv_params cmd_params;
+	struct bt_hci_cmd_le_set_ext_adv_data *cmd_data;
+	struct {
+		struct bt_hci_cmd_le_set_ext_adv_enable hdr;
+		struct bt_hci_cmd_ext_adv_set set;
+	} __attribute__ ((packed)) cmd_enable;
+	uint8_t buf[sizeof(*cmd_data) + 31];
+	uint32_t hci_interval;
+	uint16_t ms;
+	uint8_t count;
+
+	if (tx->info.type == MESH_IO_TIMING_TYPE_GENERAL) {
+		ms = tx->info.u.gen.interval;
+		count = tx->info.u.gen.cnt;
+	} else {
+		ms = 25;
+		count = 1;
+	}
+
+	set->tx = tx;
+	set->state = ADV_SET_BUSY;
+
+	if (count == MESH_IO_TX_COUNT_UNLIMITED &&
+				ext_pinned_sets(pvt) + 1 < pvt->num_sets)
+		set->pinned = true;
+
+	if (set->loaded == tx->id)
+		goto enable;
+
+	set->loaded = tx->id;
+
+	/* Time slices of a loaded PDU are not new transmissions */
+	tx_account(pvt, tx);
+
+	cmd_addr.handle = set->handle;
+	l_getrandom(cmd_addr.bdaddr, 6);
+	cmd_addr.bdaddr[5] |= 0xc0;
+	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_ADV_SET_RAND_ADDR,
+				&cmd_addr, sizeof(cmd_addr), NULL, NULL, NULL);
+
+	hci_interval = (ms * 16) / 10;
+	if (hci_interval < 0x0020)
+		hci_interval = 0x0020;
+
+	memset(&cmd_params, 0, sizeof(cmd_params));
+	cmd_params.handle = set->handle;
+	cmd_params.evt_properties = L_CPU_TO_LE16(0x0010); /* ADV_NONCONN_IND */
+	cmd_params.min_interval[0] = hci_interval;
+	cmd_params.min_interval[1] = hci_interval >> 8;
+	cmd_params.min_interval[2] = hci_interval >> 16;
+	memcpy(cmd_params.max_interval, cmd_params.min_interval, 3);
+	cmd_params.channel_map = 0x07;
+	cmd_params.own_addr_type = 0x01; /* ADDR_TYPE_RANDOM */
+	cmd_params.tx_power = 0x7f; /* No preference */
+	cmd_params.primary_phy = 0x01; /* LE 1M */
+	cmd_params.secondary_phy = 0x01; /* LE 1M */
+	cmd_params.sid = set->handle;
+	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_EXT_ADV_PARAMS,
+			&cmd_params, sizeof(cmd_params), NULL, NULL, NULL);
+
+	cmd_data = (void *) buf;
+	cmd_data->handle = set->handle;
+	cmd_data->operation = 0x03; /* Complete data */
+	cmd_data->fragment_preference = 0x01; /* No fragmentation */
+	cmd_data->data_len = tx->len + 1;
+	cmd_data->data[0] = tx->len;
+	memcpy(cmd_data->data + 1, tx->pkt, tx->len);
+	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_EXT_ADV_DATA, buf,
+			sizeof(*cmd_data) + cmd_data->data_len,
+			NULL, NULL, NULL);
+
+enable:
+	cmd_enable.hdr.enable = 0x01;
+	cmd_enable.hdr.num_of_sets = 1;
+	cmd_enable.set.handle = set->handle;
+
+	if (set->pinned) {
+		cmd_enable.set.duration = 0;
+		cmd_enable.set.max_events = 0;
+	} else if (count == MESH_IO_TX_COUNT_UNLIMITED) {
+		/* Time slice of one interval (10 ms units), then requeue */
+		cmd_enable.set.duration = L_CPU_TO_LE16(ms < 10 ? 1 : ms / 10);
+		cmd_enable.set.max_events = 0;
+	} else {
+		cmd_enable.set.duration = 0;
+		cmd_enable.set.max_events = count;
+	}
+
+	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_EXT_ADV_ENABLE,
+				&cmd_enable, sizeof(cmd_enable),
+				ext_set_enable_done, set, NULL);
+}
+
+static void ext_set_stop(struct adv_set *set)
+{
+	struct {
+		struct bt_hci_cmd_le_set_ext_adv_enable hdr;
+		struct bt_hci_cmd_ext_adv_set set;
+	} __attribute__ ((packed)) cmd;
+
+	l_free(set->tx);
+	set->tx = NULL;
+	set->state = ADV_SET_STOPPING;
+	set->pinned = false;
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.hdr.enable = 0x00;
+	cmd.hdr.num_of_sets = 1;
+	cmd.set.handle = set->handle;
+
+	bt_hci_send(set->pvt->hci, BT_HCI_CMD_LE_SET_EXT_ADV_ENABLE,
+				&cmd, sizeof(cmd),
+				ext_set_disable_done, set, NULL);
+}
+
+static struct adv_set *ext_idle_set(struct mesh_io_private *pvt)
+{
+	uint8_t i;
+
+	for (i = 0; i < pvt->num_sets; i++) {
+		if (pvt->sets[i].state == ADV_SET_IDLE)
+			return &pvt->sets[i];
+	}
+
+	return NULL;
+}
+
+static void ext_dispatch(struct mesh_io_private *pvt)
+{
+	struct adv_set *set;
+	struct tx_pkt *tx;
+	uint32_t delay;
+
+	while ((set = ext_idle_set(pvt))) {
+		tx = l_queue_peek_head(pvt->tx_pkts);
+		if (!tx)
+			break;
+
+		if (tx->info.type == MESH_IO_TIMING_TYPE_POLL_RSP) {
+			/* Hold the queue until Instant + Delay */
+			delay = instant_remaining_ms(
+					tx->info.u.poll_rsp.instant +
+					tx->info.u.poll_rsp.delay);
+
+			if (delay && delay <= 255) {
+				if (pvt->tx_timeout)
+					l_timeout_modify_ms(pvt->tx_timeout,
+									delay);
+				else
+					pvt->tx_timeout = l_timeout_create_ms(
+							delay, tx_timeout,
+							pvt, NULL);
+				return;
+			}
+		}
+
+		l_queue_pop_head(pvt->tx_pkts);
+		ext_set_start(set, tx);
+	}
+
+	l_timeout_remove(pvt->tx_timeout);
+	pvt->tx_timeout = NULL;
+}
+
+static void event_adv_set_term(struct mesh_io_private *pvt, const void *buf,
+								uint8_t size)
+{
+	const struct bt_hci_evt_le_adv_set_term *evt = buf;
+	struct adv_set *set;
+
+	if (!pvt || size < sizeof(*evt) || evt->handle >= pvt->num_sets)
+		return;
+
+	set = &pvt->sets[evt->handle];
+	if (set->state != ADV_SET_BUSY)
+		return;
+
+	ext_set_done(set, true);
+	ext_dispatch(pvt);
+}
+
 static void tx_timeout(struct l_timeout *timeout, void *user_data)
 {
 	struct mesh_io_private *pvt = user_data;
@@ -497,6 +937,11 @@ static void tx_timeout(struct l_timeout *timeout, void *user_data)
 	if (!pvt)
 		return;
 
+	if (pvt->num_sets) {
+		ext_dispatch(pvt);
+		return;
+	}
+
 	tx = l_queue_pop_head(pvt->tx_pkts);
 	if (!tx) {
 		l_timeout_remove(timeout);
@@ -543,6 +988,10 @@ static void tx_worker(void *user_data)
 	struct tx_pkt *tx;
 	uint32_t delay;
 
+	/* Restarted once the advertising mode is known */
+	if (!pvt->ready)
+		return;
+
 	tx = l_queue_peek_head(pvt->tx_pkts);
 	if (!tx)
 		return;
@@ -608,6 +1057,8 @@ static bool send_tx(struct mesh_io *io, struct mesh_io_send_info *info,
 	memcpy(&tx->info, info, sizeof(tx->info));
 	memcpy(&tx->pkt, data, len);
 	tx->len = len;
+	tx->id = ++pvt->tx_id;
+	tx->instant = get_instant();
 
 	if (info->type == MESH_IO_TIMING_TYPE_POLL_RSP)
 		l_queue_push_head(pvt->tx_pkts, tx);
@@ -616,6 +1067,9 @@ static bool send_tx(struct mesh_io *io, struct mesh_io_send_info *info,
 		l_queue_push_tail(pvt->tx_pkts, tx);
 	}
 
+	if (l_queue_length(pvt->tx_pkts) > pvt->max_queued)
+		pvt->max_queued = l_queue_length(pvt->tx_pkts);
+
 	if (!sending) {
 		l_timeout_remove(pvt->tx_timeout);
 		pvt->tx_timeout = NULL;
@@ -647,11 +1101,34 @@ static bool find_by_pattern(const void *a, const void *b)
 static bool tx_cancel(struct mesh_io *io, const uint8_t *data, uint8_t len)
 {
 	struct mesh_io_private *pvt = io->pvt;
+	struct tx_pattern pattern = {
+		.data = data,
+		.len = len
+	};
 	struct tx_pkt *tx;
+	uint8_t i;
 
 	if (!data)
 		return false;
 
+	/* Stop any advertising set still repeating a matching PDU */
+	for (i = 0; i < pvt->num_sets; i++) {
+		struct adv_set *set = &pvt->sets[i];
+		bool match;
+
+		if (set->state != ADV_SET_BUSY)
+			continue;
+
+		if (len == 1)
+			match = find_by_ad_type(set->tx,
+						L_UINT_TO_PTR(data[0]));
+		else
+			match = find_by_pattern(set->tx, &pattern);
+
+		if (match)
+			ext_set_stop(set);
+	}
+
 	if (len == 1) {
 		do {
 			tx = l_queue_remove_if(pvt->tx_pkts, find_by_ad_type,
@@ -663,11 +1140,6 @@ static bool tx_cancel(struct mesh_io *io, const uint8_t *data, uint8_t len)
 
 		} while (tx);
 	} else {
-		struct tx_pattern pattern = {
-			.data = data,
-			.len = len
-		};
-
 		do {
 			tx = l_queue_remove_if(pvt->tx_pkts, find_by_pattern,
 								&pattern);
@@ -680,7 +1152,9 @@ static bool tx_cancel(struct mesh_io *io, const uint8_t *data, uint8_t len)
 	}
 
 	if (l_queue_isempty(pvt->tx_pkts)) {
-		send_cancel(pvt);
+		if (!pvt->num_sets)
+			send_cancel(pvt);
+
 		l_timeout_remove(pvt->tx_timeout);
 		pvt->tx_timeout = NULL;
 	}
@@ -708,10 +1182,74 @@ static void set_recv_scan_enable(const void *buf, uint8_t size,
 			&cmd, sizeof(cmd), NULL, NULL, NULL);
 }
 
+static void set_recv_ext_scan_enable(const void *buf, uint8_t size,
+							void *user_data)
+{
+	struct mesh_io_private *pvt = user_data;
+	struct bt_hci_cmd_le_set_ext_scan_enable cmd;
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.enable = 0x01;	/* Enable scanning */
+	cmd.filter_dup = 0x00;	/* Report duplicates */
+	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_EXT_SCAN_ENABLE,
+			&cmd, sizeof(cmd), NULL, NULL, NULL);
+}
+
+static void start_scan(struct mesh_io_private *pvt)
+{
+	struct bt_hci_cmd_le_set_scan_parameters cmd;
+	struct {
+		struct bt_hci_cmd_le_set_ext_scan_params hdr;
+		struct bt_hci_le_scan_phy phy;
+	} __attribute__ ((packed)) ext_cmd;
+
+	if (pvt->num_sets) {
+		ext_cmd.hdr.own_addr_type = 0x01;	/* ADDR_TYPE_RANDOM */
+		ext_cmd.hdr.filter_policy = 0x00;	/* Accept all */
+		ext_cmd.hdr.num_phys = 0x01;		/* LE 1M */
+		ext_cmd.phy.type = 0x00;		/* Passive scanning */
+		ext_cmd.phy.interval = L_CPU_TO_LE16(0x0010);	/* 10 ms */
+		ext_cmd.phy.window = L_CPU_TO_LE16(0x0010);	/* 10 ms */
+
+		bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_EXT_SCAN_PARAMS,
+				&ext_cmd, sizeof(ext_cmd),
+				set_recv_ext_scan_enable, pvt, NULL);
+		return;
+	}
+
+	cmd.type = 0x00;			/* Passive scanning */
+	cmd.interval = L_CPU_TO_LE16(0x0010);	/* 10 ms */
+	cmd.window = L_CPU_TO_LE16(0x0010);	/* 10 ms */
+	cmd.own_addr_type = 0x01;		/* ADDR_TYPE_RANDOM */
+	cmd.filter_policy = 0x00;		/* Accept all */
+
+	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_SCAN_PARAMETERS,
+			&cmd, sizeof(cmd),
+			set_recv_scan_enable, pvt, NULL);
+}
+
+static void stop_scan(struct mesh_io_private *pvt)
+{
+	struct bt_hci_cmd_le_set_scan_enable cmd;
+	struct bt_hci_cmd_le_set_ext_scan_enable ext_cmd;
+
+	if (pvt->num_sets) {
+		memset(&ext_cmd, 0, sizeof(ext_cmd));
+		ext_cmd.enable = 0x00;	/* Disable scanning */
+		bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_EXT_SCAN_ENABLE,
+				&ext_cmd, sizeof(ext_cmd), NULL, NULL, NULL);
+		return;
+	}
+
+	cmd.enable = 0x00;	/* Disable scanning */
+	cmd.filter_dup = 0x00;	/* Report duplicates */
+	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_SCAN_ENABLE,
+			&cmd, sizeof(cmd), NULL, NULL, NULL);
+}
+
 static bool recv_register(struct mesh_io *io, uint8_t filter_id,
 				mesh_io_recv_func_t cb, void *user_data)
 {
-	struct bt_hci_cmd_le_set_scan_parameters cmd;
 	struct mesh_io_private *pvt = io->pvt;
 	struct pvt_rx_reg *rx_reg;
 	bool already_scanning;
@@ -737,24 +1275,15 @@ static bool recv_register(struct mesh_io *io, uint8_t filter_id,
 
 	l_queue_push_head(pvt->rx_regs, rx_reg);
 
-	if (!already_scanning) {
-		cmd.type = 0x00;			/* Passive scanning */
-		cmd.interval = L_CPU_TO_LE16(0x0010);	/* 10 ms */
-		cmd.window = L_CPU_TO_LE16(0x0010);	/* 10 ms */
-		cmd.own_addr_type = 0x01;		/* ADDR_TYPE_RANDOM */
-		cmd.filter_policy = 0x00;		/* Accept all */
-
-		bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_SCAN_PARAMETERS,
-				&cmd, sizeof(cmd),
-				set_recv_scan_enable, pvt, NULL);
-	}
+	/* Scanning starts once the advertising mode is known */
+	if (!already_scanning && pvt->ready)
+		start_scan(pvt);
 
 	return true;
 }
 
 static bool recv_deregister(struct mesh_io *io, uint8_t filter_id)
 {
-	struct bt_hci_cmd_le_set_scan_enable cmd;
 	struct mesh_io_private *pvt = io->pvt;
 
 	struct pvt_rx_reg *rx_reg;
@@ -765,13 +1294,8 @@ static bool recv_deregister(struct mesh_io *io, uint8_t filter_id)
 	if (rx_reg)
 		l_free(rx_reg);
 
-	if (l_queue_isempty(pvt->rx_regs)) {
-		cmd.enable = 0x00;	/* Disable scanning */
-		cmd.filter_dup = 0x00;	/* Report duplicates */
-		bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_SCAN_ENABLE,
-				&cmd, sizeof(cmd), NULL, NULL, NULL);
-
-	}
+	if (l_queue_isempty(pvt->rx_regs) && pvt->ready)
+		stop_scan(pvt);
 
 	return true;
 }
@@ -797,6 +1321,7 @@ const struct mesh_io_api mesh_io_generic = {
 	.init = dev_init,
 	.destroy = dev_destroy,
 	.caps = dev_caps,
+	.tx_stats = dev_tx_stats,
 	.send = send_tx,
 	.reg = recv_register,
 	.dereg = recv_deregister,
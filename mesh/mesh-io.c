@@ -132,6 +132,16 @@ bool mesh_io_get_caps(struct mesh_io *io, struct mesh_io_caps *caps)
 	return false;
 }
 
+bool mesh_io_get_tx_stats(struct mesh_io *io, struct mesh_io_tx_stats *stats)
+{
+	io = l_queue_find(io_list, match_by_io, io);
+
+	if (io && io->api && io->api->tx_stats)
+		return io->api->tx_stats(io, stats);
+
+	return false;
+}
+
 bool mesh_io_register_recv_cb(struct mesh_io *io, uint8_t filter_id,
 				mesh_io_recv_func_t cb, void *user_data)
 {
@@ -74,6 +74,16 @@ struct mesh_io_caps {
 	uint8_t window_accuracy;
 };
 
+struct mesh_io_tx_stats {
+	uint32_t queued;
+	uint32_t max_queued;
+	uint32_t sent;
+	uint32_t latency_avg;	/* Queue to controller, in ms */
+	uint32_t latency_max;
+	uint8_t adv_sets;	/* Zero when using legacy advertising */
+	uint8_t adv_sets_busy;
+};
+
 typedef void (*mesh_io_recv_func_t)(void *user_data,
 					struct mesh_io_recv_info *info,
 					const uint8_t *data, uint16_t len);
@@ -85,6 +95,7 @@ struct mesh_io *mesh_io_new(enum mesh_io_type type, void *opts);
 void mesh_io_destroy(struct mesh_io *io);
 
 bool mesh_io_get_caps(struct mesh_io *io, struct mesh_io_caps *caps);
+bool mesh_io_get_tx_stats(struct mesh_io *io, struct mesh_io_tx_stats *stats);
 
 bool mesh_io_register_recv_cb(struct mesh_io *io, uint8_t filter_id,
 				mesh_io_recv_func_t cb, void *user_data);
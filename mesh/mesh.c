@@ -202,6 +202,14 @@ static void free_pending_join_call(bool failed)
 void mesh_cleanup(void)
 {
 	struct l_dbus_message *reply;
+	struct mesh_io_tx_stats stats;
+
+	if (mesh_io_get_tx_stats(mesh.io, &stats))
+		l_debug("TX: %u sent, %u queued (max %u), latency %u/%u ms "
+				"(avg/max), %u/%u adv sets busy",
+				stats.sent, stats.queued, stats.max_queued,
+				stats.latency_avg, stats.latency_max,
+				stats.adv_sets_busy, stats.adv_sets);
 
 	mesh_io_destroy(mesh.io);
 
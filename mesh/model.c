@@ -77,7 +77,23 @@ struct mod_forward {
 	bool done;
 };
 
+/*
+ * Subscription index: for each local node, the models that are
+ * subscribed to a group or virtual address, hashed on the 16-bit
+ * address and kept in element order. Messages to such addresses are
+ * only offered to these models instead of to every model of every
+ * element.
+ */
+#define SUB_INDEX_SIZE	64
+
+struct mod_sub {
+	struct mesh_net *net;
+	struct mesh_model *mod;
+	uint16_t addr;
+};
+
 static struct l_queue *mesh_virtuals;
+static struct l_queue *sub_index[SUB_INDEX_SIZE];
 
 static uint32_t virt_id_next = VIRTUAL_BASE;
 static struct timeval tx_start;
@@ -109,6 +125,74 @@ static bool simple_match(const void *a, const void *b)
 	return a == b;
 }
 
+static int compare_sub_element(const void *a, const void *b, void *user_data)
+{
+	const struct mod_sub *sub_a = a;
+	const struct mod_sub *sub_b = b;
+
+	if (sub_a->mod->ele_idx < sub_b->mod->ele_idx)
+		return -1;
+
+	if (sub_a->mod->ele_idx > sub_b->mod->ele_idx)
+		return 1;
+
+	return 0;
+}
+
+static bool match_sub(const void *a, const void *b)
+{
+	const struct mod_sub *sub = a;
+	const struct mod_sub *match = b;
+
+	return sub->mod == match->mod && sub->addr == match->addr;
+}
+
+static void sub_index_add(struct mesh_net *net, struct mesh_model *mod,
+								uint16_t addr)
+{
+	struct l_queue **bucket = &sub_index[addr % SUB_INDEX_SIZE];
+	struct mod_sub *sub;
+
+	if (!*bucket)
+		*bucket = l_queue_new();
+
+	sub = l_new(struct mod_sub, 1);
+	sub->net = net;
+	sub->mod = mod;
+	sub->addr = addr;
+
+	l_queue_insert(*bucket, sub, compare_sub_element, NULL);
+}
+
+static void sub_index_del(struct mesh_model *mod, uint16_t addr)
+{
+	struct l_queue **bucket = &sub_index[addr % SUB_INDEX_SIZE];
+	struct mod_sub match = { .mod = mod, .addr = addr };
+
+	l_free(l_queue_remove_if(*bucket, match_sub, &match));
+
+	if (l_queue_isempty(*bucket)) {
+		l_queue_destroy(*bucket, NULL);
+		*bucket = NULL;
+	}
+}
+
+static void sub_index_del_all(struct mesh_model *mod, struct l_queue *subs)
+{
+	const struct l_queue_entry *entry;
+
+	for (entry = l_queue_get_entries(subs); entry; entry = entry->next)
+		sub_index_del(mod, (uint16_t) L_PTR_TO_UINT(entry->data));
+}
+
+static void sub_index_add_all(struct mesh_net *net, struct mesh_model *mod)
+{
+	const struct l_queue_entry *entry;
+
+	for (entry = l_queue_get_entries(mod->subs); entry; entry = entry->next)
+		sub_index_add(net, mod, (uint16_t) L_PTR_TO_UINT(entry->data));
+}
+
 static bool has_binding(struct l_queue *bindings, uint16_t idx)
 {
 	const struct l_queue_entry *l;
@@ -359,7 +443,7 @@ static int app_packet_decrypt(struct mesh_net *net, const uint8_t *data,
 				uint8_t key_aid, uint32_t seq,
 				uint32_t iv_idx, uint8_t *out)
 {
-	struct l_queue *app_keys = mesh_net_get_app_keys(net);
+	struct l_queue *app_keys = mesh_net_get_app_keys_aid(net, key_aid);
 	const struct l_queue_entry *entry;
 
 	if (!app_keys)
@@ -390,6 +474,7 @@ static int app_packet_decrypt(struct mesh_net *net, const uint8_t *data,
 			}
 
 			print_packet("Failed App Key", old_key, 16);
+			mesh_net_app_decrypt_failed(net);
 		}
 
 		if (new_key && new_key_aid == key_aid) {
@@ -403,6 +488,7 @@ static int app_packet_decrypt(struct mesh_net *net, const uint8_t *data,
 			}
 
 			print_packet("Failed App Key", new_key, 16);
+			mesh_net_app_decrypt_failed(net);
 		}
 	}
 
@@ -779,6 +865,7 @@ static int add_sub(struct mesh_net *net, struct mesh_model *mod,
 		l_queue_push_head(mod->virtuals, virt);
 
 	l_queue_push_tail(mod->subs, L_UINT_TO_PTR(grp));
+	sub_index_add(net, mod, grp);
 
 	l_debug("Added %4.4x", grp);
 
@@ -856,6 +943,69 @@ static void send_msg_rcvd(struct mesh_node *node, uint8_t ele_idx, bool is_sub,
 	l_dbus_send(dbus, msg);
 }
 
+static void forward_external(struct mesh_node *node, uint8_t ele_idx,
+				bool is_sub, int decrypt_idx,
+				struct mod_forward *fwd)
+{
+	struct mesh_net *net = node_get_net(node);
+
+	/*
+	 * Cycle through external models if the message has not been
+	 * handled by internal models
+	 */
+	if (!fwd->has_dst || fwd->done)
+		return;
+
+	if ((decrypt_idx & APP_IDX_MASK) == decrypt_idx)
+		send_msg_rcvd(node, ele_idx, is_sub, fwd->src, fwd->app_idx,
+							fwd->size, fwd->data);
+	else if (decrypt_idx == APP_IDX_DEV_REMOTE ||
+			(decrypt_idx == APP_IDX_DEV_LOCAL &&
+			 mesh_net_is_local_address(net, fwd->src, 1)))
+		send_dev_key_msg_rcvd(node, ele_idx, fwd->src, decrypt_idx,
+						0, fwd->size, fwd->data);
+}
+
+/* Deliver a group or virtual address message using the subscription index */
+static bool forward_subscribers(struct mesh_node *node, uint16_t addr,
+				int decrypt_idx, struct mod_forward *fwd)
+{
+	struct mesh_net *net = node_get_net(node);
+	const struct l_queue_entry *entry;
+	int ele_idx = -1;
+	bool result = false;
+
+	entry = l_queue_get_entries(sub_index[fwd->dst % SUB_INDEX_SIZE]);
+
+	for (; entry; entry = entry->next) {
+		struct mod_sub *sub = entry->data;
+
+		if (sub->net != net || sub->addr != fwd->dst)
+			continue;
+
+		if (sub->mod->ele_idx != ele_idx) {
+			if (ele_idx >= 0) {
+				forward_external(node, ele_idx, true,
+							decrypt_idx, fwd);
+				result |= fwd->has_dst | fwd->done;
+			}
+
+			ele_idx = sub->mod->ele_idx;
+			fwd->unicast = addr + ele_idx;
+			fwd->has_dst = false;
+		}
+
+		forward_model(sub->mod, fwd);
+	}
+
+	if (ele_idx >= 0) {
+		forward_external(node, ele_idx, true, decrypt_idx, fwd);
+		result |= fwd->has_dst | fwd->done;
+	}
+
+	return result;
+}
+
 bool mesh_model_rx(struct mesh_node *node, bool szmict, uint32_t seq0,
 			uint32_t seq, uint32_t iv_index, uint8_t ttl,
 			uint16_t net_idx, uint16_t src, uint16_t dst,
@@ -965,6 +1115,10 @@ bool mesh_model_rx(struct mesh_node *node, bool szmict, uint32_t seq0,
 
 	is_subscription = !(IS_UNICAST(dst));
 
+	if (is_subscription && !IS_FIXED_GROUP_ADDRESS(dst)) {
+		result = forward_subscribers(node, addr, decrypt_idx, &forward);
+		goto done;
+	}
 
 	for (i = 0; i < num_ele; i++) {
 		struct l_queue *models;
@@ -980,21 +1134,8 @@ bool mesh_model_rx(struct mesh_node *node, bool szmict, uint32_t seq0,
 		/* Internal models */
 		l_queue_foreach(models, forward_model, &forward);
 
-		/*
-		 * Cycle through external models if the message has not been
-		 * handled by internal models
-		 */
-		if (forward.has_dst && !forward.done) {
-			if ((decrypt_idx & APP_IDX_MASK) == decrypt_idx)
-				send_msg_rcvd(node, i, is_subscription, src,
-						forward.app_idx, forward.size,
-						forward.data);
-			else if (decrypt_idx == APP_IDX_DEV_REMOTE ||
-				(decrypt_idx == APP_IDX_DEV_LOCAL &&
-				 mesh_net_is_local_address(net, src, 1)))
-				send_dev_key_msg_rcvd(node, i, src, decrypt_idx,
-						0, forward.size, forward.data);
-		}
+		forward_external(node, i, is_subscription, decrypt_idx,
+								&forward);
 
 		/*
 		 * Either the message has been processed internally or
@@ -1166,6 +1307,7 @@ void mesh_model_free(void *data)
 {
 	struct mesh_model *mod = data;
 
+	sub_index_del_all(mod, mod->subs);
 	l_queue_destroy(mod->bindings, NULL);
 	l_queue_destroy(mod->subs, NULL);
 	l_queue_destroy(mod->virtuals, unref_virt);
@@ -1386,6 +1528,7 @@ int mesh_model_sub_ovr(struct mesh_node *node, uint16_t addr, uint32_t id,
 
 	subs = mod->subs;
 	virtuals = mod->virtuals;
+	sub_index_del_all(mod, subs);
 	mod->subs = l_queue_new();
 	mod->virtuals = l_queue_new();
 
@@ -1409,8 +1552,10 @@ int mesh_model_sub_ovr(struct mesh_node *node, uint16_t addr, uint32_t id,
 
 	if (status != MESH_STATUS_SUCCESS) {
 		/* Adding new group failed, so revert to old lists */
+		sub_index_del_all(mod, mod->subs);
 		l_queue_destroy(mod->subs, NULL);
 		mod->subs = subs;
+		sub_index_add_all(node_get_net(node), mod);
 		l_queue_destroy(mod->virtuals, unref_virt);
 		mod->virtuals = virtuals;
 	} else {
@@ -1460,8 +1605,10 @@ int mesh_model_sub_del(struct mesh_node *node, uint16_t addr, uint32_t id,
 
 	*dst = grp;
 
-	if (l_queue_remove(mod->subs, L_UINT_TO_PTR(grp)))
+	if (l_queue_remove(mod->subs, L_UINT_TO_PTR(grp))) {
+		sub_index_del(mod, grp);
 		mesh_net_dst_unreg(node_get_net(node), grp);
+	}
 
 	return MESH_STATUS_SUCCESS;
 }
@@ -1482,7 +1629,9 @@ int mesh_model_sub_del_all(struct mesh_node *node, uint16_t addr, uint32_t id)
 	for (; entry; entry = entry->next)
 		mesh_net_dst_unreg(net, (uint16_t) L_PTR_TO_UINT(entry->data));
 
+	sub_index_del_all(mod, mod->subs);
 	l_queue_destroy(mod->subs, NULL);
+	mod->subs = NULL;
 	l_queue_destroy(mod->virtuals, unref_virt);
 	mod->virtuals = l_queue_new();
 
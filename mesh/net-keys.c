@@ -107,6 +107,10 @@ uint32_t net_key_add(const uint8_t master[16])
 	if (!result)
 		goto fail;
 
+	mesh_crypto_key_ref(key->encrypt);
+	mesh_crypto_key_ref(key->privacy);
+	mesh_crypto_key_ref(key->beacon);
+
 	key->id = ++last_master_id;
 	l_queue_push_tail(keys, key);
 	return key->id;
@@ -143,6 +147,9 @@ uint32_t net_key_frnd_add(uint32_t master_id, uint16_t lpn, uint16_t frnd,
 		return 0;
 	}
 
+	mesh_crypto_key_ref(frnd_key->encrypt);
+	mesh_crypto_key_ref(frnd_key->privacy);
+
 	frnd_key->friend_key = true;
 	frnd_key->ref_cnt++;
 	frnd_key->id = ++last_master_id;
@@ -157,6 +164,12 @@ void net_key_unref(uint32_t id)
 
 	if (key && key->ref_cnt) {
 		if (--key->ref_cnt == 0) {
+			mesh_crypto_key_unref(key->encrypt);
+			mesh_crypto_key_unref(key->privacy);
+
+			if (!key->friend_key)
+				mesh_crypto_key_unref(key->beacon);
+
 			l_queue_remove(keys, key);
 			l_free(key);
 		}
@@ -64,6 +64,13 @@
 
 #define SAR_KEY(src, seq0)	((((uint32_t)(seq0)) << 16) | (src))
 
+/* SAR sessions are hashed by remote address and recycled through a pool */
+#define SAR_HASH_SIZE		32
+#define SAR_POOL_MAX		8
+
+/* Largest reassembled message plus room for ACK-Flags and MIC */
+#define SAR_BUF_SIZE		(MAX_SEG_TO_LEN(SEG_MASK) + 4)
+
 enum _relay_advice {
 	RELAY_NONE,		/* Relay not enabled in node */
 	RELAY_ALLOWED,		/* Relay enabled, msg not to node's unicast */
@@ -116,6 +123,8 @@ struct mesh_net {
 	struct mesh_node *node;
 	struct mesh_prov *prov;
 	struct l_queue *app_keys;
+	struct l_queue *app_keys_aid[KEY_AID_MASK + 1];
+	uint32_t app_decrypt_fail;
 	unsigned int pkt_id;
 	unsigned int bea_id;
 	unsigned int beacon_id;
@@ -147,16 +156,22 @@ struct mesh_net {
 		bool enable;
 		uint16_t interval;
 		uint8_t count;
+		uint32_t period;	/* Second the current tally started */
+		uint32_t tally;
+		uint32_t rate;		/* PDUs relayed in the last second */
+		uint8_t pkt[30];
 	} relay;
 
 	struct mesh_net_heartbeat heartbeat;
 
 	struct l_queue *subnets;
 	struct l_queue *msg_cache;
-	struct l_queue *sar_in;
-	struct l_queue *sar_out;
+	struct l_queue *sar_in[SAR_HASH_SIZE];
+	struct l_queue *sar_out[SAR_HASH_SIZE];
+	struct l_queue *sar_pool;
 	struct l_queue *frnd_msgs;
 	struct l_queue *friends;
+	size_t frnd_cache_bytes;	/* Friend Queue buffer usage */
 	struct l_queue *destinations;
 
 	uint8_t prov_priv_key[32];
@@ -182,6 +197,7 @@ struct mesh_msg {
 };
 
 struct mesh_sar {
+	struct mesh_net *net;
 	unsigned int id;
 	struct l_timeout *seg_timeout;
 	struct l_timeout *msg_timeout;
@@ -202,7 +218,7 @@ struct mesh_sar {
 	uint8_t ttl;
 	uint8_t last_seg;
 	uint8_t key_aid;
-	uint8_t buf[4]; /* Large enough for ACK-Flags and MIC */
+	uint8_t buf[SAR_BUF_SIZE];
 };
 
 struct mesh_destination {
@@ -266,6 +282,9 @@ struct net_beacon_data {
 static struct l_queue *fast_cache;
 static struct l_queue *nets;
 
+/* Upper bound on Friend Queue memory, shared by all friendships of a node */
+#define FRND_CACHE_BUDGET	(64 * 1024)
+
 static void net_rx(void *net_ptr, void *user_data);
 
 static inline struct mesh_subnet *get_primary_subnet(struct mesh_net *net)
@@ -328,15 +347,163 @@ static bool match_by_friend(const void *a, const void *b)
 	return frnd->dst == dst;
 }
 
+static struct mesh_friend_slot *cache_slot(struct mesh_friend *frnd,
+								uint8_t i)
+{
+	return &frnd->pkt_cache[(frnd->cache_head + i) % frnd->cache_max];
+}
+
+static void cache_release(struct mesh_friend *frnd,
+					struct mesh_friend_slot *slot)
+{
+	if (!slot->pkt)
+		return;
+
+	if (frnd->pkt == slot->pkt)
+		frnd->pkt = NULL;
+
+	frnd->net->frnd_cache_bytes -= slot->size;
+	l_free(slot->pkt);
+	slot->pkt = NULL;
+	slot->size = 0;
+}
+
+/*
+ * Remove the i'th queued message. Its buffer stays with the ring and is
+ * reused by a later enqueue, so it must no longer be the pending response.
+ */
+static void cache_remove(struct mesh_friend *frnd, uint8_t i)
+{
+	struct mesh_friend_slot removed;
+
+	if (i >= frnd->cache_len)
+		return;
+
+	if (frnd->pkt == cache_slot(frnd, i)->pkt)
+		frnd->pkt = NULL;
+
+	if (!i) {
+		frnd->cache_head = (frnd->cache_head + 1) % frnd->cache_max;
+		frnd->cache_len--;
+		return;
+	}
+
+	removed = *cache_slot(frnd, i);
+
+	for (; i + 1 < frnd->cache_len; i++)
+		*cache_slot(frnd, i) = *cache_slot(frnd, i + 1);
+
+	*cache_slot(frnd, i) = removed;
+	frnd->cache_len--;
+}
+
+static void trim_idle_slots(void *a, void *b)
+{
+	struct mesh_friend *frnd = a;
+	bool *trimmed = b;
+	uint8_t i;
+
+	for (i = frnd->cache_len; i < frnd->cache_max; i++) {
+		struct mesh_friend_slot *slot = cache_slot(frnd, i);
+
+		if (slot->pkt) {
+			cache_release(frnd, slot);
+			*trimmed = true;
+		}
+	}
+}
+
+/*
+ * Make room for a new buffer of size bytes within the node's budget: first
+ * by freeing buffers none of its friendships is using, then by dropping this
+ * friend's oldest messages.
+ */
+static bool cache_reserve(struct mesh_friend *frnd, size_t size)
+{
+	while (frnd->net->frnd_cache_bytes + size > FRND_CACHE_BUDGET) {
+		bool trimmed = false;
+
+		l_queue_foreach(frnd->net->friends, trim_idle_slots, &trimmed);
+		if (trimmed)
+			continue;
+
+		if (!frnd->cache_len)
+			return false;
+
+		cache_remove(frnd, 0);
+		frnd->last = frnd->seq;
+	}
+
+	return true;
+}
+
+static struct mesh_friend_msg *cache_push(struct mesh_friend *frnd,
+								size_t size)
+{
+	struct mesh_friend_slot *slot;
+
+	/* Queue full, overwrite the oldest message */
+	if (frnd->cache_len == frnd->cache_max) {
+		/*
+		 * TODO: Guard against popping UPDATE packets
+		 * (disallowed per spec)
+		 */
+		cache_remove(frnd, 0);
+		frnd->last = frnd->seq;
+	}
+
+	slot = cache_slot(frnd, frnd->cache_len);
+
+	if (frnd->pkt == slot->pkt)
+		frnd->pkt = NULL;
+
+	if (slot->size < size) {
+		cache_release(frnd, slot);
+
+		if (!cache_reserve(frnd, size))
+			return NULL;
+
+		slot->pkt = l_malloc(size);
+		slot->size = size;
+		frnd->net->frnd_cache_bytes += size;
+	}
+
+	frnd->cache_len++;
+
+	return slot->pkt;
+}
+
+struct mesh_friend_msg *mesh_friend_cache_peek(struct mesh_friend *frnd)
+{
+	if (!frnd->cache_len)
+		return NULL;
+
+	return cache_slot(frnd, 0)->pkt;
+}
+
+void mesh_friend_cache_pop(struct mesh_friend *frnd)
+{
+	cache_remove(frnd, 0);
+}
+
 static void free_friend_internals(struct mesh_friend *frnd)
 {
-	if (frnd->pkt_cache)
-		l_queue_destroy(frnd->pkt_cache, l_free);
+	uint8_t i;
+
+	if (frnd->pkt_cache) {
+		for (i = 0; i < frnd->cache_max; i++)
+			cache_release(frnd, &frnd->pkt_cache[i]);
+
+		l_free(frnd->pkt_cache);
+	}
 
 	if (frnd->grp_list)
 		l_free(frnd->grp_list);
 
 	frnd->pkt_cache = NULL;
+	frnd->cache_head = 0;
+	frnd->cache_len = 0;
+	frnd->pkt = NULL;
 	frnd->grp_list = NULL;
 	net_key_unref(frnd->net_key_cur);
 	net_key_unref(frnd->net_key_upd);
@@ -381,7 +548,8 @@ static void frnd_kr_phase3(void *a, void *b)
 struct mesh_friend *mesh_friend_new(struct mesh_net *net, uint16_t dst,
 					uint8_t ele_cnt, uint8_t frd,
 					uint8_t frw, uint32_t fpt,
-					uint16_t fn_cnt, uint16_t lp_cnt)
+					uint16_t fn_cnt, uint16_t lp_cnt,
+					uint8_t cache_max)
 {
 	struct mesh_subnet *subnet;
 	struct mesh_friend *frnd = l_queue_find(net->friends,
@@ -406,7 +574,11 @@ struct mesh_friend *mesh_friend_new(struct mesh_net *net, uint16_t dst,
 	frnd->lp_cnt = lp_cnt;
 	frnd->poll_timeout = fpt;
 	frnd->ele_cnt = ele_cnt;
-	frnd->pkt_cache = l_queue_new();
+	if (!cache_max || cache_max > FRND_CACHE_MAX)
+		cache_max = FRND_CACHE_MAX;
+
+	frnd->cache_max = cache_max;
+	frnd->pkt_cache = l_new(struct mesh_friend_slot, frnd->cache_max);
 	frnd->net_key_upd = 0;
 
 	subnet = get_primary_subnet(net);
@@ -513,14 +685,16 @@ uint32_t mesh_net_next_seq_num(struct mesh_net *net)
 	return seq;
 }
 
-static struct mesh_sar *mesh_sar_new(size_t len)
+static struct mesh_sar *mesh_sar_new(struct mesh_net *net)
 {
-	size_t size = sizeof(struct mesh_sar) + len;
-	struct mesh_sar *sar;
+	struct mesh_sar *sar = l_queue_pop_head(net->sar_pool);
 
-	sar = l_malloc(size);
+	if (sar)
+		memset(sar, 0, sizeof(*sar));
+	else
+		sar = l_new(struct mesh_sar, 1);
 
-	memset(sar, 0, size);
+	sar->net = net;
 
 	return sar;
 }
@@ -534,9 +708,55 @@ static void mesh_sar_free(void *data)
 
 	l_timeout_remove(sar->seg_timeout);
 	l_timeout_remove(sar->msg_timeout);
+
+	if (l_queue_length(sar->net->sar_pool) < SAR_POOL_MAX) {
+		l_queue_push_head(sar->net->sar_pool, sar);
+		return;
+	}
+
 	l_free(sar);
 }
 
+static unsigned int sar_hash(uint16_t remote)
+{
+	return (remote ^ (remote >> 8)) % SAR_HASH_SIZE;
+}
+
+static void sar_add(struct l_queue **table, struct mesh_sar *sar)
+{
+	unsigned int h = sar_hash(sar->remote);
+
+	if (!table[h])
+		table[h] = l_queue_new();
+
+	l_queue_push_head(table[h], sar);
+}
+
+static bool sar_remove(struct l_queue **table, struct mesh_sar *sar)
+{
+	return l_queue_remove(table[sar_hash(sar->remote)], sar);
+}
+
+static unsigned int sar_count(struct l_queue **table)
+{
+	unsigned int i, count = 0;
+
+	for (i = 0; i < SAR_HASH_SIZE; i++)
+		count += l_queue_length(table[i]);
+
+	return count;
+}
+
+static void sar_table_free(struct l_queue **table)
+{
+	int i;
+
+	for (i = 0; i < SAR_HASH_SIZE; i++) {
+		l_queue_destroy(table[i], mesh_sar_free);
+		table[i] = NULL;
+	}
+}
+
 static void mesh_msg_free(void *data)
 {
 	struct mesh_msg *msg = data;
@@ -684,8 +904,7 @@ struct mesh_net *mesh_net_new(struct mesh_node *node)
 
 	net->subnets = l_queue_new();
 	net->msg_cache = l_queue_new();
-	net->sar_in = l_queue_new();
-	net->sar_out = l_queue_new();
+	net->sar_pool = l_queue_new();
 	net->frnd_msgs = l_queue_new();
 	net->friends = l_queue_new();
 	net->destinations = l_queue_new();
@@ -704,18 +923,24 @@ struct mesh_net *mesh_net_new(struct mesh_node *node)
 
 void mesh_net_free(struct mesh_net *net)
 {
+	int i;
+
 	if (!net)
 		return;
 
 	l_queue_destroy(net->subnets, subnet_free);
 	l_queue_destroy(net->msg_cache, mesh_msg_free);
-	l_queue_destroy(net->sar_in, mesh_sar_free);
-	l_queue_destroy(net->sar_out, mesh_sar_free);
+	sar_table_free(net->sar_in);
+	sar_table_free(net->sar_out);
+	l_queue_destroy(net->sar_pool, l_free);
 	l_queue_destroy(net->frnd_msgs, l_free);
 	l_queue_destroy(net->friends, mesh_friend_free);
 	l_queue_destroy(net->destinations, l_free);
 	l_queue_destroy(net->app_keys, appkey_key_free);
 
+	for (i = 0; i <= KEY_AID_MASK; i++)
+		l_queue_destroy(net->app_keys_aid[i], NULL);
+
 	l_free(net);
 }
 
@@ -1160,19 +1385,18 @@ static bool msg_in_cache(struct mesh_net *net, uint16_t src, uint32_t seq,
 		return true;
 	}
 
-	msg = l_new(struct mesh_msg, 1);
-	*msg = tst;
-	l_queue_push_head(net->msg_cache, msg);
-	l_debug("Add %4.4x + %6.6x + %8.8x", src, seq, mic);
-
-	if (l_queue_length(net->msg_cache) > MSG_CACHE_SIZE) {
+	/* Once full, recycle the Tail (oldest msg in cache) */
+	if (l_queue_length(net->msg_cache) >= MSG_CACHE_SIZE) {
 		msg = l_queue_peek_tail(net->msg_cache);
-		/* Remove Tail (oldest msg in cache) */
+		l_queue_remove(net->msg_cache, msg);
 		l_debug("Remove %4.4x + %6.6x + %8.8x",
 						msg->src, msg->seq, msg->mic);
-		if (l_queue_remove(net->msg_cache, msg))
-			l_free(msg);
-	}
+	} else
+		msg = l_new(struct mesh_msg, 1);
+
+	*msg = tst;
+	l_queue_push_head(net->msg_cache, msg);
+	l_debug("Add %4.4x + %6.6x + %8.8x", src, seq, mic);
 
 	return false;
 }
@@ -1193,20 +1417,37 @@ static bool match_sar_remote(const void *a, const void *b)
 	return sar->remote == remote;
 }
 
-static bool match_msg_timeout(const void *a, const void *b)
+static bool match_sar_key(const void *a, const void *b)
 {
 	const struct mesh_sar *sar = a;
-	const struct l_timeout *msg_timeout = b;
+	uint32_t key = L_PTR_TO_UINT(b);
 
-	return sar->msg_timeout == msg_timeout;
+	return SAR_KEY(sar->remote, sar->seqZero) == key;
 }
 
-static bool match_seg_timeout(const void *a, const void *b)
+static struct mesh_sar *sar_find(struct l_queue **table, uint16_t remote)
 {
-	const struct mesh_sar *sar = a;
-	const struct l_timeout *seg_timeout = b;
+	return l_queue_find(table[sar_hash(remote)], match_sar_remote,
+							L_UINT_TO_PTR(remote));
+}
+
+static struct mesh_sar *sar_find_seq0(struct l_queue **table, uint16_t remote,
+								uint16_t seq0)
+{
+	struct mesh_sar *sar;
+	int i;
+
+	sar = l_queue_find(table[sar_hash(remote)], match_sar_key,
+				L_UINT_TO_PTR(SAR_KEY(remote, seq0)));
+	if (sar)
+		return sar;
+
+	/* ACKs sent on behalf of a Low Power Node come from its Friend */
+	for (i = 0; i < SAR_HASH_SIZE && !sar; i++)
+		sar = l_queue_find(table[i], match_sar_seq0,
+							L_UINT_TO_PTR(seq0));
 
-	return sar->seg_timeout == seg_timeout;
+	return sar;
 }
 
 static bool match_dest_dst(const void *a, const void *b)
@@ -1353,26 +1594,22 @@ enqueue:
 	/* Special handling for Seg Ack -- Only one per message queue */
 	if (((rx->u.one[0].hdr >> OPCODE_HDR_SHIFT) & OPCODE_MASK) ==
 						NET_OP_SEG_ACKNOWLEDGE) {
-		void *old_head = l_queue_peek_head(frnd->pkt_cache);
 		/* Suppress duplicate ACKs */
-		do {
-			void *old = l_queue_remove_if(frnd->pkt_cache,
-							match_ack, rx);
-
-			if (old) {
-				if (old_head == old) {
-					/*
-					 * If we are discarding head for any
-					 * reason, reset FRND SEQ
-					 */
-					frnd->last = frnd->seq;
-				}
+		for (i = 0; i < frnd->cache_len;) {
+			if (!match_ack(cache_slot(frnd, i)->pkt, rx)) {
+				i++;
+				continue;
+			}
 
-				l_free(old);
-			} else
-				break;
+			/*
+			 * If we are discarding head for any
+			 * reason, reset FRND SEQ
+			 */
+			if (!i)
+				frnd->last = frnd->seq;
 
-		} while (true);
+			cache_remove(frnd, i);
+		}
 	}
 
 	l_debug("%s for %4.4x from %4.4x ttl: %2.2x (seq: %6.6x) (ctl: %d)",
@@ -1386,20 +1623,14 @@ enqueue:
 	} else
 		size = sizeof(struct mesh_friend_msg);
 
-	pkt = l_malloc(size);
-	memcpy(pkt, rx, size);
-
-	l_queue_push_tail(frnd->pkt_cache, pkt);
-
-	if (l_queue_length(frnd->pkt_cache) > FRND_CACHE_MAX) {
-		/*
-		 * TODO: Guard against popping UPDATE packets
-		 * (disallowed per spec)
-		 */
-		pkt = l_queue_pop_head(frnd->pkt_cache);
-		l_free(pkt);
-		frnd->last = frnd->seq;
+	pkt = cache_push(frnd, size);
+	if (!pkt) {
+		l_debug("Friend Queue budget exhausted, dropping for %4.4x",
+								frnd->dst);
+		return;
 	}
+
+	memcpy(pkt, rx, size);
 }
 
 static void enqueue_update(void *a, void *b)
@@ -1603,49 +1834,39 @@ static void send_net_ack(struct mesh_net *net, struct mesh_sar *sar,
 
 static void inseg_to(struct l_timeout *seg_timeout, void *user_data)
 {
-	struct mesh_net *net = user_data;
-	struct mesh_sar *sar = l_queue_find(net->sar_in,
-					match_seg_timeout, seg_timeout);
+	struct mesh_sar *sar = user_data;
 
 	l_timeout_remove(seg_timeout);
-	if (!sar)
-		return;
 
 	/* Send NAK */
 	l_info("Timeout %p %3.3x", sar, sar->app_idx);
-	send_net_ack(net, sar, sar->flags);
+	send_net_ack(sar->net, sar, sar->flags);
 
-	sar->seg_timeout = l_timeout_create(SEG_TO, inseg_to, net, NULL);
+	sar->seg_timeout = l_timeout_create(SEG_TO, inseg_to, sar, NULL);
 }
 
 static void inmsg_to(struct l_timeout *msg_timeout, void *user_data)
 {
-	struct mesh_net *net = user_data;
-	struct mesh_sar *sar = l_queue_remove_if(net->sar_in,
-			match_msg_timeout, msg_timeout);
+	struct mesh_sar *sar = user_data;
 
 	l_timeout_remove(msg_timeout);
-	if (!sar)
-		return;
-
 	sar->msg_timeout = NULL;
 
+	sar_remove(sar->net->sar_in, sar);
+
 	/* print_packet("Incoming SAR Timeout", sar->buf, sar->len); */
 	mesh_sar_free(sar);
 }
 
 static void outmsg_to(struct l_timeout *msg_timeout, void *user_data)
 {
-	struct mesh_net *net = user_data;
-	struct mesh_sar *sar = l_queue_remove_if(net->sar_out,
-			match_msg_timeout, msg_timeout);
+	struct mesh_sar *sar = user_data;
 
 	l_timeout_remove(msg_timeout);
-	if (!sar)
-		return;
-
 	sar->msg_timeout = NULL;
 
+	sar_remove(sar->net->sar_out, sar);
+
 	if (sar->status_func)
 		sar->status_func(sar->remote, 1,
 				sar->buf, sar->len - 4,
@@ -1667,8 +1888,7 @@ static void ack_received(struct mesh_net *net, bool timeout,
 
 	l_info("ACK Rxed (%x) (to:%d): %8.8x", seq0, timeout, ack_flag);
 
-	outgoing = l_queue_find(net->sar_out, match_sar_seq0,
-							L_UINT_TO_PTR(seq0));
+	outgoing = sar_find_seq0(net->sar_out, src, seq0);
 
 	if (!outgoing) {
 		l_info("Not Found: %4.4x", seq0);
@@ -1690,7 +1910,7 @@ static void ack_received(struct mesh_net *net, bool timeout,
 					outgoing->buf,
 					outgoing->len - 4, outgoing->user_data);
 
-		l_queue_remove(net->sar_out, outgoing);
+		sar_remove(net->sar_out, outgoing);
 		mesh_sar_free(outgoing);
 
 		return;
@@ -1716,43 +1936,35 @@ static void ack_received(struct mesh_net *net, bool timeout,
 	}
 
 	l_timeout_remove(outgoing->seg_timeout);
-	outgoing->seg_timeout = l_timeout_create(SEG_TO, outseg_to, net, NULL);
+	outgoing->seg_timeout = l_timeout_create(SEG_TO, outseg_to, outgoing,
+									NULL);
 }
 
 static void outack_to(struct l_timeout *seg_timeout, void *user_data)
 {
-	struct mesh_net *net = user_data;
-	struct mesh_sar *sar = l_queue_find(net->sar_out,
-					match_seg_timeout, seg_timeout);
+	struct mesh_sar *sar = user_data;
 
 	l_timeout_remove(seg_timeout);
-	if (!sar)
-		return;
-
 	sar->seg_timeout = NULL;
 
 	/* Re-Send missing segments by faking NAK */
-	ack_received(net, true, sar->remote, sar->src,
+	ack_received(sar->net, true, sar->remote, sar->src,
 				sar->seqZero, sar->last_nak);
 }
 
 static void outseg_to(struct l_timeout *seg_timeout, void *user_data)
 {
-	struct mesh_net *net = user_data;
-	struct mesh_sar *sar = l_queue_find(net->sar_out,
-					match_seg_timeout, seg_timeout);
+	struct mesh_sar *sar = user_data;
+	struct mesh_net *net = sar->net;
 
 	l_timeout_remove(seg_timeout);
-	if (!sar)
-		return;
-
 	sar->seg_timeout = NULL;
 
 	if (net->friend_addr) {
 		/* We are LPN -- Poll for ACK */
 		frnd_ack_poll(net);
 		sar->seg_timeout = l_timeout_create(SEG_TO,
-				outack_to, net, NULL);
+				outack_to, sar, NULL);
 	} else {
 		/* Re-Send missing segments by faking NACK */
 		ack_received(net, true, sar->remote, sar->src,
@@ -1928,8 +2140,7 @@ static bool seg_rxed(struct mesh_net *net, bool frnd, uint32_t iv_index,
 	 * DST could receive additional Segments after
 	 * completing due to a lost ACK, so re-ACK and discard
 	 */
-	sar_in = l_queue_find(net->sar_in, match_sar_remote,
-						L_UINT_TO_PTR(src));
+	sar_in = sar_find(net->sar_in, src);
 
 	/* Discard *old* incoming-SAR-in-progress if this segment newer */
 	seqAuth = seq_auth(seq, seqZero);
@@ -1946,7 +2157,7 @@ static bool seg_rxed(struct mesh_net *net, bool frnd, uint32_t iv_index,
 
 		if (newer) {
 			/* Cancel Old, start New */
-			l_queue_remove(net->sar_in, sar_in);
+			sar_remove(net->sar_in, sar_in);
 			mesh_sar_free(sar_in);
 			sar_in = NULL;
 		} else
@@ -1975,8 +2186,8 @@ static bool seg_rxed(struct mesh_net *net, bool frnd, uint32_t iv_index,
 
 		l_info("RXed (new: %04x %06x size: %d len: %d) %d of %d",
 				seqZero, seq, size, len, segO, segN);
-		l_debug("Queue Size: %d", l_queue_length(net->sar_in));
-		sar_in = mesh_sar_new(len);
+		l_debug("Queue Size: %d", sar_count(net->sar_in));
+		sar_in = mesh_sar_new(net);
 		sar_in->seqAuth = seqAuth;
 		sar_in->iv_index = iv_index;
 		sar_in->src = dst;
@@ -1987,10 +2198,10 @@ static bool seg_rxed(struct mesh_net *net, bool frnd, uint32_t iv_index,
 		sar_in->last_seg = 0xff;
 		if (!net->friend_addr)
 			sar_in->msg_timeout = l_timeout_create(MSG_TO,
-					inmsg_to, net, NULL);
+					inmsg_to, sar_in, NULL);
 
 		l_debug("First Seg %4.4x", sar_in->flags);
-		l_queue_push_head(net->sar_in, sar_in);
+		sar_add(net->sar_in, sar_in);
 	}
 	/* print_packet("Seg", data, size); */
 
@@ -2039,7 +2250,7 @@ static bool seg_rxed(struct mesh_net *net, bool frnd, uint32_t iv_index,
 				send_net_ack(net, sar_in, sar_in->flags);
 
 			sar_in->seg_timeout = l_timeout_create(SEG_TO,
-				inseg_to, net, NULL);
+				inseg_to, sar_in, NULL);
 		} else
 			largest = 0;
 	} else
@@ -2245,9 +2456,26 @@ static bool match_by_dst(const void *a, const void *b)
 	return dest->dst == dst;
 }
 
-static void send_relay_pkt(struct mesh_net *net, uint8_t *data, uint8_t size)
+static void relay_count(struct mesh_net *net)
 {
-	uint8_t packet[30];
+	uint32_t now = get_timestamp_secs();
+
+	if (now != net->relay.period) {
+		net->relay.rate = (now == net->relay.period + 1) ?
+							net->relay.tally : 0;
+		net->relay.period = now;
+		net->relay.tally = 0;
+	}
+
+	net->relay.tally++;
+}
+
+static void send_relay_pkt(struct mesh_net *net, uint32_t key_id,
+				uint32_t iv_index, const uint8_t *data,
+				uint8_t size)
+{
+	uint8_t *packet = net->relay.pkt;
+	uint8_t ttl = data[1] & TTL_MASK;
 	struct mesh_io *io = net->io;
 	struct mesh_io_send_info info = {
 		.type = MESH_IO_TIMING_TYPE_GENERAL,
@@ -2257,10 +2485,23 @@ static void send_relay_pkt(struct mesh_net *net, uint8_t *data, uint8_t size)
 		.u.gen.max_delay = DEFAULT_MAX_DELAY
 	};
 
+	if (size > sizeof(net->relay.pkt) - 1)
+		return;
+
+	/*
+	 * Work on our own copy so the decrypted PDU cached by net-keys stays
+	 * intact. Only the TTL changes; re-encrypting recomputes the NetMIC
+	 * and obfuscation for the new header.
+	 */
 	packet[0] = MESH_AD_TYPE_NETWORK;
 	memcpy(packet + 1, data, size);
+	packet[2] = (packet[2] & ~TTL_MASK) | (ttl - 1);
+
+	if (!net_key_encrypt(key_id, iv_index, packet + 1, size))
+		return;
 
 	mesh_io_send(io, &info, packet, size + 1);
+	relay_count(net);
 }
 
 static void send_msg_pkt(struct mesh_net *net, uint8_t *packet, uint8_t size)
@@ -2491,6 +2732,55 @@ static enum _relay_advice packet_received(void *user_data,
 		return RELAY_NONE;
 }
 
+/*
+ * Relay-only fast path: when a PDU is neither addressed to nor sourced by
+ * this node, and this node has no LPN or Friend role in its delivery, all
+ * that is needed is the network header, the message cache and the relay
+ * decision. Returns false if the PDU needs the full receive path.
+ */
+static bool relay_only(struct mesh_net *net, uint32_t key_id,
+				const uint8_t *pkt, uint8_t size,
+				enum _relay_advice *advice)
+{
+	uint16_t src, dst;
+	uint32_t seq, cookie;
+	bool ctl;
+
+	if (!net->relay.enable || net->friend_addr || size < 14)
+		return false;
+
+	ctl = !!(pkt[1] & CTL);
+	dst = l_get_be16(pkt + 7);
+
+	if (!dst || (ctl && (pkt[9] & OPCODE_MASK) == NET_OP_HEARTBEAT))
+		return false;
+
+	src = l_get_be16(pkt + 5);
+
+	if (is_us(net, dst, false) || is_us(net, src, true))
+		return false;
+
+	if (key_id_to_net_idx(net, key_id) == NET_IDX_INVALID) {
+		*advice = RELAY_NONE;
+		return true;
+	}
+
+	seq = l_get_be32(pkt + 1) & SEQ_MASK;
+	cookie = ctl ? l_get_be32(pkt + 9) : l_get_be32(pkt + size - 8);
+
+	if (msg_in_cache(net, src, seq, cookie) ||
+					(pkt[1] & TTL_MASK) < 0x02)
+		*advice = RELAY_NONE;
+	else if (IS_GROUP(dst) || IS_VIRTUAL(dst))
+		*advice = RELAY_ALWAYS;
+	else if (IS_UNICAST(dst))
+		*advice = RELAY_ALLOWED;
+	else
+		*advice = RELAY_NONE;
+
+	return true;
+}
+
 static void net_rx(void *net_ptr, void *user_data)
 {
 	struct net_queue_data *data = user_data;
@@ -2512,16 +2802,18 @@ static void net_rx(void *net_ptr, void *user_data)
 	if (!key_id)
 		return;
 
-	print_packet("RX: Network [enc] :", data->data, data->len);
-
 	if (data->info) {
 		net->instant = data->info->instant;
 		net->chan = data->info->chan;
 		rssi = data->info->rssi;
 	}
 
-	relay_advice = packet_received(net, key_id, iv_index,
+	if (!relay_only(net, key_id, out, out_size, &relay_advice)) {
+		print_packet("RX: Network [enc] :", data->data, data->len);
+		relay_advice = packet_received(net, key_id, iv_index,
 							out, out_size, rssi);
+	}
+
 	if (relay_advice > data->relay_advice) {
 		data->iv_index = iv_index;
 		data->relay_advice = relay_advice;
@@ -2557,15 +2849,10 @@ static void net_msg_recv(void *user_data, struct mesh_io_recv_info *info,
 	l_queue_foreach(nets, net_rx, &net_data);
 
 	if (net_data.relay_advice == RELAY_ALWAYS ||
-			net_data.relay_advice == RELAY_ALLOWED) {
-		uint8_t ttl = net_data.out[1] & TTL_MASK;
-
-		net_data.out[1] &=  ~TTL_MASK;
-		net_data.out[1] |= ttl - 1;
-		net_key_encrypt(net_data.key_id, net_data.iv_index,
-					net_data.out, net_data.out_size);
-		send_relay_pkt(net_data.net, net_data.out, net_data.out_size);
-	}
+			net_data.relay_advice == RELAY_ALLOWED)
+		send_relay_pkt(net_data.net, net_data.key_id,
+					net_data.iv_index, net_data.out,
+					net_data.out_size);
 }
 
 static void set_network_beacon(void *a, void *b)
@@ -2618,7 +2905,7 @@ static void iv_upd_to(struct l_timeout *upd_timeout, void *user_data)
 
 	switch (net->iv_upd_state) {
 	case IV_UPD_UPDATING:
-		if (l_queue_length(net->sar_out)) {
+		if (sar_count(net->sar_out)) {
 			l_info("don't leave IV Update until sar_out empty");
 			l_timeout_modify(net->iv_update_timeout, 10);
 			break;
@@ -2752,7 +3039,7 @@ static void update_iv_ivu_state(struct mesh_net *net, uint32_t iv_index,
 
 	if ((iv_index - ivu) > (local_iv_index - local_ivu)) {
 		/* Don't accept IV_Index changes when performing SAR Out */
-		if (l_queue_length(net->sar_out))
+		if (sar_count(net->sar_out))
 			return;
 	}
 
@@ -3352,13 +3639,15 @@ bool mesh_net_app_send(struct mesh_net *net, bool frnd_cred, uint16_t src,
 
 	/* If Segmented, Cancel any OB segmented message to same DST */
 	if (seg_max) {
-		payload = l_queue_remove_if(net->sar_out, match_sar_remote,
-							L_UINT_TO_PTR(dst));
-		mesh_sar_free(payload);
+		payload = sar_find(net->sar_out, dst);
+		if (payload) {
+			sar_remove(net->sar_out, payload);
+			mesh_sar_free(payload);
+		}
 	}
 
 	/* Setup OTA Network send */
-	payload = mesh_sar_new(msg_len);
+	payload = mesh_sar_new(net);
 	memcpy(payload->buf, msg, msg_len);
 	payload->len = msg_len;
 	payload->src = src;
@@ -3390,11 +3679,11 @@ bool mesh_net_app_send(struct mesh_net *net, bool frnd_cred, uint16_t src,
 
 	/* Reliable: Cache; Unreliable: Flush*/
 	if (result && seg_max && IS_UNICAST(dst)) {
-		l_queue_push_head(net->sar_out, payload);
+		sar_add(net->sar_out, payload);
 		payload->seg_timeout =
-			l_timeout_create(SEG_TO, outseg_to, net, NULL);
+			l_timeout_create(SEG_TO, outseg_to, payload, NULL);
 		payload->msg_timeout =
-			l_timeout_create(MSG_TO, outmsg_to, net, NULL);
+			l_timeout_create(MSG_TO, outmsg_to, payload, NULL);
 		payload->status_func = status_func;
 		payload->user_data = user_data;
 		payload->id = ++net->sar_id_next;
@@ -3781,6 +4070,54 @@ struct l_queue *mesh_net_get_app_keys(struct mesh_net *net)
 	return net->app_keys;
 }
 
+struct l_queue *mesh_net_get_app_keys_aid(struct mesh_net *net,
+							uint8_t key_aid)
+{
+	struct l_queue **aid_keys;
+
+	if (!net)
+		return NULL;
+
+	aid_keys = &net->app_keys_aid[key_aid & KEY_AID_MASK];
+
+	if (!*aid_keys)
+		*aid_keys = l_queue_new();
+
+	return *aid_keys;
+}
+
+void mesh_net_app_decrypt_failed(struct mesh_net *net)
+{
+	if (net)
+		net->app_decrypt_fail++;
+}
+
+uint32_t mesh_net_get_app_decrypt_failures(struct mesh_net *net)
+{
+	if (!net)
+		return 0;
+
+	return net->app_decrypt_fail;
+}
+
+uint32_t mesh_net_get_relay_rate(struct mesh_net *net)
+{
+	uint32_t now;
+
+	if (!net)
+		return 0;
+
+	now = get_timestamp_secs();
+
+	if (now == net->relay.period)
+		return net->relay.rate;
+
+	if (now == net->relay.period + 1)
+		return net->relay.tally;
+
+	return 0;
+}
+
 bool mesh_net_have_key(struct mesh_net *net, uint16_t idx)
 {
 	if (!net)
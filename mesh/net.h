@@ -162,9 +162,14 @@ struct mesh_key_set {
 	uint8_t privacy_key[16];
 };
 
+struct mesh_friend_slot {
+	struct mesh_friend_msg *pkt;
+	uint16_t size;			/* Bytes allocated for pkt */
+};
+
 struct mesh_friend {
 	struct mesh_net *net;
-	struct l_queue *pkt_cache;
+	struct mesh_friend_slot *pkt_cache;	/* Ring of cache_max slots */
 	struct l_timeout *timeout;
 	void *pkt;
 	uint16_t *grp_list;
@@ -179,6 +184,9 @@ struct mesh_friend {
 	uint8_t ele_cnt;
 	uint8_t frd;
 	uint8_t frw;
+	uint8_t cache_head;
+	uint8_t cache_len;
+	uint8_t cache_max;
 	bool seq;
 	bool last;
 };
@@ -284,6 +292,11 @@ bool mesh_net_get_key(struct mesh_net *net, bool new_key, uint16_t idx,
 bool mesh_net_attach(struct mesh_net *net, struct mesh_io *io);
 struct mesh_io *mesh_net_detach(struct mesh_net *net);
 struct l_queue *mesh_net_get_app_keys(struct mesh_net *net);
+struct l_queue *mesh_net_get_app_keys_aid(struct mesh_net *net,
+							uint8_t key_aid);
+void mesh_net_app_decrypt_failed(struct mesh_net *net);
+uint32_t mesh_net_get_app_decrypt_failures(struct mesh_net *net);
+uint32_t mesh_net_get_relay_rate(struct mesh_net *net);
 
 bool mesh_net_flush(struct mesh_net *net);
 void mesh_net_transport_send(struct mesh_net *net, uint32_t key_id,
@@ -317,8 +330,11 @@ bool mesh_net_dst_unreg(struct mesh_net *net, uint16_t dst);
 struct mesh_friend *mesh_friend_new(struct mesh_net *net, uint16_t dst,
 					uint8_t ele_cnt, uint8_t frd,
 					uint8_t frw, uint32_t fpt,
-					uint16_t fn_cnt, uint16_t lp_cnt);
+					uint16_t fn_cnt, uint16_t lp_cnt,
+					uint8_t cache_max);
 void mesh_friend_free(void *frnd);
+struct mesh_friend_msg *mesh_friend_cache_peek(struct mesh_friend *frnd);
+void mesh_friend_cache_pop(struct mesh_friend *frnd);
 bool mesh_friend_clear(struct mesh_net *net, struct mesh_friend *frnd);
 void mesh_friend_sub_add(struct mesh_net *net, uint16_t lpn, uint8_t ele_cnt,
 							uint8_t grp_cnt,
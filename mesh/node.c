@@ -32,6 +32,7 @@
 #include "mesh/mesh-defs.h"
 #include "mesh/mesh.h"
 #include "mesh/net.h"
+#include "mesh/crypto.h"
 #include "mesh/appkey.h"
 #include "mesh/mesh-config.h"
 #include "mesh/provision.h"
@@ -91,6 +92,7 @@ struct mesh_node {
 	uint32_t disc_watch;
 	uint32_t seq_number;
 	bool provisioner;
+	bool dev_key_ref;
 	uint16_t primary;
 	struct node_composition *comp;
 	struct {
@@ -313,6 +315,10 @@ static void free_node_resources(void *data)
 	free_node_dbus_resources(node);
 
 	mesh_net_free(node->net);
+
+	if (node->dev_key_ref)
+		mesh_crypto_key_unref(node->dev_key);
+
 	l_free(node->comp);
 	l_free(node->storage_dir);
 	l_free(node);
@@ -486,7 +492,7 @@ static bool init_from_storage(struct mesh_config_node *db_node,
 	node->ttl = db_node->ttl;
 	node->seq_number = db_node->seq_number;
 
-	memcpy(node->dev_key, db_node->dev_key, 16);
+	node_set_device_key(node, db_node->dev_key);
 	memcpy(node->token, db_node->token, 8);
 
 	num_ele = l_queue_length(db_node->elements);
@@ -615,7 +621,13 @@ uint16_t node_get_primary(struct mesh_node *node)
 
 void node_set_device_key(struct mesh_node *node, uint8_t key[16])
 {
+	/* Only a stored key holds a reference */
+	if (node->dev_key_ref)
+		mesh_crypto_key_unref(node->dev_key);
+
 	memcpy(node->dev_key, key, 16);
+	mesh_crypto_key_ref(node->dev_key);
+	node->dev_key_ref = true;
 }
 
 const uint8_t *node_get_device_key(struct mesh_node *node)
@@ -1440,7 +1452,7 @@ static bool add_local_node(struct mesh_node *node, uint16_t unicast, bool kr,
 	if (!mesh_config_write_token(node->cfg, node->token))
 		return false;
 
-	memcpy(node->dev_key, dev_key, 16);
+	node_set_device_key(node, dev_key);
 	if (!mesh_config_write_device_key(node->cfg, dev_key))
 		return false;
 
@@ -2313,6 +2325,36 @@ static bool lastheard_getter(struct l_dbus *dbus, struct l_dbus_message *msg,
 
 }
 
+static bool decrypt_failures_getter(struct l_dbus *dbus,
+					struct l_dbus_message *msg,
+					struct l_dbus_message_builder *builder,
+					void *user_data)
+{
+	struct mesh_node *node = user_data;
+	uint32_t failures;
+
+	failures = mesh_net_get_app_decrypt_failures(node_get_net(node));
+
+	l_dbus_message_builder_append_basic(builder, 'u', &failures);
+
+	return true;
+}
+
+static bool relay_rate_getter(struct l_dbus *dbus,
+					struct l_dbus_message *msg,
+					struct l_dbus_message_builder *builder,
+					void *user_data)
+{
+	struct mesh_node *node = user_data;
+	uint32_t rate;
+
+	rate = mesh_net_get_relay_rate(node_get_net(node));
+
+	l_dbus_message_builder_append_basic(builder, 'u', &rate);
+
+	return true;
+}
+
 static bool addresses_getter(struct l_dbus *dbus, struct l_dbus_message *msg,
 					struct l_dbus_message_builder *builder,
 					void *user_data)
@@ -2367,6 +2409,10 @@ static void setup_node_interface(struct l_dbus_interface *iface)
 					lastheard_getter, NULL);
 	l_dbus_interface_property(iface, "Addresses", 0, "aq", addresses_getter,
 									NULL);
+	l_dbus_interface_property(iface, "AppKeyDecryptFailures", 0, "u",
+					decrypt_failures_getter, NULL);
+	l_dbus_interface_property(iface, "RelayedPacketsPerSecond", 0, "u",
+					relay_rate_getter, NULL);
 }
 
 bool node_dbus_init(struct l_dbus *bus)
@@ -27,7 +27,9 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
 
 #include "lib/bluetooth.h"
 
@@ -37,6 +39,60 @@
 #include "monitor/bt.h"
 #include "analyze.h"
 
+/*
+ * Latency samples are kept in a log-linear histogram so that arbitrarily
+ * long traces can be summarized in a single pass with bounded memory.
+ * Values below 2^HIST_SUB_BITS are exact, larger values are stored with
+ * HIST_SUB_BITS bits of precision (about 3%).
+ */
+#define HIST_SUB_BITS		5
+#define HIST_SUB_COUNT		(1 << HIST_SUB_BITS)
+#define HIST_NUM_BUCKETS	((32 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+struct hist {
+	unsigned long count;
+	uint64_t sum;
+	uint32_t min;
+	uint32_t max;
+	uint32_t *buckets;
+};
+
+#define ATT_CID			0x0004
+
+#define CONN_TYPE_ACL		0x01
+#define CONN_TYPE_LE		0x02
+
+struct att_req {
+	bool pending;
+	uint8_t opcode;
+	struct timeval tv;
+};
+
+struct hci_conn {
+	uint16_t handle;
+	uint8_t type;
+	uint8_t bdaddr[6];
+	bool setup_seen;
+	bool terminated;
+	struct timeval time_connected;
+	struct timeval time_disconnected;
+	unsigned long tx_num;
+	unsigned long rx_num;
+	uint64_t tx_bytes;
+	uint64_t rx_bytes;
+	struct queue *tx_queue;
+	struct hist nocp;
+	uint32_t interval;
+	struct timeval interval_start;
+	int64_t last_slot;
+	unsigned long events_total;
+	unsigned long events_active;
+	struct att_req att_req[2];
+	struct att_req att_ind[2];
+	struct hist att;
+	unsigned long att_unanswered;
+};
+
 struct hci_dev {
 	uint16_t index;
 	uint8_t type;
@@ -52,9 +108,331 @@ struct hci_dev {
 	unsigned long user_log;
 	unsigned long unknown;
 	uint16_t manufacturer;
+	uint16_t acl_max_pkt;
+	uint16_t le_max_pkt;
+	uint16_t acl_inflight;
+	uint16_t le_inflight;
+	struct timeval acl_starved_since;
+	struct timeval le_starved_since;
+	struct timeval acl_starved;
+	struct timeval le_starved;
+	struct queue *conn_list;
 };
 
 static struct queue *dev_list;
+static struct timeval last_tv;
+
+static uint64_t tv_to_usec(const struct timeval *tv)
+{
+	return (uint64_t) tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+/* Histogram samples are capped at UINT32_MAX us, about 71 minutes */
+static uint32_t tv_to_sample(const struct timeval *tv)
+{
+	uint64_t usec = tv_to_usec(tv);
+
+	return usec > UINT32_MAX ? UINT32_MAX : usec;
+}
+
+static unsigned int hist_index(uint32_t value)
+{
+	unsigned int shift;
+
+	if (value < HIST_SUB_COUNT)
+		return value;
+
+	shift = 31 - __builtin_clz(value) - HIST_SUB_BITS;
+
+	return (shift + 1) * HIST_SUB_COUNT +
+				((value >> shift) - HIST_SUB_COUNT);
+}
+
+static uint32_t hist_value(unsigned int index)
+{
+	unsigned int shift;
+
+	if (index < HIST_SUB_COUNT)
+		return index;
+
+	shift = index / HIST_SUB_COUNT - 1;
+
+	return (uint32_t) (index % HIST_SUB_COUNT + HIST_SUB_COUNT) << shift;
+}
+
+static void hist_add(struct hist *hist, uint32_t value)
+{
+	if (!hist->buckets)
+		hist->buckets = new0(uint32_t, HIST_NUM_BUCKETS);
+
+	if (!hist->count || value < hist->min)
+		hist->min = value;
+
+	if (value > hist->max)
+		hist->max = value;
+
+	hist->buckets[hist_index(value)]++;
+	hist->sum += value;
+	hist->count++;
+}
+
+static uint32_t hist_percentile(const struct hist *hist, unsigned int pct)
+{
+	unsigned long target, seen = 0;
+	unsigned int i;
+
+	target = (hist->count * pct + 99) / 100;
+	if (!target)
+		target = 1;
+
+	for (i = 0; i < HIST_NUM_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= target)
+			break;
+	}
+
+	if (i == HIST_NUM_BUCKETS)
+		return hist->max;
+
+	if (hist_value(i) < hist->min)
+		return hist->min;
+
+	if (hist_value(i) > hist->max)
+		return hist->max;
+
+	return hist_value(i);
+}
+
+static void hist_print(const struct hist *hist, const char *label)
+{
+	if (!hist->count)
+		return;
+
+	printf("    %s: %lu samples\n", label, hist->count);
+	printf("      min %u.%03u msec, avg %u.%03u msec, "
+					"max %u.%03u msec\n",
+				hist->min / 1000, hist->min % 1000,
+				(uint32_t) (hist->sum / hist->count) / 1000,
+				(uint32_t) (hist->sum / hist->count) % 1000,
+				hist->max / 1000, hist->max % 1000);
+	printf("      p50 %u.%03u msec, p90 %u.%03u msec, "
+					"p99 %u.%03u msec\n",
+				hist_percentile(hist, 50) / 1000,
+				hist_percentile(hist, 50) % 1000,
+				hist_percentile(hist, 90) / 1000,
+				hist_percentile(hist, 90) % 1000,
+				hist_percentile(hist, 99) / 1000,
+				hist_percentile(hist, 99) % 1000);
+}
+
+static void conn_close_interval(struct hci_conn *conn, struct timeval *tv)
+{
+	struct timeval res;
+
+	if (!conn->interval || !timerisset(&conn->interval_start))
+		return;
+
+	timersub(tv, &conn->interval_start, &res);
+	conn->events_total += tv_to_usec(&res) / conn->interval + 1;
+	conn->interval_start = *tv;
+	conn->last_slot = -1;
+}
+
+static void conn_destroy(void *data)
+{
+	struct hci_conn *conn = data;
+	struct timeval *end, res;
+	const char *str;
+
+	switch (conn->type) {
+	case CONN_TYPE_ACL:
+		str = "BR-ACL";
+		break;
+	case CONN_TYPE_LE:
+		str = "LE-ACL";
+		break;
+	default:
+		str = "unknown";
+		break;
+	}
+
+	end = conn->terminated ? &conn->time_disconnected : &last_tv;
+
+	if (!conn->terminated)
+		conn_close_interval(conn, end);
+
+	printf("  Found %s connection with handle %u\n", str, conn->handle);
+	printf("    BD_ADDR %2.2X:%2.2X:%2.2X:%2.2X:%2.2X:%2.2X\n",
+			conn->bdaddr[5], conn->bdaddr[4], conn->bdaddr[3],
+			conn->bdaddr[2], conn->bdaddr[1], conn->bdaddr[0]);
+
+	if (!conn->setup_seen)
+		printf("    Connection setup missing\n");
+	else if (timercmp(end, &conn->time_connected, >)) {
+		timersub(end, &conn->time_connected, &res);
+		printf("    Duration %lu.%06lu seconds%s\n",
+				(unsigned long) res.tv_sec,
+				(unsigned long) res.tv_usec,
+				conn->terminated ? "" : " (not terminated)");
+
+		if (res.tv_sec || res.tv_usec) {
+			double secs = res.tv_sec + res.tv_usec / 1000000.0;
+
+			printf("    TX throughput %.0f bytes/sec, "
+						"RX throughput %.0f bytes/sec\n",
+						conn->tx_bytes / secs,
+						conn->rx_bytes / secs);
+		}
+	}
+
+	printf("    %lu TX packets (%llu bytes)\n", conn->tx_num,
+					(unsigned long long) conn->tx_bytes);
+	printf("    %lu RX packets (%llu bytes)\n", conn->rx_num,
+					(unsigned long long) conn->rx_bytes);
+
+	if (queue_length(conn->tx_queue))
+		printf("    %u TX packets not completed\n",
+					queue_length(conn->tx_queue));
+
+	hist_print(&conn->nocp, "TX completion latency");
+
+	if (conn->events_total)
+		printf("    Interval utilization %lu/%lu events (%lu%%)\n",
+				conn->events_active, conn->events_total,
+				conn->events_active * 100 / conn->events_total);
+
+	hist_print(&conn->att, "ATT response latency");
+
+	if (conn->att_unanswered)
+		printf("    %lu ATT requests without response\n",
+						conn->att_unanswered);
+
+	printf("\n");
+
+	queue_destroy(conn->tx_queue, free);
+	free(conn->nocp.buckets);
+	free(conn->att.buckets);
+	free(conn);
+}
+
+static struct hci_conn *conn_alloc(struct hci_dev *dev, uint16_t handle,
+								uint8_t type)
+{
+	struct hci_conn *conn;
+
+	conn = new0(struct hci_conn, 1);
+
+	conn->handle = handle;
+	conn->type = type;
+	conn->last_slot = -1;
+	conn->tx_queue = queue_new();
+
+	queue_push_tail(dev->conn_list, conn);
+
+	return conn;
+}
+
+static bool conn_match_handle(const void *a, const void *b)
+{
+	const struct hci_conn *conn = a;
+	uint16_t handle = PTR_TO_UINT(b);
+
+	return !conn->terminated && conn->handle == handle;
+}
+
+static struct hci_conn *conn_lookup(struct hci_dev *dev, uint16_t handle)
+{
+	return queue_find(dev->conn_list, conn_match_handle,
+						UINT_TO_PTR(handle));
+}
+
+static struct hci_conn *conn_lookup_type(struct hci_dev *dev,
+						uint16_t handle, uint8_t type)
+{
+	struct hci_conn *conn;
+
+	conn = conn_lookup(dev, handle);
+	if (!conn)
+		conn = conn_alloc(dev, handle, type);
+
+	return conn;
+}
+
+static void starved_update(uint16_t inflight, uint16_t max_pkt,
+				struct timeval *since, struct timeval *total,
+				struct timeval *tv)
+{
+	struct timeval res;
+
+	if (!max_pkt)
+		return;
+
+	if (inflight >= max_pkt) {
+		if (!timerisset(since))
+			*since = *tv;
+		return;
+	}
+
+	if (!timerisset(since))
+		return;
+
+	timersub(tv, since, &res);
+	timeradd(total, &res, total);
+	timerclear(since);
+}
+
+static bool conn_uses_le_pool(struct hci_dev *dev, struct hci_conn *conn)
+{
+	return conn->type == CONN_TYPE_LE && dev->le_max_pkt;
+}
+
+static void dev_credits_sent(struct hci_dev *dev, struct hci_conn *conn,
+							struct timeval *tv)
+{
+	if (conn_uses_le_pool(dev, conn)) {
+		dev->le_inflight++;
+		starved_update(dev->le_inflight, dev->le_max_pkt,
+				&dev->le_starved_since, &dev->le_starved, tv);
+	} else {
+		dev->acl_inflight++;
+		starved_update(dev->acl_inflight, dev->acl_max_pkt,
+				&dev->acl_starved_since, &dev->acl_starved, tv);
+	}
+}
+
+static void dev_credits_completed(struct hci_dev *dev, struct hci_conn *conn,
+					uint16_t count, struct timeval *tv)
+{
+	if (conn_uses_le_pool(dev, conn)) {
+		dev->le_inflight -= count < dev->le_inflight ?
+						count : dev->le_inflight;
+		starved_update(dev->le_inflight, dev->le_max_pkt,
+				&dev->le_starved_since, &dev->le_starved, tv);
+	} else {
+		dev->acl_inflight -= count < dev->acl_inflight ?
+						count : dev->acl_inflight;
+		starved_update(dev->acl_inflight, dev->acl_max_pkt,
+				&dev->acl_starved_since, &dev->acl_starved, tv);
+	}
+}
+
+static void print_starved(const char *label, uint16_t max_pkt,
+				struct timeval *since, struct timeval *total)
+{
+	struct timeval res;
+
+	if (!max_pkt)
+		return;
+
+	if (timerisset(since)) {
+		timersub(&last_tv, since, &res);
+		timeradd(total, &res, total);
+	}
+
+	printf("  %s buffers %u, starved for %lu.%06lu seconds\n", label,
+				max_pkt, (unsigned long) total->tv_sec,
+				(unsigned long) total->tv_usec);
+}
 
 static void dev_destroy(void *data)
 {
@@ -90,8 +468,15 @@ static void dev_destroy(void *data)
 	printf("  %lu system notes\n", dev->system_note);
 	printf("  %lu user logs\n", dev->user_log);
 	printf("  %lu unknown opcodes\n", dev->unknown);
+
+	print_starved("ACL", dev->acl_max_pkt, &dev->acl_starved_since,
+							&dev->acl_starved);
+	print_starved("LE", dev->le_max_pkt, &dev->le_starved_since,
+							&dev->le_starved);
 	printf("\n");
 
+	queue_destroy(dev->conn_list, conn_destroy);
+
 	free(dev);
 }
 
@@ -103,6 +488,7 @@ static struct hci_dev *dev_alloc(uint16_t index)
 
 	dev->index = index;
 	dev->manufacturer = 0xffff;
+	dev->conn_list = queue_new();
 
 	return dev;
 }
@@ -188,6 +574,28 @@ static void rsp_read_bd_addr(struct hci_dev *dev, struct timeval *tv,
 	memcpy(dev->bdaddr, rsp->bdaddr, 6);
 }
 
+static void rsp_read_buffer_size(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_rsp_read_buffer_size *rsp = data;
+
+	if (size < sizeof(*rsp) || rsp->status)
+		return;
+
+	dev->acl_max_pkt = le16_to_cpu(rsp->acl_max_pkt);
+}
+
+static void rsp_le_read_buffer_size(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_rsp_le_read_buffer_size *rsp = data;
+
+	if (size < sizeof(*rsp) || rsp->status)
+		return;
+
+	dev->le_max_pkt = rsp->le_max_pkt;
+}
+
 static void evt_cmd_complete(struct hci_dev *dev, struct timeval *tv,
 					const void *data, uint16_t size)
 {
@@ -203,6 +611,162 @@ static void evt_cmd_complete(struct hci_dev *dev, struct timeval *tv,
 	case BT_HCI_CMD_READ_BD_ADDR:
 		rsp_read_bd_addr(dev, tv, data, size);
 		break;
+	case BT_HCI_CMD_READ_BUFFER_SIZE:
+		rsp_read_buffer_size(dev, tv, data, size);
+		break;
+	case BT_HCI_CMD_LE_READ_BUFFER_SIZE:
+		rsp_le_read_buffer_size(dev, tv, data, size);
+		break;
+	}
+}
+
+static void conn_setup(struct hci_dev *dev, struct timeval *tv,
+				uint16_t handle, uint8_t type,
+				const uint8_t *bdaddr, uint16_t interval)
+{
+	struct hci_conn *conn;
+
+	conn = conn_lookup(dev, handle);
+	if (!conn || conn->setup_seen)
+		conn = conn_alloc(dev, handle, type);
+
+	memcpy(conn->bdaddr, bdaddr, 6);
+	conn->setup_seen = true;
+	conn->time_connected = *tv;
+
+	if (interval) {
+		conn->interval = interval * 1250;
+		conn->interval_start = *tv;
+	}
+}
+
+static void evt_conn_complete(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_conn_complete *evt = data;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	if (evt->link_type != 0x01)
+		return;
+
+	conn_setup(dev, tv, le16_to_cpu(evt->handle), CONN_TYPE_ACL,
+							evt->bdaddr, 0);
+}
+
+static void evt_disconnect_complete(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_disconnect_complete *evt = data;
+	struct hci_conn *conn;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	conn = conn_lookup(dev, le16_to_cpu(evt->handle));
+	if (!conn)
+		return;
+
+	conn_close_interval(conn, tv);
+
+	/* Outstanding packets are flushed and their credits returned */
+	dev_credits_completed(dev, conn, queue_length(conn->tx_queue), tv);
+
+	conn->terminated = true;
+	conn->time_disconnected = *tv;
+}
+
+static void evt_num_completed_packets(struct hci_dev *dev,
+				struct timeval *tv, const void *data,
+				uint16_t size)
+{
+	const struct bt_hci_evt_num_completed_packets *evt = data;
+	const uint8_t *ptr = data + 1;
+	uint8_t i;
+
+	if (size < 1 || size < 1 + evt->num_handles * 4)
+		return;
+
+	for (i = 0; i < evt->num_handles; i++, ptr += 4) {
+		uint16_t handle = get_le16(ptr);
+		uint16_t count = get_le16(ptr + 2);
+		struct hci_conn *conn;
+		uint16_t j;
+
+		conn = conn_lookup(dev, handle);
+		if (!conn)
+			continue;
+
+		dev_credits_completed(dev, conn, count, tv);
+
+		for (j = 0; j < count; j++) {
+			struct timeval *sent, res;
+
+			sent = queue_pop_head(conn->tx_queue);
+			if (!sent)
+				break;
+
+			timersub(tv, sent, &res);
+			hist_add(&conn->nocp, tv_to_sample(&res));
+			free(sent);
+		}
+	}
+}
+
+static void evt_le_meta_event(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	uint8_t subevt;
+
+	if (size < 1)
+		return;
+
+	subevt = *((const uint8_t *) data);
+
+	data += 1;
+	size -= 1;
+
+	switch (subevt) {
+	case BT_HCI_EVT_LE_CONN_COMPLETE:
+	{
+		const struct bt_hci_evt_le_conn_complete *evt = data;
+
+		if (size < sizeof(*evt) || evt->status)
+			return;
+
+		conn_setup(dev, tv, le16_to_cpu(evt->handle), CONN_TYPE_LE,
+				evt->peer_addr, le16_to_cpu(evt->interval));
+		break;
+	}
+	case BT_HCI_EVT_LE_ENHANCED_CONN_COMPLETE:
+	{
+		const struct bt_hci_evt_le_enhanced_conn_complete *evt = data;
+
+		if (size < sizeof(*evt) || evt->status)
+			return;
+
+		conn_setup(dev, tv, le16_to_cpu(evt->handle), CONN_TYPE_LE,
+				evt->peer_addr, le16_to_cpu(evt->interval));
+		break;
+	}
+	case BT_HCI_EVT_LE_CONN_UPDATE_COMPLETE:
+	{
+		const struct bt_hci_evt_le_conn_update_complete *evt = data;
+		struct hci_conn *conn;
+
+		if (size < sizeof(*evt) || evt->status)
+			return;
+
+		conn = conn_lookup(dev, le16_to_cpu(evt->handle));
+		if (!conn)
+			return;
+
+		conn_close_interval(conn, tv);
+		conn->interval = le16_to_cpu(evt->interval) * 1250;
+		conn->interval_start = *tv;
+		break;
+	}
 	}
 }
 
@@ -225,14 +789,145 @@ static void event_pkt(struct timeval *tv, uint16_t index,
 	case BT_HCI_EVT_CMD_COMPLETE:
 		evt_cmd_complete(dev, tv, data, size);
 		break;
+	case BT_HCI_EVT_CONN_COMPLETE:
+		evt_conn_complete(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_DISCONNECT_COMPLETE:
+		evt_disconnect_complete(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_NUM_COMPLETED_PACKETS:
+		evt_num_completed_packets(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_LE_META_EVENT:
+		evt_le_meta_event(dev, tv, data, size);
+		break;
+	}
+}
+
+static bool att_is_request(uint8_t opcode)
+{
+	switch (opcode) {
+	case 0x02:
+	case 0x04:
+	case 0x06:
+	case 0x08:
+	case 0x0a:
+	case 0x0c:
+	case 0x0e:
+	case 0x10:
+	case 0x12:
+	case 0x16:
+	case 0x18:
+	case 0x20:
+		return true;
+	}
+
+	return false;
+}
+
+static bool att_is_response(uint8_t opcode)
+{
+	switch (opcode) {
+	case 0x01:
+	case 0x03:
+	case 0x05:
+	case 0x07:
+	case 0x09:
+	case 0x0b:
+	case 0x0d:
+	case 0x0f:
+	case 0x11:
+	case 0x13:
+	case 0x17:
+	case 0x19:
+	case 0x21:
+		return true;
 	}
+
+	return false;
+}
+
+static void att_complete(struct hci_conn *conn, struct att_req *req,
+							struct timeval *tv)
+{
+	struct timeval res;
+
+	if (!req->pending)
+		return;
+
+	timersub(tv, &req->tv, &res);
+	hist_add(&conn->att, tv_to_sample(&res));
+	req->pending = false;
+}
+
+static void att_start(struct hci_conn *conn, struct att_req *req,
+					uint8_t opcode, struct timeval *tv)
+{
+	/* A new transaction implies the previous one timed out */
+	if (req->pending)
+		conn->att_unanswered++;
+
+	req->pending = true;
+	req->opcode = opcode;
+	req->tv = *tv;
+}
+
+static void att_pdu(struct hci_conn *conn, struct timeval *tv, bool out,
+					const void *data, uint16_t size)
+{
+	uint8_t opcode;
+
+	if (size < 1)
+		return;
+
+	opcode = *((const uint8_t *) data);
+
+	/*
+	 * Requests and indications are indexed by the direction they were
+	 * sent in, so responses and confirmations look up the opposite one.
+	 */
+	if (att_is_request(opcode))
+		att_start(conn, &conn->att_req[out], opcode, tv);
+	else if (att_is_response(opcode))
+		att_complete(conn, &conn->att_req[!out], tv);
+	else if (opcode == 0x1d)
+		att_start(conn, &conn->att_ind[out], opcode, tv);
+	else if (opcode == 0x1e)
+		att_complete(conn, &conn->att_ind[!out], tv);
+}
+
+static void conn_activity(struct hci_conn *conn, struct timeval *tv)
+{
+	struct timeval res;
+	int64_t slot;
+
+	if (!conn->interval || !timerisset(&conn->interval_start))
+		return;
+
+	if (timercmp(tv, &conn->interval_start, <))
+		return;
+
+	timersub(tv, &conn->interval_start, &res);
+	slot = tv_to_usec(&res) / conn->interval;
+
+	if (slot == conn->last_slot)
+		return;
+
+	conn->last_slot = slot;
+	conn->events_active++;
 }
 
-static void acl_pkt(struct timeval *tv, uint16_t index,
+static void acl_pkt(struct timeval *tv, uint16_t index, bool out,
 					const void *data, uint16_t size)
 {
 	const struct bt_hci_acl_hdr *hdr = data;
 	struct hci_dev *dev;
+	struct hci_conn *conn;
+	uint16_t handle;
+	uint8_t flags;
+
+	if (size < sizeof(*hdr))
+		return;
 
 	data += sizeof(*hdr);
 	size -= sizeof(*hdr);
@@ -242,6 +937,35 @@ static void acl_pkt(struct timeval *tv, uint16_t index,
 		return;
 
 	dev->num_acl++;
+
+	handle = le16_to_cpu(hdr->handle);
+	flags = handle >> 12;
+
+	conn = conn_lookup_type(dev, handle & 0x0fff, CONN_TYPE_ACL);
+
+	conn_activity(conn, tv);
+
+	if (out) {
+		struct timeval *sent;
+
+		sent = new0(struct timeval, 1);
+		*sent = *tv;
+
+		conn->tx_num++;
+		conn->tx_bytes += size;
+		queue_push_tail(conn->tx_queue, sent);
+		dev_credits_sent(dev, conn, tv);
+	} else {
+		conn->rx_num++;
+		conn->rx_bytes += size;
+	}
+
+	/* Only start fragments carry the basic L2CAP header */
+	if ((flags & 0x03) == 0x01 || size < 4)
+		return;
+
+	if (get_le16(data + 2) == ATT_CID)
+		att_pdu(conn, tv, out, data + 4, size - 4);
 }
 
 static void sco_pkt(struct timeval *tv, uint16_t index,
@@ -371,8 +1095,10 @@ void analyze_trace(const char *path)
 			event_pkt(&tv, index, buf, pktlen);
 			break;
 		case BTSNOOP_OPCODE_ACL_TX_PKT:
+			acl_pkt(&tv, index, true, buf, pktlen);
+			break;
 		case BTSNOOP_OPCODE_ACL_RX_PKT:
-			acl_pkt(&tv, index, buf, pktlen);
+			acl_pkt(&tv, index, false, buf, pktlen);
 			break;
 		case BTSNOOP_OPCODE_SCO_TX_PKT:
 		case BTSNOOP_OPCODE_SCO_RX_PKT:
@@ -399,6 +1125,7 @@ void analyze_trace(const char *path)
 			break;
 		}
 
+		last_tv = tv;
 		num_packets++;
 	}
 
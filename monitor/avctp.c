@@ -44,6 +44,7 @@
 #include "keys.h"
 #include "sdp.h"
 #include "avctp.h"
+#include "profile.h"
 
 /* ctype entries */
 #define AVC_CTYPE_CONTROL		0x0
@@ -1661,6 +1662,7 @@ static bool avrcp_pdu_packet(struct avctp_frame *avctp_frame, uint8_t ctype,
 	uint16_t len;
 	int i;
 	const struct avrcp_ctrl_pdu_data *ctrl_pdu_data = NULL;
+	bool ret;
 
 	if (!l2cap_frame_get_u8(frame, &pduid))
 		return false;
@@ -1692,7 +1694,11 @@ static bool avrcp_pdu_packet(struct avctp_frame *avctp_frame, uint8_t ctype,
 		return true;
 	}
 
-	return ctrl_pdu_data->func(avctp_frame, ctype, len, indent + 2);
+	profile_start();
+	ret = ctrl_pdu_data->func(avctp_frame, ctype, len, indent + 2);
+	profile_stop("AVRCP", pdu2str(pduid), len);
+
+	return ret;
 }
 
 static bool avrcp_control_packet(struct avctp_frame *avctp_frame)
@@ -2467,6 +2473,8 @@ static bool avrcp_browsing_packet(struct avctp_frame *avctp_frame)
 
 	print_field("AVRCP: %s: len 0x%04x", pdu2str(pduid), len);
 
+	profile_start();
+
 	switch (pduid) {
 	case AVRCP_SET_BROWSED_PLAYER:
 		avrcp_set_browsed_player(avctp_frame);
@@ -2493,6 +2501,8 @@ static bool avrcp_browsing_packet(struct avctp_frame *avctp_frame)
 		packet_hexdump(frame->data, frame->size);
 	}
 
+	profile_stop("AVRCP Browsing", pdu2str(pduid), len);
+
 	return true;
 }
 
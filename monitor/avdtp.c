@@ -39,6 +39,7 @@
 #include "l2cap.h"
 #include "avdtp.h"
 #include "a2dp.h"
+#include "profile.h"
 
 /* Message Types */
 #define AVDTP_MSG_TYPE_COMMAND		0x00
@@ -287,6 +288,7 @@ static bool service_media_codec(struct avdtp_frame *avdtp_frame, uint8_t losc)
 	struct l2cap_frame *frame = &avdtp_frame->l2cap_frame;
 	uint8_t type = 0;
 	uint8_t codec = 0;
+	bool ret;
 
 	if (losc < 2)
 		return false;
@@ -302,10 +304,17 @@ static bool service_media_codec(struct avdtp_frame *avdtp_frame, uint8_t losc)
 	print_field("%*cMedia Codec: %s (0x%02x)", 2, ' ',
 					mediacodec2str(codec), codec);
 
-	if (is_configuration_sig_id(avdtp_frame->sig_id))
-		return a2dp_codec_cfg(codec, losc, frame);
-	else
-		return a2dp_codec_cap(codec, losc, frame);
+	profile_start();
+
+	if (is_configuration_sig_id(avdtp_frame->sig_id)) {
+		ret = a2dp_codec_cfg(codec, losc, frame);
+		profile_stop("A2DP Configuration", mediacodec2str(codec), losc);
+	} else {
+		ret = a2dp_codec_cap(codec, losc, frame);
+		profile_stop("A2DP Capabilities", mediacodec2str(codec), losc);
+	}
+
+	return ret;
 }
 
 static bool decode_capabilities(struct avdtp_frame *avdtp_frame)
@@ -772,13 +781,21 @@ void avdtp_packet(const struct l2cap_frame *frame)
 
 	l2cap_frame_pull(&avdtp_frame.l2cap_frame, frame, 0);
 
+	/* Profiled as reserved signal if the header turns out malformed */
+	avdtp_frame.sig_id = 0x00;
+
 	switch (frame->seq_num) {
 	case 1:
+		profile_start();
 		ret = avdtp_signalling_packet(&avdtp_frame);
+		profile_stop("AVDTP", sigid2str(avdtp_frame.sig_id),
+								frame->size);
 		break;
 	default:
+		profile_start();
 		if (packet_has_filter(PACKET_FILTER_SHOW_A2DP_STREAM))
 			packet_hexdump(frame->data, frame->size);
+		profile_stop("AVDTP", "Media Stream", frame->size);
 		return;
 	}
 
@@ -60,9 +60,13 @@
 #include "jlink.h"
 
 static struct btsnoop *btsnoop_file = NULL;
+static int flush_id = 0;
 static bool hcidump_fallback = false;
 static bool decode_control = true;
 static uint16_t filter_index = HCI_DEV_NONE;
+static unsigned long start_frame = 0;
+static struct timeval start_time;
+static bool start_time_set = false;
 
 struct control_data {
 	uint16_t channel;
@@ -1466,11 +1470,134 @@ int control_rtt(char *jlink, char *rtt)
 	return 0;
 }
 
-bool control_writer(const char *path)
+static void flush_callback(int id, void *user_data)
+{
+	btsnoop_flush(btsnoop_file);
+
+	if (mainloop_modify_timeout(id, 1000) < 0)
+		mainloop_remove_timeout(id);
+}
+
+bool control_writer(const char *path, bool compress, bool index)
 {
 	btsnoop_file = btsnoop_create(path, 0, 0, BTSNOOP_FORMAT_MONITOR);
+	if (!btsnoop_file)
+		return false;
+
+	if (compress) {
+		if (!btsnoop_enable_compression(btsnoop_file)) {
+			btsnoop_unref(btsnoop_file);
+			btsnoop_file = NULL;
+			return false;
+		}
+
+		/* Push out partial chunks when the trace goes idle */
+		flush_id = mainloop_add_timeout(1000, flush_callback,
+								NULL, NULL);
+
+		return true;
+	}
+
+	/* Sidecar index for seeking, readers can rebuild it if missing */
+	if (index)
+		btsnoop_enable_index(btsnoop_file);
+
+	return true;
+}
+
+void control_writer_close(void)
+{
+	if (flush_id > 0) {
+		mainloop_remove_timeout(flush_id);
+		flush_id = 0;
+	}
+
+	btsnoop_unref(btsnoop_file);
+	btsnoop_file = NULL;
+}
+
+void control_reader_start_frame(unsigned long frame)
+{
+	start_frame = frame;
+}
+
+bool control_reader_start_time(const char *offset)
+{
+	unsigned long sec, usec = 0;
+	const char *frac;
+	char *end;
+	int digits;
+
+	sec = strtoul(offset, &end, 10);
+	if (end == offset || (*end && *end != '.'))
+		return false;
 
-	return !!btsnoop_file;
+	if (*end == '.') {
+		frac = end + 1;
+
+		for (digits = 0; digits < 6; digits++) {
+			usec *= 10;
+			if (*frac >= '0' && *frac <= '9')
+				usec += *frac++ - '0';
+		}
+
+		if (*frac)
+			return false;
+	}
+
+	start_time.tv_sec = sec;
+	start_time.tv_usec = usec;
+	start_time_set = true;
+
+	return true;
+}
+
+static bool reader_seek(void)
+{
+	unsigned char buf[BTSNOOP_MAX_PACKET_SIZE];
+	uint64_t frames[BTSNOOP_MAX_INDEX];
+	uint16_t index, opcode, pktlen;
+	struct timeval tv, target;
+	int i;
+
+	if (start_frame <= 1 && !start_time_set)
+		return true;
+
+	/*
+	 * Keep the time offsets relative to the start of the trace, so
+	 * that they match what a complete read of the file would show.
+	 */
+	if (!btsnoop_read_hci(btsnoop_file, &tv, &index, &opcode,
+							buf, &pktlen))
+		return false;
+
+	packet_set_time_offset(&tv);
+
+	/* Frame numbers are per controller, -i selects which one counts */
+	if (start_frame > 1) {
+		index = filter_index == HCI_DEV_NONE ? BTSNOOP_INDEX_ANY :
+								filter_index;
+
+		if (!btsnoop_seek_frame(btsnoop_file, index, start_frame,
+								frames)) {
+			fprintf(stderr, "Failed to seek to frame %lu\n",
+								start_frame);
+			return false;
+		}
+	} else {
+		timeradd(&tv, &start_time, &target);
+
+		if (!btsnoop_seek_time(btsnoop_file, &target, frames)) {
+			fprintf(stderr, "Failed to seek to time offset\n");
+			return false;
+		}
+	}
+
+	/* Continue numbering where a complete read would be */
+	for (i = 0; i < BTSNOOP_MAX_INDEX; i++)
+		packet_set_frame(i, frames[i]);
+
+	return true;
 }
 
 void control_reader(const char *path, bool pager)
@@ -1498,6 +1625,11 @@ void control_reader(const char *path, bool pager)
 		break;
 	}
 
+	if (!reader_seek()) {
+		btsnoop_unref(btsnoop_file);
+		return;
+	}
+
 	if (pager)
 		open_pager();
 
@@ -24,8 +24,11 @@
 
 #include <stdint.h>
 
-bool control_writer(const char *path);
+bool control_writer(const char *path, bool compress, bool index);
+void control_writer_close(void);
 void control_reader(const char *path, bool pager);
+void control_reader_start_frame(unsigned long frame);
+bool control_reader_start_time(const char *offset);
 void control_server(const char *path);
 int control_tty(const char *path, unsigned int speed);
 int control_rtt(char *jlink, char *rtt);
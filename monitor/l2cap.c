@@ -46,6 +46,7 @@
 #include "avdtp.h"
 #include "rfcomm.h"
 #include "bnep.h"
+#include "profile.h"
 
 
 #define L2CAP_MODE_BASIC		0x00
@@ -1499,7 +1500,9 @@ static void bredr_sig_packet(uint16_t index, bool in, uint16_t handle,
 
 		l2cap_frame_init(&frame, index, in, handle, hdr->ident, cid, 0,
 								data, len);
+		profile_start();
 		opcode_data->func(&frame);
+		profile_stop("L2CAP Signaling", opcode_data->str, frame.size);
 
 		data += len;
 		size -= len;
@@ -1581,7 +1584,9 @@ static void le_sig_packet(uint16_t index, bool in, uint16_t handle,
 
 	l2cap_frame_init(&frame, index, in, handle, hdr->ident, cid, 0,
 							data, len);
+	profile_start();
 	opcode_data->func(&frame);
+	profile_stop("LE L2CAP Signaling", opcode_data->str, frame.size);
 }
 
 static void connless_packet(uint16_t index, bool in, uint16_t handle,
@@ -1981,7 +1986,9 @@ static void amp_packet(uint16_t index, bool in, uint16_t handle,
 	}
 
 	l2cap_frame_init(&frame, index, in, handle, 0, cid, 0, data + 6, len);
+	profile_start();
 	opcode_data->func(&frame);
+	profile_stop("AMP", opcode_data->str, frame.size);
 }
 
 static void print_hex_field(const char *label, const uint8_t *data,
@@ -2571,7 +2578,9 @@ static void att_packet(uint16_t index, bool in, uint16_t handle,
 
 	l2cap_frame_init(&frame, index, in, handle, 0, cid, 0,
 						data + 1, size - 1);
+	profile_start();
 	opcode_data->func(&frame);
+	profile_stop("ATT", opcode_data->str, frame.size);
 }
 
 static void print_addr(const uint8_t *addr, uint8_t addr_type)
@@ -3028,7 +3037,9 @@ static void smp_packet(uint16_t index, bool in, uint16_t handle,
 
 	l2cap_frame_init(&frame, index, in, handle, 0, cid, 0,
 						data + 1, size - 1);
+	profile_start();
 	opcode_data->func(&frame);
+	profile_stop("SMP", opcode_data->str, frame.size);
 }
 
 void l2cap_frame(uint16_t index, bool in, uint16_t handle, uint16_t cid,
@@ -3123,23 +3134,33 @@ void l2cap_frame(uint16_t index, bool in, uint16_t handle, uint16_t cid,
 
 		switch (frame.psm) {
 		case 0x0001:
+			profile_start();
 			sdp_packet(&frame);
+			profile_stop("L2CAP", "SDP", frame.size);
 			break;
 		case 0x0003:
+			profile_start();
 			rfcomm_packet(&frame);
+			profile_stop("L2CAP", "RFCOMM", frame.size);
 			break;
 		case 0x000f:
+			profile_start();
 			bnep_packet(&frame);
+			profile_stop("L2CAP", "BNEP", frame.size);
 			break;
 		case 0x001f:
 			att_packet(index, in, handle, cid, data, size);
 			break;
 		case 0x0017:
 		case 0x001B:
+			profile_start();
 			avctp_packet(&frame);
+			profile_stop("L2CAP", "AVCTP", frame.size);
 			break;
 		case 0x0019:
+			profile_start();
 			avdtp_packet(&frame);
+			profile_stop("L2CAP", "AVDTP", frame.size);
 			break;
 		default:
 			packet_hexdump(data, size);
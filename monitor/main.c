@@ -43,6 +43,7 @@
 #include "analyze.h"
 #include "ellisys.h"
 #include "control.h"
+#include "profile.h"
 
 static void signal_callback(int signum, void *user_data)
 {
@@ -61,7 +62,12 @@ static void usage(void)
 	printf("\tbtmon [options]\n");
 	printf("options:\n"
 		"\t-r, --read <file>      Read traces in btsnoop format\n"
+		"\t-N, --start-frame <num>\n"
+		"\t                       Start reading at frame #num\n"
+		"\t-O, --start-time <sec> Start reading at time offset\n"
 		"\t-w, --write <file>     Save traces in btsnoop format\n"
+		"\t-z, --compress         Compress saved traces\n"
+		"\t-x, --write-index      Save a seek index with the traces\n"
 		"\t-a, --analyze <file>   Analyze traces in btsnoop format\n"
 		"\t-s, --server <socket>  Start monitor server socket\n"
 		"\t-p, --priority <level> Show only priority or lower\n"
@@ -75,6 +81,7 @@ static void usage(void)
 		"\t-A, --a2dp             Dump A2DP stream traffic\n"
 		"\t-E, --ellisys [ip]     Send Ellisys HCI Injection\n"
 		"\t-P, --no-pager         Disable pager usage\n"
+		"\t-X, --profile          Show decoder profile at exit\n"
 		"\t-J  --jlink <device>,[<serialno>],[<interface>],[<speed>]\n"
 		"\t                       Read data from RTT\n"
 		"\t-R  --rtt [<address>],[<area>],[<name>]\n"
@@ -84,7 +91,11 @@ static void usage(void)
 
 static const struct option main_options[] = {
 	{ "read",      required_argument, NULL, 'r' },
+	{ "start-frame", required_argument, NULL, 'N' },
+	{ "start-time", required_argument, NULL, 'O' },
 	{ "write",     required_argument, NULL, 'w' },
+	{ "compress",  no_argument,       NULL, 'z' },
+	{ "write-index", no_argument,     NULL, 'x' },
 	{ "analyze",   required_argument, NULL, 'a' },
 	{ "server",    required_argument, NULL, 's' },
 	{ "priority",  required_argument, NULL, 'p' },
@@ -98,6 +109,7 @@ static const struct option main_options[] = {
 	{ "a2dp",      no_argument,       NULL, 'A' },
 	{ "ellisys",   required_argument, NULL, 'E' },
 	{ "no-pager",  no_argument,       NULL, 'P' },
+	{ "profile",   no_argument,       NULL, 'X' },
 	{ "jlink",     required_argument, NULL, 'J' },
 	{ "rtt",       required_argument, NULL, 'R' },
 	{ "todo",      no_argument,       NULL, '#' },
@@ -112,7 +124,11 @@ int main(int argc, char *argv[])
 	bool use_pager = true;
 	const char *reader_path = NULL;
 	const char *writer_path = NULL;
+	bool compress = false;
+	bool write_index = false;
 	const char *analyze_path = NULL;
+	bool start_frame = false;
+	bool start_time = false;
 	const char *ellisys_server = NULL;
 	const char *tty = NULL;
 	unsigned int tty_speed = B115200;
@@ -130,7 +146,7 @@ int main(int argc, char *argv[])
 		int opt;
 		struct sockaddr_un addr;
 
-		opt = getopt_long(argc, argv, "r:w:a:s:p:i:d:B:V:tTSAE:PJ:R:vh",
+		opt = getopt_long(argc, argv, "r:N:O:w:zxa:s:p:i:d:B:V:tTSAE:PXJ:R:vh",
 							main_options, NULL);
 		if (opt < 0)
 			break;
@@ -139,9 +155,27 @@ int main(int argc, char *argv[])
 		case 'r':
 			reader_path = optarg;
 			break;
+		case 'N':
+			start_frame = true;
+			control_reader_start_frame(strtoul(optarg, NULL, 0));
+			break;
+		case 'O':
+			start_time = true;
+			if (!control_reader_start_time(optarg)) {
+				fprintf(stderr, "Invalid time offset: %s\n",
+									optarg);
+				return EXIT_FAILURE;
+			}
+			break;
 		case 'w':
 			writer_path = optarg;
 			break;
+		case 'z':
+			compress = true;
+			break;
+		case 'x':
+			write_index = true;
+			break;
 		case 'a':
 			analyze_path = optarg;
 			break;
@@ -202,6 +236,9 @@ int main(int argc, char *argv[])
 		case 'P':
 			use_pager = false;
 			break;
+		case 'X':
+			profile_enable();
+			break;
 		case 'J':
 			jlink = optarg;
 			break;
@@ -228,6 +265,11 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (!reader_path && (start_frame || start_time)) {
+		fprintf(stderr, "Start frame and time require reading traces\n");
+		return EXIT_FAILURE;
+	}
+
 	if (reader_path && analyze_path) {
 		fprintf(stderr, "Display and analyze can't be combined\n");
 		return EXIT_FAILURE;
@@ -249,10 +291,12 @@ int main(int argc, char *argv[])
 			ellisys_enable(ellisys_server, ellisys_port);
 
 		control_reader(reader_path, use_pager);
+		profile_report();
 		return EXIT_SUCCESS;
 	}
 
-	if (writer_path && !control_writer(writer_path)) {
+	if (writer_path && !control_writer(writer_path, compress,
+							write_index)) {
 		printf("Failed to open '%s'\n", writer_path);
 		return EXIT_FAILURE;
 	}
@@ -271,6 +315,11 @@ int main(int argc, char *argv[])
 
 	exit_status = mainloop_run_with_signal(signal_callback, NULL);
 
+	if (writer_path)
+		control_writer_close();
+
+	profile_report();
+
 	keys_cleanup();
 
 	return exit_status;
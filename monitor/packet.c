@@ -57,6 +57,7 @@
 #include "intel.h"
 #include "broadcom.h"
 #include "packet.h"
+#include "profile.h"
 
 #define COLOR_CHANNEL_LABEL		COLOR_WHITE
 #define COLOR_FRAME_LABEL		COLOR_WHITE
@@ -257,6 +258,11 @@ void packet_set_priority(const char *priority)
 		priority_level = atoi(priority);
 }
 
+void packet_set_time_offset(const struct timeval *tv)
+{
+	time_offset = tv->tv_sec;
+}
+
 void packet_select_index(uint16_t index)
 {
 	filter_mask &= ~PACKET_FILTER_SHOW_INDEX;
@@ -279,6 +285,12 @@ struct index_data {
 
 static struct index_data index_list[MAX_INDEX];
 
+void packet_set_frame(uint16_t index, size_t frame)
+{
+	if (index < MAX_INDEX)
+		index_list[index].frame = frame;
+}
+
 void packet_set_fallback_manufacturer(uint16_t manufacturer)
 {
 	int i;
@@ -3906,22 +3918,34 @@ void packet_monitor(struct timeval *tv, struct ucred *cred,
 		packet_del_index(tv, index, str);
 		break;
 	case BTSNOOP_OPCODE_COMMAND_PKT:
+		profile_start();
 		packet_hci_command(tv, cred, index, data, size);
+		profile_stop("HCI", "Command", size);
 		break;
 	case BTSNOOP_OPCODE_EVENT_PKT:
+		profile_start();
 		packet_hci_event(tv, cred, index, data, size);
+		profile_stop("HCI", "Event", size);
 		break;
 	case BTSNOOP_OPCODE_ACL_TX_PKT:
+		profile_start();
 		packet_hci_acldata(tv, cred, index, false, data, size);
+		profile_stop("HCI", "ACL Data", size);
 		break;
 	case BTSNOOP_OPCODE_ACL_RX_PKT:
+		profile_start();
 		packet_hci_acldata(tv, cred, index, true, data, size);
+		profile_stop("HCI", "ACL Data", size);
 		break;
 	case BTSNOOP_OPCODE_SCO_TX_PKT:
+		profile_start();
 		packet_hci_scodata(tv, cred, index, false, data, size);
+		profile_stop("HCI", "SCO Data", size);
 		break;
 	case BTSNOOP_OPCODE_SCO_RX_PKT:
+		profile_start();
 		packet_hci_scodata(tv, cred, index, true, data, size);
+		profile_stop("HCI", "SCO Data", size);
 		break;
 	case BTSNOOP_OPCODE_OPEN_INDEX:
 		if (index < MAX_INDEX)
@@ -8638,7 +8662,9 @@ static void cmd_complete_evt(const void *data, uint8_t size)
 		}
 	}
 
+	profile_start();
 	opcode_data->rsp_func(data + 3, size - 3);
+	profile_stop("HCI Response", opcode_data->str, size - 3);
 }
 
 static void cmd_status_evt(const void *data, uint8_t size)
@@ -9764,7 +9790,9 @@ static void print_subevent(const struct subevent_data *subevent_data,
 		}
 	}
 
+	profile_start();
 	subevent_data->func(data, size);
+	profile_stop("LE Meta Event", subevent_data->str, size);
 }
 
 static const struct subevent_data le_meta_event_table[] = {
@@ -10302,7 +10330,9 @@ void packet_hci_command(struct timeval *tv, struct ucred *cred, uint16_t index,
 		}
 	}
 
+	profile_start();
 	opcode_data->cmd_func(data, hdr->plen);
+	profile_stop("HCI Command", opcode_data->str, hdr->plen);
 }
 
 void packet_hci_event(struct timeval *tv, struct ucred *cred, uint16_t index,
@@ -10382,7 +10412,9 @@ void packet_hci_event(struct timeval *tv, struct ucred *cred, uint16_t index,
 		}
 	}
 
+	profile_start();
 	event_data->func(data, hdr->plen);
+	profile_stop("HCI Event", event_data->str, hdr->plen);
 }
 
 void packet_hci_acldata(struct timeval *tv, struct ucred *cred, uint16_t index,
@@ -12361,7 +12393,9 @@ static void mgmt_command_complete_evt(const void *data, uint16_t size)
 		}
 	}
 
+	profile_start();
 	mgmt_data->rsp_func(data, size);
+	profile_stop("MGMT Response", mgmt_data->str, size);
 }
 
 static void mgmt_command_status_evt(const void *data, uint16_t size)
@@ -12898,7 +12932,9 @@ void packet_ctrl_command(struct timeval *tv, struct ucred *cred, uint16_t index,
 		}
 	}
 
+	profile_start();
 	mgmt_data->func(data, size);
+	profile_stop("MGMT Command", mgmt_data->str, size);
 }
 
 void packet_ctrl_event(struct timeval *tv, struct ucred *cred, uint16_t index,
@@ -12992,7 +13028,9 @@ void packet_ctrl_event(struct timeval *tv, struct ucred *cred, uint16_t index,
 		}
 	}
 
+	profile_start();
 	mgmt_data->func(data, size);
+	profile_stop("MGMT Event", mgmt_data->str, size);
 }
 
 void packet_todo(void)
@@ -42,6 +42,8 @@ void packet_del_filter(unsigned long filter);
 
 void packet_set_priority(const char *priority);
 void packet_select_index(uint16_t index);
+void packet_set_time_offset(const struct timeval *tv);
+void packet_set_frame(uint16_t index, size_t frame);
 void packet_set_fallback_manufacturer(uint16_t manufacturer);
 
 void packet_hexdump(const unsigned char *buf, uint16_t len);
@@ -0,0 +1,230 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  BlueZ contributors
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "src/shared/util.h"
+#include "profile.h"
+
+/*
+ * Decoders nest (HCI into L2CAP into AVDTP and so on), so a stack of
+ * active calls is used to split the elapsed time of each call into the
+ * time spent in the decoder itself and the time spent in its children.
+ */
+#define MAX_DEPTH	32
+
+struct profile_frame {
+	uint64_t start;
+	uint64_t child;
+};
+
+struct profile_entry {
+	const char *domain;
+	const char *name;
+	unsigned long calls;
+	uint64_t total;
+	uint64_t self;
+	uint64_t bytes;
+};
+
+static bool enabled = false;
+static struct profile_frame stack[MAX_DEPTH];
+static unsigned int depth;
+static struct profile_entry *entries;
+static size_t entries_len;
+static size_t entries_size;
+
+static uint64_t get_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void profile_enable(void)
+{
+	enabled = true;
+}
+
+void profile_start(void)
+{
+	if (!enabled)
+		return;
+
+	if (depth < MAX_DEPTH) {
+		stack[depth].start = get_nsec();
+		stack[depth].child = 0;
+	}
+
+	depth++;
+}
+
+static size_t entry_hash(const char *domain, const char *name, size_t size)
+{
+	uintptr_t val = (uintptr_t) domain * 31 + (uintptr_t) name;
+
+	return (val ^ (val >> 17)) * 2654435761U & (size - 1);
+}
+
+static struct profile_entry *entry_lookup(const char *domain,
+							const char *name)
+{
+	struct profile_entry *entry;
+	size_t i;
+
+	/* Open addressing table, kept at most half full */
+	if (entries_len * 2 >= entries_size) {
+		struct profile_entry *old = entries;
+		size_t old_size = entries_size;
+
+		entries_size = entries_size ? entries_size * 2 : 256;
+		entries = new0(struct profile_entry, entries_size);
+		entries_len = 0;
+
+		for (i = 0; i < old_size; i++) {
+			if (!old[i].domain)
+				continue;
+
+			entry = entry_lookup(old[i].domain, old[i].name);
+			*entry = old[i];
+		}
+
+		free(old);
+	}
+
+	i = entry_hash(domain, name, entries_size);
+
+	while (entries[i].domain) {
+		if (entries[i].domain == domain && entries[i].name == name)
+			return &entries[i];
+
+		i = (i + 1) & (entries_size - 1);
+	}
+
+	entries[i].domain = domain;
+	entries[i].name = name;
+	entries_len++;
+
+	return &entries[i];
+}
+
+void profile_stop(const char *domain, const char *name, uint32_t size)
+{
+	struct profile_entry *entry;
+	uint64_t elapsed;
+
+	if (!enabled || !depth)
+		return;
+
+	depth--;
+
+	if (depth >= MAX_DEPTH)
+		return;
+
+	elapsed = get_nsec() - stack[depth].start;
+
+	if (depth > 0)
+		stack[depth - 1].child += elapsed;
+
+	entry = entry_lookup(domain, name ? name : "Unknown");
+	entry->calls++;
+	entry->total += elapsed;
+	entry->self += elapsed > stack[depth].child ?
+					elapsed - stack[depth].child : 0;
+	entry->bytes += size;
+}
+
+static int entry_compare(const void *a, const void *b)
+{
+	const struct profile_entry *entry_a = a;
+	const struct profile_entry *entry_b = b;
+
+	if (entry_a->self != entry_b->self)
+		return entry_a->self < entry_b->self ? 1 : -1;
+
+	return 0;
+}
+
+void profile_report(void)
+{
+	struct profile_entry *list;
+	unsigned long calls = 0;
+	uint64_t self = 0;
+	size_t i, len = 0;
+
+	if (!enabled)
+		return;
+
+	list = new0(struct profile_entry, entries_len + 1);
+
+	for (i = 0; i < entries_size; i++) {
+		if (!entries[i].domain)
+			continue;
+
+		list[len++] = entries[i];
+		calls += entries[i].calls;
+		self += entries[i].self;
+	}
+
+	qsort(list, len, sizeof(*list), entry_compare);
+
+	/* Report goes to stderr since stdout may have been the pager */
+	fprintf(stderr, "\nDecoder profile: %lu calls, %llu.%03llu msec\n\n",
+			calls, (unsigned long long) self / 1000000,
+			(unsigned long long) self / 1000 % 1000);
+	fprintf(stderr, "%10s %10s %5s %10s %8s %12s  %s\n", "Self msec",
+			"Total msec", "%", "Calls", "ns/call", "Bytes",
+			"Decoder");
+
+	for (i = 0; i < len; i++) {
+		struct profile_entry *entry = &list[i];
+
+		fprintf(stderr, "%6llu.%03llu %6llu.%03llu %5.1f %10lu %8llu "
+					"%12llu  %s: %s\n",
+			(unsigned long long) entry->self / 1000000,
+			(unsigned long long) entry->self / 1000 % 1000,
+			(unsigned long long) entry->total / 1000000,
+			(unsigned long long) entry->total / 1000 % 1000,
+			self ? entry->self * 100.0 / self : 0.0,
+			entry->calls,
+			(unsigned long long) (entry->total / entry->calls),
+			(unsigned long long) entry->bytes,
+			entry->domain, entry->name);
+	}
+
+	free(list);
+	free(entries);
+	entries = NULL;
+	entries_len = 0;
+	entries_size = 0;
+}
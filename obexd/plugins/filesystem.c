@@ -39,7 +39,9 @@
 #include <sys/sendfile.h>
 #include <fcntl.h>
 #include <sys/wait.h>
+#include <sys/eventfd.h>
 #include <inttypes.h>
+#include <pthread.h>
 
 #include <glib.h>
 
@@ -49,6 +51,10 @@
 #include "obexd/src/mimetype.h"
 #include "filesystem.h"
 
+#define FILE_IO_CHUNK		(64 * 1024)
+#define FILE_READ_AHEAD		(1024 * 1024)
+#define FILE_WRITE_BEHIND	(1024 * 1024)
+
 #define EOL_CHARS "\n"
 
 #define FL_VERSION "<?xml version=\"1.0\" encoding=\"UTF-8\"?>" EOL_CHARS
@@ -232,28 +238,363 @@ static int filesystem_close(void *object)
 	return 0;
 }
 
-static ssize_t filesystem_read(void *object, void *buf, size_t count)
+/*
+ * Regular files are read and written by a worker thread so that slow storage
+ * doesn't stall the main loop: GET data is read ahead of what has been sent
+ * and PUT data is queued in a ring and written behind the transfer. Once an
+ * operation returned -EAGAIN the worker wakes up obexd through notify_fd.
+ */
+struct file_object {
+	int fd;
+	gboolean writer;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int notify_fd;
+	guint notify_id;
+	uint8_t *buf;		/* Write ring or read scratch buffer */
+	int64_t offset;		/* Position of file_read */
+	int64_t size;
+	int64_t consumed;	/* End of the data handed to obexd */
+	int64_t cached;		/* End of the data read by the worker */
+	size_t head;		/* Moved by the main loop only */
+	size_t tail;		/* Moved by the worker only */
+	int err;
+	gboolean waiting;
+	gboolean quit;
+};
+
+static void file_wakeup(struct file_object *obj)
+{
+	uint64_t value = 1;
+
+	if (!obj->waiting)
+		return;
+
+	obj->waiting = FALSE;
+
+	if (write(obj->notify_fd, &value, sizeof(value)) < 0)
+		error("Unable to wake up file I/O: %s (%d)", strerror(errno),
+									errno);
+}
+
+static void *file_read_thread(void *user_data)
 {
+	struct file_object *obj = user_data;
+	int64_t offset;
 	ssize_t ret;
+	size_t len;
+	int err;
 
-	ret = read(GPOINTER_TO_INT(object), buf, count);
-	if (ret < 0)
-		return -errno;
+	pthread_mutex_lock(&obj->mutex);
+
+	while (!obj->quit && obj->cached < obj->size) {
+		if (obj->cached - obj->consumed >= FILE_READ_AHEAD) {
+			pthread_cond_wait(&obj->cond, &obj->mutex);
+			continue;
+		}
+
+		offset = obj->cached;
+		len = MIN(obj->size - offset, FILE_IO_CHUNK);
+
+		pthread_mutex_unlock(&obj->mutex);
+
+		/* Only pulls the data into the page cache */
+		ret = pread(obj->fd, obj->buf, len, offset);
+		err = ret < 0 ? -errno : 0;
+
+		pthread_mutex_lock(&obj->mutex);
+
+		if (err == -EINTR)
+			continue;
+
+		if (err < 0) {
+			obj->err = err;
+			break;
+		}
+
+		/* Truncated since it was opened */
+		if (ret == 0) {
+			obj->size = obj->cached;
+			break;
+		}
+
+		obj->cached += ret;
+		file_wakeup(obj);
+	}
+
+	file_wakeup(obj);
+
+	pthread_mutex_unlock(&obj->mutex);
+
+	return NULL;
+}
+
+static void *file_write_thread(void *user_data)
+{
+	struct file_object *obj = user_data;
+	size_t offset, len;
+	ssize_t ret;
+	int err;
+
+	pthread_mutex_lock(&obj->mutex);
+
+	while (TRUE) {
+		while (!obj->quit && obj->head == obj->tail)
+			pthread_cond_wait(&obj->cond, &obj->mutex);
+
+		if (obj->quit)
+			break;
+
+		offset = obj->tail & (FILE_WRITE_BEHIND - 1);
+		len = MIN(obj->head - obj->tail, FILE_WRITE_BEHIND - offset);
+		len = MIN(len, FILE_IO_CHUNK);
+
+		pthread_mutex_unlock(&obj->mutex);
+
+		ret = write(obj->fd, obj->buf + offset, len);
+		err = ret < 0 ? -errno : 0;
+
+		pthread_mutex_lock(&obj->mutex);
+
+		if (err == -EINTR)
+			continue;
+
+		if (err < 0) {
+			obj->err = err;
+			break;
+		}
+
+		obj->tail += ret;
+		file_wakeup(obj);
+	}
+
+	file_wakeup(obj);
+
+	pthread_mutex_unlock(&obj->mutex);
+
+	return NULL;
+}
+
+static gboolean file_notify(GIOChannel *io, GIOCondition cond,
+							gpointer user_data)
+{
+	struct file_object *obj = user_data;
+	uint64_t value;
+	int err;
+
+	if (read(obj->notify_fd, &value, sizeof(value)) < 0)
+		return TRUE;
+
+	pthread_mutex_lock(&obj->mutex);
+	err = obj->err;
+	pthread_mutex_unlock(&obj->mutex);
+
+	obex_object_set_io_flags(obj, obj->writer ? G_IO_OUT : G_IO_IN, err);
+
+	return TRUE;
+}
+
+static void *file_open(const char *name, int oflag, mode_t mode,
+					void *context, size_t *size, int *err)
+{
+	struct file_object *obj;
+	struct stat st;
+	GIOChannel *io;
+	void *object;
+	int ret;
+
+	object = filesystem_open(name, oflag, mode, context, size, err);
+	if (object == NULL)
+		return NULL;
+
+	obj = g_new0(struct file_object, 1);
+	obj->fd = GPOINTER_TO_INT(object);
+	obj->writer = (oflag & O_ACCMODE) != O_RDONLY;
+
+	if (!obj->writer) {
+		if (fstat(obj->fd, &st) < 0) {
+			ret = -errno;
+			goto failed;
+		}
+
+		obj->size = st.st_size;
+	}
+
+	obj->notify_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (obj->notify_fd < 0) {
+		ret = -errno;
+		goto failed;
+	}
+
+	obj->buf = g_malloc(obj->writer ? FILE_WRITE_BEHIND : FILE_IO_CHUNK);
+
+	pthread_mutex_init(&obj->mutex, NULL);
+	pthread_cond_init(&obj->cond, NULL);
+
+	ret = pthread_create(&obj->thread, NULL, obj->writer ?
+				file_write_thread : file_read_thread, obj);
+	if (ret) {
+		ret = -ret;
+		pthread_cond_destroy(&obj->cond);
+		pthread_mutex_destroy(&obj->mutex);
+		close(obj->notify_fd);
+		g_free(obj->buf);
+		goto failed;
+	}
+
+	io = g_io_channel_unix_new(obj->notify_fd);
+	obj->notify_id = g_io_add_watch(io, G_IO_IN, file_notify, obj);
+	g_io_channel_unref(io);
+
+	return obj;
+
+failed:
+	error("Unable to start file I/O: %s (%d)", strerror(-ret), -ret);
+
+	if (err)
+		*err = ret;
+
+	filesystem_close(object);
+	g_free(obj);
+
+	return NULL;
+}
+
+static int file_close(void *object)
+{
+	struct file_object *obj = object;
+	int err;
+
+	/* Data not flushed yet only belongs to aborted transfers */
+	pthread_mutex_lock(&obj->mutex);
+	obj->quit = TRUE;
+	pthread_cond_signal(&obj->cond);
+	pthread_mutex_unlock(&obj->mutex);
+
+	pthread_join(obj->thread, NULL);
+
+	g_source_remove(obj->notify_id);
+	close(obj->notify_fd);
+
+	pthread_cond_destroy(&obj->cond);
+	pthread_mutex_destroy(&obj->mutex);
+
+	err = filesystem_close(GINT_TO_POINTER(obj->fd));
+
+	g_free(obj->buf);
+	g_free(obj);
+
+	return err;
+}
+
+static ssize_t file_ready(void *object, int64_t offset, size_t count)
+{
+	struct file_object *obj = object;
+	ssize_t ret;
+
+	pthread_mutex_lock(&obj->mutex);
+
+	if (obj->err < 0)
+		ret = obj->err;
+	else if (obj->cached >= obj->size)
+		ret = count;
+	else if (obj->cached > offset)
+		ret = MIN((int64_t) count, obj->cached - offset);
+	else {
+		obj->waiting = TRUE;
+		ret = -EAGAIN;
+	}
+
+	if (ret > 0 && offset + ret > obj->consumed) {
+		obj->consumed = offset + ret;
+		pthread_cond_signal(&obj->cond);
+	}
+
+	pthread_mutex_unlock(&obj->mutex);
 
 	return ret;
 }
 
-static ssize_t filesystem_write(void *object, const void *buf, size_t count)
+static ssize_t file_read(void *object, void *buf, size_t count)
 {
+	struct file_object *obj = object;
 	ssize_t ret;
 
-	ret = write(GPOINTER_TO_INT(object), buf, count);
+	ret = file_ready(obj, obj->offset, count);
+	if (ret < 0)
+		return ret;
+
+	ret = pread(obj->fd, buf, ret, obj->offset);
 	if (ret < 0)
 		return -errno;
 
+	obj->offset += ret;
+
 	return ret;
 }
 
+static int file_get_fd(void *object)
+{
+	struct file_object *obj = object;
+
+	return obj->fd;
+}
+
+static ssize_t file_write(void *object, const void *buf, size_t count)
+{
+	struct file_object *obj = object;
+	size_t space, offset, len;
+	int err;
+
+	pthread_mutex_lock(&obj->mutex);
+
+	err = obj->err;
+	space = FILE_WRITE_BEHIND - (obj->head - obj->tail);
+	if (err == 0 && space == 0) {
+		obj->waiting = TRUE;
+		err = -EAGAIN;
+	}
+
+	pthread_mutex_unlock(&obj->mutex);
+
+	if (err < 0)
+		return err;
+
+	/* Only the main loop moves head so the free space is ours to fill */
+	count = MIN(count, space);
+	offset = obj->head & (FILE_WRITE_BEHIND - 1);
+	len = MIN(count, FILE_WRITE_BEHIND - offset);
+
+	memcpy(obj->buf + offset, buf, len);
+	memcpy(obj->buf, (const uint8_t *) buf + len, count - len);
+
+	pthread_mutex_lock(&obj->mutex);
+	obj->head += count;
+	pthread_cond_signal(&obj->cond);
+	pthread_mutex_unlock(&obj->mutex);
+
+	return count;
+}
+
+static int file_flush(void *object)
+{
+	struct file_object *obj = object;
+	int err;
+
+	pthread_mutex_lock(&obj->mutex);
+
+	err = obj->err;
+	if (err == 0 && obj->head != obj->tail) {
+		obj->waiting = TRUE;
+		err = -EAGAIN;
+	}
+
+	pthread_mutex_unlock(&obj->mutex);
+
+	return err;
+}
+
 static int filesystem_rename(const char *name, const char *destname)
 {
 	int ret;
@@ -656,10 +997,13 @@ done:
 }
 
 static struct obex_mime_type_driver file = {
-	.open = filesystem_open,
-	.close = filesystem_close,
-	.read = filesystem_read,
-	.write = filesystem_write,
+	.open = file_open,
+	.close = file_close,
+	.read = file_read,
+	.ready = file_ready,
+	.get_fd = file_get_fd,
+	.write = file_write,
+	.flush = file_flush,
 	.remove = remove,
 	.move = filesystem_rename,
 	.copy = filesystem_copy,
@@ -39,11 +39,13 @@ struct obex_session {
 	const void *nonhdr;
 	size_t nonhdr_len;
 	guint get_rsp;
+	guint put_rsp;
 	uint8_t *buf;
 	int64_t pending;
 	int64_t offset;
 	int64_t size;
 	void *object;
+	struct obex_map *map;	/* Window of the object sent without copying */
 	gboolean aborted;
 	int err;
 	struct obex_service_driver *service;
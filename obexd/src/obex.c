@@ -36,6 +36,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <inttypes.h>
 
@@ -54,6 +55,9 @@
 #include "service.h"
 #include "transport.h"
 
+/* Size of the file windows mapped for GET, a multiple of the page size */
+#define MAP_WINDOW_SIZE (4 * 1024 * 1024)
+
 typedef struct {
 	uint8_t  version;
 	uint8_t  flags;
@@ -126,10 +130,50 @@ static void os_session_mark_aborted(struct obex_session *os)
 	os->aborted = (os->size != os->offset);
 }
 
+/*
+ * A window stays mapped while the session or gobex, which may still be
+ * writing a body pointing into it, holds a reference.
+ */
+struct obex_map {
+	void *addr;
+	size_t len;
+	int64_t offset;
+	int refs;
+};
+
+static struct obex_map *map_ref(struct obex_map *map)
+{
+	map->refs++;
+
+	return map;
+}
+
+static void map_unref(gpointer data)
+{
+	struct obex_map *map = data;
+
+	if (--map->refs > 0)
+		return;
+
+	munmap(map->addr, map->len);
+	g_free(map);
+}
+
+static void os_unmap(struct obex_session *os)
+{
+	if (os->map == NULL)
+		return;
+
+	map_unref(os->map);
+	os->map = NULL;
+}
+
 static void os_reset_session(struct obex_session *os)
 {
 	os_session_mark_aborted(os);
 
+	os_unmap(os);
+
 	if (os->object) {
 		os->driver->set_io_watch(os->object, NULL, NULL);
 		os->driver->close(os->object);
@@ -168,6 +212,8 @@ static void os_reset_session(struct obex_session *os)
 		os->get_rsp = 0;
 	}
 
+	os->put_rsp = 0;
+
 	os->object = NULL;
 	os->driver = NULL;
 	os->aborted = FALSE;
@@ -331,10 +377,11 @@ static ssize_t driver_write(struct obex_session *os)
 
 		w = os->driver->write(os->object, os->buf + len, os->pending);
 		if (w < 0) {
-			error("write(): %s (%zd)", strerror(-w), -w);
+			if (w != -EAGAIN)
+				error("write(): %s (%zd)", strerror(-w), -w);
 			if (w == -EINTR)
 				continue;
-			else if (w == -EINVAL)
+			else if (w == -EINVAL || w == -EAGAIN)
 				memmove(os->buf, os->buf + len, os->pending);
 
 			return w;
@@ -371,6 +418,7 @@ static gssize driver_read(struct obex_session *os, void *buf, gsize size)
 		if (len == -EAGAIN)
 			os->driver->set_io_watch(os->object, handle_async_io,
 									os);
+		return len;
 	}
 
 	os->offset += len;
@@ -393,27 +441,196 @@ static gssize send_data(void *buf, gsize size, gpointer user_data)
 	return driver_read(os, buf, size);
 }
 
-static void transfer_complete(GObex *obex, GError *err, gpointer user_data)
+static gboolean driver_can_map(struct obex_session *os)
+{
+	struct stat st;
+	int fd;
+
+	if (os->driver->get_fd == NULL)
+		return FALSE;
+
+	fd = os->driver->get_fd(os->object);
+	if (fd < 0 || fstat(fd, &st) < 0)
+		return FALSE;
+
+	return S_ISREG(st.st_mode);
+}
+
+static int driver_map(struct obex_session *os)
+{
+	int fd = os->driver->get_fd(os->object);
+	struct stat st;
+	void *addr;
+	size_t len;
+	int64_t start;
+
+	os_unmap(os);
+
+	if (fstat(fd, &st) < 0)
+		return -errno;
+
+	if (os->offset >= st.st_size)
+		return 0;
+
+	start = os->offset & ~((int64_t) MAP_WINDOW_SIZE - 1);
+	len = MIN(st.st_size - start, MAP_WINDOW_SIZE);
+
+	addr = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, start);
+	if (addr == MAP_FAILED)
+		return -errno;
+
+	madvise(addr, len, MADV_WILLNEED);
+
+	os->map = g_new0(struct obex_map, 1);
+	os->map->addr = addr;
+	os->map->len = len;
+	os->map->offset = start;
+	os->map->refs = 1;
+
+	return len;
+}
+
+/*
+ * Regular files are mapped and handed to gobex as a reference so the data
+ * goes from the page cache to the socket without being copied in between.
+ * The mapping is only accessed by the kernel while sending, so a file
+ * truncated in the meantime results in a send error rather than SIGBUS.
+ */
+static gssize send_body(const void **buf, gsize size, gpointer *ref,
+							gpointer user_data)
 {
 	struct obex_session *os = user_data;
+	int64_t end;
+	gsize len;
+	int err;
 
-	DBG("");
+	DBG("name=%s type=%s file=%p size=%zu", os->name, os->type, os->object,
+									size);
 
-	if (err != NULL) {
-		error("transfer failed: %s\n", err->message);
-		goto reset;
+	if (os->aborted)
+		return os->err < 0 ? os->err : -EPERM;
+
+	if (os->object == NULL)
+		return -EIO;
+
+	if (os->service->progress != NULL)
+		os->service->progress(os, os->service_data);
+
+	if (os->map == NULL || os->offset >= os->map->offset + os->map->len) {
+		err = driver_map(os);
+		if (err <= 0) {
+			if (err < 0)
+				error("mmap(): %s (%d)", strerror(-err), -err);
+			return err;
+		}
 	}
 
-	if (os->object && os->driver && os->driver->flush) {
-		if (os->driver->flush(os->object) == -EAGAIN) {
-			g_obex_suspend(os->obex);
+	end = os->map->offset + os->map->len;
+
+	len = MIN((int64_t) size, end - os->offset);
+
+	/* Don't fault in pages the driver hasn't read ahead yet */
+	if (os->driver->ready) {
+		gssize ret = os->driver->ready(os->object, os->offset, len);
+
+		if (ret == -EAGAIN)
 			os->driver->set_io_watch(os->object, handle_async_io,
 									os);
-			return;
+		if (ret <= 0)
+			return ret;
+
+		len = ret;
+	}
+
+	*buf = (uint8_t *) os->map->addr + (os->offset - os->map->offset);
+	*ref = map_ref(os->map);
+
+	os->offset += len;
+
+	DBG("%zu mapped", len);
+
+	return len;
+}
+
+static int driver_flush(struct obex_session *os)
+{
+	ssize_t ret;
+	int err;
+
+	/* Data held back by a full ring goes first */
+	if (os->pending > 0) {
+		ret = driver_write(os);
+		if (ret < 0) {
+			err = ret;
+			goto done;
 		}
 	}
 
-reset:
+	err = os->driver->flush(os->object);
+
+done:
+	if (err < 0 && err != -EAGAIN) {
+		error("flush(): %s (%d)", strerror(-err), -err);
+		os->err = err;
+		os->aborted = TRUE;
+	}
+
+	return err;
+}
+
+static gboolean handle_async_flush(void *object, int flags, int err,
+							void *user_data)
+{
+	struct obex_session *os = user_data;
+
+	if (err == 0) {
+		err = driver_flush(os);
+	} else {
+		os->err = err;
+		os->aborted = TRUE;
+	}
+
+	if (err == -EAGAIN)
+		return TRUE;
+
+	g_obex_resume(os->obex);
+	g_obex_put_rsp_flushed(os->put_rsp, err);
+
+	return FALSE;
+}
+
+/* Holds back the final PUT response until the data is written */
+static int flush_data(gpointer user_data)
+{
+	struct obex_session *os = user_data;
+	int err;
+
+	DBG("name=%s type=%s file=%p", os->name, os->type, os->object);
+
+	if (os->object == NULL || os->driver == NULL ||
+						os->driver->flush == NULL)
+		return 0;
+
+	err = driver_flush(os);
+	if (err != -EAGAIN)
+		return err;
+
+	/* Replaces handle_async_io in case recv_data hit a full ring */
+	os->driver->set_io_watch(os->object, NULL, NULL);
+	os->driver->set_io_watch(os->object, handle_async_flush, os);
+
+	return -EAGAIN;
+}
+
+static void transfer_complete(GObex *obex, GError *err, gpointer user_data)
+{
+	struct obex_session *os = user_data;
+
+	DBG("");
+
+	if (err != NULL)
+		error("transfer failed: %s\n", err->message);
+
 	os_reset_session(os);
 }
 
@@ -468,8 +685,12 @@ done:
 		g_obex_packet_add_header(rsp, hdr);
 	}
 
-	g_obex_get_rsp_pkt(os->obex, rsp, send_data, transfer_complete, os,
-									NULL);
+	if (driver_can_map(os))
+		g_obex_get_rsp_pkt_ref(os->obex, rsp, send_body, map_unref,
+						transfer_complete, os, NULL);
+	else
+		g_obex_get_rsp_pkt(os->obex, rsp, send_data, transfer_complete,
+								os, NULL);
 
 	os->headers_sent = TRUE;
 
@@ -856,8 +1077,9 @@ static void cmd_put(GObex *obex, GObexPacket *req, gpointer user_data)
 
 	err = os->service->put(os, os->service_data);
 	if (err == 0) {
-		g_obex_put_rsp(obex, req, recv_data, transfer_complete, os,
-						NULL, G_OBEX_HDR_INVALID);
+		os->put_rsp = g_obex_put_rsp_flush(obex, req, recv_data,
+					flush_data, transfer_complete, os,
+					NULL, G_OBEX_HDR_INVALID);
 		print_event(G_OBEX_OP_PUT, G_OBEX_RSP_CONTINUE);
 		return;
 	}
@@ -310,10 +310,20 @@ struct pending_req {
 	void *data;
 	size_t data_size;
 	struct avdtp_stream *stream; /* Set if the request targeted a stream */
-	guint timeout;
+	gint64 queued;		/* Submission time */
+	gint64 sent;		/* Transmission time */
+	gint64 deadline;	/* Response timeout */
 	gboolean collided;
 };
 
+struct signal_stats {
+	unsigned int count;
+	unsigned int timeouts;
+	gint64 queue_time;	/* Total time spent waiting to be sent */
+	gint64 rtt;		/* Total time spent waiting for a response */
+	gint64 max_rtt;
+};
+
 struct avdtp_remote_sep {
 	uint8_t seid;
 	uint8_t type;
@@ -375,6 +385,7 @@ struct avdtp_stream {
 	gboolean delay_reporting;
 	uint16_t delay;		/* AVDTP 1.3 Delay Reporting feature */
 	gboolean starting;	/* only valid while sep state == OPEN */
+	gint64 start_time;	/* When streaming was requested */
 };
 
 /* Structure describing an AVDTP connection between two devices */
@@ -410,6 +421,13 @@ struct avdtp {
 
 	struct discover_callback *discover;
 	struct pending_req *req;
+	guint req_timer;	/* Shared by all requests */
+	gint64 req_timer_deadline;
+
+	struct queue *out;	/* Packets waiting for the socket to drain */
+	guint out_id;
+
+	struct signal_stats stats[AVDTP_DELAY_REPORT + 1];
 
 	guint dc_timer;
 	int dc_timeout;
@@ -456,23 +474,137 @@ static const char *avdtp_statestr(avdtp_state_t state)
 	}
 }
 
-static gboolean try_send(int sk, void *data, size_t len)
+static const char *avdtp_sigstr(uint8_t signal_id)
 {
-	int err;
+	switch (signal_id) {
+	case AVDTP_DISCOVER:
+		return "DISCOVER";
+	case AVDTP_GET_CAPABILITIES:
+		return "GET_CAPABILITIES";
+	case AVDTP_SET_CONFIGURATION:
+		return "SET_CONFIGURATION";
+	case AVDTP_GET_CONFIGURATION:
+		return "GET_CONFIGURATION";
+	case AVDTP_RECONFIGURE:
+		return "RECONFIGURE";
+	case AVDTP_OPEN:
+		return "OPEN";
+	case AVDTP_START:
+		return "START";
+	case AVDTP_CLOSE:
+		return "CLOSE";
+	case AVDTP_SUSPEND:
+		return "SUSPEND";
+	case AVDTP_ABORT:
+		return "ABORT";
+	case AVDTP_SECURITY_CONTROL:
+		return "SECURITY_CONTROL";
+	case AVDTP_GET_ALL_CAPABILITIES:
+		return "GET_ALL_CAPABILITIES";
+	case AVDTP_DELAY_REPORT:
+		return "DELAY_REPORT";
+	default:
+		return "<unknown signal>";
+	}
+}
+
+struct out_packet {
+	size_t len;
+	uint8_t data[0];
+};
+
+static int send_packet(int sk, const void *data, size_t len)
+{
+	ssize_t err;
 
 	do {
-		err = send(sk, data, len, 0);
+		err = send(sk, data, len, MSG_DONTWAIT);
 	} while (err < 0 && errno == EINTR);
 
-	if (err < 0) {
-		error("send: %s (%d)", strerror(errno), errno);
-		return FALSE;
-	} else if ((size_t) err != len) {
-		error("try_send: complete buffer not sent (%d/%zu bytes)",
+	if (err < 0)
+		return -errno;
+
+	if ((size_t) err != len) {
+		error("try_send: complete buffer not sent (%zd/%zu bytes)",
 								err, len);
-		return FALSE;
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static gboolean session_writable(GIOChannel *chan, GIOCondition cond,
+								gpointer data)
+{
+	struct avdtp *session = data;
+	int sk = g_io_channel_unix_get_fd(chan);
+	struct out_packet *pkt;
+
+	if (cond & (G_IO_ERR | G_IO_HUP | G_IO_NVAL))
+		goto failed;
+
+	while ((pkt = queue_peek_head(session->out))) {
+		int err = send_packet(sk, pkt->data, pkt->len);
+
+		if (err == -EAGAIN)
+			return TRUE;
+
+		if (err < 0) {
+			error("send: %s (%d)", strerror(-err), -err);
+			goto failed;
+		}
+
+		queue_pop_head(session->out);
+		free(pkt);
 	}
 
+	session->out_id = 0;
+
+	return FALSE;
+
+failed:
+	/* Disconnection is handled by session_cb */
+	queue_remove_all(session->out, NULL, NULL, free);
+	session->out_id = 0;
+
+	return FALSE;
+}
+
+/*
+ * Never block the mainloop on a congested signalling channel, packets which
+ * cannot be sent right away are kept in order until the socket drains.
+ */
+static gboolean try_send(struct avdtp *session, void *data, size_t len)
+{
+	int sk = g_io_channel_unix_get_fd(session->io);
+	struct out_packet *pkt;
+
+	if (queue_isempty(session->out)) {
+		int err = send_packet(sk, data, len);
+
+		if (!err)
+			return TRUE;
+
+		if (err != -EAGAIN) {
+			error("send: %s (%d)", strerror(-err), -err);
+			return FALSE;
+		}
+	}
+
+	pkt = malloc(sizeof(*pkt) + len);
+	if (!pkt)
+		return FALSE;
+
+	pkt->len = len;
+	memcpy(pkt->data, data, len);
+	queue_push_tail(session->out, pkt);
+
+	if (!session->out_id)
+		session->out_id = g_io_add_watch(session->io, G_IO_OUT |
+						G_IO_ERR | G_IO_HUP |
+						G_IO_NVAL, session_writable,
+						session);
+
 	return TRUE;
 }
 
@@ -483,15 +615,12 @@ static gboolean avdtp_send(struct avdtp *session, uint8_t transaction,
 	unsigned int cont_fragments, sent;
 	struct avdtp_start_header start;
 	struct avdtp_continue_header cont;
-	int sock;
 
 	if (session->io == NULL) {
 		error("avdtp_send: session is closed");
 		return FALSE;
 	}
 
-	sock = g_io_channel_unix_get_fd(session->io);
-
 	/* Single packet - no fragmentation */
 	if (sizeof(struct avdtp_single_header) + len <= session->omtu) {
 		struct avdtp_single_header single;
@@ -506,7 +635,7 @@ static gboolean avdtp_send(struct avdtp *session, uint8_t transaction,
 		memcpy(session->buf, &single, sizeof(single));
 		memcpy(session->buf + sizeof(single), data, len);
 
-		return try_send(sock, session->buf, sizeof(single) + len);
+		return try_send(session, session->buf, sizeof(single) + len);
 	}
 
 	/* Check if there is enough space to start packet */
@@ -533,7 +662,7 @@ static gboolean avdtp_send(struct avdtp *session, uint8_t transaction,
 	memcpy(session->buf + sizeof(start), data,
 					session->omtu - sizeof(start));
 
-	if (!try_send(sock, session->buf, session->omtu))
+	if (!try_send(session, session->buf, session->omtu))
 		return FALSE;
 
 	DBG("first packet with %zu bytes sent", session->omtu - sizeof(start));
@@ -561,7 +690,8 @@ static gboolean avdtp_send(struct avdtp *session, uint8_t transaction,
 		memcpy(session->buf, &cont, sizeof(cont));
 		memcpy(session->buf + sizeof(cont), data + sent, to_copy);
 
-		if (!try_send(sock, session->buf, to_copy + sizeof(cont)))
+		if (!try_send(session, session->buf,
+						to_copy + sizeof(cont)))
 			return FALSE;
 
 		sent += to_copy;
@@ -574,12 +704,31 @@ static void pending_req_free(void *data)
 {
 	struct pending_req *req = data;
 
-	if (req->timeout)
-		g_source_remove(req->timeout);
 	g_free(req->data);
 	g_free(req);
 }
 
+static void signal_stats_update(struct avdtp *session, struct pending_req *req)
+{
+	struct signal_stats *stats;
+	gint64 rtt;
+
+	if (req->signal_id >= G_N_ELEMENTS(session->stats))
+		return;
+
+	stats = &session->stats[req->signal_id];
+	rtt = g_get_monotonic_time() - req->sent;
+
+	stats->count++;
+	stats->queue_time += req->sent - req->queued;
+	stats->rtt += rtt;
+	stats->max_rtt = MAX(stats->max_rtt, rtt);
+
+	DBG("%s: queued %" G_GINT64_FORMAT " us rtt %" G_GINT64_FORMAT " us",
+					avdtp_sigstr(req->signal_id),
+					req->sent - req->queued, rtt);
+}
+
 static void close_stream(struct avdtp_stream *stream)
 {
 	int sock;
@@ -984,6 +1133,12 @@ static void avdtp_sep_set_state(struct avdtp *session,
 			stream->start_timer = 0;
 		}
 		stream->open_acp = FALSE;
+		if (stream->start_time) {
+			DBG("stream %p started in %" G_GINT64_FORMAT
+					" us", stream, g_get_monotonic_time() -
+					stream->start_time);
+			stream->start_time = 0;
+		}
 		break;
 	case AVDTP_STATE_CLOSING:
 	case AVDTP_STATE_ABORTING:
@@ -991,12 +1146,14 @@ static void avdtp_sep_set_state(struct avdtp *session,
 			g_source_remove(stream->start_timer);
 			stream->start_timer = 0;
 		}
+		stream->start_time = 0;
 		break;
 	case AVDTP_STATE_IDLE:
 		if (stream->start_timer) {
 			g_source_remove(stream->start_timer);
 			stream->start_timer = 0;
 		}
+		stream->start_time = 0;
 		if (session->pending_open == stream)
 			handle_transport_connect(session, NULL, 0, 0);
 		if (session->req && session->req->stream == stream)
@@ -1067,12 +1224,35 @@ static void remove_disconnect_timer(struct avdtp *session)
 	session->stream_setup = FALSE;
 }
 
+static void print_signal_stats(struct avdtp *session)
+{
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(session->stats); i++) {
+		struct signal_stats *stats = &session->stats[i];
+
+		if (!stats->count && !stats->timeouts)
+			continue;
+
+		DBG("%s: %u responses %u timeouts, avg queue %"
+			G_GINT64_FORMAT " us, avg rtt %" G_GINT64_FORMAT
+			" us, max rtt %" G_GINT64_FORMAT " us",
+			avdtp_sigstr(i), stats->count,
+			stats->timeouts,
+			stats->count ? stats->queue_time / stats->count : 0,
+			stats->count ? stats->rtt / stats->count : 0,
+			stats->max_rtt);
+	}
+}
+
 static void avdtp_free(void *data)
 {
 	struct avdtp *session = data;
 
 	DBG("%p", session);
 
+	print_signal_stats(session);
+
 	g_slist_free_full(session->streams, stream_free);
 
 	if (session->io) {
@@ -1085,9 +1265,17 @@ static void avdtp_free(void *data)
 		session->io_id = 0;
 	}
 
+	if (session->out_id)
+		g_source_remove(session->out_id);
+
+	queue_destroy(session->out, free);
+
 	if (session->dc_timer)
 		remove_disconnect_timer(session);
 
+	if (session->req_timer)
+		g_source_remove(session->req_timer);
+
 	if (session->req)
 		pending_req_free(session->req);
 
@@ -1113,6 +1301,13 @@ static void connection_lost(struct avdtp *session, int err)
 	g_slist_foreach(session->streams, (GFunc) release_stream, session);
 	session->streams = NULL;
 
+	if (session->out_id) {
+		g_source_remove(session->out_id);
+		session->out_id = 0;
+	}
+
+	queue_remove_all(session->out, NULL, NULL, free);
+
 	finalize_discovery(session, err);
 
 	avdtp_set_state(session, AVDTP_SESSION_STATE_DISCONNECTED);
@@ -2203,8 +2398,7 @@ static gboolean session_cb(GIOChannel *chan, GIOCondition cond,
 		return TRUE;
 	}
 
-	g_source_remove(session->req->timeout);
-	session->req->timeout = 0;
+	signal_stats_update(session, session->req);
 
 	switch (header->message_type) {
 	case AVDTP_MSG_TYPE_ACCEPT:
@@ -2366,6 +2560,7 @@ struct avdtp *avdtp_new(GIOChannel *chan, struct btd_device *device,
 	 * but just setting of the initial state */
 	session->state = AVDTP_SESSION_STATE_DISCONNECTED;
 	session->lseps = lseps;
+	session->out = queue_new();
 
 	session->version = get_version(session);
 
@@ -2536,9 +2731,50 @@ done:
 	return err;
 }
 
+static gboolean request_timeout(gpointer user_data);
+
+/*
+ * A single timer per session covers the pending request, it is left running
+ * when a response arrives and only re-armed if it fires before the deadline
+ * of the request pending at that time, instead of adding and removing a
+ * source for every signal.
+ */
+static void req_timer_start(struct avdtp *session, gint64 deadline)
+{
+	gint64 now = g_get_monotonic_time();
+	guint seconds;
+
+	if (session->req_timer) {
+		if (session->req_timer_deadline <= deadline)
+			return;
+
+		g_source_remove(session->req_timer);
+	}
+
+	seconds = (deadline - now + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC;
+
+	session->req_timer_deadline = now + seconds * G_USEC_PER_SEC;
+	session->req_timer = g_timeout_add_seconds(seconds, request_timeout,
+								session);
+}
+
 static gboolean request_timeout(gpointer user_data)
 {
 	struct avdtp *session = user_data;
+	struct pending_req *req = session->req;
+
+	session->req_timer = 0;
+
+	if (!req)
+		return FALSE;
+
+	if (g_get_monotonic_time() < req->deadline) {
+		req_timer_start(session, req->deadline);
+		return FALSE;
+	}
+
+	if (req->signal_id < G_N_ELEMENTS(session->stats))
+		session->stats[req->signal_id].timeouts++;
 
 	cancel_request(session, ETIMEDOUT);
 
@@ -2578,6 +2814,7 @@ static int send_req(struct avdtp *session, gboolean priority,
 	}
 
 	session->req = req;
+	req->sent = g_get_monotonic_time();
 
 	switch (req->signal_id) {
 	case AVDTP_ABORT:
@@ -2590,7 +2827,9 @@ static int send_req(struct avdtp *session, gboolean priority,
 		timeout = REQ_TIMEOUT;
 	}
 
-	req->timeout = g_timeout_add_seconds(timeout, request_timeout, session);
+	req->deadline = req->sent + timeout * G_USEC_PER_SEC;
+	req_timer_start(session, req->deadline);
+
 	return 0;
 
 failed:
@@ -2616,6 +2855,7 @@ static int send_request(struct avdtp *session, gboolean priority,
 	memcpy(req->data, buffer, size);
 	req->data_size = size;
 	req->stream = stream;
+	req->queued = g_get_monotonic_time();
 
 	return send_req(session, priority, req);
 }
@@ -3460,6 +3700,9 @@ int avdtp_start(struct avdtp *session, struct avdtp_stream *stream)
 	if (stream->lsep->state != AVDTP_STATE_OPEN)
 		return -EINVAL;
 
+	if (!stream->start_time)
+		stream->start_time = g_get_monotonic_time();
+
 	/* Recommendation 12:
 	 *  If the RD has configured and opened a stream it is also responsible
 	 *  to start the streaming via GAVDP_START.
@@ -0,0 +1,520 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  BlueZ contributors
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#include <glib.h>
+#include <sbc/sbc.h>
+
+#include "src/log.h"
+#include "src/shared/io.h"
+#include "src/shared/timeout.h"
+
+#include "pcm.h"
+
+#define PCM_RING_PERIODS	16
+#define MAX_FRAMES_PER_PACKET	15
+
+/*
+ * Packets are sent against the media clock: at most PCM_LEAD_US ahead of
+ * it, and the clock restarts when the client fell behind by more than
+ * PCM_LATE_US (an underrun or a pause).
+ */
+#define PCM_LEAD_US		20000
+#define PCM_LATE_US		100000
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+
+struct rtp_header {
+	unsigned cc:4;
+	unsigned x:1;
+	unsigned p:1;
+	unsigned v:2;
+
+	unsigned pt:7;
+	unsigned m:1;
+
+	uint16_t sequence_number;
+	uint32_t timestamp;
+	uint32_t ssrc;
+} __attribute__ ((packed));
+
+struct rtp_payload {
+	unsigned frame_count:4;
+	unsigned rfa0:1;
+	unsigned is_last_fragment:1;
+	unsigned is_first_fragment:1;
+	unsigned is_fragmented:1;
+} __attribute__ ((packed));
+
+#elif __BYTE_ORDER == __BIG_ENDIAN
+
+struct rtp_header {
+	unsigned v:2;
+	unsigned p:1;
+	unsigned x:1;
+	unsigned cc:4;
+
+	unsigned m:1;
+	unsigned pt:7;
+
+	uint16_t sequence_number;
+	uint32_t timestamp;
+	uint32_t ssrc;
+} __attribute__ ((packed));
+
+struct rtp_payload {
+	unsigned is_fragmented:1;
+	unsigned is_first_fragment:1;
+	unsigned is_last_fragment:1;
+	unsigned rfa0:1;
+	unsigned frame_count:4;
+} __attribute__ ((packed));
+
+#else
+#error "Unknown byte order"
+#endif
+
+struct media_packet_sbc {
+	struct rtp_header hdr;
+	struct rtp_payload payload;
+	uint8_t data[0];
+} __attribute__ ((packed));
+
+struct a2dp_pcm {
+	sbc_t sbc;
+	struct io *stream_io;
+	int ring_fd;
+	struct a2dp_pcm_ring *ring;
+	size_t map_size;
+	uint32_t size;
+	uint32_t tail;
+	int event_fd;
+	struct io *event_io;
+	size_t codesize;
+	size_t frame_len;
+	unsigned int frames_per_packet;
+	unsigned int samples_per_frame;
+	struct media_packet_sbc *mp;
+	size_t len;
+	uint8_t *bounce;
+	uint16_t seq;
+	uint32_t timestamp;
+	unsigned int rate;
+	uint64_t clock_start;
+	uint64_t clock_samples;
+	unsigned int pace_id;
+	bool blocked;
+};
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+/* Returns how long the next packet has to wait for the media clock */
+static uint64_t packet_delay(struct a2dp_pcm *pcm)
+{
+	uint64_t now = now_us();
+	uint64_t due;
+
+	due = pcm->clock_start + pcm->clock_samples * 1000000 / pcm->rate;
+
+	if (!pcm->clock_start || due + PCM_LATE_US < now) {
+		pcm->clock_start = now;
+		pcm->clock_samples = 0;
+		return 0;
+	}
+
+	if (due <= now + PCM_LEAD_US)
+		return 0;
+
+	return due - now - PCM_LEAD_US;
+}
+
+static const uint8_t *ring_frame(struct a2dp_pcm *pcm)
+{
+	uint32_t offset = pcm->tail & (pcm->size - 1);
+	uint32_t first;
+
+	if (offset + pcm->codesize <= pcm->size)
+		return &pcm->ring->data[offset];
+
+	/* Frame wraps around the end of the ring */
+	first = pcm->size - offset;
+	memcpy(pcm->bounce, &pcm->ring->data[offset], first);
+	memcpy(pcm->bounce + first, pcm->ring->data, pcm->codesize - first);
+
+	return pcm->bounce;
+}
+
+/* Returns whether a full period of PCM is waiting in the ring */
+static bool ring_ready(struct a2dp_pcm *pcm)
+{
+	size_t period = pcm->codesize * pcm->frames_per_packet;
+	uint32_t head, avail;
+
+	head = __atomic_load_n(&pcm->ring->head, __ATOMIC_ACQUIRE);
+	avail = head - pcm->tail;
+
+	if (avail > pcm->size) {
+		error("PCM ring overrun (%u bytes), resyncing", avail);
+		pcm->tail = head;
+		__atomic_store_n(&pcm->ring->tail, pcm->tail,
+							__ATOMIC_RELEASE);
+		return false;
+	}
+
+	return avail >= period;
+}
+
+static bool encode_packet(struct a2dp_pcm *pcm)
+{
+	uint8_t *dst = pcm->mp->data;
+	unsigned int i;
+
+	for (i = 0; i < pcm->frames_per_packet; i++) {
+		ssize_t written = 0;
+		ssize_t ret;
+
+		ret = sbc_encode(&pcm->sbc, ring_frame(pcm), pcm->codesize,
+					dst, pcm->frame_len, &written);
+		if (ret < 0) {
+			error("SBC encoding failed: %zd", ret);
+			return false;
+		}
+
+		pcm->tail += pcm->codesize;
+		dst += written;
+	}
+
+	__atomic_store_n(&pcm->ring->tail, pcm->tail, __ATOMIC_RELEASE);
+
+	pcm->mp->hdr.sequence_number = htons(pcm->seq++);
+	pcm->mp->hdr.timestamp = htonl(pcm->timestamp);
+	pcm->mp->payload.frame_count = pcm->frames_per_packet;
+	pcm->len = dst - (uint8_t *) pcm->mp;
+
+	pcm->timestamp += pcm->frames_per_packet * pcm->samples_per_frame;
+	pcm->clock_samples += pcm->frames_per_packet * pcm->samples_per_frame;
+
+	return true;
+}
+
+static bool pace_timeout(void *user_data);
+
+static bool next_packet(struct a2dp_pcm *pcm)
+{
+	uint64_t delay;
+
+	if (pcm->pace_id || !ring_ready(pcm))
+		return false;
+
+	delay = packet_delay(pcm);
+	if (!delay)
+		return encode_packet(pcm);
+
+	/* Round up so the timer never fires before the packet is due */
+	pcm->pace_id = timeout_add((delay + 999) / 1000, pace_timeout, pcm,
+									NULL);
+
+	return false;
+}
+
+/* Returns true if the stream is blocked and has a packet pending */
+static bool send_packets(struct a2dp_pcm *pcm)
+{
+	int fd = io_get_fd(pcm->stream_io);
+
+	while (pcm->len || next_packet(pcm)) {
+		ssize_t ret;
+
+		ret = send(fd, pcm->mp, pcm->len, MSG_DONTWAIT);
+		if (ret < 0) {
+			if (errno == EAGAIN)
+				return true;
+
+			error("Unable to send media packet: %s (%d)",
+						strerror(errno), errno);
+		}
+
+		pcm->len = 0;
+	}
+
+	return false;
+}
+
+static bool stream_writable(struct io *io, void *user_data)
+{
+	struct a2dp_pcm *pcm = user_data;
+
+	pcm->blocked = send_packets(pcm);
+
+	return pcm->blocked;
+}
+
+static void pcm_pump(struct a2dp_pcm *pcm)
+{
+	/* Keep the remaining data in the ring until the socket drains */
+	if (pcm->blocked)
+		return;
+
+	pcm->blocked = send_packets(pcm);
+	if (pcm->blocked)
+		io_set_write_handler(pcm->stream_io, stream_writable, pcm,
+									NULL);
+}
+
+static bool pace_timeout(void *user_data)
+{
+	struct a2dp_pcm *pcm = user_data;
+
+	pcm->pace_id = 0;
+	pcm_pump(pcm);
+
+	return false;
+}
+
+static bool event_read(struct io *io, void *user_data)
+{
+	struct a2dp_pcm *pcm = user_data;
+	uint64_t value;
+
+	if (read(pcm->event_fd, &value, sizeof(value)) < 0 &&
+							errno != EAGAIN) {
+		error("Unable to read PCM event: %s (%d)", strerror(errno),
+									errno);
+		return false;
+	}
+
+	pcm_pump(pcm);
+
+	return true;
+}
+
+static bool ring_init(struct a2dp_pcm *pcm)
+{
+	size_t period = pcm->codesize * pcm->frames_per_packet;
+
+	pcm->size = 1;
+	while (pcm->size < period * PCM_RING_PERIODS)
+		pcm->size <<= 1;
+
+	pcm->map_size = sizeof(*pcm->ring) + pcm->size;
+
+	pcm->ring_fd = memfd_create("bluez-pcm",
+					MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (pcm->ring_fd < 0)
+		return false;
+
+	if (ftruncate(pcm->ring_fd, pcm->map_size) < 0)
+		return false;
+
+	/* Clients must not be able to resize the mapping under us */
+	if (fcntl(pcm->ring_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+							F_SEAL_SEAL) < 0)
+		return false;
+
+	pcm->ring = mmap(NULL, pcm->map_size, PROT_READ | PROT_WRITE,
+						MAP_SHARED, pcm->ring_fd, 0);
+	if (pcm->ring == MAP_FAILED) {
+		pcm->ring = NULL;
+		return false;
+	}
+
+	pcm->ring->size = pcm->size;
+
+	return true;
+}
+
+static bool codec_init(struct a2dp_pcm *pcm, const uint8_t *config,
+						size_t size, uint16_t omtu)
+{
+	size_t payload;
+
+	if (sbc_init_a2dp(&pcm->sbc, 0L, config, size) < 0)
+		return false;
+
+	pcm->sbc.endian = SBC_LE;
+
+	pcm->codesize = sbc_get_codesize(&pcm->sbc);
+	pcm->frame_len = sbc_get_frame_length(&pcm->sbc);
+
+	switch (pcm->sbc.blocks) {
+	case SBC_BLK_4:
+		pcm->samples_per_frame = 4;
+		break;
+	case SBC_BLK_8:
+		pcm->samples_per_frame = 8;
+		break;
+	case SBC_BLK_12:
+		pcm->samples_per_frame = 12;
+		break;
+	default:
+		pcm->samples_per_frame = 16;
+		break;
+	}
+
+	pcm->samples_per_frame *= pcm->sbc.subbands == SBC_SB_4 ? 4 : 8;
+
+	switch (pcm->sbc.frequency) {
+	case SBC_FREQ_16000:
+		pcm->rate = 16000;
+		break;
+	case SBC_FREQ_32000:
+		pcm->rate = 32000;
+		break;
+	case SBC_FREQ_44100:
+		pcm->rate = 44100;
+		break;
+	default:
+		pcm->rate = 48000;
+		break;
+	}
+
+	if (omtu < sizeof(*pcm->mp))
+		return false;
+
+	payload = omtu - sizeof(*pcm->mp);
+
+	pcm->frames_per_packet = payload / pcm->frame_len;
+	if (pcm->frames_per_packet > MAX_FRAMES_PER_PACKET)
+		pcm->frames_per_packet = MAX_FRAMES_PER_PACKET;
+
+	if (!pcm->frames_per_packet)
+		return false;
+
+	pcm->mp = g_malloc0(omtu);
+	pcm->mp->hdr.v = 2;
+	pcm->mp->hdr.pt = 0x60;
+	pcm->mp->hdr.ssrc = htonl(1);
+
+	pcm->bounce = g_malloc(pcm->codesize);
+
+	return true;
+}
+
+struct a2dp_pcm *a2dp_pcm_new(const uint8_t *config, size_t size, int fd,
+							uint16_t omtu)
+{
+	struct a2dp_pcm *pcm;
+
+	pcm = g_new0(struct a2dp_pcm, 1);
+	pcm->ring_fd = -1;
+	pcm->event_fd = -1;
+
+	if (!codec_init(pcm, config, size, omtu)) {
+		error("Unable to setup SBC encoder");
+		goto fail;
+	}
+
+	if (!ring_init(pcm)) {
+		error("Unable to setup PCM ring: %s (%d)", strerror(errno),
+									errno);
+		goto fail;
+	}
+
+	pcm->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (pcm->event_fd < 0) {
+		error("Unable to create PCM eventfd: %s (%d)",
+						strerror(errno), errno);
+		goto fail;
+	}
+
+	pcm->stream_io = io_new(fd);
+	pcm->event_io = io_new(pcm->event_fd);
+	io_set_read_handler(pcm->event_io, event_read, pcm, NULL);
+
+	DBG("codesize %zu frame length %zu frames per packet %u ring %u",
+				pcm->codesize, pcm->frame_len,
+				pcm->frames_per_packet, pcm->size);
+
+	return pcm;
+
+fail:
+	a2dp_pcm_free(pcm);
+	return NULL;
+}
+
+void a2dp_pcm_free(struct a2dp_pcm *pcm)
+{
+	if (!pcm)
+		return;
+
+	if (pcm->pace_id)
+		timeout_remove(pcm->pace_id);
+
+	io_destroy(pcm->event_io);
+	io_destroy(pcm->stream_io);
+
+	if (pcm->event_fd >= 0)
+		close(pcm->event_fd);
+
+	if (pcm->ring)
+		munmap(pcm->ring, pcm->map_size);
+
+	if (pcm->ring_fd >= 0)
+		close(pcm->ring_fd);
+
+	if (pcm->codesize)
+		sbc_finish(&pcm->sbc);
+
+	g_free(pcm->bounce);
+	g_free(pcm->mp);
+	g_free(pcm);
+}
+
+int a2dp_pcm_get_ring_fd(struct a2dp_pcm *pcm)
+{
+	return pcm->ring_fd;
+}
+
+int a2dp_pcm_get_event_fd(struct a2dp_pcm *pcm)
+{
+	return pcm->event_fd;
+}
+
+uint32_t a2dp_pcm_get_period(struct a2dp_pcm *pcm)
+{
+	return pcm->codesize * pcm->frames_per_packet;
+}
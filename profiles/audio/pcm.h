@@ -0,0 +1,50 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  BlueZ contributors
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Layout of the shared memory returned by MediaTransport1.AcquirePCM.
+ *
+ * The client produces s16 little endian interleaved samples at data[head %
+ * size] and advances head, bluetoothd consumes them and advances tail. Both
+ * counters are free running byte counts, each one written by a single side
+ * only and kept on its own cache line.
+ */
+struct a2dp_pcm_ring {
+	uint32_t size;			/* Size of data in bytes, power of 2 */
+	uint32_t reserved0[15];
+	uint32_t head;			/* Written by the client */
+	uint32_t reserved1[15];
+	uint32_t tail;			/* Written by bluetoothd */
+	uint32_t reserved2[15];
+	uint8_t data[0];
+} __attribute__ ((packed));
+
+struct a2dp_pcm;
+
+struct a2dp_pcm *a2dp_pcm_new(const uint8_t *config, size_t size, int fd,
+							uint16_t omtu);
+void a2dp_pcm_free(struct a2dp_pcm *pcm);
+
+int a2dp_pcm_get_ring_fd(struct a2dp_pcm *pcm);
+int a2dp_pcm_get_event_fd(struct a2dp_pcm *pcm);
+uint32_t a2dp_pcm_get_period(struct a2dp_pcm *pcm);
@@ -50,6 +50,15 @@
 #define MEDIA_FOLDER_INTERFACE "org.bluez.MediaFolder1"
 #define MEDIA_ITEM_INTERFACE "org.bluez.MediaItem1"
 
+/*
+ * Listed items are cached in pages per folder so browsing back and forth
+ * through a large folder, or returning to it, is served without asking the
+ * remote again. Pages of folders other than the current scope are evicted
+ * least recently used first.
+ */
+#define PAGE_ITEMS		32
+#define MAX_CACHED_PAGES	64
+
 struct player_callback {
 	const struct media_player_callback *cbs;
 	void *user_data;
@@ -70,6 +79,9 @@ struct media_item {
 	bool			playable;	/* Item playable flag */
 	uint64_t		uid;		/* Item uid */
 	GHashTable		*metadata;	/* Item metadata */
+	struct media_folder	*folder;	/* Folder holding the item */
+	unsigned int		refs;		/* Cached pages listing it */
+	bool			registered;	/* Item object registered */
 };
 
 struct media_folder {
@@ -77,10 +89,22 @@ struct media_folder {
 	struct media_item	*item;		/* Folder item */
 	uint32_t		number_of_items;/* Number of items */
 	GSList			*subfolders;
-	GSList			*items;
+	GHashTable		*children;	/* Subfolders by uid */
+	GHashTable		*items;		/* Items by uid */
+	GHashTable		*pages;		/* Cached pages by number */
+	uint32_t		list_start;	/* Start of pending listing */
+	uint32_t		list_end;	/* End of pending listing */
+	uint16_t		list_counter;	/* UID counter of listing */
 	DBusMessage		*msg;
 };
 
+struct media_page {
+	struct media_folder	*folder;
+	uint32_t		number;
+	struct media_item	*items[PAGE_ITEMS];
+	GList			*link;		/* Link in player LRU */
+};
+
 struct media_player {
 	char			*device;	/* Device path */
 	char			*name;		/* Player name */
@@ -102,6 +126,10 @@ struct media_player {
 	struct player_callback	*cb;
 	GSList			*pending;
 	GSList			*folders;
+	GHashTable		*folder_names;	/* Folder lists by name */
+	GHashTable		*folder_paths;	/* Folders by object path */
+	uint16_t		uid_counter;
+	GQueue			*pages;		/* Cached pages, LRU first */
 };
 
 static void append_track(void *key, void *value, void *user_data)
@@ -570,12 +598,297 @@ static DBusMessage *media_player_rewind(DBusConnection *conn, DBusMessage *msg,
 	return g_dbus_create_reply(msg, DBUS_TYPE_INVALID);
 }
 
+static bool media_item_register(struct media_item *item);
+
+static void media_item_free(struct media_item *item)
+{
+	if (item->metadata != NULL)
+		g_hash_table_unref(item->metadata);
+
+	g_free(item->path);
+	g_free(item->name);
+	g_free(item);
+}
+
+static void media_item_unregister(struct media_item *item)
+{
+	if (!item->registered)
+		return;
+
+	g_dbus_unregister_interface(btd_get_dbus_connection(), item->path,
+						MEDIA_ITEM_INTERFACE);
+
+	item->registered = false;
+}
+
+static void media_item_destroy(void *data)
+{
+	struct media_item *item = data;
+
+	DBG("%s", item->path);
+
+	media_item_unregister(item);
+	media_item_free(item);
+}
+
+/* The current track keeps its item, the Track property points to it */
+static bool media_item_pinned(struct media_item *item)
+{
+	return item->metadata != NULL && item->metadata == item->player->track;
+}
+
+/* Frees an item once it is neither visible nor cached */
+static void media_item_collect(struct media_item *item)
+{
+	if (item->refs || item->registered ||
+					item->type == PLAYER_ITEM_TYPE_FOLDER)
+		return;
+
+	g_hash_table_remove(item->folder->items, &item->uid);
+}
+
+static struct media_page *media_folder_find_page(struct media_folder *folder,
+							uint32_t number)
+{
+	struct media_player *mp = folder->item->player;
+	struct media_page *page;
+
+	page = g_hash_table_lookup(folder->pages, GUINT_TO_POINTER(number));
+	if (page == NULL)
+		return NULL;
+
+	g_queue_unlink(mp->pages, page->link);
+	g_queue_push_tail_link(mp->pages, page->link);
+
+	return page;
+}
+
+static struct media_page *media_folder_get_page(struct media_folder *folder,
+							uint32_t number)
+{
+	struct media_player *mp = folder->item->player;
+	struct media_page *page;
+
+	page = media_folder_find_page(folder, number);
+	if (page != NULL)
+		return page;
+
+	page = g_new0(struct media_page, 1);
+	page->folder = folder;
+	page->number = number;
+
+	g_queue_push_tail(mp->pages, page);
+	page->link = g_queue_peek_tail_link(mp->pages);
+
+	g_hash_table_insert(folder->pages, GUINT_TO_POINTER(number), page);
+
+	return page;
+}
+
+static void media_page_set_item(struct media_page *page, unsigned int slot,
+						struct media_item *item)
+{
+	struct media_item *old = page->items[slot];
+
+	if (old == item)
+		return;
+
+	item->refs++;
+	page->items[slot] = item;
+
+	if (old != NULL) {
+		old->refs--;
+		media_item_collect(old);
+	}
+}
+
+static void media_page_free(void *data)
+{
+	struct media_page *page = data;
+	struct media_folder *folder = page->folder;
+	struct media_player *mp = folder->item->player;
+	unsigned int i;
+
+	g_hash_table_remove(folder->pages, GUINT_TO_POINTER(page->number));
+	g_queue_delete_link(mp->pages, page->link);
+
+	for (i = 0; i < PAGE_ITEMS; i++) {
+		struct media_item *item = page->items[i];
+
+		if (item == NULL)
+			continue;
+
+		item->refs--;
+		media_item_collect(item);
+	}
+
+	g_free(page);
+}
+
+static void media_player_evict_pages(struct media_player *mp)
+{
+	GList *l, *next;
+
+	for (l = mp->pages->head; l && mp->pages->length > MAX_CACHED_PAGES;
+								l = next) {
+		struct media_page *page = l->data;
+
+		next = l->next;
+
+		/* What the current scope has listed stays until it is left */
+		if (page->folder == mp->scope)
+			continue;
+
+		media_page_free(page);
+	}
+}
+
+static struct media_folder *media_folder_new(struct media_player *mp,
+						struct media_item *item)
+{
+	struct media_folder *folder;
+	GSList *names;
+
+	folder = g_new0(struct media_folder, 1);
+	folder->item = item;
+	folder->children = g_hash_table_new(g_int64_hash, g_int64_equal);
+	folder->items = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+						NULL, media_item_destroy);
+	folder->pages = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	/* Names are not unique, lookups return the oldest folder */
+	names = g_hash_table_lookup(mp->folder_names, item->name);
+	names = g_slist_append(names, folder);
+	g_hash_table_insert(mp->folder_names, item->name, names);
+
+	g_hash_table_insert(mp->folder_paths, item->path, folder);
+
+	return folder;
+}
+
+static void media_folder_flush(struct media_folder *folder)
+{
+	g_list_free_full(g_hash_table_get_values(folder->pages),
+							media_page_free);
+}
+
+/* Unregisters the items of a folder which is no longer the scope */
+static void media_folder_hide(struct media_folder *folder)
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	g_hash_table_iter_init(&iter, folder->items);
+
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		struct media_item *item = value;
+
+		if (media_item_pinned(item))
+			continue;
+
+		media_item_unregister(item);
+
+		if (!item->refs)
+			g_hash_table_iter_remove(&iter);
+	}
+}
+
+static void media_folder_set_number_of_items(struct media_folder *folder,
+						uint32_t number_of_items)
+{
+	if (folder->number_of_items == number_of_items)
+		return;
+
+	media_folder_flush(folder);
+	folder->number_of_items = number_of_items;
+}
+
+static bool media_folder_cacheable(struct media_player *mp,
+						struct media_folder *folder)
+{
+	/*
+	 * Without UID counter there is no telling when listings change and
+	 * the now playing list changes without the counter being updated.
+	 */
+	return mp->uid_counter && folder != mp->playlist;
+}
+
+static void media_folder_cache(struct media_folder *folder, uint32_t start,
+								GSList *items)
+{
+	uint32_t pos;
+	GSList *l;
+
+	for (l = items, pos = start; l; l = l->next, pos++) {
+		struct media_page *page;
+
+		page = media_folder_get_page(folder, pos / PAGE_ITEMS);
+		media_page_set_item(page, pos % PAGE_ITEMS, l->data);
+	}
+
+	media_player_evict_pages(folder->item->player);
+}
+
+/* Returns the items between start and end or NULL if any is not cached */
+static GSList *media_folder_cached_items(struct media_folder *folder,
+						uint32_t start, uint32_t end)
+{
+	struct media_page *page = NULL;
+	GSList *items = NULL;
+	uint32_t pos;
+
+	if (end >= folder->number_of_items)
+		end = folder->number_of_items - 1;
+
+	if (start > end)
+		return NULL;
+
+	for (pos = end + 1; pos-- > start;) {
+		struct media_item *item;
+
+		if (page == NULL || page->number != pos / PAGE_ITEMS)
+			page = media_folder_find_page(folder, pos / PAGE_ITEMS);
+
+		item = page ? page->items[pos % PAGE_ITEMS] : NULL;
+		if (item == NULL) {
+			g_slist_free(items);
+			return NULL;
+		}
+
+		items = g_slist_prepend(items, item);
+	}
+
+	return items;
+}
+
+static void media_player_flush_pages(struct media_player *mp)
+{
+	while (!g_queue_is_empty(mp->pages))
+		media_page_free(g_queue_peek_head(mp->pages));
+}
+
+void media_player_set_uid_counter(struct media_player *mp, uint16_t counter)
+{
+	if (mp->uid_counter == counter)
+		return;
+
+	DBG("%u", counter);
+
+	mp->uid_counter = counter;
+
+	/* UIDs may refer to other items now, drop all cached listings */
+	media_player_flush_pages(mp);
+}
+
 static void parse_folder_list(gpointer data, gpointer user_data)
 {
 	struct media_item *item = data;
 	DBusMessageIter *array = user_data;
 	DBusMessageIter entry;
 
+	if (!media_item_register(item))
+		return;
+
 	dbus_message_iter_open_container(array, DBUS_TYPE_DICT_ENTRY, NULL,
 								&entry);
 
@@ -588,22 +901,12 @@ static void parse_folder_list(gpointer data, gpointer user_data)
 	dbus_message_iter_close_container(array, &entry);
 }
 
-void media_player_list_complete(struct media_player *mp, GSList *items,
-								int err)
+static DBusMessage *list_items_reply(DBusMessage *msg, GSList *items)
 {
-	struct media_folder *folder = mp->scope;
 	DBusMessage *reply;
 	DBusMessageIter iter, array;
 
-	if (folder == NULL || folder->msg == NULL)
-		return;
-
-	if (err < 0) {
-		reply = btd_error_failed(folder->msg, strerror(-err));
-		goto done;
-	}
-
-	reply = dbus_message_new_method_return(folder->msg);
+	reply = dbus_message_new_method_return(msg);
 
 	dbus_message_iter_init_append(reply, &iter);
 
@@ -621,6 +924,39 @@ void media_player_list_complete(struct media_player *mp, GSList *items,
 	g_slist_foreach(items, parse_folder_list, &array);
 	dbus_message_iter_close_container(&iter, &array);
 
+	return reply;
+}
+
+void media_player_list_complete(struct media_player *mp, GSList *items,
+								int err)
+{
+	struct media_folder *folder = mp->scope;
+	DBusMessage *reply;
+	uint32_t end;
+
+	if (folder == NULL || folder->msg == NULL)
+		return;
+
+	if (err < 0) {
+		reply = btd_error_failed(folder->msg, strerror(-err));
+		goto done;
+	}
+
+	reply = list_items_reply(folder->msg, items);
+
+	end = folder->list_end;
+	if (folder->number_of_items && end >= folder->number_of_items)
+		end = folder->number_of_items - 1;
+
+	/*
+	 * Items that could not be parsed are left out of the list, so the
+	 * positions are only known if the whole range was returned.
+	 */
+	if (media_folder_cacheable(mp, folder) &&
+			folder->list_counter == mp->uid_counter &&
+			g_slist_length(items) == end - folder->list_start + 1)
+		media_folder_cache(folder, folder->list_start, items);
+
 done:
 	g_dbus_send_message(btd_get_dbus_connection(), reply);
 	dbus_message_unref(folder->msg);
@@ -661,12 +997,22 @@ void media_player_search_complete(struct media_player *mp, int ret)
 	}
 
 	if (search == NULL) {
-		search = g_new0(struct media_folder, 1);
-		search->item = media_player_create_subfolder(mp, "search", 0);
+		struct media_item *item;
+
+		item = media_player_create_subfolder(mp, "search", 0);
+		if (item == NULL) {
+			reply = btd_error_failed(folder->msg,
+							strerror(ENOMEM));
+			goto done;
+		}
+
+		search = media_folder_new(mp, item);
 		mp->search = search;
 		mp->folders = g_slist_prepend(mp->folders, search);
 	}
 
+	/* Results of a new search are listed from the start */
+	media_folder_flush(search);
 	search->number_of_items = ret;
 
 	reply = g_dbus_create_reply(folder->msg,
@@ -688,7 +1034,7 @@ void media_player_total_items_complete(struct media_player *mp,
 		return;
 
 	if (folder->number_of_items != num_of_items) {
-		folder->number_of_items = num_of_items;
+		media_folder_set_number_of_items(folder, num_of_items);
 
 		g_dbus_emit_property_changed(btd_get_dbus_connection(),
 				mp->path, MEDIA_FOLDER_INTERFACE,
@@ -836,44 +1182,58 @@ static DBusMessage *media_folder_list_items(DBusConnection *conn,
 	if (folder->msg != NULL)
 		return btd_error_failed(msg, strerror(EBUSY));
 
+	if (media_folder_cacheable(mp, folder) && folder->number_of_items) {
+		GSList *items = media_folder_cached_items(folder, start, end);
+
+		if (items != NULL) {
+			DBusMessage *reply = list_items_reply(msg, items);
+
+			g_slist_free(items);
+
+			return reply;
+		}
+	}
+
 	err = cb->cbs->list_items(mp, folder->item->name, start, end,
 							cb->user_data);
 	if (err < 0)
 		return btd_error_failed(msg, strerror(-err));
 
 	folder->msg = dbus_message_ref(msg);
+	folder->list_start = start;
+	folder->list_end = end;
+	folder->list_counter = mp->uid_counter;
 
 	return NULL;
 }
 
-static void media_item_free(struct media_item *item)
+static void media_folder_destroy(void *data)
 {
-	if (item->metadata != NULL)
-		g_hash_table_unref(item->metadata);
+	struct media_folder *folder = data;
+	struct media_player *mp = folder->item->player;
+	GSList *names;
 
-	g_free(item->path);
-	g_free(item->name);
-	g_free(item);
-}
+	media_folder_flush(folder);
 
-static void media_item_destroy(void *data)
-{
-	struct media_item *item = data;
-
-	DBG("%s", item->path);
+	g_slist_free_full(folder->subfolders, media_folder_destroy);
+	g_hash_table_destroy(folder->children);
+	g_hash_table_destroy(folder->items);
+	g_hash_table_destroy(folder->pages);
 
-	g_dbus_unregister_interface(btd_get_dbus_connection(), item->path,
-						MEDIA_ITEM_INTERFACE);
+	/* The key is the name of the first folder in the list */
+	names = g_hash_table_lookup(mp->folder_names, folder->item->name);
+	names = g_slist_remove(names, folder);
+	g_hash_table_remove(mp->folder_names, folder->item->name);
 
-	media_item_free(item);
-}
+	if (names != NULL) {
+		struct media_folder *first = names->data;
 
-static void media_folder_destroy(void *data)
-{
-	struct media_folder *folder = data;
+		g_hash_table_insert(mp->folder_names, first->item->name,
+									names);
+	}
 
-	g_slist_free_full(folder->subfolders, media_folder_destroy);
-	g_slist_free_full(folder->items, media_item_destroy);
+	if (g_hash_table_lookup(mp->folder_paths, folder->item->path) == folder)
+		g_hash_table_remove(mp->folder_paths, folder->item->path);
 
 	if (folder->msg != NULL)
 		dbus_message_unref(folder->msg);
@@ -904,8 +1264,7 @@ static void media_player_change_scope(struct media_player *mp,
 		goto done;
 
 cleanup:
-	g_slist_free_full(mp->scope->items, media_item_destroy);
-	mp->scope->items = NULL;
+	media_folder_hide(mp->scope);
 
 	/* Destroy search folder if it exists and is not being set as scope */
 	if (mp->search != NULL && folder != mp->search) {
@@ -917,6 +1276,9 @@ cleanup:
 done:
 	mp->scope = folder;
 
+	/* Pages of the previous scope can be evicted now */
+	media_player_evict_pages(mp);
+
 	if (cb->cbs->total_items) {
 		err = cb->cbs->total_items(mp, folder->item->name,
 							cb->user_data);
@@ -932,31 +1294,19 @@ done:
 				MEDIA_FOLDER_INTERFACE, "Name");
 }
 
-static struct media_folder *find_folder(GSList *folders, const char *pattern)
+static struct media_folder *media_player_find_folder(struct media_player *mp,
+							const char *pattern)
 {
-	GSList *l;
-
-	for (l = folders; l; l = l->next) {
-		struct media_folder *folder = l->data;
+	struct media_folder *folder;
+	GSList *names;
 
-		if (g_str_equal(folder->item->name, pattern))
-			return folder;
+	folder = g_hash_table_lookup(mp->folder_paths, pattern);
+	if (folder != NULL)
+		return folder;
 
-		if (g_str_equal(folder->item->path, pattern))
-			return folder;
+	names = g_hash_table_lookup(mp->folder_names, pattern);
 
-		folder = find_folder(folder->subfolders, pattern);
-		if (folder != NULL)
-			return folder;
-	}
-
-	return NULL;
-}
-
-static struct media_folder *media_player_find_folder(struct media_player *mp,
-							const char *pattern)
-{
-	return find_folder(mp->folders, pattern);
+	return names ? names->data : NULL;
 }
 
 static DBusMessage *media_folder_change_folder(DBusConnection *conn,
@@ -993,8 +1343,7 @@ static DBusMessage *media_folder_change_folder(DBusConnection *conn,
 	 * ChangePath can only navigate one level up/down so check if folder
 	 * is direct child or parent of the current folder otherwise fail.
 	 */
-	if (!g_slist_find(mp->folder->subfolders, folder) &&
-				!g_slist_find(folder->subfolders, mp->folder))
+	if (folder->parent != mp->folder && mp->folder->parent != folder)
 		return btd_error_invalid_args(msg);
 
 	if (cb->cbs->change_folder == NULL)
@@ -1109,19 +1458,11 @@ media_player_find_folder_by_uid(struct media_player *mp, uint64_t uid)
 {
 	struct media_folder *folder = mp->scope;
 	struct media_folder *parent = folder->parent;
-	GSList *l;
 
 	if (parent && parent->item->uid == uid)
 		return parent;
 
-	for (l = folder->subfolders; l; l = l->next) {
-		struct media_folder *folder = l->data;
-
-		if (folder->item->uid == uid)
-			return folder;
-	}
-
-	return NULL;
+	return g_hash_table_lookup(folder->children, &uid);
 }
 
 static void media_player_set_folder_by_uid(struct media_player *mp,
@@ -1137,7 +1478,7 @@ static void media_player_set_folder_by_uid(struct media_player *mp,
 		return;
 	}
 
-	folder->number_of_items = number_of_items;
+	media_folder_set_number_of_items(folder, number_of_items);
 
 	media_player_set_scope(mp, folder);
 }
@@ -1189,7 +1530,13 @@ void media_player_destroy(struct media_player *mp)
 						MEDIA_FOLDER_INTERFACE);
 
 	g_slist_free_full(mp->pending, g_free);
+
+	/* Pages may list folder items of other folders */
+	media_player_flush_pages(mp);
 	g_slist_free_full(mp->folders, media_folder_destroy);
+	g_hash_table_destroy(mp->folder_names);
+	g_hash_table_destroy(mp->folder_paths);
+	g_queue_free(mp->pages);
 
 	g_timer_destroy(mp->progress);
 	g_free(mp->cb);
@@ -1215,6 +1562,9 @@ struct media_player *media_player_controller_create(const char *path,
 	mp->track = g_hash_table_new_full(g_str_hash, g_str_equal,
 							g_free, g_free);
 	mp->progress = g_timer_new();
+	mp->folder_names = g_hash_table_new(g_str_hash, g_str_equal);
+	mp->folder_paths = g_hash_table_new(g_str_hash, g_str_equal);
+	mp->pages = g_queue_new();
 
 	if (!g_dbus_register_interface(btd_get_dbus_connection(),
 					mp->path, MEDIA_PLAYER_INTERFACE,
@@ -1476,7 +1826,7 @@ void media_player_set_folder(struct media_player *mp, const char *name,
 		return;
 	}
 
-	folder->number_of_items = number_of_items;
+	media_folder_set_number_of_items(folder, number_of_items);
 
 	media_player_set_scope(mp, folder);
 }
@@ -1502,19 +1852,10 @@ void media_player_set_playlist(struct media_player *mp, const char *name)
 static struct media_item *media_folder_find_item(struct media_folder *folder,
 								uint64_t uid)
 {
-	GSList *l;
-
 	if (uid == 0)
 		return NULL;
 
-	for (l = folder->items; l; l = l->next) {
-		struct media_item *item = l->data;
-
-		if (item->uid == uid)
-			return item;
-	}
-
-	return NULL;
+	return g_hash_table_lookup(folder->items, &uid);
 }
 
 static DBusMessage *media_item_play(DBusConnection *conn, DBusMessage *msg,
@@ -1774,10 +2115,33 @@ void media_item_set_playable(struct media_item *item, bool value)
 
 	item->playable = value;
 
+	if (!item->registered)
+		return;
+
 	g_dbus_emit_property_changed(btd_get_dbus_connection(), item->path,
 					MEDIA_ITEM_INTERFACE, "Playable");
 }
 
+static bool media_item_register(struct media_item *item)
+{
+	if (item->registered)
+		return true;
+
+	if (!g_dbus_register_interface(btd_get_dbus_connection(),
+					item->path, MEDIA_ITEM_INTERFACE,
+					media_item_methods,
+					NULL,
+					media_item_properties, item, NULL)) {
+		error("D-Bus failed to register %s on %s path",
+					MEDIA_ITEM_INTERFACE, item->path);
+		return false;
+	}
+
+	item->registered = true;
+
+	return true;
+}
+
 static struct media_item *media_folder_create_item(struct media_player *mp,
 						struct media_folder *folder,
 						const char *name,
@@ -1795,6 +2159,10 @@ static struct media_item *media_folder_create_item(struct media_player *mp,
 	if (strtype == NULL)
 		return NULL;
 
+	/* UID 0 is reserved, elements cannot be looked up without one */
+	if (type != PLAYER_ITEM_TYPE_FOLDER && uid == 0)
+		return NULL;
+
 	DBG("%s type %s uid %" PRIu64 "", name, strtype, uid);
 
 	item = g_new0(struct media_item, 1);
@@ -1810,22 +2178,16 @@ static struct media_item *media_folder_create_item(struct media_player *mp,
 	item->name = g_strdup(name);
 	item->type = type;
 	item->folder_type = PLAYER_FOLDER_TYPE_INVALID;
+	item->folder = folder;
 
-	if (!g_dbus_register_interface(btd_get_dbus_connection(),
-					item->path, MEDIA_ITEM_INTERFACE,
-					media_item_methods,
-					NULL,
-					media_item_properties, item, NULL)) {
-		error("D-Bus failed to register %s on %s path",
-					MEDIA_ITEM_INTERFACE, item->path);
-		media_item_free(item);
-		return NULL;
-	}
-
+	/* Elements are only registered once they are listed */
 	if (type != PLAYER_ITEM_TYPE_FOLDER) {
-		folder->items = g_slist_prepend(folder->items, item);
 		item->metadata = g_hash_table_new_full(g_str_hash, g_str_equal,
 							g_free, g_free);
+		g_hash_table_insert(folder->items, &item->uid, item);
+	} else if (!media_item_register(item)) {
+		media_item_free(item);
+		return NULL;
 	}
 
 	DBG("%s", item->path);
@@ -1866,8 +2228,7 @@ struct media_item *media_player_create_folder(struct media_player *mp,
 	if (item == NULL)
 		return NULL;
 
-	folder = g_new0(struct media_folder, 1);
-	folder->item = item;
+	folder = media_folder_new(mp, item);
 
 	item->folder_type = type;
 
@@ -1882,6 +2243,7 @@ done:
 		mp->folder->subfolders = g_slist_prepend(
 							mp->folder->subfolders,
 							folder);
+		g_hash_table_insert(mp->folder->children, &item->uid, folder);
 	} else
 		mp->folders = g_slist_prepend(mp->folders, folder);
 
@@ -1917,7 +2279,7 @@ struct media_item *media_player_set_playlist_item(struct media_player *mp,
 
 	item = media_folder_create_item(mp, folder, NULL,
 						PLAYER_ITEM_TYPE_AUDIO, uid);
-	if (item == NULL)
+	if (item == NULL || !media_item_register(item))
 		return NULL;
 
 	media_item_set_playable(item, true);
@@ -52,6 +52,10 @@
 #include "sink.h"
 #include "source.h"
 #include "avrcp.h"
+#ifdef HAVE_A2DP_PCM
+#include "a2dp-codecs.h"
+#include "pcm.h"
+#endif
 
 #define MEDIA_TRANSPORT_INTERFACE "org.bluez.MediaTransport1"
 
@@ -112,6 +116,9 @@ struct media_transport {
 								guint id);
 	GDestroyNotify		destroy;
 	void			*data;
+#ifdef HAVE_A2DP_PCM
+	struct a2dp_pcm		*pcm;		/* Encoder for AcquirePCM */
+#endif
 };
 
 static GSList *transports = NULL;
@@ -261,6 +268,11 @@ static void media_transport_remove_owner(struct media_transport *transport)
 
 	transport->owner = NULL;
 
+#ifdef HAVE_A2DP_PCM
+	a2dp_pcm_free(transport->pcm);
+	transport->pcm = NULL;
+#endif
+
 	if (owner->watch)
 		g_dbus_remove_watch(btd_get_dbus_connection(), owner->watch);
 
@@ -285,6 +297,30 @@ static gboolean media_transport_set_fd(struct media_transport *transport,
 	return TRUE;
 }
 
+#ifdef HAVE_A2DP_PCM
+static gboolean reply_pcm(struct media_transport *transport, DBusMessage *msg)
+{
+	int ring_fd, event_fd;
+	uint32_t period;
+
+	transport->pcm = a2dp_pcm_new(transport->configuration,
+					transport->size, transport->fd,
+					transport->omtu);
+	if (transport->pcm == NULL)
+		return FALSE;
+
+	ring_fd = a2dp_pcm_get_ring_fd(transport->pcm);
+	event_fd = a2dp_pcm_get_event_fd(transport->pcm);
+	period = a2dp_pcm_get_period(transport->pcm);
+
+	return g_dbus_send_reply(btd_get_dbus_connection(), msg,
+						DBUS_TYPE_UNIX_FD, &ring_fd,
+						DBUS_TYPE_UNIX_FD, &event_fd,
+						DBUS_TYPE_UINT32, &period,
+						DBUS_TYPE_INVALID);
+}
+#endif
+
 static void a2dp_resume_complete(struct avdtp *session, int err,
 							void *user_data)
 {
@@ -312,6 +348,11 @@ static void a2dp_resume_complete(struct avdtp *session, int err,
 
 	media_transport_set_fd(transport, fd, imtu, omtu);
 
+#ifdef HAVE_A2DP_PCM
+	if (g_str_equal(dbus_message_get_member(req->msg), "AcquirePCM"))
+		ret = reply_pcm(transport, req->msg);
+	else
+#endif
 	ret = g_dbus_send_reply(btd_get_dbus_connection(), req->msg,
 						DBUS_TYPE_UNIX_FD, &fd,
 						DBUS_TYPE_UINT16, &imtu,
@@ -509,6 +550,21 @@ static DBusMessage *try_acquire(DBusConnection *conn, DBusMessage *msg,
 	return NULL;
 }
 
+#ifdef HAVE_A2DP_PCM
+static DBusMessage *acquire_pcm(DBusConnection *conn, DBusMessage *msg,
+								void *data)
+{
+	struct media_transport *transport = data;
+
+	/* Encoding is only done for SBC streams sent by the local source */
+	if (media_endpoint_get_codec(transport->endpoint) != A2DP_CODEC_SBC ||
+						transport->sink_watch == 0)
+		return btd_error_not_supported(msg);
+
+	return acquire(conn, msg, data);
+}
+#endif
+
 static DBusMessage *release(DBusConnection *conn, DBusMessage *msg,
 					void *data)
 {
@@ -528,7 +584,8 @@ static DBusMessage *release(DBusConnection *conn, DBusMessage *msg,
 
 		member = dbus_message_get_member(owner->pending->msg);
 		/* Cancel Acquire request if that exist */
-		if (g_str_equal(member, "Acquire"))
+		if (g_str_equal(member, "Acquire") ||
+					g_str_equal(member, "AcquirePCM"))
 			media_owner_remove(owner);
 		else
 			return btd_error_in_progress(msg);
@@ -720,6 +777,13 @@ static const GDBusMethodTable transport_methods[] = {
 							{ "mtu_w", "q" }),
 			try_acquire) },
 	{ GDBUS_ASYNC_METHOD("Release", NULL, NULL, release) },
+#ifdef HAVE_A2DP_PCM
+	{ GDBUS_EXPERIMENTAL_ASYNC_METHOD("AcquirePCM",
+			NULL,
+			GDBUS_ARGS({ "ring", "h" }, { "event", "h" },
+							{ "period", "u" }),
+			acquire_pcm) },
+#endif
 	{ },
 };
 
@@ -33,9 +33,12 @@
 #include <string.h>
 #include <stdio.h>
 #include <limits.h>
+#include <stdint.h>
 #include <arpa/inet.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
+#include "src/shared/lz4.h"
 #include "src/shared/btsnoop.h"
 
 struct btsnoop_hdr {
@@ -60,6 +63,79 @@ static const uint8_t btsnoop_id[] = { 0x62, 0x74, 0x73, 0x6e,
 
 static const uint32_t btsnoop_version = 1;
 
+/*
+ * Compressed traces use the regular file header with a different
+ * identification pattern, followed by independently LZ4 compressed
+ * chunks of regular packet records. Records never span two chunks and
+ * the chunk headers double as an index for seeking.
+ */
+static const uint8_t btsnoop_lz4_id[] = { 0x62, 0x74, 0x73, 0x6e,
+					  0x6c, 0x7a, 0x34, 0x00 };
+
+struct btsnoop_chunk {
+	uint32_t	size;		/* Stored Length */
+	uint32_t	len;		/* Uncompressed Length */
+	uint32_t	count;		/* Number of Packets */
+	uint32_t	flags;		/* Chunk Flags */
+	uint64_t	ts;		/* Timestamp of first packet */
+} __attribute__ ((packed));
+#define BTSNOOP_CHUNK_SIZE (sizeof(struct btsnoop_chunk))
+
+#define BTSNOOP_CHUNK_FLAG_STORED	(1 << 0)
+
+#define BTSNOOP_CHUNK_MAX_LEN		(64 * 1024)
+#define BTSNOOP_CHUNK_TIMEOUT		1000000ll
+
+/*
+ * The optional sidecar index (<file>.idx) stores the file offset and the
+ * timestamp of every BTSNOOP_INDEX_INTERVAL-th packet so that readers can
+ * seek to a frame number or a point in time without decoding the whole
+ * file. Each entry also carries the number of HCI packets seen so far on
+ * every controller index, which is how btmon numbers the frames it shows.
+ * Entries with BTSNOOP_IDX_META set in the frame point to the controller
+ * index records instead, which are replayed after a seek so that readers
+ * know the controllers. All fields are stored in big endian like the
+ * btsnoop file itself.
+ */
+struct btsnoop_idx_hdr {
+	uint8_t		id[8];		/* Identification Pattern */
+	uint32_t	version;	/* Version Number = 3 */
+	uint32_t	interval;	/* Packets between entries */
+} __attribute__ ((packed));
+#define BTSNOOP_IDX_HDR_SIZE (sizeof(struct btsnoop_idx_hdr))
+
+struct btsnoop_idx_entry {
+	uint64_t	frame;		/* Packet number */
+	uint64_t	offset;		/* File offset of packet record */
+	uint64_t	ts;		/* Timestamp microseconds */
+	uint64_t	hci[BTSNOOP_MAX_INDEX];	/* HCI packets per index */
+} __attribute__ ((packed));
+#define BTSNOOP_IDX_ENTRY_SIZE (sizeof(struct btsnoop_idx_entry))
+
+static const uint8_t btsnoop_idx_id[] = { 0x62, 0x74, 0x73, 0x6e,
+					  0x70, 0x69, 0x64, 0x78 };
+
+static const uint32_t btsnoop_idx_version = 3;
+
+#define BTSNOOP_INDEX_INTERVAL	1024
+#define BTSNOOP_IDX_META	(1ull << 63)
+
+struct btsnoop_idx {
+	uint64_t frame;
+	uint64_t offset;
+	uint64_t ts;
+	uint64_t hci[BTSNOOP_MAX_INDEX];
+};
+
+#define BTSNOOP_META_MAX_SIZE	32
+
+struct btsnoop_meta {
+	uint64_t frame;
+	uint64_t offset;
+	struct btsnoop_pkt pkt;
+	uint8_t data[BTSNOOP_META_MAX_SIZE];
+};
+
 struct pklg_pkt {
 	uint32_t	len;
 	uint64_t	ts;
@@ -81,8 +157,48 @@ struct btsnoop {
 	size_t cur_size;
 	unsigned int max_count;
 	unsigned int cur_count;
+	char *idx_path;
+	int idx_fd;
+	uint64_t frame;
+	uint64_t hci[BTSNOOP_MAX_INDEX];
+	struct btsnoop_idx *idx;
+	size_t idx_len;
+	size_t idx_size;
+	bool idx_dirty;
+	struct btsnoop_meta *meta;
+	size_t meta_len;
+	size_t meta_size;
+	size_t replay_pos;
+	size_t replay_len;
+	bool compressed;
+	uint8_t *chunk;
+	uint8_t *chunk_buf;
+	size_t chunk_len;
+	size_t chunk_pos;
+	uint32_t chunk_count;
+	uint64_t chunk_ts;
 };
 
+static bool chunk_flush(struct btsnoop *btsnoop);
+
+static bool chunk_alloc(struct btsnoop *btsnoop)
+{
+	btsnoop->chunk = malloc(BTSNOOP_CHUNK_MAX_LEN);
+	btsnoop->chunk_buf = malloc(lz4_compress_bound(BTSNOOP_CHUNK_MAX_LEN));
+
+	if (!btsnoop->chunk || !btsnoop->chunk_buf) {
+		free(btsnoop->chunk);
+		free(btsnoop->chunk_buf);
+		btsnoop->chunk = NULL;
+		btsnoop->chunk_buf = NULL;
+		return false;
+	}
+
+	btsnoop->compressed = true;
+
+	return true;
+}
+
 struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 {
 	struct btsnoop *btsnoop;
@@ -100,6 +216,7 @@ struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 	}
 
 	btsnoop->flags = flags;
+	btsnoop->idx_fd = -1;
 
 	len = read(btsnoop->fd, &hdr, BTSNOOP_HDR_SIZE);
 	if (len < 0 || len != BTSNOOP_HDR_SIZE)
@@ -110,6 +227,16 @@ struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 		if (be32toh(hdr.version) != btsnoop_version)
 			goto failed;
 
+		btsnoop->format = be32toh(hdr.type);
+		btsnoop->index = 0xffff;
+	} else if (!memcmp(hdr.id, btsnoop_lz4_id, sizeof(btsnoop_lz4_id))) {
+		/* Check for compressed BTSnoop version 1 format */
+		if (be32toh(hdr.version) != btsnoop_version)
+			goto failed;
+
+		if (!chunk_alloc(btsnoop))
+			goto failed;
+
 		btsnoop->format = be32toh(hdr.type);
 		btsnoop->index = 0xffff;
 	} else {
@@ -130,6 +257,9 @@ struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 		lseek(btsnoop->fd, 0, SEEK_SET);
 	}
 
+	if (asprintf(&btsnoop->idx_path, "%s.idx", path) < 0)
+		btsnoop->idx_path = NULL;
+
 	return btsnoop_ref(btsnoop);
 
 failed:
@@ -172,6 +302,7 @@ struct btsnoop *btsnoop_create(const char *path, size_t max_size,
 
 	btsnoop->format = format;
 	btsnoop->index = 0xffff;
+	btsnoop->idx_fd = -1;
 	btsnoop->path = path;
 	btsnoop->max_count = max_count;
 	btsnoop->max_size = max_size;
@@ -210,9 +341,20 @@ void btsnoop_unref(struct btsnoop *btsnoop)
 	if (__sync_sub_and_fetch(&btsnoop->ref_count, 1))
 		return;
 
+	if (btsnoop->compressed && btsnoop->path && btsnoop->fd >= 0)
+		chunk_flush(btsnoop);
+
 	if (btsnoop->fd >= 0)
 		close(btsnoop->fd);
 
+	if (btsnoop->idx_fd >= 0)
+		close(btsnoop->idx_fd);
+
+	free(btsnoop->idx_path);
+	free(btsnoop->idx);
+	free(btsnoop->meta);
+	free(btsnoop->chunk);
+	free(btsnoop->chunk_buf);
 	free(btsnoop);
 }
 
@@ -224,6 +366,62 @@ uint32_t btsnoop_get_format(struct btsnoop *btsnoop)
 	return btsnoop->format;
 }
 
+static int index_create(const char *path)
+{
+	struct btsnoop_idx_hdr hdr;
+	char idx_path[PATH_MAX];
+	ssize_t written;
+	int fd;
+
+	snprintf(idx_path, PATH_MAX, "%s.idx", path);
+
+	fd = open(idx_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+					S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0)
+		return -1;
+
+	memcpy(hdr.id, btsnoop_idx_id, sizeof(btsnoop_idx_id));
+	hdr.version = htobe32(btsnoop_idx_version);
+	hdr.interval = htobe32(BTSNOOP_INDEX_INTERVAL);
+
+	written = write(fd, &hdr, BTSNOOP_IDX_HDR_SIZE);
+	if (written != BTSNOOP_IDX_HDR_SIZE) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+bool btsnoop_enable_index(struct btsnoop *btsnoop)
+{
+	char path[PATH_MAX];
+
+	if (!btsnoop || !btsnoop->path)
+		return false;
+
+	if (btsnoop->idx_fd >= 0)
+		return true;
+
+	/* Only possible before the first packet has been written */
+	if (btsnoop->cur_size != BTSNOOP_HDR_SIZE)
+		return false;
+
+	/* Compressed traces carry their own chunk index */
+	if (btsnoop->compressed)
+		return false;
+
+	if (btsnoop->max_size)
+		snprintf(path, PATH_MAX, "%s.%u", btsnoop->path,
+			btsnoop->cur_count ? btsnoop->cur_count - 1 : 0);
+	else
+		snprintf(path, PATH_MAX, "%s", btsnoop->path);
+
+	btsnoop->idx_fd = index_create(path);
+
+	return btsnoop->idx_fd >= 0;
+}
+
 static bool btsnoop_rotate(struct btsnoop *btsnoop)
 {
 	struct btsnoop_hdr hdr;
@@ -237,6 +435,12 @@ static bool btsnoop_rotate(struct btsnoop *btsnoop)
 		snprintf(path, PATH_MAX, "%s.%u", btsnoop->path,
 				btsnoop->cur_count - btsnoop->max_count);
 		unlink(path);
+
+		if (btsnoop->idx_fd >= 0) {
+			snprintf(path, PATH_MAX, "%s.%u.idx", btsnoop->path,
+				btsnoop->cur_count - btsnoop->max_count);
+			unlink(path);
+		}
 	}
 
 	snprintf(path, PATH_MAX,"%s.%u", btsnoop->path, btsnoop->cur_count);
@@ -247,7 +451,11 @@ static bool btsnoop_rotate(struct btsnoop *btsnoop)
 	if (btsnoop->fd < 0)
 		return false;
 
-	memcpy(hdr.id, btsnoop_id, sizeof(btsnoop_id));
+	if (btsnoop->compressed)
+		memcpy(hdr.id, btsnoop_lz4_id, sizeof(btsnoop_lz4_id));
+	else
+		memcpy(hdr.id, btsnoop_id, sizeof(btsnoop_id));
+
 	hdr.version = htobe32(btsnoop_version);
 	hdr.type = htobe32(btsnoop->format);
 
@@ -256,10 +464,245 @@ static bool btsnoop_rotate(struct btsnoop *btsnoop)
 		return false;
 
 	btsnoop->cur_size = BTSNOOP_HDR_SIZE;
+	btsnoop->frame = 0;
+	memset(btsnoop->hci, 0, sizeof(btsnoop->hci));
+
+	if (btsnoop->idx_fd >= 0) {
+		close(btsnoop->idx_fd);
+		btsnoop->idx_fd = index_create(path);
+	}
 
 	return true;
 }
 
+static bool chunk_flush(struct btsnoop *btsnoop)
+{
+	struct btsnoop_chunk chunk;
+	struct iovec iov[2];
+	size_t size;
+	ssize_t written;
+
+	if (!btsnoop->chunk_len)
+		return true;
+
+	size = lz4_compress(btsnoop->chunk, btsnoop->chunk_len,
+				btsnoop->chunk_buf, btsnoop->chunk_len);
+	if (size) {
+		chunk.flags = 0;
+		iov[1].iov_base = btsnoop->chunk_buf;
+	} else {
+		/* Incompressible data is stored as is */
+		size = btsnoop->chunk_len;
+		chunk.flags = htobe32(BTSNOOP_CHUNK_FLAG_STORED);
+		iov[1].iov_base = btsnoop->chunk;
+	}
+
+	chunk.size = htobe32(size);
+	chunk.len = htobe32(btsnoop->chunk_len);
+	chunk.count = htobe32(btsnoop->chunk_count);
+	chunk.ts = htobe64(btsnoop->chunk_ts);
+
+	iov[0].iov_base = &chunk;
+	iov[0].iov_len = BTSNOOP_CHUNK_SIZE;
+	iov[1].iov_len = size;
+
+	btsnoop->chunk_len = 0;
+	btsnoop->chunk_count = 0;
+
+	if (btsnoop->max_size && btsnoop->max_size <=
+			btsnoop->cur_size + size + BTSNOOP_CHUNK_SIZE)
+		if (!btsnoop_rotate(btsnoop))
+			return false;
+
+	written = writev(btsnoop->fd, iov, 2);
+	if (written < 0)
+		return false;
+
+	btsnoop->cur_size += written;
+
+	return true;
+}
+
+static bool chunk_write(struct btsnoop *btsnoop, struct btsnoop_pkt *pkt,
+					const void *data, uint16_t size)
+{
+	uint64_t ts = be64toh(pkt->ts);
+
+	/*
+	 * Bound both the chunk size and the time covered by a chunk. This
+	 * only runs when another packet arrives, so writers that can go
+	 * idle need to call btsnoop_flush() periodically as well, or the
+	 * buffered packets are lost if the process dies.
+	 */
+	if (btsnoop->chunk_len && (btsnoop->chunk_len + BTSNOOP_PKT_SIZE +
+				size > BTSNOOP_CHUNK_MAX_LEN ||
+				ts - btsnoop->chunk_ts >= BTSNOOP_CHUNK_TIMEOUT))
+		if (!chunk_flush(btsnoop))
+			return false;
+
+	if (!btsnoop->chunk_len)
+		btsnoop->chunk_ts = ts;
+
+	memcpy(btsnoop->chunk + btsnoop->chunk_len, pkt, BTSNOOP_PKT_SIZE);
+	btsnoop->chunk_len += BTSNOOP_PKT_SIZE;
+
+	if (data && size > 0) {
+		memcpy(btsnoop->chunk + btsnoop->chunk_len, data, size);
+		btsnoop->chunk_len += size;
+	}
+
+	btsnoop->chunk_count++;
+
+	return true;
+}
+
+bool btsnoop_flush(struct btsnoop *btsnoop)
+{
+	if (!btsnoop || btsnoop->fd < 0)
+		return false;
+
+	/* Only compressed writers buffer packets */
+	if (!btsnoop->compressed || !btsnoop->path)
+		return true;
+
+	return chunk_flush(btsnoop);
+}
+
+bool btsnoop_enable_compression(struct btsnoop *btsnoop)
+{
+	struct btsnoop_hdr hdr;
+
+	if (!btsnoop || !btsnoop->path)
+		return false;
+
+	if (btsnoop->compressed)
+		return true;
+
+	/* Only possible before the first packet has been written */
+	if (btsnoop->cur_size != BTSNOOP_HDR_SIZE || btsnoop->idx_fd >= 0)
+		return false;
+
+	memcpy(hdr.id, btsnoop_lz4_id, sizeof(btsnoop_lz4_id));
+	hdr.version = htobe32(btsnoop_version);
+	hdr.type = htobe32(btsnoop->format);
+
+	if (pwrite(btsnoop->fd, &hdr, BTSNOOP_HDR_SIZE, 0) != BTSNOOP_HDR_SIZE)
+		return false;
+
+	return chunk_alloc(btsnoop);
+}
+
+static uint16_t get_opcode_from_flags(uint8_t type, uint32_t flags)
+{
+	switch (type) {
+	case 0x01:
+		return BTSNOOP_OPCODE_COMMAND_PKT;
+	case 0x02:
+		if (flags & 0x01)
+			return BTSNOOP_OPCODE_ACL_RX_PKT;
+		else
+			return BTSNOOP_OPCODE_ACL_TX_PKT;
+	case 0x03:
+		if (flags & 0x01)
+			return BTSNOOP_OPCODE_SCO_RX_PKT;
+		else
+			return BTSNOOP_OPCODE_SCO_TX_PKT;
+	case 0x04:
+		return BTSNOOP_OPCODE_EVENT_PKT;
+	case 0xff:
+		if (flags & 0x02) {
+			if (flags & 0x01)
+				return BTSNOOP_OPCODE_EVENT_PKT;
+			else
+				return BTSNOOP_OPCODE_COMMAND_PKT;
+		} else {
+			if (flags & 0x01)
+				return BTSNOOP_OPCODE_ACL_RX_PKT;
+			else
+				return BTSNOOP_OPCODE_ACL_TX_PKT;
+		}
+		break;
+	}
+
+	return 0xffff;
+}
+
+/*
+ * Returns the controller index of the records that btmon numbers as HCI
+ * packets, or BTSNOOP_INDEX_ANY for everything else. The type is the first
+ * data byte, which only UART traces need.
+ */
+static uint16_t hci_index(struct btsnoop *btsnoop,
+				const struct btsnoop_pkt *pkt, uint8_t type)
+{
+	uint32_t flags = be32toh(pkt->flags);
+	uint16_t opcode;
+
+	switch (btsnoop->format) {
+	case BTSNOOP_FORMAT_HCI:
+		return 0;
+	case BTSNOOP_FORMAT_UART:
+		if (get_opcode_from_flags(type, flags) == 0xffff)
+			return BTSNOOP_INDEX_ANY;
+		return 0;
+	case BTSNOOP_FORMAT_MONITOR:
+		opcode = flags & 0xffff;
+		if (opcode < BTSNOOP_OPCODE_COMMAND_PKT ||
+				opcode > BTSNOOP_OPCODE_SCO_RX_PKT)
+			return BTSNOOP_INDEX_ANY;
+		return flags >> 16;
+	}
+
+	return BTSNOOP_INDEX_ANY;
+}
+
+static void hci_count(uint64_t *hci, uint16_t index)
+{
+	if (index < BTSNOOP_MAX_INDEX)
+		hci[index]++;
+}
+
+/* Controller index records, which readers need to make sense of the rest */
+static bool meta_record(struct btsnoop *btsnoop, const struct btsnoop_pkt *pkt)
+{
+	if (btsnoop->format != BTSNOOP_FORMAT_MONITOR)
+		return false;
+
+	if (be32toh(pkt->len) > BTSNOOP_META_MAX_SIZE)
+		return false;
+
+	switch (be32toh(pkt->flags) & 0xffff) {
+	case BTSNOOP_OPCODE_NEW_INDEX:
+	case BTSNOOP_OPCODE_DEL_INDEX:
+	case BTSNOOP_OPCODE_OPEN_INDEX:
+	case BTSNOOP_OPCODE_CLOSE_INDEX:
+	case BTSNOOP_OPCODE_INDEX_INFO:
+		return true;
+	}
+
+	return false;
+}
+
+static void index_write(struct btsnoop *btsnoop, uint64_t frame, uint64_t ts)
+{
+	struct btsnoop_idx_entry entry;
+	int i;
+
+	entry.frame = htobe64(frame);
+	entry.offset = htobe64(btsnoop->cur_size);
+	entry.ts = htobe64(ts);
+
+	for (i = 0; i < BTSNOOP_MAX_INDEX; i++)
+		entry.hci[i] = htobe64(btsnoop->hci[i]);
+
+	if (write(btsnoop->idx_fd, &entry, BTSNOOP_IDX_ENTRY_SIZE) !=
+						BTSNOOP_IDX_ENTRY_SIZE) {
+		/* A stale index is rebuilt by readers, so just stop here */
+		close(btsnoop->idx_fd);
+		btsnoop->idx_fd = -1;
+	}
+}
+
 bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
 			uint32_t flags, uint32_t drops, const void *data,
 			uint16_t size)
@@ -271,7 +714,7 @@ bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
 	if (!btsnoop || !tv)
 		return false;
 
-	if (btsnoop->max_size && btsnoop->max_size <=
+	if (!btsnoop->compressed && btsnoop->max_size && btsnoop->max_size <=
 			btsnoop->cur_size + size + BTSNOOP_PKT_SIZE)
 		if (!btsnoop_rotate(btsnoop))
 			return false;
@@ -284,11 +727,25 @@ bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
 	pkt.drops = htobe32(drops);
 	pkt.ts    = htobe64(ts + 0x00E03AB44A676000ll);
 
+	if (btsnoop->compressed)
+		return chunk_write(btsnoop, &pkt, data, size);
+
+	if (btsnoop->idx_fd >= 0 &&
+			!(btsnoop->frame % BTSNOOP_INDEX_INTERVAL))
+		index_write(btsnoop, btsnoop->frame, be64toh(pkt.ts));
+
+	if (btsnoop->idx_fd >= 0 && meta_record(btsnoop, &pkt))
+		index_write(btsnoop, btsnoop->frame | BTSNOOP_IDX_META,
+							be64toh(pkt.ts));
+
 	written = write(btsnoop->fd, &pkt, BTSNOOP_PKT_SIZE);
 	if (written < 0)
 		return false;
 
 	btsnoop->cur_size += BTSNOOP_PKT_SIZE;
+	btsnoop->frame++;
+	hci_count(btsnoop->hci, hci_index(btsnoop, &pkt,
+				data && size > 0 ? *(uint8_t *) data : 0));
 
 	if (data && size > 0) {
 		written = write(btsnoop->fd, data, size);
@@ -466,39 +923,93 @@ static bool pklg_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 	return true;
 }
 
-static uint16_t get_opcode_from_flags(uint8_t type, uint32_t flags)
+static bool chunk_load(struct btsnoop *btsnoop)
 {
-	switch (type) {
-	case 0x01:
-		return BTSNOOP_OPCODE_COMMAND_PKT;
-	case 0x02:
-		if (flags & 0x01)
-			return BTSNOOP_OPCODE_ACL_RX_PKT;
-		else
-			return BTSNOOP_OPCODE_ACL_TX_PKT;
-	case 0x03:
-		if (flags & 0x01)
-			return BTSNOOP_OPCODE_SCO_RX_PKT;
-		else
-			return BTSNOOP_OPCODE_SCO_TX_PKT;
-	case 0x04:
-		return BTSNOOP_OPCODE_EVENT_PKT;
-	case 0xff:
-		if (flags & 0x02) {
-			if (flags & 0x01)
-				return BTSNOOP_OPCODE_EVENT_PKT;
-			else
-				return BTSNOOP_OPCODE_COMMAND_PKT;
-		} else {
-			if (flags & 0x01)
-				return BTSNOOP_OPCODE_ACL_RX_PKT;
-			else
-				return BTSNOOP_OPCODE_ACL_TX_PKT;
-		}
-		break;
+	struct btsnoop_chunk chunk;
+	uint32_t size, len;
+	ssize_t ret;
+
+	btsnoop->chunk_len = 0;
+	btsnoop->chunk_pos = 0;
+
+	ret = read(btsnoop->fd, &chunk, BTSNOOP_CHUNK_SIZE);
+	if (ret == 0)
+		return false;
+
+	if (ret != BTSNOOP_CHUNK_SIZE)
+		goto failed;
+
+	size = be32toh(chunk.size);
+	len = be32toh(chunk.len);
+
+	if (len > BTSNOOP_CHUNK_MAX_LEN ||
+			size > lz4_compress_bound(BTSNOOP_CHUNK_MAX_LEN))
+		goto failed;
+
+	if (be32toh(chunk.flags) & BTSNOOP_CHUNK_FLAG_STORED) {
+		if (size != len || read(btsnoop->fd, btsnoop->chunk, len) !=
+								(ssize_t) len)
+			goto failed;
+	} else {
+		if (read(btsnoop->fd, btsnoop->chunk_buf, size) !=
+								(ssize_t) size)
+			goto failed;
+
+		if (lz4_decompress(btsnoop->chunk_buf, size, btsnoop->chunk,
+						len) != (ssize_t) len)
+			goto failed;
 	}
 
-	return 0xffff;
+	btsnoop->chunk_len = len;
+
+	return true;
+
+failed:
+	btsnoop->aborted = true;
+	return false;
+}
+
+static ssize_t snoop_read(struct btsnoop *btsnoop, void *data, size_t len)
+{
+	if (!btsnoop->compressed)
+		return read(btsnoop->fd, data, len);
+
+	if (!len)
+		return 0;
+
+	if (btsnoop->chunk_pos == btsnoop->chunk_len &&
+						!chunk_load(btsnoop))
+		return btsnoop->aborted ? -1 : 0;
+
+	/* Records are never split across chunks */
+	if (len > btsnoop->chunk_len - btsnoop->chunk_pos)
+		return -1;
+
+	memcpy(data, btsnoop->chunk + btsnoop->chunk_pos, len);
+	btsnoop->chunk_pos += len;
+
+	return len;
+}
+
+/* Returns the controller index records that precede a seek target */
+static bool replay_read(struct btsnoop *btsnoop, struct timeval *tv,
+					uint16_t *index, uint16_t *opcode,
+					void *data, uint16_t *size)
+{
+	struct btsnoop_meta *meta = &btsnoop->meta[btsnoop->replay_pos++];
+	uint32_t flags = be32toh(meta->pkt.flags);
+	uint64_t ts;
+
+	ts = be64toh(meta->pkt.ts) - 0x00E03AB44A676000ll;
+	tv->tv_sec = (ts / 1000000ll) + 946684800ll;
+	tv->tv_usec = ts % 1000000ll;
+
+	*index = flags >> 16;
+	*opcode = flags & 0xffff;
+	*size = be32toh(meta->pkt.len);
+	memcpy(data, meta->data, *size);
+
+	return true;
 }
 
 bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
@@ -517,7 +1028,10 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 	if (btsnoop->pklg_format)
 		return pklg_read_hci(btsnoop, tv, index, opcode, data, size);
 
-	len = read(btsnoop->fd, &pkt, BTSNOOP_PKT_SIZE);
+	if (btsnoop->replay_pos < btsnoop->replay_len)
+		return replay_read(btsnoop, tv, index, opcode, data, size);
+
+	len = snoop_read(btsnoop, &pkt, BTSNOOP_PKT_SIZE);
 	if (len == 0)
 		return false;
 
@@ -545,7 +1059,7 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		break;
 
 	case BTSNOOP_FORMAT_UART:
-		len = read(btsnoop->fd, &pkt_type, 1);
+		len = snoop_read(btsnoop, &pkt_type, 1);
 		if (len < 0) {
 			btsnoop->aborted = true;
 			return false;
@@ -566,7 +1080,7 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		return false;
 	}
 
-	len = read(btsnoop->fd, data, toread);
+	len = snoop_read(btsnoop, data, toread);
 	if (len < 0) {
 		btsnoop->aborted = true;
 		return false;
@@ -582,3 +1096,561 @@ bool btsnoop_read_phy(struct btsnoop *btsnoop, struct timeval *tv,
 {
 	return false;
 }
+
+static bool index_add(struct btsnoop *btsnoop, uint64_t frame,
+			uint64_t offset, uint64_t ts, const uint64_t *hci)
+{
+	struct btsnoop_idx *entry;
+
+	if (btsnoop->idx_len == btsnoop->idx_size) {
+		size_t size = btsnoop->idx_size ? btsnoop->idx_size * 2 : 64;
+
+		entry = realloc(btsnoop->idx, size * sizeof(*entry));
+		if (!entry)
+			return false;
+
+		btsnoop->idx = entry;
+		btsnoop->idx_size = size;
+	}
+
+	entry = &btsnoop->idx[btsnoop->idx_len++];
+	entry->frame = frame;
+	entry->offset = offset;
+	entry->ts = ts;
+	memcpy(entry->hci, hci, sizeof(entry->hci));
+
+	return true;
+}
+
+static bool meta_add(struct btsnoop *btsnoop, uint64_t frame, uint64_t offset,
+			const struct btsnoop_pkt *pkt, const void *data)
+{
+	struct btsnoop_meta *meta;
+
+	if (btsnoop->meta_len == btsnoop->meta_size) {
+		size_t size = btsnoop->meta_size ? btsnoop->meta_size * 2 : 16;
+
+		meta = realloc(btsnoop->meta, size * sizeof(*meta));
+		if (!meta)
+			return false;
+
+		btsnoop->meta = meta;
+		btsnoop->meta_size = size;
+	}
+
+	meta = &btsnoop->meta[btsnoop->meta_len++];
+	meta->frame = frame;
+	meta->offset = offset;
+	meta->pkt = *pkt;
+	memcpy(meta->data, data, be32toh(pkt->len));
+
+	return true;
+}
+
+static bool meta_read(struct btsnoop *btsnoop, uint64_t frame, uint64_t offset,
+								uint64_t ts)
+{
+	struct btsnoop_pkt pkt;
+	uint8_t data[BTSNOOP_META_MAX_SIZE];
+	uint32_t len;
+
+	if (pread(btsnoop->fd, &pkt, BTSNOOP_PKT_SIZE, offset) !=
+							BTSNOOP_PKT_SIZE)
+		return false;
+
+	if (be64toh(pkt.ts) != ts || !meta_record(btsnoop, &pkt))
+		return false;
+
+	len = be32toh(pkt.len);
+	if (pread(btsnoop->fd, data, len, offset + BTSNOOP_PKT_SIZE) !=
+								(ssize_t) len)
+		return false;
+
+	return meta_add(btsnoop, frame, offset, &pkt, data);
+}
+
+static bool index_valid(struct btsnoop *btsnoop, struct btsnoop_idx *entry)
+{
+	struct btsnoop_pkt pkt;
+
+	if (pread(btsnoop->fd, &pkt, BTSNOOP_PKT_SIZE, entry->offset) !=
+							BTSNOOP_PKT_SIZE)
+		return false;
+
+	return be64toh(pkt.ts) == entry->ts;
+}
+
+static void index_load(struct btsnoop *btsnoop)
+{
+	struct btsnoop_idx_hdr hdr;
+	struct btsnoop_idx_entry entry;
+	uint64_t hci[BTSNOOP_MAX_INDEX];
+	int fd, i;
+
+	fd = open(btsnoop->idx_path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	if (read(fd, &hdr, BTSNOOP_IDX_HDR_SIZE) != BTSNOOP_IDX_HDR_SIZE)
+		goto done;
+
+	if (memcmp(hdr.id, btsnoop_idx_id, sizeof(btsnoop_idx_id)) ||
+			be32toh(hdr.version) != btsnoop_idx_version ||
+			be32toh(hdr.interval) != BTSNOOP_INDEX_INTERVAL)
+		goto done;
+
+	while (read(fd, &entry, BTSNOOP_IDX_ENTRY_SIZE) ==
+						BTSNOOP_IDX_ENTRY_SIZE) {
+		uint64_t frame = be64toh(entry.frame);
+
+		if (frame & BTSNOOP_IDX_META) {
+			if (!meta_read(btsnoop, frame & ~BTSNOOP_IDX_META,
+						be64toh(entry.offset),
+						be64toh(entry.ts)))
+				goto invalid;
+			continue;
+		}
+
+		for (i = 0; i < BTSNOOP_MAX_INDEX; i++)
+			hci[i] = be64toh(entry.hci[i]);
+
+		if (!index_add(btsnoop, frame, be64toh(entry.offset),
+						be64toh(entry.ts), hci))
+			break;
+	}
+
+	/*
+	 * Checking the first and last entry against the trace catches
+	 * sidecar files that belong to a different or rewritten trace.
+	 */
+	if (!btsnoop->idx_len || (!btsnoop->idx[0].frame &&
+			index_valid(btsnoop, &btsnoop->idx[0]) &&
+			index_valid(btsnoop,
+				&btsnoop->idx[btsnoop->idx_len - 1])))
+		goto done;
+
+invalid:
+	btsnoop->idx_len = 0;
+	btsnoop->meta_len = 0;
+
+done:
+	close(fd);
+}
+
+static void index_scan(struct btsnoop *btsnoop)
+{
+	uint8_t buf[65536];
+	uint64_t hci[BTSNOOP_MAX_INDEX];
+	uint64_t offset, frame;
+
+	/* Continue from the last entry, it may have been a partial write */
+	if (btsnoop->idx_len) {
+		btsnoop->idx_len--;
+		offset = btsnoop->idx[btsnoop->idx_len].offset;
+		frame = btsnoop->idx[btsnoop->idx_len].frame;
+		memcpy(hci, btsnoop->idx[btsnoop->idx_len].hci, sizeof(hci));
+	} else {
+		offset = BTSNOOP_HDR_SIZE;
+		frame = 0;
+		memset(hci, 0, sizeof(hci));
+	}
+
+	/* Records from there on are found again below */
+	while (btsnoop->meta_len &&
+			btsnoop->meta[btsnoop->meta_len - 1].frame >= frame)
+		btsnoop->meta_len--;
+
+	while (1) {
+		size_t pos = 0;
+		ssize_t len;
+
+		len = pread(btsnoop->fd, buf, sizeof(buf), offset);
+		if (len < (ssize_t) BTSNOOP_PKT_SIZE)
+			break;
+
+		while (pos + BTSNOOP_PKT_SIZE <= (size_t) len) {
+			const struct btsnoop_pkt *pkt = (void *) (buf + pos);
+			uint32_t toread = be32toh(pkt->len);
+			uint8_t type = 0;
+
+			if (toread > BTSNOOP_MAX_PACKET_SIZE)
+				return;
+
+			/* UART traces need the first data byte as well */
+			if (toread) {
+				if (pos + BTSNOOP_PKT_SIZE == (size_t) len)
+					break;
+				type = buf[pos + BTSNOOP_PKT_SIZE];
+			}
+
+			if (!(frame % BTSNOOP_INDEX_INTERVAL)) {
+				if (!index_add(btsnoop, frame, offset + pos,
+							be64toh(pkt->ts), hci))
+					return;
+				btsnoop->idx_dirty = true;
+			}
+
+			if (meta_record(btsnoop, pkt)) {
+				if (!meta_read(btsnoop, frame, offset + pos,
+							be64toh(pkt->ts)))
+					return;
+				btsnoop->idx_dirty = true;
+			}
+
+			hci_count(hci, hci_index(btsnoop, pkt, type));
+
+			pos += BTSNOOP_PKT_SIZE + toread;
+			frame++;
+		}
+
+		if (!pos)
+			break;
+
+		offset += pos;
+	}
+}
+
+static void index_save(struct btsnoop *btsnoop)
+{
+	struct btsnoop_idx_hdr hdr;
+	char tmp[PATH_MAX];
+	size_t i;
+	int fd, j;
+
+	snprintf(tmp, PATH_MAX, "%s.tmp", btsnoop->idx_path);
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+					S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0)
+		return;
+
+	memcpy(hdr.id, btsnoop_idx_id, sizeof(btsnoop_idx_id));
+	hdr.version = htobe32(btsnoop_idx_version);
+	hdr.interval = htobe32(BTSNOOP_INDEX_INTERVAL);
+
+	if (write(fd, &hdr, BTSNOOP_IDX_HDR_SIZE) != BTSNOOP_IDX_HDR_SIZE)
+		goto failed;
+
+	for (i = 0; i < btsnoop->idx_len; i++) {
+		struct btsnoop_idx_entry entry;
+
+		entry.frame = htobe64(btsnoop->idx[i].frame);
+		entry.offset = htobe64(btsnoop->idx[i].offset);
+		entry.ts = htobe64(btsnoop->idx[i].ts);
+
+		for (j = 0; j < BTSNOOP_MAX_INDEX; j++)
+			entry.hci[j] = htobe64(btsnoop->idx[i].hci[j]);
+
+		if (write(fd, &entry, BTSNOOP_IDX_ENTRY_SIZE) !=
+						BTSNOOP_IDX_ENTRY_SIZE)
+			goto failed;
+	}
+
+	for (i = 0; i < btsnoop->meta_len; i++) {
+		struct btsnoop_idx_entry entry;
+
+		memset(&entry, 0, sizeof(entry));
+		entry.frame = htobe64(btsnoop->meta[i].frame |
+							BTSNOOP_IDX_META);
+		entry.offset = htobe64(btsnoop->meta[i].offset);
+		entry.ts = btsnoop->meta[i].pkt.ts;
+
+		if (write(fd, &entry, BTSNOOP_IDX_ENTRY_SIZE) !=
+						BTSNOOP_IDX_ENTRY_SIZE)
+			goto failed;
+	}
+
+	close(fd);
+
+	if (rename(tmp, btsnoop->idx_path) < 0)
+		unlink(tmp);
+
+	return;
+
+failed:
+	close(fd);
+	unlink(tmp);
+}
+
+/*
+ * Chunk headers give the offsets, but the HCI packet numbers are only
+ * known after decompressing every chunk once.
+ */
+static void index_scan_chunks(struct btsnoop *btsnoop)
+{
+	uint64_t hci[BTSNOOP_MAX_INDEX] = { 0 };
+	struct btsnoop_chunk chunk;
+	uint64_t frame = 0;
+	off_t offset;
+
+	offset = lseek(btsnoop->fd, BTSNOOP_HDR_SIZE, SEEK_SET);
+
+	while (offset >= 0 && pread(btsnoop->fd, &chunk, BTSNOOP_CHUNK_SIZE,
+					offset) == BTSNOOP_CHUNK_SIZE) {
+		if (!index_add(btsnoop, frame, offset, be64toh(chunk.ts), hci))
+			break;
+
+		if (!chunk_load(btsnoop))
+			break;
+
+		while (btsnoop->chunk_pos + BTSNOOP_PKT_SIZE <=
+						btsnoop->chunk_len) {
+			const struct btsnoop_pkt *pkt;
+			const uint8_t *data;
+			uint8_t type = 0;
+
+			pkt = (void *) (btsnoop->chunk + btsnoop->chunk_pos);
+			btsnoop->chunk_pos += BTSNOOP_PKT_SIZE;
+
+			/* Records never span chunks, so the data is here */
+			if (btsnoop->chunk_pos < btsnoop->chunk_len)
+				type = btsnoop->chunk[btsnoop->chunk_pos];
+
+			data = btsnoop->chunk + btsnoop->chunk_pos;
+			if (meta_record(btsnoop, pkt) && btsnoop->chunk_pos +
+					be32toh(pkt->len) <= btsnoop->chunk_len)
+				meta_add(btsnoop, frame, 0, pkt, data);
+
+			hci_count(hci, hci_index(btsnoop, pkt, type));
+
+			btsnoop->chunk_pos += be32toh(pkt->len);
+			frame++;
+		}
+
+		offset = lseek(btsnoop->fd, 0, SEEK_CUR);
+	}
+
+	btsnoop->aborted = false;
+	btsnoop->chunk_len = 0;
+	btsnoop->chunk_pos = 0;
+}
+
+static bool index_prepare(struct btsnoop *btsnoop)
+{
+	/* Apple Packet Logger files have no fixed size record header */
+	if (btsnoop->pklg_format || !btsnoop->idx_path)
+		return false;
+
+	if (!btsnoop->idx && btsnoop->compressed)
+		index_scan_chunks(btsnoop);
+	else if (!btsnoop->idx) {
+		index_load(btsnoop);
+		index_scan(btsnoop);
+
+		/* Failing to store the index only costs a rescan next time */
+		if (btsnoop->idx_dirty) {
+			index_save(btsnoop);
+			btsnoop->idx_dirty = false;
+		}
+	}
+
+	return btsnoop->idx_len > 0;
+}
+
+/*
+ * Records are skipped until one reaches the requested HCI packet number on
+ * the given index or the requested time, and frames is left with the number
+ * of HCI packets per index that precede it.
+ */
+static bool seek_stop(struct btsnoop *btsnoop, const struct btsnoop_pkt *pkt,
+				uint8_t type, uint16_t index, uint64_t frame,
+				uint64_t ts, uint64_t *frames)
+{
+	uint16_t pkt_index;
+
+	if (be64toh(pkt->ts) >= ts)
+		return true;
+
+	pkt_index = hci_index(btsnoop, pkt, type);
+	if (pkt_index >= BTSNOOP_MAX_INDEX)
+		return false;
+
+	if ((index == BTSNOOP_INDEX_ANY || index == pkt_index) &&
+					frames[pkt_index] + 1 >= frame)
+		return true;
+
+	frames[pkt_index]++;
+
+	return false;
+}
+
+static bool index_seek_chunk(struct btsnoop *btsnoop,
+				struct btsnoop_idx *entry, uint16_t index,
+				uint64_t frame, uint64_t ts, uint64_t *frames,
+				uint64_t *record)
+{
+	if (lseek(btsnoop->fd, entry->offset, SEEK_SET) < 0)
+		return false;
+
+	btsnoop->aborted = false;
+	btsnoop->chunk_len = 0;
+	btsnoop->chunk_pos = 0;
+
+	while (1) {
+		const struct btsnoop_pkt *pkt;
+		size_t pos;
+
+		if (btsnoop->chunk_pos == btsnoop->chunk_len &&
+						!chunk_load(btsnoop))
+			return false;
+
+		if (btsnoop->chunk_len - btsnoop->chunk_pos < BTSNOOP_PKT_SIZE)
+			return false;
+
+		pkt = (void *) (btsnoop->chunk + btsnoop->chunk_pos);
+		pos = btsnoop->chunk_pos + BTSNOOP_PKT_SIZE;
+
+		if (seek_stop(btsnoop, pkt, pos < btsnoop->chunk_len ?
+					btsnoop->chunk[pos] : 0,
+					index, frame, ts, frames))
+			break;
+
+		btsnoop->chunk_pos = pos + be32toh(pkt->len);
+		(*record)++;
+
+		/* Corrupted record lengths would point past the chunk */
+		if (btsnoop->chunk_pos > btsnoop->chunk_len)
+			return false;
+	}
+
+	return true;
+}
+
+/* Controller index records before the seek target are read first */
+static void replay_start(struct btsnoop *btsnoop, uint64_t record)
+{
+	btsnoop->replay_pos = 0;
+	btsnoop->replay_len = 0;
+
+	while (btsnoop->replay_len < btsnoop->meta_len &&
+			btsnoop->meta[btsnoop->replay_len].frame < record)
+		btsnoop->replay_len++;
+}
+
+static bool index_seek(struct btsnoop *btsnoop, struct btsnoop_idx *entry,
+				uint16_t index, uint64_t frame, uint64_t ts,
+				uint64_t *frames)
+{
+	uint64_t offset = entry->offset;
+	uint64_t record = entry->frame;
+
+	memcpy(frames, entry->hci, sizeof(entry->hci));
+
+	if (btsnoop->compressed) {
+		if (!index_seek_chunk(btsnoop, entry, index, frame, ts,
+							frames, &record))
+			return false;
+
+		replay_start(btsnoop, record);
+
+		return true;
+	}
+
+	while (1) {
+		struct btsnoop_pkt pkt;
+		uint8_t type = 0;
+
+		if (pread(btsnoop->fd, &pkt, BTSNOOP_PKT_SIZE, offset) !=
+							BTSNOOP_PKT_SIZE)
+			return false;
+
+		if (btsnoop->format == BTSNOOP_FORMAT_UART &&
+				pread(btsnoop->fd, &type, 1,
+					offset + BTSNOOP_PKT_SIZE) != 1)
+			return false;
+
+		if (seek_stop(btsnoop, &pkt, type, index, frame, ts, frames))
+			break;
+
+		offset += BTSNOOP_PKT_SIZE + be32toh(pkt.len);
+		record++;
+	}
+
+	if (lseek(btsnoop->fd, offset, SEEK_SET) < 0)
+		return false;
+
+	btsnoop->aborted = false;
+	replay_start(btsnoop, record);
+
+	return true;
+}
+
+static bool index_before(struct btsnoop_idx *entry, uint16_t index,
+							uint64_t frame)
+{
+	int i;
+
+	if (index != BTSNOOP_INDEX_ANY)
+		return entry->hci[index] < frame;
+
+	for (i = 0; i < BTSNOOP_MAX_INDEX; i++) {
+		if (entry->hci[i] >= frame)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Frames are numbered per controller index starting at 1 and only count
+ * HCI packets, the same way btmon shows them. BTSNOOP_INDEX_ANY seeks to
+ * the first packet with that number on any index.
+ */
+bool btsnoop_seek_frame(struct btsnoop *btsnoop, uint16_t index,
+				unsigned long frame, uint64_t *frames)
+{
+	size_t low = 0, high;
+
+	if (!btsnoop || !frames)
+		return false;
+
+	if (index != BTSNOOP_INDEX_ANY && index >= BTSNOOP_MAX_INDEX)
+		return false;
+
+	if (!index_prepare(btsnoop))
+		return false;
+
+	/* Find the last entry that is before the requested frame */
+	high = btsnoop->idx_len;
+	while (high - low > 1) {
+		size_t mid = low + (high - low) / 2;
+
+		if (index_before(&btsnoop->idx[mid], index, frame))
+			low = mid;
+		else
+			high = mid;
+	}
+
+	return index_seek(btsnoop, &btsnoop->idx[low], index, frame,
+							UINT64_MAX, frames);
+}
+
+bool btsnoop_seek_time(struct btsnoop *btsnoop, const struct timeval *tv,
+							uint64_t *frames)
+{
+	size_t low = 0, high;
+	uint64_t ts;
+
+	if (!btsnoop || !tv || !frames || !index_prepare(btsnoop))
+		return false;
+
+	ts = (tv->tv_sec - 946684800ll) * 1000000ll + tv->tv_usec;
+	ts += 0x00E03AB44A676000ll;
+
+	/*
+	 * Find the last entry that is not later than the requested time,
+	 * this assumes that timestamps are monotonic within the trace.
+	 */
+	high = btsnoop->idx_len;
+	while (high - low > 1) {
+		size_t mid = low + (high - low) / 2;
+
+		if (btsnoop->idx[mid].ts <= ts)
+			low = mid;
+		else
+			high = mid;
+	}
+
+	return index_seek(btsnoop, &btsnoop->idx[low], BTSNOOP_INDEX_ANY,
+							UINT64_MAX, ts, frames);
+}
@@ -56,6 +56,10 @@
 
 #define BTSNOOP_MAX_PACKET_SIZE		(1486 + 4)
 
+/* Controller indexes that seeking keeps HCI packet numbers for */
+#define BTSNOOP_MAX_INDEX	16
+#define BTSNOOP_INDEX_ANY	0xffff
+
 #define BTSNOOP_TYPE_PRIMARY	0
 #define BTSNOOP_TYPE_AMP	1
 
@@ -120,3 +124,11 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 					void *data, uint16_t *size);
 bool btsnoop_read_phy(struct btsnoop *btsnoop, struct timeval *tv,
 			uint16_t *frequency, void *data, uint16_t *size);
+
+bool btsnoop_enable_index(struct btsnoop *btsnoop);
+bool btsnoop_enable_compression(struct btsnoop *btsnoop);
+bool btsnoop_flush(struct btsnoop *btsnoop);
+bool btsnoop_seek_frame(struct btsnoop *btsnoop, uint16_t index,
+				unsigned long frame, uint64_t *frames);
+bool btsnoop_seek_time(struct btsnoop *btsnoop, const struct timeval *tv,
+							uint64_t *frames);
@@ -0,0 +1,250 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  BlueZ contributors
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include "src/shared/util.h"
+#include "src/shared/lz4.h"
+
+/*
+ * Minimal implementation of the LZ4 block format. The output is readable
+ * by any LZ4 block decoder and the decoder accepts any valid LZ4 block,
+ * but no frame format or dictionary support is provided.
+ */
+
+#define MIN_MATCH	4
+#define LAST_LITERALS	5
+#define MF_LIMIT	12
+#define MAX_DISTANCE	65535
+#define HASH_BITS	12
+#define RUN_MASK	15
+
+static inline uint32_t read32(const uint8_t *ptr)
+{
+	uint32_t val;
+
+	memcpy(&val, ptr, sizeof(val));
+
+	return val;
+}
+
+static inline unsigned int hash32(uint32_t val)
+{
+	return (val * 2654435761U) >> (32 - HASH_BITS);
+}
+
+static uint8_t *put_length(uint8_t *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+
+	*op++ = len;
+
+	return op;
+}
+
+size_t lz4_compress_bound(size_t len)
+{
+	return len + len / 255 + 16;
+}
+
+static uint8_t *put_literals(uint8_t *op, uint8_t *oend, uint8_t *token,
+				const uint8_t *anchor, size_t litlen)
+{
+	if ((size_t) (oend - op) < litlen + litlen / 255 + 1)
+		return NULL;
+
+	if (litlen >= RUN_MASK) {
+		*token = RUN_MASK << 4;
+		op = put_length(op, litlen - RUN_MASK);
+	} else
+		*token = litlen << 4;
+
+	memcpy(op, anchor, litlen);
+
+	return op + litlen;
+}
+
+size_t lz4_compress(const void *src, size_t src_len, void *dst, size_t dst_len)
+{
+	uint32_t table[1 << HASH_BITS];
+	const uint8_t *base = src;
+	const uint8_t *ip = base, *anchor = base;
+	const uint8_t *iend = base + src_len;
+	const uint8_t *mflimit, *matchlimit;
+	uint8_t *op = dst, *oend = op + dst_len;
+	uint8_t *token;
+
+	if (!dst_len)
+		return 0;
+
+	/* Table entries hold the position plus one, zero means unused */
+	memset(table, 0, sizeof(table));
+
+	if (src_len < MF_LIMIT + 1)
+		goto last_literals;
+
+	/* Only valid once the input is known to be long enough */
+	mflimit = iend - MF_LIMIT;
+	matchlimit = iend - LAST_LITERALS;
+
+	while (ip < mflimit) {
+		uint32_t seq = read32(ip);
+		unsigned int h = hash32(seq);
+		const uint8_t *ref;
+		size_t mlen;
+
+		ref = table[h] ? base + table[h] - 1 : NULL;
+		table[h] = ip - base + 1;
+
+		if (!ref || ip - ref > MAX_DISTANCE || read32(ref) != seq) {
+			ip++;
+			continue;
+		}
+
+		/* Extend the match backwards over pending literals */
+		while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		mlen = MIN_MATCH;
+		while (ip + mlen < matchlimit && ip[mlen] == ref[mlen])
+			mlen++;
+
+		if (op >= oend)
+			return 0;
+
+		token = op++;
+
+		op = put_literals(op, oend, token, anchor, ip - anchor);
+		if (!op || oend - op < 2 + (ptrdiff_t) (mlen / 255 + 1))
+			return 0;
+
+		put_le16(ip - ref, op);
+		op += 2;
+
+		if (mlen - MIN_MATCH >= RUN_MASK) {
+			*token |= RUN_MASK;
+			op = put_length(op, mlen - MIN_MATCH - RUN_MASK);
+		} else
+			*token |= mlen - MIN_MATCH;
+
+		ip += mlen;
+		anchor = ip;
+	}
+
+last_literals:
+	if (op >= oend)
+		return 0;
+
+	token = op++;
+
+	op = put_literals(op, oend, token, anchor, iend - anchor);
+	if (!op)
+		return 0;
+
+	return op - (uint8_t *) dst;
+}
+
+static const uint8_t *get_length(const uint8_t *ip, const uint8_t *iend,
+								size_t *len)
+{
+	uint8_t val;
+
+	do {
+		if (ip >= iend)
+			return NULL;
+
+		val = *ip++;
+		*len += val;
+	} while (val == 255);
+
+	return ip;
+}
+
+ssize_t lz4_decompress(const void *src, size_t src_len,
+					void *dst, size_t dst_len)
+{
+	const uint8_t *ip = src, *iend = ip + src_len;
+	uint8_t *op = dst, *oend = op + dst_len;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+		size_t litlen = token >> 4;
+		size_t mlen = token & RUN_MASK;
+		const uint8_t *ref;
+		uint16_t offset;
+
+		if (litlen == RUN_MASK) {
+			ip = get_length(ip, iend, &litlen);
+			if (!ip)
+				return -1;
+		}
+
+		if (litlen > (size_t) (iend - ip) ||
+					litlen > (size_t) (oend - op))
+			return -1;
+
+		memcpy(op, ip, litlen);
+		ip += litlen;
+		op += litlen;
+
+		/* The last sequence only carries literals */
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return -1;
+
+		offset = get_le16(ip);
+		ip += 2;
+
+		if (!offset || offset > op - (uint8_t *) dst)
+			return -1;
+
+		if (mlen == RUN_MASK) {
+			ip = get_length(ip, iend, &mlen);
+			if (!ip)
+				return -1;
+		}
+
+		mlen += MIN_MATCH;
+
+		if (mlen > (size_t) (oend - op))
+			return -1;
+
+		/* Matches may overlap the output, so copy byte by byte */
+		for (ref = op - offset; mlen > 0; mlen--)
+			*op++ = *ref++;
+	}
+
+	return op - (uint8_t *) dst;
+}
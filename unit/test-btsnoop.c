@@ -0,0 +1,340 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  BlueZ contributors
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include "src/shared/btsnoop.h"
+#include "src/shared/tester.h"
+
+#define BASE_SEC	1700000000
+
+struct test_data {
+	unsigned int count;
+	uint16_t len;
+	unsigned int per_sec;
+};
+
+static const struct test_data roundtrip_data = {
+	.count = 500,
+	.len = 0,
+	.per_sec = 8,
+};
+
+/* Records of 24 + 1000 bytes fill a 64 KiB chunk exactly */
+static const struct test_data chunks_data = {
+	.count = 64 * 5 + 1,
+	.len = 1000,
+	.per_sec = 1000,
+};
+
+static const struct test_data seek_data = {
+	.count = 5000,
+	.len = 0,
+	.per_sec = 16,
+};
+
+static char trace_path[] = "/tmp/test-btsnoop-XXXXXX";
+
+static void remove_trace(void)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s.idx", trace_path);
+
+	unlink(trace_path);
+	unlink(path);
+}
+
+static uint16_t pkt_len(const struct test_data *data, unsigned int i)
+{
+	return data->len ? data->len : 4 + i % 251;
+}
+
+static uint16_t pkt_opcode(unsigned int i)
+{
+	return i % 3 ? BTSNOOP_OPCODE_EVENT_PKT : BTSNOOP_OPCODE_COMMAND_PKT;
+}
+
+static void pkt_time(const struct test_data *data, unsigned int i,
+							struct timeval *tv)
+{
+	tv->tv_sec = BASE_SEC + i / data->per_sec;
+	tv->tv_usec = (i % data->per_sec) * (1000000 / data->per_sec);
+}
+
+static void pkt_fill(unsigned int i, uint8_t *buf, uint16_t len)
+{
+	uint16_t j;
+
+	/* Repeating header with a payload that varies per packet */
+	for (j = 0; j < len; j++)
+		buf[j] = j < 8 ? j : (j % 16 ? 0 : i + j);
+}
+
+static void write_trace(const struct test_data *data)
+{
+	struct btsnoop_opcode_new_index ni;
+	uint8_t buf[BTSNOOP_MAX_PACKET_SIZE];
+	struct btsnoop *btsnoop;
+	struct timeval tv;
+	unsigned int i;
+
+	btsnoop = btsnoop_create(trace_path, 0, 0, BTSNOOP_FORMAT_MONITOR);
+	g_assert(btsnoop);
+	g_assert(btsnoop_enable_compression(btsnoop));
+
+	memset(&ni, 0, sizeof(ni));
+	ni.type = BTSNOOP_TYPE_PRIMARY;
+	ni.bus = BTSNOOP_BUS_VIRTUAL;
+	strcpy(ni.name, "hci0");
+
+	pkt_time(data, 0, &tv);
+	g_assert(btsnoop_write_hci(btsnoop, &tv, 0, BTSNOOP_OPCODE_NEW_INDEX,
+						0, &ni, sizeof(ni)));
+
+	for (i = 0; i < data->count; i++) {
+		uint16_t len = pkt_len(data, i);
+
+		pkt_time(data, i, &tv);
+		pkt_fill(i, buf, len);
+
+		g_assert(btsnoop_write_hci(btsnoop, &tv, 0, pkt_opcode(i), 0,
+								buf, len));
+	}
+
+	btsnoop_unref(btsnoop);
+}
+
+static void check_new_index(struct btsnoop *btsnoop)
+{
+	struct btsnoop_opcode_new_index *ni;
+	uint8_t buf[BTSNOOP_MAX_PACKET_SIZE];
+	uint16_t index, opcode, size;
+	struct timeval tv;
+
+	g_assert(btsnoop_read_hci(btsnoop, &tv, &index, &opcode, buf, &size));
+	g_assert_cmpint(index, ==, 0);
+	g_assert_cmpint(opcode, ==, BTSNOOP_OPCODE_NEW_INDEX);
+	g_assert_cmpint(size, ==, sizeof(*ni));
+
+	ni = (void *) buf;
+	g_assert(!strcmp(ni->name, "hci0"));
+}
+
+static void check_packet(struct btsnoop *btsnoop,
+				const struct test_data *data, unsigned int i)
+{
+	uint8_t buf[BTSNOOP_MAX_PACKET_SIZE];
+	uint8_t expect[BTSNOOP_MAX_PACKET_SIZE];
+	uint16_t index, opcode, size;
+	struct timeval tv, expect_tv;
+	uint16_t len = pkt_len(data, i);
+
+	g_assert(btsnoop_read_hci(btsnoop, &tv, &index, &opcode, buf, &size));
+
+	pkt_time(data, i, &expect_tv);
+	pkt_fill(i, expect, len);
+
+	g_assert_cmpint(tv.tv_sec, ==, expect_tv.tv_sec);
+	g_assert_cmpint(tv.tv_usec, ==, expect_tv.tv_usec);
+	g_assert_cmpint(index, ==, 0);
+	g_assert_cmpint(opcode, ==, pkt_opcode(i));
+	g_assert_cmpint(size, ==, len);
+	g_assert(memcmp(buf, expect, len) == 0);
+}
+
+static void check_end(struct btsnoop *btsnoop)
+{
+	uint8_t buf[BTSNOOP_MAX_PACKET_SIZE];
+	uint16_t index, opcode, size;
+	struct timeval tv;
+
+	g_assert(!btsnoop_read_hci(btsnoop, &tv, &index, &opcode, buf,
+								&size));
+}
+
+static void test_roundtrip(const void *test_data)
+{
+	const struct test_data *data = test_data;
+	struct btsnoop *btsnoop;
+	unsigned int i;
+
+	write_trace(data);
+
+	btsnoop = btsnoop_open(trace_path, 0);
+	g_assert(btsnoop);
+	g_assert_cmpint(btsnoop_get_format(btsnoop), ==,
+						BTSNOOP_FORMAT_MONITOR);
+
+	check_new_index(btsnoop);
+
+	for (i = 0; i < data->count; i++)
+		check_packet(btsnoop, data, i);
+
+	check_end(btsnoop);
+
+	btsnoop_unref(btsnoop);
+	remove_trace();
+
+	tester_test_passed();
+}
+
+static void test_chunks(const void *test_data)
+{
+	const struct test_data *data = test_data;
+	struct btsnoop *btsnoop;
+	struct stat st;
+	off_t raw;
+	unsigned int i;
+
+	write_trace(data);
+
+	/* Uncompressed size of the header and all records */
+	raw = 16 + (24 + sizeof(struct btsnoop_opcode_new_index)) +
+					(off_t) data->count * (24 + data->len);
+
+	g_assert(stat(trace_path, &st) == 0);
+	tester_debug("%lld bytes stored in %lld bytes", (long long) raw,
+						(long long) st.st_size);
+	g_assert(st.st_size < raw);
+
+	btsnoop = btsnoop_open(trace_path, 0);
+	g_assert(btsnoop);
+
+	check_new_index(btsnoop);
+
+	for (i = 0; i < data->count; i++)
+		check_packet(btsnoop, data, i);
+
+	check_end(btsnoop);
+
+	btsnoop_unref(btsnoop);
+	remove_trace();
+
+	tester_test_passed();
+}
+
+static void check_seek_frame(struct btsnoop *btsnoop,
+				const struct test_data *data, unsigned int i)
+{
+	uint64_t frames[BTSNOOP_MAX_INDEX];
+
+	/* Frames are numbered from 1 */
+	g_assert(btsnoop_seek_frame(btsnoop, 0, i + 1, frames));
+	g_assert_cmpint(frames[0], ==, i);
+
+	/* Controller index records before the seek point are replayed */
+	check_new_index(btsnoop);
+	check_packet(btsnoop, data, i);
+
+	if (i + 1 < data->count)
+		check_packet(btsnoop, data, i + 1);
+}
+
+static void check_seek_time(struct btsnoop *btsnoop,
+				const struct test_data *data, unsigned int i)
+{
+	uint64_t frames[BTSNOOP_MAX_INDEX];
+	struct timeval tv;
+
+	pkt_time(data, i, &tv);
+
+	g_assert(btsnoop_seek_time(btsnoop, &tv, frames));
+	g_assert_cmpint(frames[0], ==, i);
+
+	check_new_index(btsnoop);
+	check_packet(btsnoop, data, i);
+}
+
+static void test_seek(const void *test_data)
+{
+	const struct test_data *data = test_data;
+	uint64_t frames[BTSNOOP_MAX_INDEX];
+	struct btsnoop *btsnoop;
+	unsigned int i;
+
+	write_trace(data);
+
+	btsnoop = btsnoop_open(trace_path, 0);
+	g_assert(btsnoop);
+
+	/* Seek backwards and forwards across chunks and within them */
+	check_seek_frame(btsnoop, data, data->count / 2);
+	check_seek_frame(btsnoop, data, 0);
+	check_seek_frame(btsnoop, data, data->count - 1);
+	check_seek_frame(btsnoop, data, 1);
+
+	for (i = 7; i < data->count; i += data->count / 7)
+		check_seek_frame(btsnoop, data, i);
+
+	check_seek_time(btsnoop, data, data->count / 3);
+	check_seek_time(btsnoop, data, data->per_sec * 3);
+
+	/* Reading continues to the end after a seek */
+	check_seek_frame(btsnoop, data, data->count - 100);
+	for (i = data->count - 98; i < data->count; i++)
+		check_packet(btsnoop, data, i);
+
+	check_end(btsnoop);
+
+	/* Seeking past the last frame fails */
+	g_assert(!btsnoop_seek_frame(btsnoop, 0, data->count + 1, frames));
+
+	btsnoop_unref(btsnoop);
+	remove_trace();
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	int fd;
+
+	tester_init(&argc, &argv);
+
+	fd = mkstemp(trace_path);
+	if (fd < 0)
+		return EXIT_FAILURE;
+
+	close(fd);
+
+	tester_add("/btsnoop/compressed/roundtrip", &roundtrip_data, NULL,
+							test_roundtrip, NULL);
+	tester_add("/btsnoop/compressed/chunks", &chunks_data, NULL,
+							test_chunks, NULL);
+	tester_add("/btsnoop/compressed/seek", &seek_data, NULL,
+							test_seek, NULL);
+
+	return tester_run();
+}
@@ -211,6 +211,78 @@ static void test_encode_on_demand_fail(void)
 	g_obex_packet_free(pkt);
 }
 
+static gssize get_body_ref(const void **buf, gsize len, gpointer *ref,
+							gpointer user_data)
+{
+	static const uint8_t data[] = { 1, 2, 3, 4 };
+	int *refs = user_data;
+
+	*buf = data;
+	*ref = refs;
+	(*refs)++;
+
+	return sizeof(data);
+}
+
+static void release_body_ref(gpointer data)
+{
+	int *refs = data;
+
+	(*refs)--;
+}
+
+static void test_encode_iov(void)
+{
+	GObexPacket *pkt;
+	uint8_t buf[255];
+	struct iovec body;
+	GDestroyNotify release;
+	gpointer release_data;
+	int refs = 0;
+	gssize len;
+
+	pkt = g_obex_packet_new(G_OBEX_OP_PUT, FALSE, G_OBEX_HDR_INVALID);
+	g_obex_packet_add_body_ref(pkt, get_body_ref, release_body_ref, &refs);
+
+	len = g_obex_packet_encode_iov(pkt, buf, sizeof(buf), &body, &release,
+								&release_data);
+	if (len < 0) {
+		g_printerr("Encoding failed: %s\n", g_strerror(-len));
+		g_assert_not_reached();
+	}
+
+	g_assert_cmpuint(len + body.iov_len, ==, sizeof(pkt_put_body));
+	assert_memequal(pkt_put_body, len, buf, len);
+	assert_memequal(pkt_put_body + len, sizeof(pkt_put_body) - len,
+						body.iov_base, body.iov_len);
+
+	/* The body must stay valid until the caller releases it */
+	g_assert_cmpint(refs, ==, 1);
+	g_assert(release == release_body_ref);
+	release(release_data);
+	g_assert_cmpint(refs, ==, 0);
+
+	g_obex_packet_free(pkt);
+}
+
+static void test_encode_body_ref(void)
+{
+	GObexPacket *pkt;
+	uint8_t buf[255];
+	int refs = 0;
+	gssize len;
+
+	pkt = g_obex_packet_new(G_OBEX_OP_PUT, FALSE, G_OBEX_HDR_INVALID);
+	g_obex_packet_add_body_ref(pkt, get_body_ref, NULL, &refs);
+
+	/* Referenced bodies are never copied, the provider is not called */
+	len = g_obex_packet_encode(pkt, buf, sizeof(buf));
+	g_assert_cmpint(len, ==, -EINVAL);
+	g_assert_cmpint(refs, ==, 0);
+
+	g_obex_packet_free(pkt);
+}
+
 static void test_create_args(void)
 {
 	GObexPacket *pkt;
@@ -254,6 +326,9 @@ int main(int argc, char *argv[])
 	g_test_add_func("/gobex/test_encode_on_demand_fail",
 						test_encode_on_demand_fail);
 
+	g_test_add_func("/gobex/test_encode_iov", test_encode_iov);
+	g_test_add_func("/gobex/test_encode_body_ref", test_encode_body_ref);
+
 	g_test_add_func("/gobex/test_create_args", test_create_args);
 
 	return g_test_run();
@@ -76,6 +76,8 @@ static guint8 put_rsp_first_srm_wait[] = { G_OBEX_RSP_CONTINUE | FINAL_BIT,
 							G_OBEX_HDR_SRM, 0x01,
 							G_OBEX_HDR_SRMP, 0x01 };
 static guint8 put_rsp_last[] = { G_OBEX_RSP_SUCCESS | FINAL_BIT, 0x00, 0x03 };
+static guint8 put_rsp_err[] = { G_OBEX_RSP_INTERNAL_SERVER_ERROR |
+						FINAL_BIT, 0x00, 0x03 };
 
 static guint8 get_req_first[] = { G_OBEX_OP_GET | FINAL_BIT, 0x00, 0x23,
 	G_OBEX_HDR_TYPE, 0x00, 0x0b,
@@ -397,6 +399,97 @@ static void test_put_rsp(void)
 	g_assert_no_error(d.err);
 }
 
+static void flush_complete(GObex *obex, GError *err, gpointer user_data)
+{
+	struct test_data *d = user_data;
+
+	/* The test ends once the final response has been received */
+	if (err != NULL)
+		d->err = g_error_copy(err);
+}
+
+static gboolean flush_failed(gpointer user_data)
+{
+	struct test_data *d = user_data;
+
+	if (!g_obex_put_rsp_flushed(d->id, -EIO))
+		d->err = g_error_new(TEST_ERROR, TEST_ERROR_UNEXPECTED,
+						"No final response pending");
+
+	return FALSE;
+}
+
+static int flush_delay(gpointer user_data)
+{
+	struct test_data *d = user_data;
+
+	g_idle_add(flush_failed, d);
+
+	return -EAGAIN;
+}
+
+static void handle_put_flush(GObex *obex, GObexPacket *req,
+							gpointer user_data)
+{
+	struct test_data *d = user_data;
+	guint8 op = g_obex_packet_get_operation(req, NULL);
+
+	if (op != G_OBEX_OP_PUT) {
+		d->err = g_error_new(TEST_ERROR, TEST_ERROR_UNEXPECTED,
+					"Unexpected opcode 0x%02x", op);
+		g_main_loop_quit(d->mainloop);
+		return;
+	}
+
+	d->id = g_obex_put_rsp_flush(obex, req, rcv_data, flush_delay,
+					flush_complete, d, &d->err,
+					G_OBEX_HDR_INVALID);
+	if (d->id == 0)
+		g_main_loop_quit(d->mainloop);
+}
+
+static void test_put_rsp_flush(void)
+{
+	GIOChannel *io;
+	GIOCondition cond;
+	guint io_id, timer_id;
+	GObex *obex;
+	struct test_data d = { 0, NULL, {
+				{ put_rsp_first, sizeof(put_rsp_first) },
+				{ put_rsp_err, sizeof(put_rsp_err) } }, {
+				{ put_req_last, sizeof(put_req_last) },
+				{ NULL, -1 } } };
+
+	create_endpoints(&obex, &io, SOCK_STREAM);
+
+	cond = G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL;
+	io_id = g_io_add_watch(io, cond, test_io_cb, &d);
+
+	d.mainloop = g_main_loop_new(NULL, FALSE);
+
+	timer_id = g_timeout_add_seconds(1, test_timeout, &d);
+
+	g_obex_add_request_function(obex, G_OBEX_OP_PUT, handle_put_flush,
+									&d);
+
+	g_io_channel_write_chars(io, (char *) put_req_first,
+					sizeof(put_req_first), NULL, &d.err);
+	g_assert_no_error(d.err);
+
+	g_main_loop_run(d.mainloop);
+
+	g_assert_cmpuint(d.count, ==, 2);
+
+	g_main_loop_unref(d.mainloop);
+
+	g_source_remove(timer_id);
+	g_io_channel_unref(io);
+	g_source_remove(io_id);
+	g_obex_unref(obex);
+
+	g_assert_no_error(d.err);
+}
+
 static gboolean rcv_seq(const void *buf, gsize len, gpointer user_data)
 {
 	return TRUE;
@@ -2352,6 +2445,7 @@ int main(int argc, char *argv[])
 
 	g_test_add_func("/gobex/test_put_req_delay", test_put_req_delay);
 	g_test_add_func("/gobex/test_put_rsp_delay", test_put_rsp_delay);
+	g_test_add_func("/gobex/test_put_rsp_flush", test_put_rsp_flush);
 
 	g_test_add_func("/gobex/test_get_req_delay", test_get_req_delay);
 	g_test_add_func("/gobex/test_get_rsp_delay", test_get_rsp_delay);
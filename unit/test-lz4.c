@@ -0,0 +1,174 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  BlueZ contributors
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <glib.h>
+
+#include "src/shared/lz4.h"
+#include "src/shared/tester.h"
+
+#define DATA_LEN 65536
+
+static void fill_zero(uint8_t *buf, size_t len)
+{
+	memset(buf, 0, len);
+}
+
+static void fill_random(uint8_t *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = rand();
+}
+
+static void fill_pattern(uint8_t *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = (i % 23) * 7;
+}
+
+static void fill_packets(uint8_t *buf, size_t len)
+{
+	size_t i;
+
+	/* Mostly identical headers followed by varying payload */
+	for (i = 0; i < len; i++)
+		buf[i] = (i % 64) < 12 ? i % 64 : (rand() % 4 ? 0 : rand());
+}
+
+static void check_roundtrip(const uint8_t *src, size_t len)
+{
+	size_t bound = lz4_compress_bound(len);
+	uint8_t *comp, *decomp;
+	size_t size;
+	ssize_t ret;
+
+	comp = malloc(bound);
+	decomp = malloc(len + 1);
+	g_assert(comp && decomp);
+
+	size = lz4_compress(src, len, comp, bound);
+	g_assert(size > 0 && size <= bound);
+
+	tester_debug("%zu bytes compressed to %zu bytes", len, size);
+
+	ret = lz4_decompress(comp, size, decomp, len);
+	g_assert(ret == (ssize_t) len);
+	g_assert(memcmp(src, decomp, len) == 0);
+
+	/* Truncated input must be rejected without overrunning output */
+	if (size > 1) {
+		ret = lz4_decompress(comp, size - 1, decomp, len);
+		g_assert(ret != (ssize_t) len ||
+					memcmp(src, decomp, len) != 0);
+	}
+
+	free(comp);
+	free(decomp);
+}
+
+static void test_roundtrip(const void *data)
+{
+	void (*fill)(uint8_t *buf, size_t len) = data;
+	uint8_t *buf;
+	size_t len;
+
+	buf = malloc(DATA_LEN);
+	g_assert(buf);
+
+	for (len = 0; len <= DATA_LEN; len = len ? len * 2 : 1) {
+		fill(buf, len);
+		check_roundtrip(buf, len);
+
+		if (len > 13) {
+			check_roundtrip(buf, len - 13);
+			check_roundtrip(buf + 13, len - 13);
+		}
+	}
+
+	free(buf);
+	tester_test_passed();
+}
+
+static void test_overflow(const void *data)
+{
+	uint8_t src[1024], dst[64];
+
+	fill_random(src, sizeof(src));
+
+	/* Incompressible data does not fit a smaller output buffer */
+	g_assert(lz4_compress(src, sizeof(src), dst, sizeof(dst)) == 0);
+
+	tester_test_passed();
+}
+
+static void test_reference(const void *data)
+{
+	/* Block as produced by the reference encoder */
+	static const uint8_t block[] = { 0x3a, 0x61, 0x62, 0x63, 0x03, 0x00,
+						0x50, 0x63, 0x61, 0x62, 0x63,
+						0x61 };
+	static const uint8_t invalid[] = { 0x10, 0x61, 0x05, 0x00, 0x10,
+						0x61 };
+	static const char expect[] = "abcabcabcabcabcabcabca";
+	uint8_t out[sizeof(expect) - 1];
+	ssize_t ret;
+
+	ret = lz4_decompress(block, sizeof(block), out, sizeof(out));
+	g_assert(ret == (ssize_t) sizeof(out));
+	g_assert(memcmp(out, expect, sizeof(out)) == 0);
+
+	/* Output buffer too small */
+	ret = lz4_decompress(block, sizeof(block), out, sizeof(out) - 1);
+	g_assert(ret < 0);
+
+	/* Offsets pointing before the start of the output are invalid */
+	ret = lz4_decompress(invalid, sizeof(invalid), out, sizeof(out));
+	g_assert(ret < 0);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/lz4/zero", fill_zero, NULL, test_roundtrip, NULL);
+	tester_add("/lz4/random", fill_random, NULL, test_roundtrip, NULL);
+	tester_add("/lz4/pattern", fill_pattern, NULL, test_roundtrip, NULL);
+	tester_add("/lz4/packets", fill_packets, NULL, test_roundtrip, NULL);
+	tester_add("/lz4/overflow", NULL, NULL, test_overflow, NULL);
+	tester_add("/lz4/reference", NULL, NULL, test_reference, NULL);
+
+	return tester_run();
+}
@@ -23,6 +23,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "client/display.h"
 
@@ -1970,6 +1971,76 @@ static void check_k4(const struct mesh_crypto_test *keys)
 	l_info("");
 }
 
+#define BENCH_PACKETS	1000
+
+static double bench_packets(const uint8_t *pkt, uint8_t pkt_len,
+				uint32_t iv_index, const uint8_t *enc_key,
+				const uint8_t *priv_key, uint8_t *out)
+{
+	struct timespec start, end;
+	uint8_t clear[29];
+	double secs;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < BENCH_PACKETS; i++) {
+		mesh_crypto_packet_decode(pkt, pkt_len, false, clear, iv_index,
+							enc_key, priv_key);
+		memcpy(out, clear, pkt_len);
+		mesh_crypto_packet_encode(out, pkt_len, enc_key, iv_index,
+								priv_key);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	secs = (end.tv_sec - start.tv_sec) +
+				(end.tv_nsec - start.tv_nsec) / 1e9;
+
+	return secs > 0 ? BENCH_PACKETS / secs : 0;
+}
+
+static void check_throughput(const struct mesh_crypto_test *keys)
+{
+	uint8_t *net_key;
+	uint8_t *packet;
+	size_t packet_len;
+	uint8_t enc_key[16];
+	uint8_t priv_key[16];
+	uint8_t nid;
+	uint8_t p[] = { 0 };
+	uint8_t out[29];
+	double before, after;
+
+	l_info(COLOR_BLUE "[Throughput %s]" COLOR_OFF, keys->name);
+
+	net_key = l_util_from_hexstring(keys->net_key, NULL);
+	packet = l_util_from_hexstring(keys->packet[0], &packet_len);
+
+	mesh_crypto_k2(net_key, p, sizeof(p), &nid, enc_key, priv_key);
+
+	before = bench_packets(packet, packet_len, keys->iv_index,
+						enc_key, priv_key, out);
+	verify_data("One-shot contexts", 0, keys->packet[0], out, packet_len);
+
+	mesh_crypto_key_ref(enc_key);
+	mesh_crypto_key_ref(priv_key);
+
+	after = bench_packets(packet, packet_len, keys->iv_index,
+						enc_key, priv_key, out);
+	verify_data("Key contexts", 0, keys->packet[0], out, packet_len);
+
+	mesh_crypto_key_unref(enc_key);
+	mesh_crypto_key_unref(priv_key);
+
+	l_info("%-20s = %.0f pkt/s", "One-shot contexts", before);
+	l_info("%-20s = %.0f pkt/s", "Key contexts", after);
+	l_info("");
+
+	l_free(packet);
+	l_free(net_key);
+}
+
 int main(int argc, char *argv[])
 {
 	l_log_set_stderr();
@@ -2020,5 +2091,8 @@ int main(int argc, char *argv[])
 	/* Section 8.6 Mesh Proxy Service sample data */
 	check_id_beacon(&s8_6_2);
 
+	/* Packet throughput with and without per-key cipher contexts */
+	check_throughput(&s8_3_1);
+
 	return 0;
 }